@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_ARCHIVE_H
+#define XTF_ARCHIVE_H
+
+namespace XTF
+{
+
+/* Archive file layout (little-endian):
+ *
+ * "XTFARC01" u32 version
+ * entry: "XTFENT01" [entry record] payload
+ * ...
+ * directory: "XTFDIR01" u64 count, then per entry u64 payload offset + [entry record]
+ * footer: u64 directory offset, "XTFEND01"
+ *
+ * An entry record holds the encoding, payload size, state count, first/last state times and the
+ * binary-encoded trajectory header (which carries the uid). Listing an archive reads only the
+ * footer and directory. If the directory is missing (the writer did not reach Close()), readers
+ * rebuild it from the entry records.
+ */
+
+class ArchiveEntry
+{
+public:
+
+    enum ENCODINGS {XML, BINARY, COMPRESSED};
+
+    ENCODINGS encoding_;
+    uint64_t offset_;
+    uint64_t size_;
+    uint64_t length_;
+    timespec start_time_;
+    timespec end_time_;
+    Trajectory header_;
+
+    ArchiveEntry() : encoding_(BINARY), offset_(0), size_(0), length_(0)
+    {
+        start_time_.tv_sec = 0;
+        start_time_.tv_nsec = 0;
+        end_time_ = start_time_;
+    }
+
+    inline const std::string& uid() const
+    {
+        return header_.uid_;
+    }
+
+};
+
+class ArchiveWriter
+{
+protected:
+
+    int fd_;
+    std::string filename_;
+    std::vector<ArchiveEntry> entries_;
+    uint64_t write_offset_;
+    Parser parser_;
+
+    void AddPayload(ArchiveEntry& entry, const std::string& payload);
+
+    ArchiveWriter(const ArchiveWriter& other);
+
+    ArchiveWriter& operator=(const ArchiveWriter& other);
+
+public:
+
+    ArchiveWriter(std::string filename, bool append=false);
+
+    ~ArchiveWriter();
+
+    void Add(const TrajectoryView& view, ArchiveEntry::ENCODINGS encoding=ArchiveEntry::BINARY);
+
+    void AddXTF(std::string filename);
+
+    void Close();
+
+    const std::vector<ArchiveEntry>& Entries() const;
+
+};
+
+class ArchiveReader
+{
+protected:
+
+    int fd_;
+    std::string filename_;
+    const char* mapped_;
+    size_t mapped_size_;
+    std::vector<ArchiveEntry> entries_;
+    std::map<std::string, size_t> uids_;
+    bool recovered_;
+
+    ArchiveReader(const ArchiveReader& other);
+
+    ArchiveReader& operator=(const ArchiveReader& other);
+
+public:
+
+    ArchiveReader(std::string filename);
+
+    ~ArchiveReader();
+
+    const std::vector<ArchiveEntry>& Entries() const;
+
+    bool Recovered() const;
+
+    size_t size() const;
+
+    size_t Find(const std::string& uid) const;
+
+    const char* Payload(size_t idx, size_t& size) const;
+
+    Trajectory Load(size_t idx) const;
+
+    Trajectory Load(const std::string& uid) const;
+
+    std::vector<Trajectory> Load(const std::vector<size_t>& indices, size_t threads=0) const;
+
+    std::vector<Trajectory> LoadAll(size_t threads=0) const;
+
+};
+
+}
+
+#endif // XTF_ARCHIVE_H
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_CACHE_H
+#define XTF_CACHE_H
+
+namespace XTF
+{
+
+/* Caches parsed trajectories as binary sidecar files in a directory.
+ *
+ * A sidecar is keyed by the source file's canonical path, size and modification time, so a file
+ * that changed size or was touched is re-parsed. Sidecars are written to a temporary file and
+ * renamed into place, and eviction holds an exclusive lock on the directory, so several processes
+ * can share one cache. Hits refresh a sidecar's modification time, which eviction uses as the LRU
+ * order once the directory exceeds max_bytes. The lock file keeps a running total of sidecar
+ * bytes, so the directory is only listed when the cache is over budget.
+ *
+ * With verify_content true, every hit also reads and hashes the source file and checks it against
+ * the hash stored in the sidecar, which catches edits that keep the size and modification time
+ * but costs a full read of the source.
+ */
+
+class TrajectoryCache
+{
+protected:
+
+    std::string directory_;
+    uint64_t max_bytes_;
+    bool verify_content_;
+
+    std::string SidecarPath(const std::string& canonical) const;
+
+    bool LoadSidecar(const std::string& sidecar, const std::string& canonical, uint64_t size, const timespec& mtime, const uint64_t* content_hash, Trajectory& trajectory);
+
+    void StoreSidecar(const std::string& sidecar, const std::string& canonical, uint64_t size, const timespec& mtime, uint64_t content_hash, const Trajectory& trajectory);
+
+public:
+
+    TrajectoryCache(std::string directory, uint64_t max_bytes, bool verify_content=false);
+
+    Trajectory Load(std::string filename);
+
+    void Evict();
+
+    uint64_t Size() const;
+
+    void clear();
+
+};
+
+}
+
+#endif // XTF_CACHE_H
@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_COMPRESSION_H
+#define XTF_COMPRESSION_H
+
+namespace XTF
+{
+
+/* Lossless column codecs for time series:
+ *
+ * Doubles use XOR compression against the previous value (Gorilla): an unchanged value costs one
+ * bit, otherwise only the bits between the leading and trailing zeros of the XOR are stored.
+ * Integers use delta-of-delta encoding, so regularly spaced timestamps and sequence numbers cost
+ * one bit each.
+ *
+ * Both append a bit stream to the buffer, padded to a whole byte; decoding needs the value count.
+ */
+
+void CompressDoubles(std::string& buffer, const double* values, size_t count);
+
+// Returns the number of bytes consumed
+size_t DecompressDoubles(const char* data, size_t length, double* values, size_t count);
+
+void CompressInt64s(std::string& buffer, const int64_t* values, size_t count);
+
+size_t DecompressInt64s(const char* data, size_t length, int64_t* values, size_t count);
+
+/* Compressed container layout (little-endian):
+ *
+ * "XTFGOR01" u32 version, u32 header size, binary-encoded trajectory header,
+ * u64 block size, u64 block count, then per block:
+ * u64 first state index, u64 state count, earliest/latest state times (i64 secs + nsecs each),
+ * u64 payload size, payload
+ *
+ * A block payload holds the block's field masks (run-length encoded), its timestamps (secs and
+ * nsecs columns) and sequence numbers, one compressed column per element of every field present in
+ * the block, and its extras in the binary codec's encoding. Blocks decode independently, so
+ * reading a state or a time range decodes only the blocks it touches.
+ *
+ * States appended with push_back() are held uncompressed until a full block has accumulated.
+ */
+
+class CompressedTrajectory
+{
+protected:
+
+    class Block
+    {
+    public:
+
+        size_t start_;
+        size_t count_;
+        timespec earliest_;
+        timespec latest_;
+        std::string payload_;
+
+    };
+
+    Trajectory header_;
+    size_t block_size_;
+    size_t data_length_;
+    std::vector<Block> blocks_;
+    Trajectory pending_;
+    size_t size_;
+
+    CompressedTrajectory() : block_size_(0), data_length_(0), size_(0) {}
+
+    Block CompressBlock(const TrajectoryView& view, size_t start, size_t count) const;
+
+    void DecodeBlock(const Block& block, std::vector<State>& states) const;
+
+    size_t FindBlock(size_t idx) const;
+
+public:
+
+    CompressedTrajectory(const TrajectoryView& view, size_t block_size=1024);
+
+    static CompressedTrajectory Deserialize(const char* buffer, size_t length);
+
+    const Trajectory& Header() const;
+
+    size_t size() const;
+
+    size_t NumBlocks() const;
+
+    void push_back(const State& state);
+
+    void Flush();
+
+    State at(size_t idx) const;
+
+    std::vector<State> ReadBlock(size_t block) const;
+
+    Trajectory ReadRange(size_t start, size_t count) const;
+
+    // States timed in [start, end), matching TrajectoryView::SliceTime
+    Trajectory ReadTimeRange(const timespec& start, const timespec& end) const;
+
+    Trajectory Materialize(size_t threads=0) const;
+
+    std::string Serialize() const;
+
+    size_t CompressedBytes() const;
+
+};
+
+}
+
+#endif // XTF_COMPRESSION_H
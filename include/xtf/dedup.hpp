@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+#include "xtf/hash.hpp"
+
+#ifndef XTF_DEDUP_H
+#define XTF_DEDUP_H
+
+namespace XTF
+{
+
+/* Hashes a trajectory's content independently of how it was written, so the same states
+ * exported compact or formatted, or by another tool, hash the same.
+ *
+ * The hash covers the data type, timing, trajectory type, robot, joint names (JOINT) or frames
+ * (POSE), and every state's sequence number, timing, fields and extras, in a fixed little-endian
+ * encoding fed through XXH64 (-0.0 hashes as 0.0 and every NaN alike). The uid, generator and tags
+ * are provenance rather than content and are left out. States can be added as they are parsed.
+ *
+ * The shape hash covers only the header part, the number of states and the size of every field,
+ * which near-duplicates must share.
+ */
+class ContentHasher
+{
+protected:
+
+    StreamingHash content_;
+    StreamingHash shape_;
+    std::string scratch_;
+    size_t length_;
+
+public:
+
+    ContentHasher(const Trajectory& header);
+
+    void push_back(const State& state);
+
+    size_t size() const;
+
+    uint64_t Digest() const;
+
+    uint64_t ShapeDigest() const;
+
+};
+
+uint64_t ContentHash(const TrajectoryView& view);
+
+// Streams the file state by state, so it is never held in memory
+uint64_t ContentHashFile(std::string filename);
+
+/* True if both have the same shape (see ContentHasher), every state's timing is within tolerance
+ * seconds and every field value within tolerance. Sequence numbers and extras are ignored.
+ */
+bool NearDuplicates(const TrajectoryView& first, const TrajectoryView& second, double tolerance);
+
+class DedupResult
+{
+public:
+
+    enum STATUS {INSERTED, DUPLICATE, NEAR_DUPLICATE};
+
+    STATUS status_;
+    // The content hash of the inserted trajectory as stored, which ContentHashFile(path_) also gives
+    uint64_t hash_;
+    // Where the trajectory (or the one it duplicates) is stored
+    std::string path_;
+
+    DedupResult() : status_(INSERTED), hash_(0) {}
+
+};
+
+/* A content-addressed directory of XTF files, each stored once as <directory>/<hash>.xtf.
+ *
+ * Insert() works on the trajectory as it reads back from its export, since the stored files round
+ * values, so re-inserting a trajectory or inserting a stored file gives the same hash. It skips a
+ * trajectory whose content hash is already stored (after reading the stored file back to confirm
+ * the match, and throwing on a hash collision) and, if the store has a tolerance, one that is a
+ * near-duplicate of a stored trajectory. Near-duplicate candidates are found by shape hash and a
+ * sketch of a few evenly spaced states, and only those that pass are read back for the full
+ * comparison. The hashes, shapes and sketches are kept in an append-only index
+ * (<directory>/.xtf_dedup.idx); a record cut short by a crash is dropped on the next open, and an
+ * index with no complete header is started afresh.
+ */
+class DedupStore
+{
+protected:
+
+    class Entry
+    {
+    public:
+
+        uint64_t hash_;
+        uint64_t shape_;
+        std::vector<double> sketch_;
+
+    };
+
+    std::string directory_;
+    std::string index_path_;
+    double tolerance_;
+    std::vector<Entry> entries_;
+    std::map<uint64_t, size_t> by_hash_;
+    std::multimap<uint64_t, size_t> by_shape_;
+
+    void CreateIndex();
+
+    void LoadIndex();
+
+    void AppendIndex(const Entry& entry);
+
+    void AddEntry(const Entry& entry);
+
+    static std::vector<double> Sketch(const TrajectoryView& view);
+
+    static bool SketchesWithin(const std::vector<double>& first, const std::vector<double>& second, double tolerance);
+
+    // Confirms a content hash match by comparing with the stored file
+    bool SameContent(const TrajectoryView& view, const Entry& entry, uint64_t shape, const std::vector<double>& sketch) const;
+
+    std::vector<uint64_t> FindNearDuplicates(const TrajectoryView& view, uint64_t shape, const std::vector<double>& sketch, double tolerance) const;
+
+public:
+
+    DedupStore(std::string directory, double tolerance=0.0);
+
+    DedupResult Insert(const TrajectoryView& view, bool compact=true);
+
+    DedupResult InsertFile(std::string filename, bool compact=true);
+
+    // Content hashes of stored trajectories that are near-duplicates of view
+    std::vector<uint64_t> FindNearDuplicates(const TrajectoryView& view, double tolerance) const;
+
+    bool Contains(uint64_t hash) const;
+
+    std::string Path(uint64_t hash) const;
+
+    size_t size() const;
+
+};
+
+}
+
+#endif // XTF_DEDUP_H
@@ -0,0 +1,105 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_DIFF_H
+#define XTF_DIFF_H
+
+namespace XTF
+{
+
+/* States are paired BY_INDEX, BY_SEQUENCE (equal sequence numbers) or BY_TIME (timings within
+ * time_tolerance_ seconds); the last two expect both inputs in increasing order and treat a state
+ * with no partner as missing from the other side.
+ *
+ * A pair of values a, b agrees if |a - b| <= absolute_tolerance_ + relative_tolerance_ * max(|a|, |b|);
+ * NaN only agrees with NaN, and an infinity only with the same infinity. Double and double list
+ * extras use the same test, other extras must match exactly. The uid, generator and tags only count
+ * as header differences if compare_provenance_ is set.
+ */
+class DiffOptions
+{
+public:
+
+    enum ALIGNMENTS {BY_INDEX, BY_SEQUENCE, BY_TIME};
+
+    ALIGNMENTS alignment_;
+    double absolute_tolerance_;
+    double relative_tolerance_;
+    double time_tolerance_;
+    bool compare_timing_;
+    bool compare_extras_;
+    bool compare_provenance_;
+    // At most this many extras mismatches are described in the report (all are counted)
+    size_t max_reported_;
+
+    DiffOptions() : alignment_(BY_SEQUENCE), absolute_tolerance_(0.0), relative_tolerance_(0.0), time_tolerance_(0.0), compare_timing_(true), compare_extras_(true), compare_provenance_(false), max_reported_(100) {}
+
+};
+
+// Deviations of one field over the paired states that both have it, per joint and overall
+class FieldDeviation
+{
+public:
+
+    std::vector<double> joint_max_;
+    std::vector<double> joint_rms_;
+    double max_;
+    double rms_;
+    // Pairs compared, and values outside tolerance
+    size_t compared_;
+    size_t exceeded_;
+    // Pairs where only one side has the field or the sizes differ
+    size_t size_mismatches_;
+
+    FieldDeviation() : max_(0.0), rms_(0.0), compared_(0), exceeded_(0), size_mismatches_(0) {}
+
+};
+
+class DiffReport
+{
+public:
+
+    std::vector<std::string> header_differences_;
+    size_t first_length_;
+    size_t second_length_;
+    size_t matched_;
+    // States with no partner on the other side
+    size_t missing_from_second_;
+    size_t missing_from_first_;
+    FieldDeviation fields_[State::NUM_FIELDS];
+    // Timing deviation in seconds over the paired states
+    double timing_max_;
+    double timing_rms_;
+    size_t timing_exceeded_;
+    size_t sequence_mismatches_;
+    size_t extras_mismatch_count_;
+    std::vector<std::string> extras_mismatches_;
+    // The first place the states disagree, as positions in each input
+    bool diverged_;
+    size_t divergence_first_;
+    size_t divergence_second_;
+    std::string divergence_reason_;
+
+    DiffReport() : first_length_(0), second_length_(0), matched_(0), missing_from_second_(0), missing_from_first_(0), timing_max_(0.0), timing_rms_(0.0), timing_exceeded_(0), sequence_mismatches_(0), extras_mismatch_count_(0), diverged_(false), divergence_first_(0), divergence_second_(0) {}
+
+    // No header differences and no divergence
+    bool Equivalent() const;
+
+    // A short human-readable report
+    std::string Summary() const;
+
+};
+
+DiffReport Diff(const TrajectoryView& first, const TrajectoryView& second, const DiffOptions& options=DiffOptions());
+
+DiffReport Diff(const Trajectory& first, const Trajectory& second, const DiffOptions& options=DiffOptions());
+
+// Streams both files state by state, holding one state of each in memory
+DiffReport DiffFiles(std::string first, std::string second, const DiffOptions& options=DiffOptions());
+
+}
+
+#endif // XTF_DIFF_H
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_ENDPOINTS_H
+#define XTF_ENDPOINTS_H
+
+namespace XTF
+{
+
+// The first and last desired positions of a stored JOINT trajectory, with where to find it
+class EndpointEntry
+{
+public:
+
+    std::string uid_;
+    std::string path_;
+    std::vector<double> start_;
+    std::vector<double> goal_;
+
+    EndpointEntry() {}
+
+    EndpointEntry(const std::string& uid, const std::string& path, const std::vector<double>& start, const std::vector<double>& goal) : uid_(uid), path_(path), start_(start), goal_(goal) {}
+
+};
+
+class EndpointMatch
+{
+public:
+
+    size_t index_;
+    double distance_;
+
+    EndpointMatch() : index_(0), distance_(0.0) {}
+
+    EndpointMatch(size_t index, double distance) : index_(index), distance_(distance) {}
+
+};
+
+/* Nearest-neighbour index over trajectory start/goal configurations.
+ *
+ * The distance between two entries is sqrt(sum over joints of weight * ((start difference)^2 +
+ * (goal difference)^2)), so weights scale each joint's contribution (all 1 by default).
+ *
+ * Entries live in a few k-d trees of geometrically decreasing size: an insertion builds a small
+ * tree and merges it with the trees no more than twice its size, so each entry is rebuilt
+ * O(log n) times overall and a query searches O(log n) trees. Save()/Load() persist the entries,
+ * and the trees are rebuilt on load.
+ */
+
+class EndpointIndex
+{
+protected:
+
+    class Node
+    {
+    public:
+
+        double split_;
+        size_t dimension_;
+        size_t begin_;
+        size_t end_;
+        // Children of a split node; a leaf has left_ == 0 (the root is never a child)
+        size_t left_;
+        size_t right_;
+
+    };
+
+    class Tree
+    {
+    public:
+
+        std::vector<size_t> entries_;
+        std::vector<Node> nodes_;
+
+    };
+
+    class Search;
+
+    std::vector<std::string> joint_names_;
+    std::vector<double> weights_;
+    std::vector<EndpointEntry> entries_;
+    // Weighted start and goal of every entry: 2 * joints values each
+    std::vector<double> coordinates_;
+    std::vector<Tree> trees_;
+
+    void Append(const EndpointEntry& entry);
+
+    void Insert(size_t first);
+
+    void Build(Tree& tree);
+
+    size_t BuildNode(Tree& tree, size_t begin, size_t end);
+
+    void SearchTree(const Tree& tree, size_t node, const double* query, Search& search) const;
+
+    std::vector<double> Key(const std::vector<double>& start, const std::vector<double>& goal) const;
+
+    std::vector<EndpointMatch> Run(const std::vector<double>& start, const std::vector<double>& goal, size_t k, double radius) const;
+
+public:
+
+    EndpointIndex(const std::vector<std::string>& joint_names, const std::vector<double>& weights=std::vector<double>());
+
+    static EndpointIndex Load(std::string filename);
+
+    void Save(std::string filename) const;
+
+    // Returns the index of the new entry
+    size_t Add(const EndpointEntry& entry);
+
+    // Takes the endpoints of a JOINT trajectory with the index's joint names
+    size_t Add(const TrajectoryView& view, const std::string& path="");
+
+    // Adds the entries in order as one batch; returns the index of the first
+    size_t Add(const std::vector<EndpointEntry>& entries);
+
+    const EndpointEntry& at(size_t index) const;
+
+    size_t size() const;
+
+    const std::vector<std::string>& JointNames() const;
+
+    const std::vector<double>& Weights() const;
+
+    // The k closest entries, closest first (ties by index)
+    std::vector<EndpointMatch> Nearest(const std::vector<double>& start, const std::vector<double>& goal, size_t k) const;
+
+    // Every entry within radius, closest first (ties by index)
+    std::vector<EndpointMatch> WithinRadius(const std::vector<double>& start, const std::vector<double>& goal, double radius) const;
+
+};
+
+}
+
+#endif // XTF_ENDPOINTS_H
@@ -0,0 +1,49 @@
+#include <stdint.h>
+#include <string>
+
+#ifndef XTF_HASH_H
+#define XTF_HASH_H
+
+namespace XTF
+{
+
+// 64-bit non-cryptographic hash of a byte range (XXH64, so values match other xxHash implementations)
+uint64_t HashBytes(const void* data, size_t length, uint64_t seed=0);
+
+inline uint64_t HashString(const std::string& value, uint64_t seed=0)
+{
+    return HashBytes(value.data(), value.size(), seed);
+}
+
+// XXH64 over data supplied in pieces; Digest() equals HashBytes() over their concatenation
+class StreamingHash
+{
+protected:
+
+    uint64_t seed_;
+    uint64_t lanes_[4];
+    unsigned char buffer_[32];
+    size_t buffered_;
+    uint64_t length_;
+
+public:
+
+    StreamingHash(uint64_t seed=0);
+
+    void Update(const void* data, size_t length);
+
+    inline void Update(const std::string& value)
+    {
+        Update(value.data(), value.size());
+    }
+
+    uint64_t Digest() const;
+
+};
+
+// Formats a hash as 16 lowercase hex digits
+std::string HashToHex(uint64_t hash);
+
+}
+
+#endif // XTF_HASH_H
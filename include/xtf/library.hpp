@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_LIBRARY_H
+#define XTF_LIBRARY_H
+
+namespace XTF
+{
+
+class TrajectoryHeader
+{
+public:
+
+    std::string path_;
+    uint64_t file_size_;
+    timespec mtime_;
+    Trajectory header_;
+    size_t length_;
+    timespec start_time_;
+    timespec end_time_;
+
+    TrajectoryHeader() : file_size_(0), length_(0)
+    {
+        mtime_.tv_sec = 0;
+        mtime_.tv_nsec = 0;
+        start_time_ = mtime_;
+        end_time_ = mtime_;
+    }
+
+    inline double Duration() const
+    {
+        return TimespecToSeconds(end_time_) - TimespecToSeconds(start_time_);
+    }
+
+};
+
+/* Query syntax: clauses joined by AND, each "<field> <op> <value>".
+ *
+ * String fields (uid, robot, generator, traj_type, timing, data_type, root_frame, target_frame, path)
+ * support = and != ; list fields (tags, joint_names) support contains ; numeric fields (length,
+ * duration in seconds, with an optional trailing "s") support = != < <= > >= .
+ * Values may be quoted with ' or ". For example: robot=hubo AND tags contains 'grasp' AND duration<10s
+ */
+
+class LibraryQuery
+{
+protected:
+
+    class Clause
+    {
+    public:
+
+        std::string field_;
+        std::string op_;
+        std::string value_;
+        double number_;
+
+    };
+
+    std::vector<Clause> clauses_;
+
+public:
+
+    LibraryQuery(const std::string& query);
+
+    bool Matches(const TrajectoryHeader& entry) const;
+
+};
+
+/* Indexes the XTF files under a directory tree by their header, length and time range.
+ *
+ * Only the header and the first and last states are read from each file. The index is kept in a
+ * binary file (by default <root>/.xtf_library.idx) and Update() re-reads only files whose size or
+ * modification time changed since they were indexed.
+ */
+
+class TrajectoryLibrary
+{
+protected:
+
+    std::string root_;
+    std::string index_path_;
+    std::vector<TrajectoryHeader> entries_;
+
+    void LoadIndex();
+
+    void SaveIndex();
+
+public:
+
+    TrajectoryLibrary(std::string root, std::string index_path="");
+
+    size_t Update(size_t threads=0);
+
+    const std::vector<TrajectoryHeader>& Entries() const;
+
+    std::vector<TrajectoryHeader> Query(const std::string& query) const;
+
+    std::vector<Trajectory> LoadMatching(const std::string& query, size_t threads=0) const;
+
+    size_t size() const;
+
+};
+
+}
+
+#endif // XTF_LIBRARY_H
@@ -0,0 +1,20 @@
+#include <vector>
+#include <functional>
+#include <stdexcept>
+
+#ifndef XTF_PARALLEL_H
+#define XTF_PARALLEL_H
+
+namespace XTF
+{
+
+// Resolves a requested thread count, where 0 means one thread per hardware core
+size_t ResolveThreads(size_t requested);
+
+// Runs work(task) for every task in [0, num_tasks) on up to threads workers.
+// The first exception thrown by any task is rethrown once all workers have stopped.
+void ParallelFor(size_t num_tasks, size_t threads, const std::function<void(size_t)>& work);
+
+}
+
+#endif // XTF_PARALLEL_H
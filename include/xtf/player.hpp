@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_PLAYER_H
+#define XTF_PLAYER_H
+
+namespace XTF
+{
+
+/* A trajectory preloaded into flat state-major arrays for playback. Times are seconds from the
+ * first state. Velocities and accelerations are only stored if every state has them.
+ */
+
+class PlaybackBuffer
+{
+public:
+
+    size_t count_;
+    size_t data_length_;
+    double duration_;
+    std::vector<double> times_;
+    std::vector<double> positions_;
+    std::vector<double> velocities_;
+    std::vector<double> accelerations_;
+
+    PlaybackBuffer(const TrajectoryView& view, size_t data_length);
+
+};
+
+/* Plays desired positions, velocities and accelerations back to a controller.
+ *
+ * Step() is real-time safe: it does not allocate, throw or lock, and it finds the current
+ * segment by stepping from the previous one (a binary search only after a seek or a new
+ * trajectory). Positions are interpolated with cubic Hermite splines when velocities are
+ * available, and linearly otherwise. Velocities and accelerations are interpolated linearly
+ * (velocities fall back to the segment slope, accelerations to zero), and scaled by the
+ * time scale. POSE orientations are interpolated by slerp along the shorter arc.
+ *
+ * Load(), Pause(), Resume(), Seek() and SetTimeScale() may be called from other threads, and
+ * concurrent Load() calls are serialized by a mutex that Step() never takes.
+ * Load() publishes a new trajectory that the next Step() switches to, restarting playback from
+ * its first state. A trajectory still in use by Step() is never freed: Load() reclaims old
+ * buffers only once Step() has announced that it moved off them.
+ */
+
+class TrajectoryPlayer
+{
+protected:
+
+    size_t data_length_;
+    bool pose_;
+    std::mutex load_mutex_;
+    std::vector<PlaybackBuffer*> owned_;
+    std::atomic<PlaybackBuffer*> published_;
+    std::atomic<PlaybackBuffer*> in_use_;
+    std::atomic<bool> paused_;
+    std::atomic<double> time_scale_;
+    std::atomic<double> seek_target_;
+
+    // Only touched by the thread calling Step()
+    const PlaybackBuffer* active_;
+    size_t segment_;
+    double playback_time_;
+    timespec last_step_;
+    bool started_;
+
+    void Adopt();
+
+    void FindSegment(bool search);
+
+    void Interpolate(double* position, double* velocity, double* acceleration, double time_scale) const;
+
+public:
+
+    enum STATUS {IDLE, PLAYING, PAUSED, FINISHED};
+
+    TrajectoryPlayer(const Trajectory& header);
+
+    ~TrajectoryPlayer();
+
+    void Load(const TrajectoryView& view);
+
+    void Pause();
+
+    void Resume();
+
+    void Seek(double seconds);
+
+    void SetTimeScale(double time_scale);
+
+    // Writes data_length() values to each non-NULL output; outputs are untouched while IDLE
+    STATUS Step(const timespec& now, double* position, double* velocity=NULL, double* acceleration=NULL);
+
+    // Current playback time in seconds from the first state (only meaningful on the Step() thread)
+    double PlaybackTime() const;
+
+    size_t data_length() const;
+
+};
+
+}
+
+#endif // XTF_PLAYER_H
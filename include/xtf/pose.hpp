@@ -0,0 +1,78 @@
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_POSE_H
+#define XTF_POSE_H
+
+namespace XTF
+{
+
+/* Poses of a POSE trajectory in structure-of-arrays form: one contiguous array per component
+ * ([X,Y,Z] translation, [X,Y,Z,W] quaternion, as in the state layout), so the batch kernels below
+ * process several poses per SIMD instruction.
+ *
+ * Times are seconds relative to base_time_, which keeps nanosecond resolution for long recordings.
+ */
+
+class PoseStream
+{
+public:
+
+    enum COMPONENTS {X, Y, Z, QX, QY, QZ, QW, NUM_COMPONENTS};
+
+    timespec base_time_;
+    std::vector<double> times_;
+    std::vector<double> components_[NUM_COMPONENTS];
+
+    PoseStream()
+    {
+        base_time_.tv_sec = 0;
+        base_time_.tv_nsec = 0;
+    }
+
+    PoseStream(const TrajectoryView& view, State::FIELDS field=State::POSITION_DESIRED);
+
+    size_t size() const;
+
+    void resize(size_t count);
+
+    std::vector<double> at(size_t idx) const;
+
+    void Set(size_t idx, const std::vector<double>& pose);
+
+    timespec Timing(size_t idx) const;
+
+    // Builds a trajectory with the given header whose states hold only this field
+    Trajectory ToTrajectory(const Trajectory& header, State::FIELDS field=State::POSITION_DESIRED) const;
+
+    // Writes the poses back into the field of an existing trajectory with the same number of states
+    void Store(Trajectory& trajectory, State::FIELDS field=State::POSITION_DESIRED) const;
+
+};
+
+// Scales every quaternion to unit length (zero quaternions become NaN)
+void NormalizeQuaternions(PoseStream& poses);
+
+// out[i] = first[i] * second[i]; out may alias either input
+void ComposePoses(const PoseStream& first, const PoseStream& second, PoseStream& out);
+
+// Assumes unit quaternions
+void InvertPoses(const PoseStream& poses, PoseStream& out);
+
+// Pose of each state in the frame of the previous one (inverse(pose[i]) * pose[i + 1]), timed at the later state
+PoseStream RelativePoses(const PoseStream& poses);
+
+// Re-expresses every pose in a new root frame: pose[i] = transform * pose[i]
+void PreMultiplyPoses(PoseStream& poses, const std::vector<double>& transform);
+
+// Moves every pose to a new target frame: pose[i] = pose[i] * transform
+void PostMultiplyPoses(PoseStream& poses, const std::vector<double>& transform);
+
+// Translation is interpolated linearly and orientation by slerp; times outside the stream clamp to its ends
+PoseStream InterpolatePoses(const PoseStream& poses, const std::vector<timespec>& times);
+
+}
+
+#endif // XTF_POSE_H
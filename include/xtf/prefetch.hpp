@@ -0,0 +1,48 @@
+#include <deque>
+#include <vector>
+#include <string>
+#include <future>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_PREFETCH_H
+#define XTF_PREFETCH_H
+
+namespace XTF
+{
+
+/* Parses an ordered list of files ahead of the consumer.
+ *
+ * Up to depth files are read and parsed concurrently on background threads, and the kernel is
+ * asked to start reading the next depth files after those, so disk reads overlap with parsing.
+ * Next() returns trajectories in list order and rethrows any error from parsing that file.
+ */
+
+class TrajectoryPrefetcher
+{
+protected:
+
+    std::vector<std::string> filenames_;
+    size_t depth_;
+    size_t next_request_;
+    size_t next_advised_;
+    size_t next_result_;
+    std::deque< std::future<Trajectory> > in_flight_;
+
+    void Fill();
+
+public:
+
+    TrajectoryPrefetcher(const std::vector<std::string>& filenames, size_t depth=0);
+
+    bool HasNext() const;
+
+    Trajectory Next();
+
+    size_t size() const;
+
+};
+
+}
+
+#endif // XTF_PREFETCH_H
@@ -0,0 +1,75 @@
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_QUANTIZED_H
+#define XTF_QUANTIZED_H
+
+namespace XTF
+{
+
+// Conversion kernels between double and the reduced-precision representations (SSE2 where available)
+void DoublesToFloats(const double* values, float* converted, size_t count);
+
+void FloatsToDoubles(const float* values, double* converted, size_t count);
+
+// The quantum arrays hold one entry per value, so callers converting states pass a row of data_length
+void DoublesToFixed(const double* values, int32_t* converted, const double* inverse_quantum, size_t count);
+
+void FixedToDoubles(const int32_t* values, double* converted, const double* quantum, size_t count);
+
+// Throws std::invalid_argument if any value cannot be stored in the given mode (inverse_quantum is only read for FIXED32)
+void VerifyRepresentable(const double* values, const double* inverse_quantum, size_t count, PrecisionOptions::MODES mode);
+
+/* Holds a trajectory's state fields in FLOAT32 or FIXED32 form (see PrecisionOptions).
+ *
+ * Each field is one contiguous state-major array (state * data_length + element), allocated only if
+ * some state has that field, so a column decodes with a single conversion call. Sequence numbers,
+ * timing and extras are kept exactly.
+ */
+
+class QuantizedTrajectory
+{
+protected:
+
+    Trajectory header_;
+    PrecisionOptions precision_;
+    size_t data_length_;
+    std::vector<int> sequences_;
+    std::vector<timespec> timings_;
+    std::vector<uint8_t> field_masks_;
+    std::vector<float> float_fields_[State::NUM_FIELDS];
+    std::vector<int32_t> fixed_fields_[State::NUM_FIELDS];
+    std::vector<double> quantum_;
+    std::map<size_t, std::map<std::string, KeyValue> > extras_;
+
+public:
+
+    QuantizedTrajectory(const TrajectoryView& view, const PrecisionOptions& precision);
+
+    const Trajectory& Header() const;
+
+    const PrecisionOptions& Precision() const;
+
+    size_t size() const;
+
+    bool HasField(size_t idx, State::FIELDS field) const;
+
+    void DecodeField(size_t idx, State::FIELDS field, double* values) const;
+
+    std::vector<double> DecodeColumn(State::FIELDS field) const;
+
+    State at(size_t idx) const;
+
+    Trajectory Materialize() const;
+
+    size_t MemoryUsage() const;
+
+};
+
+}
+
+#endif // XTF_QUANTIZED_H
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_SEGMENTED_H
+#define XTF_SEGMENTED_H
+
+namespace XTF
+{
+
+/* Segmented XTF container layout:
+ *
+ * [file header: magic, header length, XTF document with an empty <states>]
+ * [block: magic, block metadata, <states> document]...
+ * [index: magic, block count, block metadata + offset per block]
+ * [footer: index offset, magic]
+ *
+ * Each block is decodable on its own, and the block headers duplicate the index so
+ * that a file whose index was never written (e.g. after a crash) can still be recovered.
+ */
+
+class SegmentIndexEntry
+{
+public:
+
+    uint64_t offset_;
+    uint64_t size_;
+    uint64_t state_count_;
+    int64_t first_sequence_;
+    int64_t last_sequence_;
+    timespec first_timing_;
+    timespec last_timing_;
+
+    SegmentIndexEntry() : offset_(0), size_(0), state_count_(0), first_sequence_(0), last_sequence_(0)
+    {
+        first_timing_.tv_sec = 0;
+        first_timing_.tv_nsec = 0;
+        last_timing_.tv_sec = 0;
+        last_timing_.tv_nsec = 0;
+    }
+
+};
+
+class SegmentedWriter
+{
+protected:
+
+    int fd_;
+    std::string filename_;
+    Trajectory pending_;
+    StatePool pool_;
+    std::vector<SegmentIndexEntry> index_;
+    uint64_t write_offset_;
+    size_t block_size_;
+    bool compact_;
+    Parser parser_;
+
+    void WriteIndex();
+
+    SegmentedWriter(const SegmentedWriter& other);
+
+    SegmentedWriter& operator=(const SegmentedWriter& other);
+
+public:
+
+    SegmentedWriter(std::string filename, const Trajectory& header, size_t block_size=1024, bool compact=true);
+
+    SegmentedWriter(std::string filename, size_t block_size=1024, bool compact=true);
+
+    ~SegmentedWriter();
+
+    void push_back(const State& state);
+
+    void Append(const TrajectoryView& view);
+
+    void Rotate();
+
+    void Flush();
+
+    void Close();
+
+    const std::vector<SegmentIndexEntry>& Index() const;
+
+};
+
+class SegmentedReader
+{
+protected:
+
+    int fd_;
+    std::string filename_;
+    Trajectory header_;
+    std::vector<SegmentIndexEntry> index_;
+    bool recovered_;
+    Parser parser_;
+
+    SegmentedReader(const SegmentedReader& other);
+
+    SegmentedReader& operator=(const SegmentedReader& other);
+
+public:
+
+    SegmentedReader(std::string filename);
+
+    ~SegmentedReader();
+
+    const Trajectory& Header() const;
+
+    const std::vector<SegmentIndexEntry>& Index() const;
+
+    bool Recovered() const;
+
+    size_t size() const;
+
+    size_t FindBlock(const timespec& timing) const;
+
+    std::vector<State> ReadBlock(size_t block);
+
+    // States timed in [start, end), matching TrajectoryView::SliceTime
+    Trajectory ReadTimeRange(const timespec& start, const timespec& end);
+
+    Trajectory ReadAll();
+
+};
+
+}
+
+#endif // XTF_SEGMENTED_H
@@ -0,0 +1,265 @@
+#include "stdlib.h"
+#include "string.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#ifndef XTF_SERIALIZATION_H
+#define XTF_SERIALIZATION_H
+
+namespace XTF
+{
+
+/* Helpers for the binary containers - all values are stored little-endian regardless of host */
+
+inline void AppendUInt32(std::string& buffer, uint32_t value)
+{
+    char bytes[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        bytes[i] = (char)((value >> (8 * i)) & 0xff);
+    }
+    buffer.append(bytes, 4);
+}
+
+inline void AppendUInt64(std::string& buffer, uint64_t value)
+{
+    char bytes[8];
+    for (size_t i = 0; i < 8; i++)
+    {
+        bytes[i] = (char)((value >> (8 * i)) & 0xff);
+    }
+    buffer.append(bytes, 8);
+}
+
+inline void AppendInt64(std::string& buffer, int64_t value)
+{
+    AppendUInt64(buffer, (uint64_t)value);
+}
+
+inline void AppendDouble(std::string& buffer, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    AppendUInt64(buffer, bits);
+}
+
+inline void AppendDoubles(std::string& buffer, const double* values, size_t count)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    buffer.append((const char*)values, count * sizeof(double));
+#else
+    for (size_t i = 0; i < count; i++)
+    {
+        AppendDouble(buffer, values[i]);
+    }
+#endif
+}
+
+inline void AppendFloats(std::string& buffer, const float* values, size_t count)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    buffer.append((const char*)values, count * sizeof(float));
+#else
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+        AppendUInt32(buffer, bits);
+    }
+#endif
+}
+
+inline void AppendInt32s(std::string& buffer, const int32_t* values, size_t count)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    buffer.append((const char*)values, count * sizeof(int32_t));
+#else
+    for (size_t i = 0; i < count; i++)
+    {
+        AppendUInt32(buffer, (uint32_t)values[i]);
+    }
+#endif
+}
+
+inline void AppendString(std::string& buffer, const std::string& value)
+{
+    AppendUInt32(buffer, (uint32_t)value.size());
+    buffer.append(value);
+}
+
+inline void AppendStrings(std::string& buffer, const std::vector<std::string>& values)
+{
+    AppendUInt32(buffer, (uint32_t)values.size());
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        AppendString(buffer, values[i]);
+    }
+}
+
+class ByteReader
+{
+protected:
+
+    const char* data_;
+    size_t size_;
+    size_t offset_;
+
+    inline void Require(size_t bytes)
+    {
+        if (bytes > (size_ - offset_))
+        {
+            throw std::invalid_argument("Binary data is truncated or otherwise corrupted");
+        }
+    }
+
+public:
+
+    ByteReader(const char* data, size_t size) : data_(data), size_(size), offset_(0) {}
+
+    inline uint32_t ReadUInt32()
+    {
+        Require(4);
+        const unsigned char* bytes = (const unsigned char*)(data_ + offset_);
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; i++)
+        {
+            value |= ((uint32_t)bytes[i]) << (8 * i);
+        }
+        offset_ += 4;
+        return value;
+    }
+
+    inline uint64_t ReadUInt64()
+    {
+        Require(8);
+        const unsigned char* bytes = (const unsigned char*)(data_ + offset_);
+        uint64_t value = 0;
+        for (size_t i = 0; i < 8; i++)
+        {
+            value |= ((uint64_t)bytes[i]) << (8 * i);
+        }
+        offset_ += 8;
+        return value;
+    }
+
+    inline int64_t ReadInt64()
+    {
+        return (int64_t)ReadUInt64();
+    }
+
+    inline double ReadDouble()
+    {
+        uint64_t bits = ReadUInt64();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    inline void ReadDoubles(double* values, size_t count)
+    {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        Require(count * sizeof(double));
+        memcpy(values, data_ + offset_, count * sizeof(double));
+        offset_ += count * sizeof(double);
+#else
+        for (size_t i = 0; i < count; i++)
+        {
+            values[i] = ReadDouble();
+        }
+#endif
+    }
+
+    inline void ReadFloats(float* values, size_t count)
+    {
+        Require(count * sizeof(float));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        memcpy(values, data_ + offset_, count * sizeof(float));
+        offset_ += count * sizeof(float);
+#else
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t bits = ReadUInt32();
+            memcpy(&values[i], &bits, sizeof(bits));
+        }
+#endif
+    }
+
+    inline void ReadInt32s(int32_t* values, size_t count)
+    {
+        Require(count * sizeof(int32_t));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        memcpy(values, data_ + offset_, count * sizeof(int32_t));
+        offset_ += count * sizeof(int32_t);
+#else
+        for (size_t i = 0; i < count; i++)
+        {
+            values[i] = (int32_t)ReadUInt32();
+        }
+#endif
+    }
+
+    inline std::string ReadString()
+    {
+        uint32_t length = ReadUInt32();
+        Require(length);
+        std::string value(data_ + offset_, length);
+        offset_ += length;
+        return value;
+    }
+
+    inline std::vector<std::string> ReadStrings()
+    {
+        uint32_t count = ReadUInt32();
+        // Every string needs at least its 4-byte length
+        RequireCount(count, 4);
+        std::vector<std::string> values;
+        values.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            values.push_back(ReadString());
+        }
+        return values;
+    }
+
+    // Rejects an element count that cannot fit in the remaining data, so a corrupt count is caught
+    // before anything is allocated for it
+    inline void RequireCount(size_t count, size_t element_size)
+    {
+        if (count > (Remaining() / element_size))
+        {
+            throw std::invalid_argument("Binary data is truncated or otherwise corrupted");
+        }
+    }
+
+    inline const char* ReadBytes(size_t length)
+    {
+        Require(length);
+        const char* bytes = data_ + offset_;
+        offset_ += length;
+        return bytes;
+    }
+
+    inline size_t Offset() const
+    {
+        return offset_;
+    }
+
+    inline size_t Remaining() const
+    {
+        return size_ - offset_;
+    }
+
+};
+
+class KeyValue;
+
+// Typed binary encoding of extras, shared by the binary containers (defined with the binary codec)
+void AppendKeyValue(std::string& buffer, const KeyValue& value);
+
+KeyValue ReadKeyValue(ByteReader& reader);
+
+}
+
+#endif // XTF_SERIALIZATION_H
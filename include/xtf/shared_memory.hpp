@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_SHARED_MEMORY_H
+#define XTF_SHARED_MEMORY_H
+
+namespace XTF
+{
+
+/* Shared memory segment layout:
+ *
+ * [SharedSegmentHeader][encoded trajectory header][state record]...
+ *
+ * Each state record is a fixed-size SharedStateRecord followed by NUM_FIELDS * data_length doubles.
+ * Fields absent from a state are flagged in its field mask. Extras are not published.
+ *
+ * Writers bracket every change with the segment's seqlock counter (odd while writing), so
+ * readers copy without taking locks and retry if the counter moved underneath them.
+ */
+
+class SharedStateRecord
+{
+public:
+
+    int64_t sequence_;
+    int64_t secs_;
+    int64_t nsecs_;
+    uint64_t field_mask_;
+
+};
+
+class SharedStateView
+{
+protected:
+
+    const SharedStateRecord* record_;
+    uint32_t data_length_;
+
+public:
+
+    SharedStateView(const SharedStateRecord* record, uint32_t data_length) : record_(record), data_length_(data_length) {}
+
+    inline int sequence() const
+    {
+        return (int)record_->sequence_;
+    }
+
+    inline timespec timing() const
+    {
+        timespec timing;
+        timing.tv_sec = record_->secs_;
+        timing.tv_nsec = record_->nsecs_;
+        return timing;
+    }
+
+    inline bool HasField(State::FIELDS field) const
+    {
+        return ((record_->field_mask_ >> field) & 1) == 1;
+    }
+
+    inline const double* Field(State::FIELDS field) const
+    {
+        if (!HasField(field))
+        {
+            return NULL;
+        }
+        return reinterpret_cast<const double*>(record_ + 1) + (field * data_length_);
+    }
+
+    inline uint32_t data_length() const
+    {
+        return data_length_;
+    }
+
+    State Copy() const;
+
+};
+
+class SharedTrajectoryWriter
+{
+protected:
+
+    std::string name_;
+    int fd_;
+    char* segment_;
+    size_t segment_size_;
+    Trajectory header_;
+
+    SharedStateRecord* Record(size_t idx);
+
+    void WriteRecord(size_t idx, const State& state);
+
+    void BeginWrite();
+
+    void EndWrite();
+
+    SharedTrajectoryWriter(const SharedTrajectoryWriter& other);
+
+    SharedTrajectoryWriter& operator=(const SharedTrajectoryWriter& other);
+
+public:
+
+    SharedTrajectoryWriter(std::string name, const Trajectory& header, size_t capacity);
+
+    ~SharedTrajectoryWriter();
+
+    void Publish(const TrajectoryView& view);
+
+    void push_back(const State& state);
+
+    void Update(size_t idx, const State& state);
+
+    size_t size() const;
+
+    size_t Capacity() const;
+
+    void Unlink();
+
+};
+
+class SharedTrajectoryReader
+{
+protected:
+
+    std::string name_;
+    int fd_;
+    const char* segment_;
+    size_t segment_size_;
+    Trajectory header_;
+
+    SharedTrajectoryReader(const SharedTrajectoryReader& other);
+
+    SharedTrajectoryReader& operator=(const SharedTrajectoryReader& other);
+
+public:
+
+    SharedTrajectoryReader(std::string name);
+
+    ~SharedTrajectoryReader();
+
+    const Trajectory& Header() const;
+
+    uint64_t BeginRead() const;
+
+    bool ValidateRead(uint64_t version) const;
+
+    size_t size() const;
+
+    size_t Capacity() const;
+
+    SharedStateView at(size_t idx) const;
+
+    Trajectory Snapshot() const;
+
+};
+
+}
+
+#endif // XTF_SHARED_MEMORY_H
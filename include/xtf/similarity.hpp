@@ -0,0 +1,95 @@
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_SIMILARITY_H
+#define XTF_SIMILARITY_H
+
+namespace XTF
+{
+
+/* Trajectories are compared on one field (positions by default) after resampling each of them to
+ * samples_ points, uniformly in time for timed trajectories and uniformly over states otherwise.
+ * The distance between two samples is the Euclidean norm over all joints.
+ *
+ * DTW sums the sample distances along the best warping path, FRECHET takes the largest one (the
+ * discrete Frechet distance). Both only warp within a Sakoe-Chiba band of band_ * samples_ samples
+ * either side of the diagonal (band_ >= 1 allows any warping).
+ */
+
+class SimilarityOptions
+{
+public:
+
+    enum METRICS {DTW, FRECHET};
+
+    METRICS metric_;
+    State::FIELDS field_;
+    size_t samples_;
+    double band_;
+    size_t threads_;
+
+    SimilarityOptions() : metric_(DTW), field_(State::POSITION_DESIRED), samples_(128), band_(0.1), threads_(0) {}
+
+};
+
+class SimilarityMatch
+{
+public:
+
+    size_t index_;
+    double distance_;
+
+    SimilarityMatch() : index_(0), distance_(0.0) {}
+
+    SimilarityMatch(size_t index, double distance) : index_(index), distance_(distance) {}
+
+};
+
+double TrajectoryDistance(const TrajectoryView& first, const TrajectoryView& second, const SimilarityOptions& options=SimilarityOptions());
+
+/* A collection of joint trajectories (all with the same joint names) held resampled in one
+ * contiguous block for nearest-neighbour queries.
+ *
+ * Query() ranks the collection by lower bounds (the first and last samples, then LB_Keogh against
+ * the query's envelope over the band) and evaluates the exact distance in that order on several
+ * threads. Candidates whose bound already exceeds the current k-th best distance are skipped, and
+ * the remaining evaluations are abandoned as soon as every path through a row exceeds it. Results
+ * are exact and do not depend on the thread count.
+ */
+
+class SimilarityIndex
+{
+protected:
+
+    SimilarityOptions options_;
+    std::vector<std::string> joint_names_;
+    size_t window_;
+    size_t size_;
+    std::vector<double> series_;
+
+    void Prepare(const TrajectoryView& view, double* out) const;
+
+public:
+
+    SimilarityIndex(const Trajectory& header, const SimilarityOptions& options=SimilarityOptions());
+
+    // Returns the index of the trajectory in the collection
+    size_t Add(const TrajectoryView& view);
+
+    // Adds the trajectories in order, resampling them in parallel; returns the index of the first
+    size_t Add(const std::vector<TrajectoryView>& views);
+
+    size_t size() const;
+
+    // The k nearest trajectories, closest first (ties by index)
+    std::vector<SimilarityMatch> Query(const TrajectoryView& query, size_t k) const;
+
+    double Distance(const TrajectoryView& query, size_t index) const;
+
+};
+
+}
+
+#endif // XTF_SIMILARITY_H
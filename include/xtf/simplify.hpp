@@ -0,0 +1,92 @@
+#include <deque>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_SIMPLIFY_H
+#define XTF_SIMPLIFY_H
+
+namespace XTF
+{
+
+/* Deviation is measured on one field (positions by default) between each dropped state and the
+ * straight line through the retained states on either side of it:
+ *
+ * - timed trajectories compare against the line evaluated at the dropped state's time, so the
+ *   simplified trajectory replays within tolerance when interpolated linearly in time
+ * - untimed trajectories (or synchronized_ = false) use the distance to the line segment
+ *
+ * Joint data uses the Euclidean norm over all joints. Pose data bounds the translation by
+ * tolerance and the orientation, compared against the slerp at the same interpolation parameter,
+ * by rotation_tolerance_ radians (the translational tolerance is used if it is negative).
+ *
+ * The first and last states, states without the field and their neighbours, and (if
+ * preserve_extras_) states with extras are always retained.
+ */
+
+class SimplifyOptions
+{
+public:
+
+    State::FIELDS field_;
+    bool synchronized_;
+    bool preserve_extras_;
+    double rotation_tolerance_;
+    size_t threads_;
+    size_t max_window_;
+
+    SimplifyOptions() : field_(State::POSITION_DESIRED), synchronized_(true), preserve_extras_(false), rotation_tolerance_(-1.0), threads_(0), max_window_(256) {}
+
+};
+
+// Indices of the states kept by Ramer-Douglas-Peucker simplification (identical for any thread count)
+std::vector<size_t> SimplifyIndices(const TrajectoryView& view, double tolerance, const SimplifyOptions& options=SimplifyOptions());
+
+Trajectory Simplify(const TrajectoryView& view, double tolerance, const SimplifyOptions& options=SimplifyOptions());
+
+/* Simplifies states as they are recorded with an opening-window pass: a state is dropped while
+ * every state since the last retained one stays within tolerance of the line to the newest state.
+ * This keeps the same error bound as Simplify(). At most max_window_ states (0 for no limit) are
+ * held back before one is retained regardless.
+ */
+
+class StreamingSimplifier
+{
+protected:
+
+    Trajectory header_;
+    double tolerance_;
+    SimplifyOptions options_;
+    bool has_anchor_;
+    State anchor_;
+    std::vector<State> window_;
+    std::deque<State> ready_;
+    size_t received_;
+    size_t retained_;
+
+    void Retain(const State& state);
+
+    bool Fits(const State& end) const;
+
+public:
+
+    StreamingSimplifier(const Trajectory& header, double tolerance, const SimplifyOptions& options=SimplifyOptions());
+
+    void push_back(const State& state);
+
+    void Finish();
+
+    bool HasNext() const;
+
+    State Next();
+
+    size_t Received() const;
+
+    size_t Retained() const;
+
+};
+
+}
+
+#endif // XTF_SIMPLIFY_H
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include <libxml++/libxml++.h>
+#include "xtf/xtf.hpp"
+
+#ifndef XTF_STREAM_H
+#define XTF_STREAM_H
+
+namespace XTF
+{
+
+// Reads the states of an XTF file one at a time, holding only the current state in memory
+class StateReader
+{
+protected:
+
+    std::string filename_;
+    Parser parser_;
+    std::unique_ptr<xmlpp::TextReader> reader_;
+    Trajectory header_;
+    size_t length_;
+    bool has_next_;
+
+    void Advance(bool skip);
+
+    StateReader(const StateReader& other);
+
+    StateReader& operator=(const StateReader& other);
+
+public:
+
+    StateReader(std::string filename);
+
+    // The header fields, with no states
+    const Trajectory& Header() const;
+
+    // The number of states in the file, as declared by (or counted from) the file
+    size_t Length() const;
+
+    bool HasNext() const;
+
+    State Next();
+
+};
+
+/* Writes an XTF file state by state through the exporter, holding at most block_size states.
+ *
+ * The states length attribute is written zero-padded to 20 digits (the same convention as
+ * Parser::AppendStates) and filled in by Close(), which the destructor calls if needed.
+ */
+class StateWriter
+{
+protected:
+
+    std::string filename_;
+    FILE* output_;
+    Parser parser_;
+    Trajectory pending_;
+    size_t block_size_;
+    bool compact_;
+    std::string indent_;
+    std::string suffix_;
+    long length_offset_;
+    size_t written_;
+
+    void WriteBlock();
+
+    StateWriter(const StateWriter& other);
+
+    StateWriter& operator=(const StateWriter& other);
+
+public:
+
+    StateWriter(std::string filename, const Trajectory& header, bool compact=false, size_t block_size=256);
+
+    ~StateWriter();
+
+    void push_back(const State& state);
+
+    void Flush();
+
+    void Close();
+
+    size_t size() const;
+
+};
+
+/* INTERLEAVED emits every state of every source in time order (ties by source order), keeping
+ * each state's sequence number and recording its source index in a "source" extra (named by
+ * source_extra_, empty to omit). All sources must share the same data type and joint names or
+ * frames.
+ *
+ * ALIGNED samples every JOINT source at a common clock, every period_ seconds from the latest
+ * first state until any source runs out. Each output state concatenates the sources' joints,
+ * interpolating each field linearly between the states either side of the tick (a field is
+ * only present if every source has it on both sides), and holds the extras of the earlier
+ * state. Joint and extra names are namespaced as "<prefix>/<name>", where the prefixes default
+ * to each source's uid; set namespace_joints_ to false to keep the names as they are
+ * (Next() then throws if two sources carry an extra of the same name).
+ *
+ * Both modes hold at most two states per source in memory.
+ */
+class MergeOptions
+{
+public:
+
+    enum MODES {INTERLEAVED, ALIGNED};
+
+    MODES mode_;
+    double period_;
+    bool namespace_joints_;
+    std::vector<std::string> prefixes_;
+    std::string source_extra_;
+    std::string uid_;
+
+    MergeOptions() : mode_(INTERLEAVED), period_(0.0), namespace_joints_(true), source_extra_("source") {}
+
+};
+
+class StateMerger
+{
+protected:
+
+    MergeOptions options_;
+    std::vector<StateReader*> sources_;
+    Trajectory header_;
+    // INTERLEAVED: the next state of each source; ALIGNED: the states either side of the clock
+    std::vector<State> current_;
+    std::vector<State> next_;
+    std::vector<bool> has_current_;
+    std::vector<bool> has_next_;
+    int64_t clock_;
+    int64_t period_;
+    int sequence_;
+    bool finished_;
+
+    void BuildHeader();
+
+    void StartAligned();
+
+    bool AdvanceAligned();
+
+public:
+
+    StateMerger(const std::vector<std::string>& filenames, const MergeOptions& options=MergeOptions());
+
+    ~StateMerger();
+
+    // The merged header fields, with no states
+    const Trajectory& Header() const;
+
+    bool HasNext();
+
+    State Next();
+
+};
+
+// Streams the merge of the files into output; returns the number of states written
+size_t MergeFiles(const std::vector<std::string>& filenames, std::string output, const MergeOptions& options=MergeOptions(), bool compact=false);
+
+}
+
+#endif // XTF_STREAM_H
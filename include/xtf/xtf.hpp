@@ -8,6 +8,12 @@
 #include <algorithm>
 #include <stdexcept>
 #include <typeinfo>
+#include <map>
+#include <time.h>
+#include <future>
+#include <memory>
+#include <iterator>
+#include <cstddef>
 #include <libxml++/libxml++.h>
 
 #ifndef XTF_H
@@ -16,6 +22,24 @@
 namespace XTF
 {
 
+inline double TimespecToSeconds(const timespec& timing)
+{
+    return (double)timing.tv_sec + ((double)timing.tv_nsec * 0.000000001);
+}
+
+inline int CompareTimespecs(const timespec& first, const timespec& second)
+{
+    if (first.tv_sec != second.tv_sec)
+    {
+        return (first.tv_sec < second.tv_sec) ? -1 : 1;
+    }
+    else if (first.tv_nsec != second.tv_nsec)
+    {
+        return (first.tv_nsec < second.tv_nsec) ? -1 : 1;
+    }
+    return 0;
+}
+
 class KeyValue
 {
 
@@ -23,16 +47,32 @@ protected:
 
     enum TYPES {KV_BOOLEAN, KV_INTEGER, KV_DOUBLE, KV_STRING, KV_BOOLEANLIST, KV_INTEGERLIST, KV_DOUBLELIST, KV_STRINGLIST};
     TYPES type_;
-    bool bool_val_;
-    double flt_val_;
-    long int_val_;
-    std::string str_val_;
-    std::vector<bool> bool_list_;
-    std::vector<double> flt_list_;
-    std::vector<long> int_list_;
-    std::vector<std::string> str_list_;
+    union
+    {
+        bool bool_val_;
+        double flt_val_;
+        long int_val_;
+    };
+    /* Strings and lists live on the heap as the one std::string or std::vector that type_ names.
+     * Values are only ever replaced whole, so copies of a KeyValue share the same payload.
+     */
+    std::shared_ptr<const void> payload_;
+
+    template<typename PayloadType>
+    inline const PayloadType& Payload() const
+    {
+        return *static_cast<const PayloadType*>(payload_.get());
+    }
+
+    template<typename PayloadType>
+    inline void SetPayload(TYPES type, PayloadType&& value)
+    {
+        type_ = type;
+        int_val_ = 0;
+        payload_ = std::make_shared<const PayloadType>(std::move(value));
+    }
 
-    void Zero();
+    void SetScalar(TYPES type);
 
 public:
 
@@ -52,9 +92,9 @@ public:
 
     KeyValue(std::vector<std::string> value);
 
-    KeyValue() {}
+    KeyValue() : type_(KV_BOOLEAN), int_val_(0) {}
 
-    TYPES Type();
+    TYPES Type() const;
 
     void SetValue(bool value);
 
@@ -72,25 +112,31 @@ public:
 
     void SetValue(std::vector<std::string> value);
 
-    bool BoolValue();
+    bool BoolValue() const;
+
+    long IntegerValue() const;
+
+    double DoubleValue() const;
 
-    long IntegerValue();
+    std::string StringValue() const;
 
-    double DoubleValue();
+    std::vector<bool> BoolListValue() const;
 
-    std::string StringValue();
+    std::vector<long> IntegerListValue() const;
 
-    std::vector<bool> BoolListValue();
+    std::vector<double> DoubleListValue() const;
 
-    std::vector<long> IntegerListValue();
+    std::vector<std::string> StringListValue() const;
 
-    std::vector<double> DoubleListValue();
+    std::string GetValueString() const;
 
-    std::vector<std::string> StringListValue();
+    std::string GetTypeString() const;
 
-    std::string GetValueString();
+    // Heap storage held by the value (not counting sizeof(KeyValue) itself)
+    size_t HeapBytes() const;
 
-    std::string GetTypeString();
+    // Releases unused capacity
+    void Compact();
 
 };
 
@@ -98,10 +144,12 @@ class State
 {
 protected:
 
-    void VerifySize(std::vector<double> element);
+    void VerifySize(const std::vector<double>& element);
 
 public:
 
+    enum FIELDS {POSITION_DESIRED, VELOCITY_DESIRED, ACCELERATION_DESIRED, POSITION_ACTUAL, VELOCITY_ACTUAL, ACCELERATION_ACTUAL, NUM_FIELDS};
+
     std::vector<double> position_desired_;
     std::vector<double> velocity_desired_;
     std::vector<double> acceleration_desired_;
@@ -119,12 +167,303 @@ public:
 
     std::vector<std::string> ListExtras();
 
+    std::vector<double>& Field(FIELDS field);
+
+    const std::vector<double>& Field(FIELDS field) const;
+
+    static const char* FieldName(FIELDS field);
+
+};
+
+class MemoryBreakdown
+{
+public:
+
+    // State objects and the blocks holding them
+    size_t states_;
+    // Heap storage of the six field vectors
+    size_t fields_;
+    // Extras map nodes, keys and values
+    size_t extras_;
+    // Header strings, joint names and tags
+    size_t strings_;
+    // The part of the above in blocks shared with other trajectories
+    size_t shared_;
+
+    MemoryBreakdown() : states_(0), fields_(0), extras_(0), strings_(0), shared_(0) {}
+
+    size_t Total() const
+    {
+        return states_ + fields_ + extras_ + strings_;
+    }
+
+};
+
+/* Bytes held by all live state storage blocks in the process, each shared block counted once.
+ * Blocks are measured when created, copied, appended to and compacted, so growth of a field
+ * through a State& is only seen at the next Trajectory::Compact().
+ */
+size_t LiveTrajectoryBytes();
+
+/* The states of a trajectory, held in blocks of BLOCK_STATES that copies of the storage share
+ * until one of them writes. Copying a storage copies one pointer per block.
+ *
+ * Every non-const accessor (operator[], front(), back(), dereferencing an iterator) counts as a
+ * write: it copies the block if it is shared and may replace the block pointer. Use a const
+ * reference, TrajectoryView or const_iterator when only reading, in particular when several
+ * threads read one trajectory.
+ */
+class StateStorage
+{
+protected:
+
+    class Block
+    {
+    public:
+
+        std::vector<State> states_;
+        // What this block currently contributes to LiveTrajectoryBytes()
+        size_t bytes_;
+
+        Block() : bytes_(0) {}
+
+        ~Block();
+
+    };
+
+    std::vector<std::shared_ptr<Block>> blocks_;
+    size_t size_;
+
+    Block& MutableBlock(size_t block);
+
+    static size_t StateBytes(const State& state);
+
+    static void Account(Block& block, size_t bytes);
+
+    static void Recount(Block& block);
+
+    // Recounts the blocks from the one holding state idx to the end
+    void RecountFrom(size_t idx);
+
+public:
+
+    static const size_t BLOCK_STATES = 256;
+
+    // Random-access iterator over the states; StorageType is const for const_iterator
+    template<typename StorageType, typename StateType>
+    class basic_iterator
+    {
+    protected:
+
+        StorageType* storage_;
+        size_t idx_;
+
+        template<typename OtherStorage, typename OtherState> friend class basic_iterator;
+
+    public:
+
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef State value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef StateType* pointer;
+        typedef StateType& reference;
+
+        basic_iterator() : storage_(NULL), idx_(0) {}
+
+        basic_iterator(StorageType* storage, size_t idx) : storage_(storage), idx_(idx) {}
+
+        // Allows iterator to convert to const_iterator
+        template<typename OtherStorage, typename OtherState>
+        basic_iterator(const basic_iterator<OtherStorage, OtherState>& other) : storage_(other.storage_), idx_(other.idx_) {}
+
+        size_t index() const { return idx_; }
+
+        reference operator*() const { return (*storage_)[idx_]; }
+
+        pointer operator->() const { return &(*storage_)[idx_]; }
+
+        reference operator[](difference_type offset) const { return (*storage_)[idx_ + offset]; }
+
+        basic_iterator& operator++() { idx_++; return *this; }
+
+        basic_iterator operator++(int) { basic_iterator old(*this); idx_++; return old; }
+
+        basic_iterator& operator--() { idx_--; return *this; }
+
+        basic_iterator operator--(int) { basic_iterator old(*this); idx_--; return old; }
+
+        basic_iterator& operator+=(difference_type offset) { idx_ += offset; return *this; }
+
+        basic_iterator& operator-=(difference_type offset) { idx_ -= offset; return *this; }
+
+        basic_iterator operator+(difference_type offset) const { return basic_iterator(storage_, idx_ + offset); }
+
+        basic_iterator operator-(difference_type offset) const { return basic_iterator(storage_, idx_ - offset); }
+
+        friend basic_iterator operator+(difference_type offset, const basic_iterator& itr) { return itr + offset; }
+
+        difference_type operator-(const basic_iterator& other) const { return (difference_type)idx_ - (difference_type)other.idx_; }
+
+        bool operator==(const basic_iterator& other) const { return (storage_ == other.storage_ && idx_ == other.idx_); }
+
+        bool operator!=(const basic_iterator& other) const { return !(*this == other); }
+
+        bool operator<(const basic_iterator& other) const { return idx_ < other.idx_; }
+
+        bool operator>(const basic_iterator& other) const { return idx_ > other.idx_; }
+
+        bool operator<=(const basic_iterator& other) const { return idx_ <= other.idx_; }
+
+        bool operator>=(const basic_iterator& other) const { return idx_ >= other.idx_; }
+
+    };
+
+    typedef basic_iterator<StateStorage, State> iterator;
+    typedef basic_iterator<const StateStorage, const State> const_iterator;
+
+    StateStorage() : size_(0) {}
+
+    StateStorage(std::vector<State>&& states);
+
+    inline size_t size() const
+    {
+        return size_;
+    }
+
+    inline bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    inline const State& operator[](size_t idx) const
+    {
+        return blocks_[idx / BLOCK_STATES]->states_[idx % BLOCK_STATES];
+    }
+
+    inline State& operator[](size_t idx)
+    {
+        return MutableBlock(idx / BLOCK_STATES).states_[idx % BLOCK_STATES];
+    }
+
+    inline const State& front() const
+    {
+        return (*this)[0];
+    }
+
+    inline State& front()
+    {
+        return (*this)[0];
+    }
+
+    inline const State& back() const
+    {
+        return (*this)[size_ - 1];
+    }
+
+    inline State& back()
+    {
+        return (*this)[size_ - 1];
+    }
+
+    inline iterator begin()
+    {
+        return iterator(this, 0);
+    }
+
+    inline iterator end()
+    {
+        return iterator(this, size_);
+    }
+
+    inline const_iterator begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    inline const_iterator end() const
+    {
+        return const_iterator(this, size_);
+    }
+
+    inline const_iterator cbegin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    inline const_iterator cend() const
+    {
+        return const_iterator(this, size_);
+    }
+
+    void push_back(const State& state);
+
+    void push_back(State&& state);
+
+    void pop_back();
+
+    // Like std::vector, inserting or erasing moves every later state (and unshares its block)
+    iterator insert(const_iterator position, const State& state);
+
+    iterator insert(const_iterator position, State&& state);
+
+    iterator erase(const_iterator position);
+
+    iterator erase(const_iterator first, const_iterator last);
+
+    void reserve(size_t capacity);
+
+    void clear();
+
+    // The number of blocks currently shared with another storage
+    size_t SharedBlocks() const;
+
+    void AddMemoryUsage(MemoryBreakdown& usage) const;
+
+    // Compacts the blocks this storage does not share
+    void Compact();
+
+    // Moves the states of unshared blocks into recycled (shared blocks stay with their other owners), then clears
+    void Drain(std::vector<State>& recycled);
+
+};
+
+/* Holds retired states so that new states can be copied into their existing field storage
+ * instead of allocating, which keeps long-running recorders from churning the heap.
+ *
+ * This is a free list, not an arena: every State still owns its field vectors and extras on the
+ * general heap, so parsing allocates them one by one and freeing a trajectory releases them one
+ * by one.
+ */
+class StatePool
+{
+protected:
+
+    std::vector<State> free_;
+
+public:
+
+    StatePool() {}
+
+    State Acquire(const State& source);
+
+    void Release(State&& state);
+
+    void Release(std::vector<State>& states);
+
+    void Release(StateStorage& states);
+
+    size_t size() const;
+
+    void clear();
+
 };
 
 class Trajectory
 {
 protected:
 
+    void VerifyState(const State& val) const;
+
 public:
 
     enum TIMINGS {TIMED, UNTIMED};
@@ -137,7 +476,7 @@ public:
     std::string root_frame_;
     std::string target_frame_;
     std::vector<std::string> tags_;
-    std::vector<State> trajectory_;
+    StateStorage trajectory_;
     std::string uid_;
     TIMINGS timing_;
     TRAJTYPES traj_type_;
@@ -153,25 +492,240 @@ public:
 
     Trajectory() {}
 
-    void push_back(State& val);
+    void push_back(const State& val);
+
+    void push_back(State&& val);
 
+    void reserve(size_t capacity);
+
+    // A write: unshares the state's block (see StateStorage), so read through a const Trajectory& instead
     State& at(size_t idx);
 
+    const State& at(size_t idx) const;
+
     State& operator[](size_t idx);
 
-    size_t size();
+    const State& operator[](size_t idx) const;
+
+    size_t size() const;
+
+    Trajectory CloneHeader() const;
+
+    MemoryBreakdown MemoryUsage() const;
+
+    /* Shrinks the header strings, joint names and tags, every state's field vectors and any extras
+     * value whose payload is not shared, to their contents. Each block keeps its BLOCK_STATES
+     * capacity, and blocks shared with other trajectories are left alone rather than copied.
+     */
+    void Compact();
+
+};
+
+class TrajectoryView
+{
+protected:
+
+    const Trajectory* trajectory_;
+    size_t start_;
+    size_t length_;
+    size_t stride_;
+
+    size_t LowerBound(const timespec& timing) const;
+
+public:
+
+    class const_iterator
+    {
+    protected:
+
+        const TrajectoryView* view_;
+        size_t idx_;
+
+    public:
+
+        const_iterator(const TrajectoryView* view, size_t idx) : view_(view), idx_(idx) {}
+
+        const State& operator*() const { return (*view_)[idx_]; }
+
+        const State* operator->() const { return &(*view_)[idx_]; }
+
+        const_iterator& operator++() { idx_++; return *this; }
+
+        const_iterator operator++(int) { const_iterator old(*this); idx_++; return old; }
+
+        bool operator==(const const_iterator& other) const { return (view_ == other.view_ && idx_ == other.idx_); }
+
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    };
+
+    TrajectoryView() : trajectory_(NULL), start_(0), length_(0), stride_(1) {}
+
+    // Views hold a pointer to the trajectory, so they cannot be made from a temporary
+    explicit TrajectoryView(const Trajectory& trajectory);
+
+    TrajectoryView(const Trajectory& trajectory, size_t start, size_t length, size_t stride=1);
+
+    TrajectoryView(const Trajectory&& trajectory) = delete;
+
+    TrajectoryView(const Trajectory&& trajectory, size_t start, size_t length, size_t stride=1) = delete;
+
+    const Trajectory& Header() const;
+
+    const State& at(size_t idx) const;
+
+    inline const State& operator[](size_t idx) const
+    {
+        return trajectory_->trajectory_[start_ + (idx * stride_)];
+    }
+
+    inline size_t size() const
+    {
+        return length_;
+    }
+
+    inline bool empty() const
+    {
+        return (length_ == 0);
+    }
+
+    inline const_iterator begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    inline const_iterator end() const
+    {
+        return const_iterator(this, length_);
+    }
+
+    TrajectoryView Slice(size_t start, size_t length, size_t stride=1) const;
+
+    TrajectoryView SliceTime(const timespec& start, const timespec& end) const;
+
+    std::vector<TrajectoryView> Split(size_t segment_length) const;
+
+    Trajectory Materialize() const;
+
+};
+
+class ConcatenatedView
+{
+protected:
+
+    std::vector<TrajectoryView> parts_;
+    std::vector<size_t> offsets_;
+
+public:
+
+    ConcatenatedView() {}
+
+    ConcatenatedView(const std::vector<TrajectoryView>& parts);
+
+    void push_back(const TrajectoryView& part);
+
+    const std::vector<TrajectoryView>& Parts() const;
+
+    const Trajectory& Header() const;
+
+    const State& at(size_t idx) const;
+
+    const State& operator[](size_t idx) const;
+
+    size_t size() const;
+
+    Trajectory Materialize() const;
+
+};
+
+class ValidationOptions
+{
+public:
+
+    bool check_timing_;
+    bool check_sequence_;
+    bool check_finite_;
+    bool check_quaternions_;
+    bool check_length_;
+    double quaternion_tolerance_;
+
+    ValidationOptions() : check_timing_(false), check_sequence_(false), check_finite_(false), check_quaternions_(false), check_length_(false), quaternion_tolerance_(0.000001) {}
+
+    static ValidationOptions All();
+
+    bool Enabled() const;
+
+};
+
+class ValidationDiagnostic
+{
+public:
+
+    enum RULES {NON_MONOTONIC_TIMING, NON_CONTIGUOUS_SEQUENCE, NON_FINITE_VALUE, NON_UNIT_QUATERNION, LENGTH_MISMATCH};
+
+    size_t state_index_;
+    RULES rule_;
+    double value_;
+    std::string field_;
+    size_t element_;
+
+    ValidationDiagnostic(size_t state_index, RULES rule, double value, std::string field="", size_t element=0) : state_index_(state_index), rule_(rule), value_(value), field_(field), element_(element) {}
+
+    std::string GetRuleString() const;
+
+};
+
+class CSVOptions
+{
+public:
+
+    char delimiter_;
+    size_t threads_;
+
+    CSVOptions() : delimiter_(','), threads_(0) {}
+
+};
+
+/* FLOAT32 stores values as IEEE single precision: each value is off by at most 2^-24 of its
+ * magnitude (2^-150 for subnormals), and magnitudes above FLT_MAX are rejected.
+ * FIXED32 stores round(value / quantum) as an int32 with a quantum per element (one quantum for
+ * every element if only one is given): each value is off by at most quantum / 2, and non-finite
+ * values or values beyond INT32_MAX quanta are rejected.
+ */
+class PrecisionOptions
+{
+public:
+
+    enum MODES {DOUBLE, FLOAT32, FIXED32};
+
+    MODES mode_;
+    std::vector<double> quantum_;
+
+    PrecisionOptions() : mode_(DOUBLE) {}
+
+    static PrecisionOptions Float32();
+
+    static PrecisionOptions Fixed32(const std::vector<double>& quantum);
+
+    void Verify(size_t data_length) const;
+
+    double Quantum(size_t element) const;
+
+    double ErrorBound(size_t element, double magnitude) const;
 
 };
 
 class Parser
 {
+    friend class StateReader;
+
 protected:
 
     std::vector<bool> ReadBools(std::string strtovec);
 
     std::vector<long> ReadLongs(std::string strtovec);
 
-    std::vector<double> ReadDoubles(std::string strtovec);
+    std::vector<double> ReadDoubles(const std::string& strtovec);
 
     inline std::string CleanNewlines(std::string dirty)
     {
@@ -198,14 +752,106 @@ protected:
 
     std::vector< std::vector<double> > ReadStateFields(xmlpp::Node* field_parent);
 
+    State ReadState(xmlpp::Node* state_node);
+
+    void WriteState(xmlpp::Element* states, const State& state);
+
+    Trajectory ParseDocument(xmlpp::DomParser& parser, const std::string& filename, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics);
+
+    void BuildDocument(xmlpp::Document& document, const Trajectory& header, const std::vector<TrajectoryView>& parts);
+
+    bool ExportViews(const Trajectory& header, const std::vector<TrajectoryView>& parts, std::string filename, bool compact);
+
+    bool ExportViewsParallel(const Trajectory& header, const std::vector<TrajectoryView>& parts, std::string filename, bool compact, size_t threads);
+
+    class CSVColumn
+    {
+    public:
+
+        enum KINDS {SEQUENCE, SECS, NSECS, TIME, FIELD, EXTRA, IGNORED};
+
+        KINDS kind_;
+        State::FIELDS field_;
+        size_t element_;
+        std::string name_;
+        std::string type_;
+
+        CSVColumn() : kind_(IGNORED), field_(State::POSITION_DESIRED), element_(0) {}
+
+    };
+
+    KeyValue ReadKeyValue(const std::string& type, const std::string& value);
+
+    std::vector<State> ReadCSVRows(const char* start, const char* end, const std::vector<CSVColumn>& columns, size_t data_length, char delimiter);
+
+    void WriteCSVRows(std::string& output, const TrajectoryView& view, size_t start, size_t end, const std::vector<CSVColumn>& columns, char delimiter);
+
+    void ValidateState(const State& state, size_t index, const State* previous, Trajectory::TIMINGS timing, Trajectory::DATATYPES data_type, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics);
+
 public:
 
     Parser() {}
 
     Trajectory ParseTraj(std::string filename);
 
+    Trajectory ParseTraj(std::string filename, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics);
+
+    std::future<Trajectory> ParseTrajAsync(std::string filename);
+
+    Trajectory ParseTrajHeader(std::string filename, size_t& length, timespec& start_time, timespec& end_time);
+
     bool ExportTraj(Trajectory trajectory, std::string filename, bool compact=false);
 
+    bool ExportTraj(const TrajectoryView& view, std::string filename, bool compact=false);
+
+    bool ExportTraj(const ConcatenatedView& view, std::string filename, bool compact=false);
+
+    // Formats chunks of states on several threads and writes them in order; the bytes match ExportTraj
+    bool ExportTrajParallel(const TrajectoryView& view, std::string filename, bool compact=false, size_t threads=0);
+
+    bool ExportTrajParallel(const ConcatenatedView& view, std::string filename, bool compact=false, size_t threads=0);
+
+    // Writes the states over the closing tags of an existing file, touching only its tail and length attribute
+    bool AppendStates(std::string filename, const std::vector<State>& states);
+
+    // Rolls back an append that was interrupted by a crash; returns true if there was one to undo
+    bool RecoverAppend(std::string filename);
+
+    Trajectory ParseTrajFromBuffer(const char* buffer, size_t length);
+
+    Trajectory ParseTrajFromBuffer(const char* buffer, size_t length, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics);
+
+    Trajectory ParseTrajFromStream(std::istream& stream);
+
+    Trajectory ParseTrajFromStream(std::istream& stream, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics);
+
+    bool ExportTrajToBuffer(const TrajectoryView& view, std::string& buffer, bool compact=false);
+
+    bool ExportTrajToStream(const TrajectoryView& view, std::ostream& stream, bool compact=false);
+
+    Trajectory ImportCSV(std::string filename, const Trajectory& header, const CSVOptions& options=CSVOptions());
+
+    bool ExportCSV(const TrajectoryView& view, std::string filename, const CSVOptions& options=CSVOptions());
+
+    std::string EncodeHeader(const Trajectory& trajectory);
+
+    Trajectory DecodeHeader(const char* buffer, size_t length);
+
+    std::string EncodeStates(const TrajectoryView& view, bool compact=true);
+
+    // The <state> elements of view as they appear inside an exported document's <states>, with every line indented by indent
+    std::string EncodeStateElements(const TrajectoryView& view, bool compact, const std::string& indent="");
+
+    // Splits the exported document of header (without its states) around <states>: prefix ends just before
+    // the length attribute's value, suffix starts at </states>, and indent is the indentation of <states>
+    void EncodeStatesEnvelope(const Trajectory& header, bool compact, std::string& prefix, std::string& suffix, std::string& indent);
+
+    std::vector<State> DecodeStates(const char* buffer, size_t length);
+
+    std::string EncodeBinary(const TrajectoryView& view, const PrecisionOptions& precision=PrecisionOptions());
+
+    Trajectory DecodeBinary(const char* buffer, size_t length);
+
 };
 
 }
@@ -216,4 +862,6 @@ std::ostream& operator<<(std::ostream& strm, XTF::State& state);
 
 std::ostream& operator<<(std::ostream& strm, XTF::Trajectory& traj);
 
+std::ostream& operator<<(std::ostream& strm, const XTF::ValidationDiagnostic& diagnostic);
+
 #endif // XTF_H
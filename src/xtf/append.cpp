@@ -0,0 +1,536 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libxml/parser.h>
+#include "xtf/xtf.hpp"
+#include "xtf/serialization.hpp"
+
+using namespace XTF;
+
+static const char APPEND_JOURNAL_MAGIC[] = "XTFJRN01";
+// The closing tags are looked for in this many bytes at the end of the file
+static const size_t APPEND_TAIL_BYTES = 64 * 1024;
+static const size_t APPEND_HEAD_CHUNK = 4096;
+// A length attribute that has to grow is rewritten once at this width, so it never has to grow again
+static const size_t APPEND_LENGTH_DIGITS = 20;
+
+class AppendPlan
+{
+public:
+
+    uint64_t file_size_;
+    // Everything from tail_offset_ to the end of the file is replaced by region_
+    uint64_t tail_offset_;
+    std::string old_tail_;
+    std::string region_;
+    // The value of the states length attribute, if it lies outside the tail (length_width_ is 0 if absent)
+    uint64_t length_offset_;
+    size_t length_width_;
+    bool self_closing_;
+    bool formatted_;
+    std::string indent_;
+
+    AppendPlan() : file_size_(0), tail_offset_(0), length_offset_(0), length_width_(0), self_closing_(false), formatted_(false) {}
+
+};
+
+static inline bool IsSpace(char value)
+{
+    return isspace((unsigned char)value) != 0;
+}
+
+static bool IsStatesTag(const std::string& text, size_t pos)
+{
+    size_t after = pos + 7;
+    return (after < text.size() && (IsSpace(text[after]) || text[after] == '>' || text[after] == '/'));
+}
+
+// True if only whitespace, a </trajectory> end tag and more whitespace follow pos
+static bool EndsDocument(const std::string& text, size_t pos)
+{
+    while (pos < text.size() && IsSpace(text[pos]))
+    {
+        pos++;
+    }
+    if (text.compare(pos, 13, "</trajectory>") != 0)
+    {
+        return false;
+    }
+    pos += 13;
+    while (pos < text.size() && IsSpace(text[pos]))
+    {
+        pos++;
+    }
+    return pos == text.size();
+}
+
+// Whitespace between the last newline before pos and pos
+static std::string LineIndent(const std::string& text, size_t pos)
+{
+    size_t start = pos;
+    while (start > 0 && (text[start - 1] == ' ' || text[start - 1] == '\t'))
+    {
+        start--;
+    }
+    return text.substr(start, pos - start);
+}
+
+static bool FindLengthValue(const std::string& tag, size_t& value_start, size_t& value_end)
+{
+    size_t pos = tag.find("length=");
+    while (pos != std::string::npos)
+    {
+        size_t quote = pos + 7;
+        if (pos > 0 && IsSpace(tag[pos - 1]) && quote < tag.size() && (tag[quote] == '"' || tag[quote] == '\''))
+        {
+            size_t close = tag.find(tag[quote], quote + 1);
+            if (close == std::string::npos)
+            {
+                return false;
+            }
+            value_start = quote + 1;
+            value_end = close;
+            return true;
+        }
+        pos = tag.find("length=", pos + 1);
+    }
+    return false;
+}
+
+static std::string PadLength(size_t length, size_t width)
+{
+    std::string digits = std::to_string(length);
+    if (digits.size() < width)
+    {
+        digits.insert(0, width - digits.size(), '0');
+    }
+    return digits;
+}
+
+static void WriteFully(int fd, const char* buffer, size_t length, uint64_t offset, const std::string& filename)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t result = pwrite(fd, buffer + done, length - done, (off_t)(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            throw std::runtime_error("Unable to write XTF file: " + filename);
+        }
+        done += (size_t)result;
+    }
+}
+
+static size_t ReadFully(int fd, char* buffer, size_t length, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t result = pread(fd, buffer + done, length - done, (off_t)(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            break;
+        }
+        done += (size_t)result;
+    }
+    return done;
+}
+
+static void SyncFile(int fd, const std::string& filename)
+{
+    if (fsync(fd) != 0)
+    {
+        throw std::runtime_error("Unable to sync XTF file: " + filename);
+    }
+}
+
+// Makes a created, renamed or removed directory entry durable
+static void SyncDirectory(const std::string& filename)
+{
+    size_t slash = filename.rfind('/');
+    std::string directory = (slash == std::string::npos) ? std::string(".") : ((slash == 0) ? std::string("/") : filename.substr(0, slash));
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static std::string JournalPath(const std::string& filename)
+{
+    return filename + ".journal";
+}
+
+static std::string RewritePath(const std::string& filename)
+{
+    return filename + ".append.tmp";
+}
+
+static void LocateTail(int fd, const std::string& filename, AppendPlan& plan)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        throw std::runtime_error("Unable to stat XTF file: " + filename);
+    }
+    plan.file_size_ = (uint64_t)info.st_size;
+    uint64_t window_start = (plan.file_size_ > APPEND_TAIL_BYTES) ? (plan.file_size_ - APPEND_TAIL_BYTES) : 0;
+    std::string window((size_t)(plan.file_size_ - window_start), '\0');
+    window.resize(ReadFully(fd, &window[0], window.size(), window_start));
+    // Markup cannot appear inside attribute values or text, so the last end tag is the real one
+    size_t close = window.rfind("</states>");
+    size_t tail = std::string::npos;
+    if (close != std::string::npos && EndsDocument(window, close + 9))
+    {
+        tail = close;
+        while (tail > 0 && IsSpace(window[tail - 1]))
+        {
+            tail--;
+        }
+        plan.formatted_ = (window.find('\n', tail) < close);
+        plan.indent_ = LineIndent(window, close);
+    }
+    else
+    {
+        // An empty trajectory is written as <states length="0"/>, which is rewritten as a whole
+        size_t open = window.rfind("<states");
+        while (open != std::string::npos && !IsStatesTag(window, open))
+        {
+            open = (open == 0) ? std::string::npos : window.rfind("<states", open - 1);
+        }
+        size_t end = (open == std::string::npos) ? std::string::npos : window.find('>', open);
+        if (end == std::string::npos || window[end - 1] != '/' || !EndsDocument(window, end + 1))
+        {
+            throw std::invalid_argument("XTF file does not end with its states and cannot be appended to: " + filename);
+        }
+        tail = open;
+        plan.self_closing_ = true;
+        plan.indent_ = LineIndent(window, open);
+        plan.formatted_ = (open > plan.indent_.size() && window[open - plan.indent_.size() - 1] == '\n');
+    }
+    if (window_start > 0 && tail == 0)
+    {
+        throw std::invalid_argument("XTF file does not end with its states and cannot be appended to: " + filename);
+    }
+    plan.tail_offset_ = window_start + tail;
+    plan.old_tail_ = window.substr(tail);
+}
+
+// Finds the value of the length attribute on the states start tag, which sits right after the header
+static void LocateLength(int fd, const AppendPlan& plan, uint64_t& value_offset, size_t& value_width)
+{
+    std::string head;
+    size_t open = std::string::npos;
+    size_t end = std::string::npos;
+    while (head.size() < plan.tail_offset_)
+    {
+        size_t previous = head.size();
+        size_t chunk = (size_t)std::min((uint64_t)APPEND_HEAD_CHUNK, plan.tail_offset_ - previous);
+        head.resize(previous + chunk);
+        head.resize(previous + ReadFully(fd, &head[previous], chunk, previous));
+        if (head.size() == previous)
+        {
+            break;
+        }
+        if (open == std::string::npos)
+        {
+            open = head.find("<states", (previous > 7) ? (previous - 7) : 0);
+            while (open != std::string::npos && open + 7 < head.size() && !IsStatesTag(head, open))
+            {
+                open = head.find("<states", open + 1);
+            }
+            if (open != std::string::npos && open + 7 >= head.size())
+            {
+                // Not sure yet whether this is <states or <state, so look again with the next chunk
+                open = std::string::npos;
+                continue;
+            }
+        }
+        if (open != std::string::npos)
+        {
+            end = head.find('>', open);
+            if (end != std::string::npos)
+            {
+                break;
+            }
+        }
+    }
+    value_width = 0;
+    size_t value_start = 0;
+    size_t value_end = 0;
+    if (end != std::string::npos && FindLengthValue(head.substr(open, end - open), value_start, value_end))
+    {
+        value_offset = open + value_start;
+        value_width = value_end - value_start;
+    }
+    else if (end == std::string::npos)
+    {
+        throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+    }
+}
+
+static void WriteJournal(const std::string& filename, const AppendPlan& plan, const std::string& old_length)
+{
+    std::string buffer(APPEND_JOURNAL_MAGIC, 8);
+    AppendUInt64(buffer, plan.file_size_);
+    AppendUInt64(buffer, plan.tail_offset_);
+    AppendString(buffer, plan.old_tail_);
+    AppendUInt64(buffer, plan.length_offset_);
+    AppendString(buffer, old_length);
+    buffer.append(APPEND_JOURNAL_MAGIC, 8);
+    std::string journal = JournalPath(filename);
+    int fd = open(journal.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Unable to write XTF append journal: " + journal);
+    }
+    try
+    {
+        WriteFully(fd, buffer.data(), buffer.size(), 0, journal);
+        SyncFile(fd, journal);
+    }
+    catch (...)
+    {
+        close(fd);
+        unlink(journal.c_str());
+        throw;
+    }
+    close(fd);
+    SyncDirectory(journal);
+}
+
+// Copies the file with the length attribute widened and the new states in place of the tail
+static void RewriteFile(int fd, const std::string& filename, const AppendPlan& plan, const std::string& length)
+{
+    std::string temp_path = RewritePath(filename);
+    int out = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        throw std::runtime_error("Unable to write XTF file: " + temp_path);
+    }
+    try
+    {
+        struct stat info;
+        if (fstat(fd, &info) == 0)
+        {
+            fchmod(out, info.st_mode & 07777);
+        }
+        std::vector<char> chunk(APPEND_TAIL_BYTES);
+        uint64_t written = 0;
+        uint64_t offset = 0;
+        while (offset < plan.tail_offset_)
+        {
+            if (offset == plan.length_offset_)
+            {
+                WriteFully(out, length.data(), length.size(), written, temp_path);
+                written += length.size();
+                offset += plan.length_width_;
+                continue;
+            }
+            uint64_t limit = (offset < plan.length_offset_) ? plan.length_offset_ : plan.tail_offset_;
+            size_t count = (size_t)std::min((uint64_t)chunk.size(), limit - offset);
+            if (ReadFully(fd, chunk.data(), count, offset) != count)
+            {
+                throw std::runtime_error("Unable to read XTF file: " + filename);
+            }
+            WriteFully(out, chunk.data(), count, written, temp_path);
+            written += count;
+            offset += count;
+        }
+        WriteFully(out, plan.region_.data(), plan.region_.size(), written, temp_path);
+        SyncFile(out, temp_path);
+    }
+    catch (...)
+    {
+        close(out);
+        unlink(temp_path.c_str());
+        throw;
+    }
+    close(out);
+    if (rename(temp_path.c_str(), filename.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("Unable to write XTF file: " + filename);
+    }
+    SyncDirectory(filename);
+}
+
+bool Parser::RecoverAppend(std::string filename)
+{
+    unlink(RewritePath(filename).c_str());
+    std::string journal = JournalPath(filename);
+    FILE* input = fopen(journal.c_str(), "rb");
+    if (input == NULL)
+    {
+        return false;
+    }
+    std::string buffer;
+    char chunk[APPEND_HEAD_CHUNK];
+    size_t count = 0;
+    while ((count = fread(chunk, 1, sizeof(chunk), input)) > 0)
+    {
+        buffer.append(chunk, count);
+    }
+    fclose(input);
+    uint64_t file_size = 0;
+    uint64_t tail_offset = 0;
+    uint64_t length_offset = 0;
+    std::string old_tail;
+    std::string old_length;
+    bool complete = false;
+    try
+    {
+        ByteReader reader(buffer.data(), buffer.size());
+        complete = (memcmp(reader.ReadBytes(8), APPEND_JOURNAL_MAGIC, 8) == 0);
+        file_size = reader.ReadUInt64();
+        tail_offset = reader.ReadUInt64();
+        old_tail = reader.ReadString();
+        length_offset = reader.ReadUInt64();
+        old_length = reader.ReadString();
+        complete = complete && (memcmp(reader.ReadBytes(8), APPEND_JOURNAL_MAGIC, 8) == 0) && reader.Remaining() == 0;
+    }
+    catch (std::invalid_argument& e)
+    {
+        complete = false;
+    }
+    // The file is only touched once the journal is complete and synced, so a partial journal means nothing to undo
+    if (complete)
+    {
+        int fd = open(filename.c_str(), O_RDWR);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Unable to recover XTF file: " + filename);
+        }
+        try
+        {
+            WriteFully(fd, old_tail.data(), old_tail.size(), tail_offset, filename);
+            WriteFully(fd, old_length.data(), old_length.size(), length_offset, filename);
+            if (ftruncate(fd, (off_t)file_size) != 0)
+            {
+                throw std::runtime_error("Unable to recover XTF file: " + filename);
+            }
+            SyncFile(fd, filename);
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    }
+    unlink(journal.c_str());
+    SyncDirectory(journal);
+    return complete;
+}
+
+bool Parser::AppendStates(std::string filename, const std::vector<State>& states)
+{
+    RecoverAppend(filename);
+    size_t length = 0;
+    timespec start_time;
+    timespec end_time;
+    Trajectory appended = ParseTrajHeader(filename, length, start_time, end_time);
+    if (states.size() == 0)
+    {
+        return true;
+    }
+    appended.reserve(states.size());
+    for (size_t idx = 0; idx < states.size(); idx++)
+    {
+        appended.push_back(states[idx]);
+    }
+    int fd = open(filename.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Unable to open XTF file: " + filename);
+    }
+    try
+    {
+        AppendPlan plan;
+        LocateTail(fd, filename, plan);
+        std::string elements = EncodeStateElements(TrajectoryView(appended), !plan.formatted_, plan.formatted_ ? plan.indent_ : std::string());
+        std::string separator = plan.formatted_ ? ("\n" + plan.indent_) : std::string();
+        size_t new_length = length + states.size();
+        std::string length_value;
+        bool rewrite = false;
+        if (plan.self_closing_)
+        {
+            // The whole start tag is in the tail, so its length can be written at full width right away
+            std::string tag = plan.old_tail_.substr(0, plan.old_tail_.find('>'));
+            tag.erase(tag.find_last_not_of(" \t\r\n/") + 1);
+            size_t value_start = 0;
+            size_t value_end = 0;
+            if (FindLengthValue(tag, value_start, value_end))
+            {
+                tag.replace(value_start, value_end - value_start, PadLength(new_length, APPEND_LENGTH_DIGITS));
+            }
+            plan.region_ = tag + ">" + elements + separator + "</states>" + plan.old_tail_.substr(plan.old_tail_.find('>') + 1);
+        }
+        else
+        {
+            LocateLength(fd, plan, plan.length_offset_, plan.length_width_);
+            plan.region_ = elements + plan.old_tail_;
+            if (plan.length_width_ > 0)
+            {
+                length_value = PadLength(new_length, plan.length_width_);
+                if (length_value.size() > plan.length_width_)
+                {
+                    length_value = PadLength(new_length, APPEND_LENGTH_DIGITS);
+                    rewrite = true;
+                }
+            }
+        }
+        if (rewrite)
+        {
+            RewriteFile(fd, filename, plan, length_value);
+            close(fd);
+            return true;
+        }
+        // Journal the bytes about to be overwritten, so a crash part way through can be rolled back
+        std::string old_length((size_t)plan.length_width_, '\0');
+        if (plan.length_width_ > 0 && ReadFully(fd, &old_length[0], old_length.size(), plan.length_offset_) != old_length.size())
+        {
+            throw std::runtime_error("Unable to read XTF file: " + filename);
+        }
+        WriteJournal(filename, plan, old_length);
+        WriteFully(fd, plan.region_.data(), plan.region_.size(), plan.tail_offset_, filename);
+        WriteFully(fd, length_value.data(), length_value.size(), plan.length_offset_, filename);
+        SyncFile(fd, filename);
+    }
+    catch (...)
+    {
+        close(fd);
+        try
+        {
+            RecoverAppend(filename);
+        }
+        catch (...)
+        {
+            // The journal is left behind, and the next append or RecoverAppend() rolls back
+        }
+        throw;
+    }
+    close(fd);
+    std::string journal = JournalPath(filename);
+    unlink(journal.c_str());
+    SyncDirectory(journal);
+    return true;
+}
@@ -0,0 +1,476 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libxml/parser.h>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/compression.hpp"
+#include "xtf/archive.hpp"
+
+using namespace XTF;
+
+static const char ARCHIVE_FILE_MAGIC[] = "XTFARC01";
+static const char ARCHIVE_ENTRY_MAGIC[] = "XTFENT01";
+static const char ARCHIVE_DIRECTORY_MAGIC[] = "XTFDIR01";
+static const char ARCHIVE_END_MAGIC[] = "XTFEND01";
+static const uint32_t ARCHIVE_VERSION = 1;
+static const size_t ARCHIVE_PREFIX_SIZE = 12;
+static const size_t ARCHIVE_FOOTER_SIZE = 16;
+
+static void WriteFully(int fd, const char* buffer, size_t length, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t result = pwrite(fd, buffer + done, length - done, (off_t)(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            throw std::runtime_error("Unable to write XTF archive");
+        }
+        done += (size_t)result;
+    }
+}
+
+static void AppendEntryRecord(std::string& buffer, const ArchiveEntry& entry, Parser& parser)
+{
+    AppendUInt32(buffer, (uint32_t)entry.encoding_);
+    AppendUInt64(buffer, entry.size_);
+    AppendUInt64(buffer, entry.length_);
+    AppendInt64(buffer, entry.start_time_.tv_sec);
+    AppendInt64(buffer, entry.start_time_.tv_nsec);
+    AppendInt64(buffer, entry.end_time_.tv_sec);
+    AppendInt64(buffer, entry.end_time_.tv_nsec);
+    AppendString(buffer, parser.EncodeBinary(TrajectoryView(entry.header_)));
+}
+
+static ArchiveEntry ReadEntryRecord(ByteReader& reader, Parser& parser)
+{
+    ArchiveEntry entry;
+    uint32_t encoding = reader.ReadUInt32();
+    if (encoding > ArchiveEntry::COMPRESSED)
+    {
+        throw std::invalid_argument("XTF archive entry has an invalid encoding");
+    }
+    entry.encoding_ = (ArchiveEntry::ENCODINGS)encoding;
+    entry.size_ = reader.ReadUInt64();
+    entry.length_ = reader.ReadUInt64();
+    entry.start_time_.tv_sec = (time_t)reader.ReadInt64();
+    entry.start_time_.tv_nsec = (long)reader.ReadInt64();
+    entry.end_time_.tv_sec = (time_t)reader.ReadInt64();
+    entry.end_time_.tv_nsec = (long)reader.ReadInt64();
+    uint32_t header_size = reader.ReadUInt32();
+    entry.header_ = parser.DecodeBinary(reader.ReadBytes(header_size), header_size);
+    return entry;
+}
+
+static bool ReadDirectory(const char* data, size_t size, std::vector<ArchiveEntry>& entries, uint64_t& data_end)
+{
+    if (size < ARCHIVE_PREFIX_SIZE || memcmp(data, ARCHIVE_FILE_MAGIC, 8) != 0)
+    {
+        throw std::invalid_argument("File is not an XTF archive");
+    }
+    ByteReader prefix(data + 8, 4);
+    if (prefix.ReadUInt32() != ARCHIVE_VERSION)
+    {
+        throw std::invalid_argument("Unsupported XTF archive version");
+    }
+    Parser parser;
+    if (size >= (ARCHIVE_PREFIX_SIZE + ARCHIVE_FOOTER_SIZE) && memcmp(data + size - 8, ARCHIVE_END_MAGIC, 8) == 0)
+    {
+        try
+        {
+            ByteReader footer(data + size - ARCHIVE_FOOTER_SIZE, 8);
+            uint64_t directory_offset = footer.ReadUInt64();
+            if (directory_offset < ARCHIVE_PREFIX_SIZE || directory_offset > (size - ARCHIVE_FOOTER_SIZE))
+            {
+                throw std::invalid_argument("XTF archive directory offset is invalid");
+            }
+            ByteReader reader(data + directory_offset, size - ARCHIVE_FOOTER_SIZE - directory_offset);
+            if (memcmp(reader.ReadBytes(8), ARCHIVE_DIRECTORY_MAGIC, 8) != 0)
+            {
+                throw std::invalid_argument("XTF archive directory is corrupted");
+            }
+            uint64_t count = reader.ReadUInt64();
+            std::vector<ArchiveEntry> listed;
+            for (uint64_t idx = 0; idx < count; idx++)
+            {
+                uint64_t offset = reader.ReadUInt64();
+                ArchiveEntry entry = ReadEntryRecord(reader, parser);
+                entry.offset_ = offset;
+                if (offset > directory_offset || entry.size_ > (directory_offset - offset))
+                {
+                    throw std::invalid_argument("XTF archive directory is corrupted");
+                }
+                listed.push_back(entry);
+            }
+            entries.swap(listed);
+            data_end = directory_offset;
+            return false;
+        }
+        catch (std::invalid_argument& e)
+        {
+            // Fall back to rebuilding the directory from the entry records
+        }
+    }
+    entries.clear();
+    uint64_t offset = ARCHIVE_PREFIX_SIZE;
+    while ((size - offset) >= 8 && memcmp(data + offset, ARCHIVE_ENTRY_MAGIC, 8) == 0)
+    {
+        try
+        {
+            ByteReader reader(data + offset + 8, size - offset - 8);
+            ArchiveEntry entry = ReadEntryRecord(reader, parser);
+            entry.offset_ = offset + 8 + reader.Offset();
+            if (entry.size_ > reader.Remaining())
+            {
+                break;
+            }
+            entries.push_back(entry);
+            offset = entry.offset_ + entry.size_;
+        }
+        catch (std::invalid_argument& e)
+        {
+            // A torn final entry ends the recovered archive
+            break;
+        }
+    }
+    data_end = offset;
+    return true;
+}
+
+ArchiveWriter::ArchiveWriter(std::string filename, bool append)
+{
+    filename_ = filename;
+    fd_ = append ? open(filename.c_str(), O_RDWR) : -1;
+    if (fd_ < 0 && append && errno != ENOENT)
+    {
+        throw std::runtime_error("Unable to open XTF archive: " + filename);
+    }
+    if (fd_ >= 0)
+    {
+        try
+        {
+            struct stat info;
+            if (fstat(fd_, &info) != 0)
+            {
+                throw std::runtime_error("Unable to stat XTF archive: " + filename);
+            }
+            size_t size = (size_t)info.st_size;
+            void* mapped = (size > 0) ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd_, 0) : MAP_FAILED;
+            if (mapped == MAP_FAILED)
+            {
+                throw std::invalid_argument("File is not an XTF archive: " + filename);
+            }
+            try
+            {
+                ReadDirectory((const char*)mapped, size, entries_, write_offset_);
+            }
+            catch (...)
+            {
+                munmap(mapped, size);
+                throw;
+            }
+            munmap(mapped, size);
+            // Drop the old directory now, so a crash before Close() leaves a file that readers can recover
+            if (ftruncate(fd_, (off_t)write_offset_) != 0)
+            {
+                throw std::runtime_error("Unable to truncate XTF archive: " + filename);
+            }
+        }
+        catch (...)
+        {
+            close(fd_);
+            fd_ = -1;
+            throw;
+        }
+        return;
+    }
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+    {
+        throw std::runtime_error("Unable to create XTF archive: " + filename);
+    }
+    try
+    {
+        std::string prefix(ARCHIVE_FILE_MAGIC, 8);
+        AppendUInt32(prefix, ARCHIVE_VERSION);
+        WriteFully(fd_, prefix.data(), prefix.size(), 0);
+        write_offset_ = prefix.size();
+    }
+    catch (...)
+    {
+        close(fd_);
+        fd_ = -1;
+        throw;
+    }
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+        // Nothing sensible can be done from a destructor
+    }
+}
+
+void ArchiveWriter::AddPayload(ArchiveEntry& entry, const std::string& payload)
+{
+    if (fd_ < 0)
+    {
+        throw std::invalid_argument("XTF archive writer is closed");
+    }
+    entry.size_ = payload.size();
+    std::string block(ARCHIVE_ENTRY_MAGIC, 8);
+    AppendEntryRecord(block, entry, parser_);
+    entry.offset_ = write_offset_ + block.size();
+    block.append(payload);
+    WriteFully(fd_, block.data(), block.size(), write_offset_);
+    write_offset_ += block.size();
+    entries_.push_back(entry);
+}
+
+void ArchiveWriter::Add(const TrajectoryView& view, ArchiveEntry::ENCODINGS encoding)
+{
+    ArchiveEntry entry;
+    entry.encoding_ = encoding;
+    entry.header_ = view.Header().CloneHeader();
+    entry.length_ = view.size();
+    if (view.size() > 0)
+    {
+        entry.start_time_ = view[0].timing_;
+        entry.end_time_ = view[view.size() - 1].timing_;
+    }
+    std::string payload;
+    if (encoding == ArchiveEntry::BINARY)
+    {
+        payload = parser_.EncodeBinary(view);
+    }
+    else if (encoding == ArchiveEntry::COMPRESSED)
+    {
+        payload = CompressedTrajectory(view).Serialize();
+    }
+    else
+    {
+        parser_.ExportTrajToBuffer(view, payload, true);
+    }
+    AddPayload(entry, payload);
+}
+
+void ArchiveWriter::AddXTF(std::string filename)
+{
+    ArchiveEntry entry;
+    entry.encoding_ = ArchiveEntry::XML;
+    size_t length = 0;
+    entry.header_ = parser_.ParseTrajHeader(filename, length, entry.start_time_, entry.end_time_);
+    entry.length_ = length;
+    FILE* input = fopen(filename.c_str(), "rb");
+    if (input == NULL)
+    {
+        std::string error_str("Unable to read XTF file (file may not exist): " + filename);
+        throw std::invalid_argument(error_str.c_str());
+    }
+    std::string contents;
+    char buffer[1 << 16];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+        contents.append(buffer, read);
+    }
+    fclose(input);
+    // The file is stored verbatim, so packing does not parse its states
+    AddPayload(entry, contents);
+}
+
+void ArchiveWriter::Close()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    std::string directory(ARCHIVE_DIRECTORY_MAGIC, 8);
+    AppendUInt64(directory, entries_.size());
+    for (size_t idx = 0; idx < entries_.size(); idx++)
+    {
+        AppendUInt64(directory, entries_[idx].offset_);
+        AppendEntryRecord(directory, entries_[idx], parser_);
+    }
+    AppendUInt64(directory, write_offset_);
+    directory.append(ARCHIVE_END_MAGIC, 8);
+    int fd = fd_;
+    fd_ = -1;
+    try
+    {
+        WriteFully(fd, directory.data(), directory.size(), write_offset_);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    bool synced = (fdatasync(fd) == 0);
+    bool closed = (close(fd) == 0);
+    if (!synced || !closed)
+    {
+        throw std::runtime_error("Unable to close XTF archive: " + filename_);
+    }
+}
+
+const std::vector<ArchiveEntry>& ArchiveWriter::Entries() const
+{
+    return entries_;
+}
+
+ArchiveReader::ArchiveReader(std::string filename)
+{
+    filename_ = filename;
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0)
+    {
+        throw std::invalid_argument("Unable to open XTF archive (file may not exist): " + filename);
+    }
+    struct stat info;
+    if (fstat(fd_, &info) != 0 || info.st_size == 0)
+    {
+        close(fd_);
+        throw std::invalid_argument("File is not an XTF archive: " + filename);
+    }
+    mapped_size_ = (size_t)info.st_size;
+    void* mapped = mmap(NULL, mapped_size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(fd_);
+        throw std::runtime_error("Unable to map XTF archive: " + filename);
+    }
+    mapped_ = (const char*)mapped;
+    try
+    {
+        uint64_t data_end = 0;
+        recovered_ = ReadDirectory(mapped_, mapped_size_, entries_, data_end);
+    }
+    catch (...)
+    {
+        munmap(mapped, mapped_size_);
+        close(fd_);
+        throw;
+    }
+    for (size_t idx = 0; idx < entries_.size(); idx++)
+    {
+        uids_.insert(std::pair<std::string, size_t>(entries_[idx].uid(), idx));
+    }
+}
+
+ArchiveReader::~ArchiveReader()
+{
+    munmap((void*)mapped_, mapped_size_);
+    close(fd_);
+}
+
+const std::vector<ArchiveEntry>& ArchiveReader::Entries() const
+{
+    return entries_;
+}
+
+bool ArchiveReader::Recovered() const
+{
+    return recovered_;
+}
+
+size_t ArchiveReader::size() const
+{
+    return entries_.size();
+}
+
+size_t ArchiveReader::Find(const std::string& uid) const
+{
+    std::map<std::string, size_t>::const_iterator found = uids_.find(uid);
+    if (found == uids_.end())
+    {
+        throw std::invalid_argument("XTF archive has no trajectory with uid: " + uid);
+    }
+    return found->second;
+}
+
+const char* ArchiveReader::Payload(size_t idx, size_t& size) const
+{
+    if (idx >= entries_.size())
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    size = (size_t)entries_[idx].size_;
+    return mapped_ + entries_[idx].offset_;
+}
+
+Trajectory ArchiveReader::Load(size_t idx) const
+{
+    size_t size = 0;
+    const char* payload = Payload(idx, size);
+    // All decoders read straight out of the mapping
+    Parser parser;
+    if (entries_[idx].encoding_ == ArchiveEntry::BINARY)
+    {
+        return parser.DecodeBinary(payload, size);
+    }
+    else if (entries_[idx].encoding_ == ArchiveEntry::COMPRESSED)
+    {
+        return CompressedTrajectory::Deserialize(payload, size).Materialize(1);
+    }
+    else
+    {
+        return parser.ParseTrajFromBuffer(payload, size);
+    }
+}
+
+Trajectory ArchiveReader::Load(const std::string& uid) const
+{
+    return Load(Find(uid));
+}
+
+std::vector<Trajectory> ArchiveReader::Load(const std::vector<size_t>& indices, size_t threads) const
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t idx = 0; idx < indices.size(); idx++)
+    {
+        size_t size = 0;
+        const char* payload = Payload(indices[idx], size);
+        size_t start = ((size_t)(payload - mapped_) / page_size) * page_size;
+        madvise((void*)(mapped_ + start), (size_t)(payload - mapped_) + size - start, MADV_WILLNEED);
+    }
+    xmlInitParser();
+    std::vector<Trajectory> loaded(indices.size());
+    ParallelFor(indices.size(), threads, [&](size_t task)
+    {
+        loaded[task] = Load(indices[task]);
+    });
+    return loaded;
+}
+
+std::vector<Trajectory> ArchiveReader::LoadAll(size_t threads) const
+{
+    std::vector<size_t> indices(entries_.size());
+    for (size_t idx = 0; idx < indices.size(); idx++)
+    {
+        indices[idx] = idx;
+    }
+    return Load(indices, threads);
+}
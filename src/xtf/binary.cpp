@@ -0,0 +1,351 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <utility>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/quantized.hpp"
+
+using namespace XTF;
+
+/* Binary trajectory layout (little-endian):
+ *
+ * "XTFBIN01" u32 version
+ * u32 precision mode (PrecisionOptions::MODES), then for FIXED32 a u32 count and that many quantum doubles
+ * uid, robot, generator, root_frame, target_frame (strings)
+ * u32 traj_type, u32 timing, u32 data_type
+ * joint_names, tags (string lists)
+ * u64 state count, then per state:
+ *   i64 sequence, i64 secs, i64 nsecs, u32 data_length, u32 field mask,
+ *   data_length values (double, float32 or int32 per the precision mode) for each field present in the mask,
+ *   u32 extra count, then per extra its name, type string and typed value
+ *
+ * Version 1 had no precision mode and always stored doubles; it is still decoded.
+ */
+
+static const char BINARY_MAGIC[] = "XTFBIN01";
+static const uint32_t BINARY_VERSION = 2;
+
+void XTF::AppendKeyValue(std::string& buffer, const KeyValue& value)
+{
+    std::string type = value.GetTypeString();
+    AppendString(buffer, type);
+    if (type == "boolean")
+    {
+        AppendUInt32(buffer, value.BoolValue() ? 1 : 0);
+    }
+    else if (type == "integer")
+    {
+        AppendInt64(buffer, value.IntegerValue());
+    }
+    else if (type == "double")
+    {
+        AppendDouble(buffer, value.DoubleValue());
+    }
+    else if (type == "string")
+    {
+        AppendString(buffer, value.StringValue());
+    }
+    else if (type == "booleanlist")
+    {
+        std::vector<bool> values = value.BoolListValue();
+        AppendUInt32(buffer, (uint32_t)values.size());
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            buffer.push_back(values[i] ? 1 : 0);
+        }
+    }
+    else if (type == "integerlist")
+    {
+        std::vector<long> values = value.IntegerListValue();
+        AppendUInt32(buffer, (uint32_t)values.size());
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            AppendInt64(buffer, values[i]);
+        }
+    }
+    else if (type == "doublelist")
+    {
+        std::vector<double> values = value.DoubleListValue();
+        AppendUInt32(buffer, (uint32_t)values.size());
+        AppendDoubles(buffer, values.data(), values.size());
+    }
+    else
+    {
+        AppendStrings(buffer, value.StringListValue());
+    }
+}
+
+KeyValue XTF::ReadKeyValue(ByteReader& reader)
+{
+    std::string type = reader.ReadString();
+    if (type == "boolean")
+    {
+        return KeyValue(reader.ReadUInt32() != 0);
+    }
+    else if (type == "integer")
+    {
+        return KeyValue((long)reader.ReadInt64());
+    }
+    else if (type == "double")
+    {
+        return KeyValue(reader.ReadDouble());
+    }
+    else if (type == "string")
+    {
+        return KeyValue(reader.ReadString());
+    }
+    else if (type == "booleanlist")
+    {
+        uint32_t count = reader.ReadUInt32();
+        reader.RequireCount(count, 1);
+        const char* bytes = reader.ReadBytes(count);
+        std::vector<bool> values(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            values[i] = (bytes[i] != 0);
+        }
+        return KeyValue(values);
+    }
+    else if (type == "integerlist")
+    {
+        uint32_t count = reader.ReadUInt32();
+        reader.RequireCount(count, 8);
+        std::vector<long> values;
+        values.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            values.push_back((long)reader.ReadInt64());
+        }
+        return KeyValue(values);
+    }
+    else if (type == "doublelist")
+    {
+        uint32_t count = reader.ReadUInt32();
+        reader.RequireCount(count, 8);
+        std::vector<double> values(count);
+        reader.ReadDoubles(values.data(), count);
+        return KeyValue(values);
+    }
+    else if (type == "stringlist")
+    {
+        return KeyValue(reader.ReadStrings());
+    }
+    else
+    {
+        throw std::invalid_argument("Binary trajectory contains an invalid extra type");
+    }
+}
+
+static void QuantumRows(const PrecisionOptions& precision, size_t length, std::vector<double>& quantum, std::vector<double>& inverse_quantum)
+{
+    precision.Verify(length);
+    quantum.assign(length, 1.0);
+    inverse_quantum.assign(length, 1.0);
+    for (size_t element = 0; element < length && precision.mode_ == PrecisionOptions::FIXED32; element++)
+    {
+        quantum[element] = precision.Quantum(element);
+        inverse_quantum[element] = 1.0 / quantum[element];
+    }
+}
+
+std::string Parser::EncodeBinary(const TrajectoryView& view, const PrecisionOptions& precision)
+{
+    const Trajectory& header = view.Header();
+    std::string buffer(BINARY_MAGIC, 8);
+    AppendUInt32(buffer, BINARY_VERSION);
+    AppendUInt32(buffer, (uint32_t)precision.mode_);
+    if (precision.mode_ == PrecisionOptions::FIXED32)
+    {
+        AppendUInt32(buffer, (uint32_t)precision.quantum_.size());
+        AppendDoubles(buffer, precision.quantum_.data(), precision.quantum_.size());
+    }
+    AppendString(buffer, header.uid_);
+    AppendString(buffer, header.robot_);
+    AppendString(buffer, header.generator_);
+    AppendString(buffer, header.root_frame_);
+    AppendString(buffer, header.target_frame_);
+    AppendUInt32(buffer, (uint32_t)header.traj_type_);
+    AppendUInt32(buffer, (uint32_t)header.timing_);
+    AppendUInt32(buffer, (uint32_t)header.data_type_);
+    AppendStrings(buffer, header.joint_names_);
+    AppendStrings(buffer, header.tags_);
+    AppendUInt64(buffer, view.size());
+    std::vector<double> quantum;
+    std::vector<double> inverse_quantum;
+    std::vector<float> float_values;
+    std::vector<int32_t> fixed_values;
+    for (size_t idx = 0; idx < view.size(); idx++)
+    {
+        const State& state = view[idx];
+        if (quantum.size() != state.data_length_)
+        {
+            QuantumRows(precision, state.data_length_, quantum, inverse_quantum);
+        }
+        AppendInt64(buffer, state.sequence_);
+        AppendInt64(buffer, state.timing_.tv_sec);
+        AppendInt64(buffer, state.timing_.tv_nsec);
+        AppendUInt32(buffer, state.data_length_);
+        uint32_t field_mask = 0;
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            if (state.Field((State::FIELDS)field).size() > 0)
+            {
+                field_mask |= (1u << field);
+            }
+        }
+        AppendUInt32(buffer, field_mask);
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            const std::vector<double>& values = state.Field((State::FIELDS)field);
+            if (values.size() == 0)
+            {
+                continue;
+            }
+            else if (values.size() != state.data_length_)
+            {
+                throw std::invalid_argument("Inconsistent trajectory state fields");
+            }
+            else if (precision.mode_ == PrecisionOptions::FLOAT32)
+            {
+                VerifyRepresentable(values.data(), inverse_quantum.data(), values.size(), precision.mode_);
+                float_values.resize(values.size());
+                DoublesToFloats(values.data(), float_values.data(), values.size());
+                AppendFloats(buffer, float_values.data(), float_values.size());
+            }
+            else if (precision.mode_ == PrecisionOptions::FIXED32)
+            {
+                VerifyRepresentable(values.data(), inverse_quantum.data(), values.size(), precision.mode_);
+                fixed_values.resize(values.size());
+                DoublesToFixed(values.data(), fixed_values.data(), inverse_quantum.data(), values.size());
+                AppendInt32s(buffer, fixed_values.data(), fixed_values.size());
+            }
+            else
+            {
+                AppendDoubles(buffer, values.data(), values.size());
+            }
+        }
+        AppendUInt32(buffer, (uint32_t)state.extras_.size());
+        std::map<std::string, KeyValue>::const_iterator itr;
+        for (itr = state.extras_.begin(); itr != state.extras_.end(); ++itr)
+        {
+            AppendString(buffer, itr->first);
+            AppendKeyValue(buffer, itr->second);
+        }
+    }
+    return buffer;
+}
+
+Trajectory Parser::DecodeBinary(const char* buffer, size_t length)
+{
+    ByteReader reader(buffer, length);
+    if (length < 12 || memcmp(reader.ReadBytes(8), BINARY_MAGIC, 8) != 0)
+    {
+        throw std::invalid_argument("Binary trajectory is malformed or otherwise corrupted");
+    }
+    uint32_t version = reader.ReadUInt32();
+    PrecisionOptions precision;
+    if (version == BINARY_VERSION)
+    {
+        uint32_t mode = reader.ReadUInt32();
+        if (mode > PrecisionOptions::FIXED32)
+        {
+            throw std::invalid_argument("Binary trajectory is malformed or otherwise corrupted");
+        }
+        precision.mode_ = (PrecisionOptions::MODES)mode;
+        if (precision.mode_ == PrecisionOptions::FIXED32)
+        {
+            uint32_t quantum_count = reader.ReadUInt32();
+            if (((size_t)quantum_count * sizeof(double)) > reader.Remaining())
+            {
+                throw std::invalid_argument("Binary data is truncated or otherwise corrupted");
+            }
+            precision.quantum_.resize(quantum_count);
+            reader.ReadDoubles(precision.quantum_.data(), quantum_count);
+        }
+    }
+    else if (version != 1)
+    {
+        throw std::invalid_argument("Binary trajectory is malformed or otherwise corrupted");
+    }
+    size_t value_size = (precision.mode_ == PrecisionOptions::DOUBLE) ? sizeof(double) : sizeof(float);
+    Trajectory decoded;
+    decoded.uid_ = reader.ReadString();
+    decoded.robot_ = reader.ReadString();
+    decoded.generator_ = reader.ReadString();
+    decoded.root_frame_ = reader.ReadString();
+    decoded.target_frame_ = reader.ReadString();
+    uint32_t traj_type = reader.ReadUInt32();
+    uint32_t timing = reader.ReadUInt32();
+    uint32_t data_type = reader.ReadUInt32();
+    if (traj_type > Trajectory::RECORDED || timing > Trajectory::UNTIMED || data_type > Trajectory::POSE)
+    {
+        throw std::invalid_argument("Binary trajectory is malformed or otherwise corrupted");
+    }
+    decoded.traj_type_ = (Trajectory::TRAJTYPES)traj_type;
+    decoded.timing_ = (Trajectory::TIMINGS)timing;
+    decoded.data_type_ = (Trajectory::DATATYPES)data_type;
+    decoded.joint_names_ = reader.ReadStrings();
+    decoded.tags_ = reader.ReadStrings();
+    uint64_t state_count = reader.ReadUInt64();
+    // Every state takes at least 32 bytes, which bounds the reservation for corrupt counts
+    decoded.reserve((size_t)std::min<uint64_t>(state_count, reader.Remaining() / 32));
+    std::vector<double> quantum;
+    std::vector<double> inverse_quantum;
+    std::vector<float> float_values;
+    std::vector<int32_t> fixed_values;
+    for (uint64_t idx = 0; idx < state_count; idx++)
+    {
+        int sequence = (int)reader.ReadInt64();
+        timespec state_timing;
+        state_timing.tv_sec = (time_t)reader.ReadInt64();
+        state_timing.tv_nsec = (long)reader.ReadInt64();
+        uint32_t data_length = reader.ReadUInt32();
+        uint32_t field_mask = reader.ReadUInt32();
+        if (field_mask != 0 && quantum.size() != data_length)
+        {
+            QuantumRows(precision, data_length, quantum, inverse_quantum);
+        }
+        std::vector<double> fields[State::NUM_FIELDS];
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            if ((field_mask >> field) & 1)
+            {
+                if (((size_t)data_length * value_size) > reader.Remaining())
+                {
+                    throw std::invalid_argument("Binary data is truncated or otherwise corrupted");
+                }
+                fields[field].resize(data_length);
+                if (precision.mode_ == PrecisionOptions::FLOAT32)
+                {
+                    float_values.resize(data_length);
+                    reader.ReadFloats(float_values.data(), data_length);
+                    FloatsToDoubles(float_values.data(), fields[field].data(), data_length);
+                }
+                else if (precision.mode_ == PrecisionOptions::FIXED32)
+                {
+                    fixed_values.resize(data_length);
+                    reader.ReadInt32s(fixed_values.data(), data_length);
+                    FixedToDoubles(fixed_values.data(), fields[field].data(), quantum.data(), data_length);
+                }
+                else
+                {
+                    reader.ReadDoubles(fields[field].data(), data_length);
+                }
+            }
+        }
+        State state(std::move(fields[0]), std::move(fields[1]), std::move(fields[2]), std::move(fields[3]), std::move(fields[4]), std::move(fields[5]), sequence, state_timing);
+        uint32_t extra_count = reader.ReadUInt32();
+        for (uint32_t extra = 0; extra < extra_count; extra++)
+        {
+            std::string name = reader.ReadString();
+            state.extras_.insert(std::pair<std::string, KeyValue>(name, XTF::ReadKeyValue(reader)));
+        }
+        decoded.push_back(std::move(state));
+    }
+    return decoded;
+}
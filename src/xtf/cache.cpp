@@ -0,0 +1,383 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xtf/xtf.hpp"
+#include "xtf/hash.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/cache.hpp"
+
+using namespace XTF;
+
+static const char CACHE_MAGIC[] = "XTFCACHE";
+static const uint32_t CACHE_VERSION = 1;
+static const char CACHE_EXTENSION[] = ".xtfc";
+static const char CACHE_TEMP_PREFIX[] = ".tmp.";
+// Temporary files older than this were left behind by a process that died mid-write
+static const time_t CACHE_STALE_TEMP_SECONDS = 3600;
+// The lock file also holds the running total of sidecar bytes, after this magic
+static const char CACHE_TOTAL_MAGIC[] = "XTFCSIZE";
+
+class CacheEntry
+{
+public:
+
+    std::string path_;
+    uint64_t size_;
+    timespec mtime_;
+
+};
+
+static bool CompareEntryAge(const CacheEntry& first, const CacheEntry& second)
+{
+    return CompareTimespecs(first.mtime_, second.mtime_) < 0;
+}
+
+static bool HasSuffix(const std::string& name, const std::string& suffix)
+{
+    return (name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
+
+static std::vector<CacheEntry> ListEntries(const std::string& directory, bool include_temporary)
+{
+    std::vector<CacheEntry> entries;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == NULL)
+    {
+        return entries;
+    }
+    struct dirent* dirent_ptr = NULL;
+    while ((dirent_ptr = readdir(dir)) != NULL)
+    {
+        std::string name(dirent_ptr->d_name);
+        bool temporary = (name.compare(0, strlen(CACHE_TEMP_PREFIX), CACHE_TEMP_PREFIX) == 0);
+        if (!HasSuffix(name, CACHE_EXTENSION) && !(include_temporary && temporary))
+        {
+            continue;
+        }
+        CacheEntry entry;
+        entry.path_ = directory + "/" + name;
+        struct stat info;
+        if (stat(entry.path_.c_str(), &info) != 0)
+        {
+            continue;
+        }
+        entry.size_ = (uint64_t)info.st_size;
+        entry.mtime_ = info.st_mtim;
+        entries.push_back(entry);
+    }
+    closedir(dir);
+    return entries;
+}
+
+static std::string ReadContents(const std::string& filename)
+{
+    FILE* input = fopen(filename.c_str(), "rb");
+    if (input == NULL)
+    {
+        std::string error_str("Unable to read XTF file (file may not exist): " + filename);
+        throw std::invalid_argument(error_str.c_str());
+    }
+    std::string contents;
+    char buffer[1 << 16];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+        contents.append(buffer, read);
+    }
+    fclose(input);
+    return contents;
+}
+
+class DirectoryLock
+{
+protected:
+
+    int fd_;
+
+public:
+
+    DirectoryLock(const std::string& directory)
+    {
+        std::string lock_path = directory + "/.lock";
+        fd_ = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0)
+        {
+            throw std::runtime_error("Unable to lock trajectory cache: " + directory);
+        }
+        while (flock(fd_, LOCK_EX) != 0 && errno == EINTR) {}
+    }
+
+    ~DirectoryLock()
+    {
+        flock(fd_, LOCK_UN);
+        close(fd_);
+    }
+
+    // False if no total has been recorded yet (or the record is damaged)
+    bool ReadTotal(uint64_t& total) const
+    {
+        char raw[16];
+        if (pread(fd_, raw, sizeof(raw), 0) != (ssize_t)sizeof(raw) || memcmp(raw, CACHE_TOTAL_MAGIC, 8) != 0)
+        {
+            return false;
+        }
+        ByteReader reader(raw + 8, 8);
+        total = reader.ReadUInt64();
+        return true;
+    }
+
+    void WriteTotal(uint64_t total)
+    {
+        std::string raw(CACHE_TOTAL_MAGIC, 8);
+        AppendUInt64(raw, total);
+        if (pwrite(fd_, raw.data(), raw.size(), 0) != (ssize_t)raw.size())
+        {
+            throw std::runtime_error("Unable to update trajectory cache size");
+        }
+    }
+
+};
+
+TrajectoryCache::TrajectoryCache(std::string directory, uint64_t max_bytes, bool verify_content)
+{
+    directory_ = directory;
+    max_bytes_ = max_bytes;
+    verify_content_ = verify_content;
+    if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("Unable to create trajectory cache directory: " + directory_);
+    }
+}
+
+std::string TrajectoryCache::SidecarPath(const std::string& canonical) const
+{
+    return directory_ + "/" + HashToHex(HashString(canonical)) + CACHE_EXTENSION;
+}
+
+Trajectory TrajectoryCache::Load(std::string filename)
+{
+    char resolved[PATH_MAX];
+    struct stat info;
+    if (realpath(filename.c_str(), resolved) == NULL || stat(resolved, &info) != 0)
+    {
+        std::string error_str("Unable to read XTF file (file may not exist): " + filename);
+        throw std::invalid_argument(error_str.c_str());
+    }
+    std::string canonical(resolved);
+    std::string sidecar = SidecarPath(canonical);
+    uint64_t size = (uint64_t)info.st_size;
+    Trajectory trajectory;
+    if (!verify_content_ && LoadSidecar(sidecar, canonical, size, info.st_mtim, NULL, trajectory))
+    {
+        return trajectory;
+    }
+    std::string contents = ReadContents(canonical);
+    uint64_t content_hash = HashString(contents);
+    if (verify_content_ && LoadSidecar(sidecar, canonical, size, info.st_mtim, &content_hash, trajectory))
+    {
+        return trajectory;
+    }
+    Parser parser;
+    trajectory = parser.ParseTrajFromBuffer(contents.data(), contents.size());
+    try
+    {
+        StoreSidecar(sidecar, canonical, size, info.st_mtim, content_hash, trajectory);
+        Evict();
+    }
+    catch (std::runtime_error& e)
+    {
+        // The cache is best-effort - failing to store a sidecar must not fail the load
+    }
+    return trajectory;
+}
+
+bool TrajectoryCache::LoadSidecar(const std::string& sidecar, const std::string& canonical, uint64_t size, const timespec& mtime, const uint64_t* content_hash, Trajectory& trajectory)
+{
+    int fd = open(sidecar.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    size_t mapped_size = (size_t)info.st_size;
+    void* mapped = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    bool hit = false;
+    try
+    {
+        ByteReader reader((const char*)mapped, mapped_size);
+        bool valid = (memcmp(reader.ReadBytes(8), CACHE_MAGIC, 8) == 0);
+        valid = valid && (reader.ReadUInt32() == CACHE_VERSION);
+        valid = valid && (reader.ReadString() == canonical);
+        valid = valid && (reader.ReadUInt64() == size);
+        valid = valid && (reader.ReadInt64() == (int64_t)mtime.tv_sec);
+        valid = valid && (reader.ReadInt64() == (int64_t)mtime.tv_nsec);
+        uint64_t stored_hash = valid ? reader.ReadUInt64() : 0;
+        valid = valid && (content_hash == NULL || stored_hash == *content_hash);
+        if (valid)
+        {
+            uint64_t payload_size = reader.ReadUInt64();
+            if (payload_size == reader.Remaining())
+            {
+                Parser parser;
+                trajectory = parser.DecodeBinary(reader.ReadBytes(payload_size), payload_size);
+                hit = true;
+            }
+        }
+    }
+    catch (std::invalid_argument& e)
+    {
+        // A corrupt sidecar is treated as a miss and overwritten
+        hit = false;
+    }
+    if (hit)
+    {
+        futimens(fd, NULL);
+    }
+    munmap(mapped, mapped_size);
+    close(fd);
+    return hit;
+}
+
+void TrajectoryCache::StoreSidecar(const std::string& sidecar, const std::string& canonical, uint64_t size, const timespec& mtime, uint64_t content_hash, const Trajectory& trajectory)
+{
+    static std::atomic<uint64_t> temp_counter(0);
+    Parser parser;
+    std::string payload = parser.EncodeBinary(TrajectoryView(trajectory));
+    std::string buffer(CACHE_MAGIC, 8);
+    AppendUInt32(buffer, CACHE_VERSION);
+    AppendString(buffer, canonical);
+    AppendUInt64(buffer, size);
+    AppendInt64(buffer, mtime.tv_sec);
+    AppendInt64(buffer, mtime.tv_nsec);
+    AppendUInt64(buffer, content_hash);
+    AppendUInt64(buffer, payload.size());
+    buffer.append(payload);
+    char temp_name[64];
+    snprintf(temp_name, sizeof(temp_name), "%s%d.%llu", CACHE_TEMP_PREFIX, (int)getpid(), (unsigned long long)temp_counter.fetch_add(1));
+    std::string temp_path = directory_ + "/" + temp_name;
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Unable to write trajectory cache entry: " + temp_path);
+    }
+    size_t done = 0;
+    while (done < buffer.size())
+    {
+        ssize_t result = write(fd, buffer.data() + done, buffer.size() - done);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            close(fd);
+            unlink(temp_path.c_str());
+            throw std::runtime_error("Unable to write trajectory cache entry: " + temp_path);
+        }
+        done += (size_t)result;
+    }
+    close(fd);
+    // The rename and the running total change together under the directory lock
+    DirectoryLock lock(directory_);
+    struct stat previous;
+    uint64_t replaced = (stat(sidecar.c_str(), &previous) == 0) ? (uint64_t)previous.st_size : 0;
+    // Readers either see the old sidecar or the complete new one, never a partial write
+    if (rename(temp_path.c_str(), sidecar.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("Unable to write trajectory cache entry: " + sidecar);
+    }
+    uint64_t total = 0;
+    if (lock.ReadTotal(total))
+    {
+        lock.WriteTotal((total + buffer.size()) - std::min(total + buffer.size(), replaced));
+    }
+}
+
+void TrajectoryCache::Evict()
+{
+    DirectoryLock lock(directory_);
+    uint64_t recorded = 0;
+    if (lock.ReadTotal(recorded) && recorded <= max_bytes_)
+    {
+        return;
+    }
+    // Over budget (or no total recorded yet): list the directory once, which also resets the total
+    std::vector<CacheEntry> entries = ListEntries(directory_, true);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t total = 0;
+    std::vector<CacheEntry> sidecars;
+    for (size_t idx = 0; idx < entries.size(); idx++)
+    {
+        if (HasSuffix(entries[idx].path_, CACHE_EXTENSION))
+        {
+            total += entries[idx].size_;
+            sidecars.push_back(entries[idx]);
+        }
+        else if ((now.tv_sec - entries[idx].mtime_.tv_sec) > CACHE_STALE_TEMP_SECONDS)
+        {
+            unlink(entries[idx].path_.c_str());
+        }
+    }
+    if (total <= max_bytes_)
+    {
+        lock.WriteTotal(total);
+        return;
+    }
+    // Processes that still have an evicted sidecar mapped keep reading it safely after the unlink
+    std::sort(sidecars.begin(), sidecars.end(), CompareEntryAge);
+    for (size_t idx = 0; idx < sidecars.size() && total > max_bytes_; idx++)
+    {
+        if (unlink(sidecars[idx].path_.c_str()) == 0)
+        {
+            total -= sidecars[idx].size_;
+        }
+    }
+    lock.WriteTotal(total);
+}
+
+uint64_t TrajectoryCache::Size() const
+{
+    std::vector<CacheEntry> entries = ListEntries(directory_, false);
+    uint64_t total = 0;
+    for (size_t idx = 0; idx < entries.size(); idx++)
+    {
+        total += entries[idx].size_;
+    }
+    return total;
+}
+
+void TrajectoryCache::clear()
+{
+    DirectoryLock lock(directory_);
+    std::vector<CacheEntry> entries = ListEntries(directory_, false);
+    for (size_t idx = 0; idx < entries.size(); idx++)
+    {
+        unlink(entries[idx].path_.c_str());
+    }
+    lock.WriteTotal(0);
+}
@@ -0,0 +1,793 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/compression.hpp"
+
+using namespace XTF;
+
+static const char COMPRESSED_MAGIC[] = "XTFGOR01";
+static const uint32_t COMPRESSED_VERSION = 1;
+
+/* Bit streams are written most significant bit first */
+
+class BitWriter
+{
+protected:
+
+    std::string& buffer_;
+    uint64_t pending_;
+    int pending_bits_;
+
+    inline void WriteShort(uint64_t value, int bits)
+    {
+        pending_ = (pending_ << bits) | (value & ((1ull << bits) - 1));
+        pending_bits_ += bits;
+        while (pending_bits_ >= 8)
+        {
+            pending_bits_ -= 8;
+            buffer_.push_back((char)((pending_ >> pending_bits_) & 0xff));
+        }
+    }
+
+public:
+
+    BitWriter(std::string& buffer) : buffer_(buffer), pending_(0), pending_bits_(0) {}
+
+    inline void Write(uint64_t value, int bits)
+    {
+        if (bits > 32)
+        {
+            WriteShort(value >> 32, bits - 32);
+            WriteShort(value, 32);
+        }
+        else if (bits > 0)
+        {
+            WriteShort(value, bits);
+        }
+    }
+
+    inline void Finish()
+    {
+        if (pending_bits_ > 0)
+        {
+            buffer_.push_back((char)((pending_ << (8 - pending_bits_)) & 0xff));
+            pending_bits_ = 0;
+        }
+    }
+
+};
+
+class BitReader
+{
+protected:
+
+    const unsigned char* data_;
+    size_t length_;
+    size_t offset_;
+    uint64_t pending_;
+    int pending_bits_;
+
+    inline uint64_t ReadShort(int bits)
+    {
+        while (pending_bits_ < bits)
+        {
+            if (offset_ >= length_)
+            {
+                throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+            }
+            pending_ = (pending_ << 8) | data_[offset_];
+            offset_++;
+            pending_bits_ += 8;
+        }
+        pending_bits_ -= bits;
+        return (pending_ >> pending_bits_) & ((1ull << bits) - 1);
+    }
+
+public:
+
+    BitReader(const char* data, size_t length) : data_((const unsigned char*)data), length_(length), offset_(0), pending_(0), pending_bits_(0) {}
+
+    inline uint64_t Read(int bits)
+    {
+        if (bits > 32)
+        {
+            uint64_t high = ReadShort(bits - 32);
+            return (high << 32) | ReadShort(32);
+        }
+        else if (bits > 0)
+        {
+            return ReadShort(bits);
+        }
+        return 0;
+    }
+
+    inline bool ReadBit()
+    {
+        return ReadShort(1) == 1;
+    }
+
+    // Bytes consumed so far, counting a partially read byte as consumed
+    inline size_t Consumed() const
+    {
+        return offset_;
+    }
+
+};
+
+static inline int LeadingZeros(uint64_t value)
+{
+    return __builtin_clzll(value);
+}
+
+static inline int TrailingZeros(uint64_t value)
+{
+    return __builtin_ctzll(value);
+}
+
+void XTF::CompressDoubles(std::string& buffer, const double* values, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    BitWriter writer(buffer);
+    uint64_t previous;
+    memcpy(&previous, &values[0], sizeof(previous));
+    writer.Write(previous, 64);
+    // The stored window starts out invalid, so the first change always writes a new one
+    int window_leading = 64;
+    int window_trailing = 64;
+    for (size_t idx = 1; idx < count; idx++)
+    {
+        uint64_t current;
+        memcpy(&current, &values[idx], sizeof(current));
+        uint64_t difference = current ^ previous;
+        previous = current;
+        if (difference == 0)
+        {
+            writer.Write(0, 1);
+            continue;
+        }
+        int leading = std::min(LeadingZeros(difference), 31);
+        int trailing = TrailingZeros(difference);
+        if (leading >= window_leading && trailing >= window_trailing)
+        {
+            writer.Write(2, 2);
+            writer.Write(difference >> window_trailing, 64 - window_leading - window_trailing);
+        }
+        else
+        {
+            int significant = 64 - leading - trailing;
+            writer.Write(3, 2);
+            writer.Write((uint64_t)leading, 5);
+            writer.Write((uint64_t)(significant - 1), 6);
+            writer.Write(difference >> trailing, significant);
+            window_leading = leading;
+            window_trailing = trailing;
+        }
+    }
+    writer.Finish();
+}
+
+size_t XTF::DecompressDoubles(const char* data, size_t length, double* values, size_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    BitReader reader(data, length);
+    uint64_t previous = reader.Read(64);
+    memcpy(&values[0], &previous, sizeof(previous));
+    int window_leading = 0;
+    int window_trailing = 0;
+    for (size_t idx = 1; idx < count; idx++)
+    {
+        if (reader.ReadBit())
+        {
+            if (reader.ReadBit())
+            {
+                window_leading = (int)reader.Read(5);
+                int significant = (int)reader.Read(6) + 1;
+                window_trailing = 64 - window_leading - significant;
+                if (window_trailing < 0)
+                {
+                    throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+                }
+            }
+            previous ^= reader.Read(64 - window_leading - window_trailing) << window_trailing;
+        }
+        memcpy(&values[idx], &previous, sizeof(previous));
+    }
+    return reader.Consumed();
+}
+
+static inline bool FitsSigned(int64_t value, int bits)
+{
+    int64_t limit = (int64_t)1 << (bits - 1);
+    return (value >= -limit && value < limit);
+}
+
+static inline int64_t SignExtend(uint64_t value, int bits)
+{
+    return (int64_t)(value << (64 - bits)) >> (64 - bits);
+}
+
+void XTF::CompressInt64s(std::string& buffer, const int64_t* values, size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    BitWriter writer(buffer);
+    writer.Write((uint64_t)values[0], 64);
+    // Deltas are taken modulo 2^64 so that no input can overflow
+    uint64_t previous_delta = 0;
+    for (size_t idx = 1; idx < count; idx++)
+    {
+        uint64_t delta = (uint64_t)values[idx] - (uint64_t)values[idx - 1];
+        int64_t delta_of_delta = (int64_t)(delta - previous_delta);
+        previous_delta = delta;
+        if (delta_of_delta == 0)
+        {
+            writer.Write(0, 1);
+        }
+        else if (FitsSigned(delta_of_delta, 7))
+        {
+            writer.Write(2, 2);
+            writer.Write((uint64_t)delta_of_delta, 7);
+        }
+        else if (FitsSigned(delta_of_delta, 9))
+        {
+            writer.Write(6, 3);
+            writer.Write((uint64_t)delta_of_delta, 9);
+        }
+        else if (FitsSigned(delta_of_delta, 12))
+        {
+            writer.Write(14, 4);
+            writer.Write((uint64_t)delta_of_delta, 12);
+        }
+        else if (FitsSigned(delta_of_delta, 32))
+        {
+            writer.Write(30, 5);
+            writer.Write((uint64_t)delta_of_delta, 32);
+        }
+        else
+        {
+            writer.Write(31, 5);
+            writer.Write((uint64_t)delta_of_delta, 64);
+        }
+    }
+    writer.Finish();
+}
+
+size_t XTF::DecompressInt64s(const char* data, size_t length, int64_t* values, size_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    static const int BUCKET_BITS[] = {7, 9, 12, 32};
+    BitReader reader(data, length);
+    uint64_t previous = reader.Read(64);
+    values[0] = (int64_t)previous;
+    uint64_t previous_delta = 0;
+    for (size_t idx = 1; idx < count; idx++)
+    {
+        int prefix = 0;
+        while (prefix < 5 && reader.ReadBit())
+        {
+            prefix++;
+        }
+        uint64_t delta_of_delta = 0;
+        if (prefix == 5)
+        {
+            delta_of_delta = reader.Read(64);
+        }
+        else if (prefix > 0)
+        {
+            int bits = BUCKET_BITS[prefix - 1];
+            delta_of_delta = (uint64_t)SignExtend(reader.Read(bits), bits);
+        }
+        previous_delta += delta_of_delta;
+        previous += previous_delta;
+        values[idx] = (int64_t)previous;
+    }
+    return reader.Consumed();
+}
+
+static size_t DataLength(const Trajectory& header)
+{
+    return (header.data_type_ == Trajectory::POSE) ? 7 : header.joint_names_.size();
+}
+
+CompressedTrajectory::CompressedTrajectory(const TrajectoryView& view, size_t block_size)
+{
+    if (block_size == 0)
+    {
+        throw std::invalid_argument("Block size must be at least one state");
+    }
+    header_ = view.Header().CloneHeader();
+    pending_ = header_.CloneHeader();
+    block_size_ = block_size;
+    data_length_ = DataLength(header_);
+    size_ = view.size();
+    for (size_t start = 0; start < view.size(); start += block_size_)
+    {
+        blocks_.push_back(CompressBlock(view, start, std::min(block_size_, view.size() - start)));
+    }
+}
+
+CompressedTrajectory::Block CompressedTrajectory::CompressBlock(const TrajectoryView& view, size_t start, size_t count) const
+{
+    Block block;
+    block.start_ = start;
+    block.count_ = count;
+    std::vector<uint8_t> masks(count, 0);
+    std::vector<int64_t> secs(count);
+    std::vector<int64_t> nsecs(count);
+    std::vector<int64_t> sequences(count);
+    uint8_t present = 0;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        const State& state = view[start + idx];
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            size_t field_size = state.Field((State::FIELDS)field).size();
+            if (field_size > 0 && field_size != data_length_)
+            {
+                throw std::invalid_argument("Inconsistent joint names and joint data");
+            }
+            else if (field_size > 0)
+            {
+                masks[idx] |= (uint8_t)(1 << field);
+            }
+        }
+        present |= masks[idx];
+        secs[idx] = (int64_t)state.timing_.tv_sec;
+        nsecs[idx] = (int64_t)state.timing_.tv_nsec;
+        sequences[idx] = (int64_t)state.sequence_;
+        if (idx == 0 || CompareTimespecs(state.timing_, block.earliest_) < 0)
+        {
+            block.earliest_ = state.timing_;
+        }
+        if (idx == 0 || CompareTimespecs(state.timing_, block.latest_) > 0)
+        {
+            block.latest_ = state.timing_;
+        }
+    }
+    std::string& payload = block.payload_;
+    // Field masks rarely change within a recording, so they are stored as runs
+    std::vector<std::pair<uint32_t, uint8_t> > runs;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        if (runs.size() > 0 && runs.back().second == masks[idx])
+        {
+            runs.back().first++;
+        }
+        else
+        {
+            runs.push_back(std::pair<uint32_t, uint8_t>(1, masks[idx]));
+        }
+    }
+    AppendUInt32(payload, (uint32_t)runs.size());
+    for (size_t run = 0; run < runs.size(); run++)
+    {
+        AppendUInt32(payload, runs[run].first);
+        payload.push_back((char)runs[run].second);
+    }
+    CompressInt64s(payload, secs.data(), count);
+    CompressInt64s(payload, nsecs.data(), count);
+    CompressInt64s(payload, sequences.data(), count);
+    // Each element is compressed as its own column across the states that have the field
+    std::vector<double> column;
+    column.reserve(count);
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        if (((present >> field) & 1) == 0)
+        {
+            continue;
+        }
+        for (size_t element = 0; element < data_length_; element++)
+        {
+            column.clear();
+            for (size_t idx = 0; idx < count; idx++)
+            {
+                if ((masks[idx] >> field) & 1)
+                {
+                    column.push_back(view[start + idx].Field((State::FIELDS)field)[element]);
+                }
+            }
+            CompressDoubles(payload, column.data(), column.size());
+        }
+    }
+    uint32_t with_extras = 0;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        with_extras += (view[start + idx].extras_.size() > 0) ? 1 : 0;
+    }
+    AppendUInt32(payload, with_extras);
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        const std::map<std::string, KeyValue>& extras = view[start + idx].extras_;
+        if (extras.size() == 0)
+        {
+            continue;
+        }
+        AppendUInt32(payload, (uint32_t)idx);
+        AppendUInt32(payload, (uint32_t)extras.size());
+        std::map<std::string, KeyValue>::const_iterator itr;
+        for (itr = extras.begin(); itr != extras.end(); ++itr)
+        {
+            AppendString(payload, itr->first);
+            AppendKeyValue(payload, itr->second);
+        }
+    }
+    return block;
+}
+
+void CompressedTrajectory::DecodeBlock(const Block& block, std::vector<State>& states) const
+{
+    const char* data = block.payload_.data();
+    size_t length = block.payload_.size();
+    size_t count = block.count_;
+    // Every state costs at least a bit in each of the timing and sequence columns
+    if (count > (length * 8))
+    {
+        throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+    }
+    ByteReader header_reader(data, length);
+    std::vector<uint8_t> masks;
+    masks.reserve(count);
+    uint32_t num_runs = header_reader.ReadUInt32();
+    uint8_t present = 0;
+    for (uint32_t run = 0; run < num_runs; run++)
+    {
+        uint32_t run_length = header_reader.ReadUInt32();
+        uint8_t mask = (uint8_t)header_reader.ReadBytes(1)[0];
+        if (run_length > (count - masks.size()))
+        {
+            throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+        }
+        masks.insert(masks.end(), run_length, mask);
+        present |= mask;
+    }
+    if (masks.size() != count)
+    {
+        throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+    }
+    size_t offset = header_reader.Offset();
+    std::vector<int64_t> secs(count);
+    std::vector<int64_t> nsecs(count);
+    std::vector<int64_t> sequences(count);
+    offset += DecompressInt64s(data + offset, length - offset, secs.data(), count);
+    offset += DecompressInt64s(data + offset, length - offset, nsecs.data(), count);
+    offset += DecompressInt64s(data + offset, length - offset, sequences.data(), count);
+    size_t first = states.size();
+    states.resize(first + count);
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        State& state = states[first + idx];
+        state.sequence_ = (int)sequences[idx];
+        state.timing_.tv_sec = (time_t)secs[idx];
+        state.timing_.tv_nsec = (long)nsecs[idx];
+        state.data_length_ = data_length_;
+    }
+    std::vector<double> column(count);
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        if (((present >> field) & 1) == 0)
+        {
+            continue;
+        }
+        size_t with_field = 0;
+        for (size_t idx = 0; idx < count; idx++)
+        {
+            if ((masks[idx] >> field) & 1)
+            {
+                states[first + idx].Field((State::FIELDS)field).resize(data_length_);
+                with_field++;
+            }
+        }
+        for (size_t element = 0; element < data_length_; element++)
+        {
+            offset += DecompressDoubles(data + offset, length - offset, column.data(), with_field);
+            size_t next = 0;
+            for (size_t idx = 0; idx < count; idx++)
+            {
+                if ((masks[idx] >> field) & 1)
+                {
+                    states[first + idx].Field((State::FIELDS)field)[element] = column[next];
+                    next++;
+                }
+            }
+        }
+    }
+    ByteReader extras_reader(data + offset, length - offset);
+    uint32_t with_extras = extras_reader.ReadUInt32();
+    for (uint32_t entry = 0; entry < with_extras; entry++)
+    {
+        uint32_t idx = extras_reader.ReadUInt32();
+        if (idx >= count)
+        {
+            throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+        }
+        uint32_t num_extras = extras_reader.ReadUInt32();
+        for (uint32_t extra = 0; extra < num_extras; extra++)
+        {
+            std::string name = extras_reader.ReadString();
+            states[first + idx].extras_.insert(std::pair<std::string, KeyValue>(name, ReadKeyValue(extras_reader)));
+        }
+    }
+}
+
+CompressedTrajectory CompressedTrajectory::Deserialize(const char* buffer, size_t length)
+{
+    ByteReader reader(buffer, length);
+    if (memcmp(reader.ReadBytes(8), COMPRESSED_MAGIC, 8) != 0)
+    {
+        throw std::invalid_argument("Buffer is not a compressed XTF trajectory");
+    }
+    if (reader.ReadUInt32() != COMPRESSED_VERSION)
+    {
+        throw std::invalid_argument("Unsupported compressed XTF version");
+    }
+    CompressedTrajectory compressed;
+    Parser parser;
+    uint32_t header_size = reader.ReadUInt32();
+    const char* encoded_header = reader.ReadBytes(header_size);
+    compressed.header_ = parser.DecodeBinary(encoded_header, header_size);
+    compressed.pending_ = compressed.header_.CloneHeader();
+    compressed.data_length_ = DataLength(compressed.header_);
+    compressed.block_size_ = (size_t)reader.ReadUInt64();
+    uint64_t num_blocks = reader.ReadUInt64();
+    if (compressed.block_size_ == 0 || num_blocks > length)
+    {
+        throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+    }
+    compressed.blocks_.resize((size_t)num_blocks);
+    for (size_t idx = 0; idx < compressed.blocks_.size(); idx++)
+    {
+        Block& block = compressed.blocks_[idx];
+        block.start_ = (size_t)reader.ReadUInt64();
+        block.count_ = (size_t)reader.ReadUInt64();
+        block.earliest_.tv_sec = (time_t)reader.ReadInt64();
+        block.earliest_.tv_nsec = (long)reader.ReadInt64();
+        block.latest_.tv_sec = (time_t)reader.ReadInt64();
+        block.latest_.tv_nsec = (long)reader.ReadInt64();
+        size_t payload_size = (size_t)reader.ReadUInt64();
+        block.payload_.assign(reader.ReadBytes(payload_size), payload_size);
+        if (block.start_ != compressed.size_ || block.count_ == 0 || block.count_ > (payload_size * 8))
+        {
+            throw std::invalid_argument("Compressed data is truncated or otherwise corrupted");
+        }
+        compressed.size_ += block.count_;
+    }
+    return compressed;
+}
+
+const Trajectory& CompressedTrajectory::Header() const
+{
+    return header_;
+}
+
+size_t CompressedTrajectory::size() const
+{
+    return size_;
+}
+
+size_t CompressedTrajectory::NumBlocks() const
+{
+    return blocks_.size();
+}
+
+void CompressedTrajectory::push_back(const State& state)
+{
+    pending_.push_back(state);
+    size_++;
+    if (pending_.size() >= block_size_)
+    {
+        Flush();
+    }
+}
+
+void CompressedTrajectory::Flush()
+{
+    if (pending_.size() == 0)
+    {
+        return;
+    }
+    blocks_.push_back(CompressBlock(TrajectoryView(pending_), 0, pending_.size()));
+    blocks_.back().start_ = size_ - pending_.size();
+    pending_.trajectory_.clear();
+}
+
+size_t CompressedTrajectory::FindBlock(size_t idx) const
+{
+    size_t low = 0;
+    size_t high = blocks_.size();
+    while ((high - low) > 1)
+    {
+        size_t middle = low + ((high - low) / 2);
+        if (blocks_[middle].start_ <= idx)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+State CompressedTrajectory::at(size_t idx) const
+{
+    if (idx >= size_)
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    size_t compressed_states = size_ - pending_.size();
+    if (idx >= compressed_states)
+    {
+        return pending_.trajectory_[idx - compressed_states];
+    }
+    const Block& block = blocks_[FindBlock(idx)];
+    std::vector<State> states;
+    DecodeBlock(block, states);
+    return states[idx - block.start_];
+}
+
+std::vector<State> CompressedTrajectory::ReadBlock(size_t block) const
+{
+    if (block >= blocks_.size())
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << block << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    std::vector<State> states;
+    DecodeBlock(blocks_[block], states);
+    return states;
+}
+
+Trajectory CompressedTrajectory::ReadRange(size_t start, size_t count) const
+{
+    if (start > size_ || count > (size_ - start))
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << (start + count) << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    Trajectory range = header_.CloneHeader();
+    range.reserve(count);
+    size_t end = start + count;
+    size_t compressed_states = size_ - pending_.size();
+    for (size_t block = (count > 0 && start < compressed_states) ? FindBlock(start) : blocks_.size(); block < blocks_.size() && blocks_[block].start_ < end; block++)
+    {
+        std::vector<State> states;
+        DecodeBlock(blocks_[block], states);
+        size_t first = std::max(start, blocks_[block].start_) - blocks_[block].start_;
+        size_t last = std::min(end, blocks_[block].start_ + blocks_[block].count_) - blocks_[block].start_;
+        for (size_t idx = first; idx < last; idx++)
+        {
+            range.push_back(std::move(states[idx]));
+        }
+    }
+    for (size_t idx = std::max(start, compressed_states); idx < end; idx++)
+    {
+        range.push_back(pending_.trajectory_[idx - compressed_states]);
+    }
+    return range;
+}
+
+Trajectory CompressedTrajectory::ReadTimeRange(const timespec& start, const timespec& end) const
+{
+    Trajectory range = header_.CloneHeader();
+    for (size_t block = 0; block < blocks_.size(); block++)
+    {
+        // Blocks are skipped on their time bounds without being decoded
+        if (CompareTimespecs(blocks_[block].latest_, start) < 0 || CompareTimespecs(blocks_[block].earliest_, end) >= 0)
+        {
+            continue;
+        }
+        std::vector<State> states;
+        DecodeBlock(blocks_[block], states);
+        for (size_t idx = 0; idx < states.size(); idx++)
+        {
+            if (CompareTimespecs(states[idx].timing_, start) >= 0 && CompareTimespecs(states[idx].timing_, end) < 0)
+            {
+                range.push_back(std::move(states[idx]));
+            }
+        }
+    }
+    for (size_t idx = 0; idx < pending_.size(); idx++)
+    {
+        const State& state = pending_.trajectory_[idx];
+        if (CompareTimespecs(state.timing_, start) >= 0 && CompareTimespecs(state.timing_, end) < 0)
+        {
+            range.push_back(state);
+        }
+    }
+    return range;
+}
+
+Trajectory CompressedTrajectory::Materialize(size_t threads) const
+{
+    std::vector<std::vector<State> > decoded(blocks_.size());
+    ParallelFor(blocks_.size(), threads, [&](size_t block)
+    {
+        DecodeBlock(blocks_[block], decoded[block]);
+    });
+    Trajectory materialized = header_.CloneHeader();
+    materialized.reserve(size_);
+    for (size_t block = 0; block < decoded.size(); block++)
+    {
+        for (size_t idx = 0; idx < decoded[block].size(); idx++)
+        {
+            materialized.push_back(std::move(decoded[block][idx]));
+        }
+    }
+    for (size_t idx = 0; idx < pending_.size(); idx++)
+    {
+        materialized.push_back(pending_.trajectory_[idx]);
+    }
+    return materialized;
+}
+
+std::string CompressedTrajectory::Serialize() const
+{
+    std::string buffer(COMPRESSED_MAGIC, 8);
+    AppendUInt32(buffer, COMPRESSED_VERSION);
+    Parser parser;
+    AppendString(buffer, parser.EncodeBinary(TrajectoryView(header_)));
+    AppendUInt64(buffer, (uint64_t)block_size_);
+    std::vector<const Block*> blocks;
+    for (size_t idx = 0; idx < blocks_.size(); idx++)
+    {
+        blocks.push_back(&blocks_[idx]);
+    }
+    // The uncompressed tail is written as a final short block
+    Block tail;
+    if (pending_.size() > 0)
+    {
+        tail = CompressBlock(TrajectoryView(pending_), 0, pending_.size());
+        tail.start_ = size_ - pending_.size();
+        blocks.push_back(&tail);
+    }
+    AppendUInt64(buffer, (uint64_t)blocks.size());
+    for (size_t idx = 0; idx < blocks.size(); idx++)
+    {
+        const Block& block = *blocks[idx];
+        AppendUInt64(buffer, (uint64_t)block.start_);
+        AppendUInt64(buffer, (uint64_t)block.count_);
+        AppendInt64(buffer, (int64_t)block.earliest_.tv_sec);
+        AppendInt64(buffer, (int64_t)block.earliest_.tv_nsec);
+        AppendInt64(buffer, (int64_t)block.latest_.tv_sec);
+        AppendInt64(buffer, (int64_t)block.latest_.tv_nsec);
+        AppendUInt64(buffer, (uint64_t)block.payload_.size());
+        buffer.append(block.payload_);
+    }
+    return buffer;
+}
+
+size_t CompressedTrajectory::CompressedBytes() const
+{
+    size_t bytes = 0;
+    for (size_t idx = 0; idx < blocks_.size(); idx++)
+    {
+        bytes += blocks_[idx].payload_.size();
+    }
+    return bytes;
+}
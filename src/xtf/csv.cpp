@@ -0,0 +1,487 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+
+using namespace XTF;
+
+/* CSV layout: one row per state, with the columns
+ *
+ * sequence, secs, nsecs, <field>.<joint>..., extra.<name>:<type>...
+ *
+ * where <field> is one of the State field names (e.g. position_desired) and <joint> is a joint name,
+ * or one of x,y,z,qx,qy,qz,qw for pose trajectories. A single "time" column in seconds may be
+ * used instead of secs/nsecs on import. Rows must not contain embedded newlines, which lets
+ * the file be split into chunks at line boundaries and parsed in parallel.
+ */
+
+static const size_t CSV_MIN_CHUNK_BYTES = 256 * 1024;
+static const size_t CSV_MIN_CHUNK_STATES = 1024;
+
+static std::vector<std::string> ElementLabels(const Trajectory& header)
+{
+    if (header.data_type_ == Trajectory::POSE)
+    {
+        const char* labels[7] = {"x", "y", "z", "qx", "qy", "qz", "qw"};
+        return std::vector<std::string>(labels, labels + 7);
+    }
+    return header.joint_names_;
+}
+
+static void SplitCells(const char* start, const char* end, char delimiter, std::vector<std::pair<const char*, size_t> >& cells, std::string& unquoted)
+{
+    // Unquoted cells point straight into the input, quoted cells are unescaped into unquoted
+    cells.clear();
+    unquoted.clear();
+    unquoted.reserve(end - start);
+    const char* cursor = start;
+    while (true)
+    {
+        if (cursor < end && *cursor == '"')
+        {
+            size_t begin = unquoted.size();
+            cursor++;
+            while (cursor < end)
+            {
+                if (*cursor == '"')
+                {
+                    if ((cursor + 1) < end && cursor[1] == '"')
+                    {
+                        unquoted.push_back('"');
+                        cursor += 2;
+                        continue;
+                    }
+                    cursor++;
+                    break;
+                }
+                unquoted.push_back(*cursor);
+                cursor++;
+            }
+            cells.push_back(std::pair<const char*, size_t>(unquoted.data() + begin, unquoted.size() - begin));
+            while (cursor < end && *cursor != delimiter)
+            {
+                cursor++;
+            }
+        }
+        else
+        {
+            const char* cell_end = (const char*)memchr(cursor, delimiter, end - cursor);
+            if (cell_end == NULL)
+            {
+                cell_end = end;
+            }
+            cells.push_back(std::pair<const char*, size_t>(cursor, cell_end - cursor));
+            cursor = cell_end;
+        }
+        if (cursor >= end)
+        {
+            break;
+        }
+        cursor++;
+    }
+}
+
+static double ParseCSVDouble(const std::pair<const char*, size_t>& cell)
+{
+    // Cells are never NUL-terminated, so copy anything too long for the stack buffer
+    char buffer[64];
+    if (cell.second < sizeof(buffer))
+    {
+        memcpy(buffer, cell.first, cell.second);
+        buffer[cell.second] = '\0';
+        return strtod(buffer, NULL);
+    }
+    return strtod(std::string(cell.first, cell.second).c_str(), NULL);
+}
+
+static void AppendCSVCell(std::string& output, const std::string& value, char delimiter)
+{
+    if (value.find(delimiter) == std::string::npos && value.find('"') == std::string::npos)
+    {
+        output.append(value);
+        return;
+    }
+    output.push_back('"');
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (value[i] == '"')
+        {
+            output.push_back('"');
+        }
+        output.push_back(value[i]);
+    }
+    output.push_back('"');
+}
+
+std::vector<State> Parser::ReadCSVRows(const char* start, const char* end, const std::vector<CSVColumn>& columns, size_t data_length, char delimiter)
+{
+    std::vector<State> states;
+    std::vector<std::pair<const char*, size_t> > cells;
+    std::string unquoted;
+    const char* line = start;
+    while (line < end)
+    {
+        const char* line_end = (const char*)memchr(line, '\n', end - line);
+        if (line_end == NULL)
+        {
+            line_end = end;
+        }
+        const char* content_end = line_end;
+        if (content_end > line && content_end[-1] == '\r')
+        {
+            content_end--;
+        }
+        if (content_end > line)
+        {
+            SplitCells(line, content_end, delimiter, cells, unquoted);
+            if (cells.size() != columns.size())
+            {
+                throw std::invalid_argument("CSV file is malformed or otherwise corrupted - a row has the wrong number of columns");
+            }
+            std::vector<double> fields[State::NUM_FIELDS];
+            size_t filled[State::NUM_FIELDS] = {0, 0, 0, 0, 0, 0};
+            int sequence = 0;
+            timespec timing;
+            timing.tv_sec = 0;
+            timing.tv_nsec = 0;
+            std::map<std::string, KeyValue> extras;
+            for (size_t column = 0; column < columns.size(); column++)
+            {
+                const CSVColumn& info = columns[column];
+                const std::pair<const char*, size_t>& cell = cells[column];
+                if (cell.second == 0 || info.kind_ == CSVColumn::IGNORED)
+                {
+                    continue;
+                }
+                if (info.kind_ == CSVColumn::FIELD)
+                {
+                    std::vector<double>& values = fields[info.field_];
+                    if (values.size() == 0)
+                    {
+                        values.resize(data_length);
+                    }
+                    values[info.element_] = ParseCSVDouble(cell);
+                    filled[info.field_]++;
+                }
+                else if (info.kind_ == CSVColumn::SEQUENCE)
+                {
+                    sequence = (int)ParseCSVDouble(cell);
+                }
+                else if (info.kind_ == CSVColumn::SECS)
+                {
+                    timing.tv_sec = (time_t)ParseCSVDouble(cell);
+                }
+                else if (info.kind_ == CSVColumn::NSECS)
+                {
+                    timing.tv_nsec = (long)ParseCSVDouble(cell);
+                }
+                else if (info.kind_ == CSVColumn::TIME)
+                {
+                    double seconds = ParseCSVDouble(cell);
+                    double whole = floor(seconds);
+                    long nsecs = (long)floor(((seconds - whole) * 1000000000.0) + 0.5);
+                    if (nsecs >= 1000000000)
+                    {
+                        whole += 1.0;
+                        nsecs -= 1000000000;
+                    }
+                    timing.tv_sec = (time_t)whole;
+                    timing.tv_nsec = nsecs;
+                }
+                else if (info.kind_ == CSVColumn::EXTRA)
+                {
+                    extras.insert(std::pair<std::string, KeyValue>(info.name_, ReadKeyValue(info.type_, std::string(cell.first, cell.second))));
+                }
+            }
+            for (size_t field = 0; field < State::NUM_FIELDS; field++)
+            {
+                if (filled[field] != 0 && filled[field] != data_length)
+                {
+                    throw std::invalid_argument("CSV file is malformed or otherwise corrupted - a row has a partially filled state field");
+                }
+            }
+            State new_state(std::move(fields[0]), std::move(fields[1]), std::move(fields[2]), std::move(fields[3]), std::move(fields[4]), std::move(fields[5]), sequence, timing);
+            new_state.extras_.swap(extras);
+            states.push_back(std::move(new_state));
+        }
+        line = line_end + 1;
+    }
+    return states;
+}
+
+Trajectory Parser::ImportCSV(std::string filename, const Trajectory& header, const CSVOptions& options)
+{
+    FILE* input = fopen(filename.c_str(), "rb");
+    if (input == NULL)
+    {
+        std::string error_str("Unable to read CSV file (file may not exist): " + filename);
+        throw std::invalid_argument(error_str.c_str());
+    }
+    std::string contents;
+    char buffer[1 << 16];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+        contents.append(buffer, read);
+    }
+    fclose(input);
+    // Map the header row onto state fields
+    size_t header_end = contents.find('\n');
+    if (header_end == std::string::npos)
+    {
+        header_end = contents.size();
+    }
+    std::string header_row = contents.substr(0, header_end);
+    if (header_row.size() > 0 && header_row[header_row.size() - 1] == '\r')
+    {
+        header_row.erase(header_row.size() - 1);
+    }
+    std::vector<std::pair<const char*, size_t> > cells;
+    std::string unquoted;
+    SplitCells(header_row.data(), header_row.data() + header_row.size(), options.delimiter_, cells, unquoted);
+    Trajectory imported = header.CloneHeader();
+    std::vector<std::string> labels = ElementLabels(imported);
+    bool derive_joint_names = (imported.data_type_ == Trajectory::JOINT && labels.size() == 0);
+    std::vector<CSVColumn> columns(cells.size());
+    for (size_t column = 0; column < cells.size(); column++)
+    {
+        std::string name(cells[column].first, cells[column].second);
+        CSVColumn& info = columns[column];
+        if (name.find_first_not_of(' ') == std::string::npos)
+        {
+            continue;
+        }
+        name = CleanString(name);
+        if (name.compare("sequence") == 0)
+        {
+            info.kind_ = CSVColumn::SEQUENCE;
+        }
+        else if (name.compare("secs") == 0)
+        {
+            info.kind_ = CSVColumn::SECS;
+        }
+        else if (name.compare("nsecs") == 0)
+        {
+            info.kind_ = CSVColumn::NSECS;
+        }
+        else if (name.compare("time") == 0)
+        {
+            info.kind_ = CSVColumn::TIME;
+        }
+        else if (name.compare(0, 6, "extra.") == 0)
+        {
+            size_t type_start = name.rfind(':');
+            if (type_start == std::string::npos || type_start < 6)
+            {
+                throw std::invalid_argument("CSV extra column is missing its type: " + name);
+            }
+            info.kind_ = CSVColumn::EXTRA;
+            info.name_ = name.substr(6, type_start - 6);
+            info.type_ = name.substr(type_start + 1);
+        }
+        else
+        {
+            for (size_t field = 0; field < State::NUM_FIELDS; field++)
+            {
+                std::string prefix = std::string(State::FieldName((State::FIELDS)field)) + ".";
+                if (name.compare(0, prefix.size(), prefix) == 0)
+                {
+                    std::string label = name.substr(prefix.size());
+                    std::vector<std::string>::iterator found = std::find(labels.begin(), labels.end(), label);
+                    if (found == labels.end())
+                    {
+                        if (!derive_joint_names)
+                        {
+                            throw std::invalid_argument("CSV column does not match any joint in the trajectory: " + name);
+                        }
+                        labels.push_back(label);
+                        found = labels.end() - 1;
+                    }
+                    info.kind_ = CSVColumn::FIELD;
+                    info.field_ = (State::FIELDS)field;
+                    info.element_ = found - labels.begin();
+                    break;
+                }
+            }
+        }
+    }
+    if (derive_joint_names)
+    {
+        imported.joint_names_ = labels;
+    }
+    // Parse the body in chunks split at line boundaries
+    const char* body = contents.data() + std::min(header_end + 1, contents.size());
+    const char* body_end = contents.data() + contents.size();
+    size_t threads = ResolveThreads(options.threads_);
+    size_t num_chunks = std::max((size_t)1, std::min(threads * 4, (size_t)(body_end - body) / CSV_MIN_CHUNK_BYTES));
+    std::vector<const char*> boundaries(1, body);
+    for (size_t chunk = 1; chunk < num_chunks; chunk++)
+    {
+        const char* target = body + (((body_end - body) * chunk) / num_chunks);
+        target = std::max(target, boundaries.back());
+        const char* newline = (const char*)memchr(target, '\n', body_end - target);
+        boundaries.push_back((newline == NULL) ? body_end : (newline + 1));
+    }
+    boundaries.push_back(body_end);
+    std::vector< std::vector<State> > chunks(num_chunks);
+    size_t data_length = labels.size();
+    char delimiter = options.delimiter_;
+    ParallelFor(num_chunks, threads, [&](size_t chunk)
+    {
+        chunks[chunk] = ReadCSVRows(boundaries[chunk], boundaries[chunk + 1], columns, data_length, delimiter);
+    });
+    size_t total = 0;
+    for (size_t chunk = 0; chunk < num_chunks; chunk++)
+    {
+        total += chunks[chunk].size();
+    }
+    imported.trajectory_.reserve(total);
+    for (size_t chunk = 0; chunk < num_chunks; chunk++)
+    {
+        for (size_t idx = 0; idx < chunks[chunk].size(); idx++)
+        {
+            imported.push_back(std::move(chunks[chunk][idx]));
+        }
+    }
+    return imported;
+}
+
+void Parser::WriteCSVRows(std::string& output, const TrajectoryView& view, size_t start, size_t end, const std::vector<CSVColumn>& columns, char delimiter)
+{
+    char number[64];
+    for (size_t idx = start; idx < end; idx++)
+    {
+        const State& state = view[idx];
+        for (size_t column = 0; column < columns.size(); column++)
+        {
+            const CSVColumn& info = columns[column];
+            if (column > 0)
+            {
+                output.push_back(delimiter);
+            }
+            if (info.kind_ == CSVColumn::SEQUENCE)
+            {
+                output.append(number, snprintf(number, sizeof(number), "%d", state.sequence_));
+            }
+            else if (info.kind_ == CSVColumn::SECS)
+            {
+                output.append(number, snprintf(number, sizeof(number), "%lld", (long long)state.timing_.tv_sec));
+            }
+            else if (info.kind_ == CSVColumn::NSECS)
+            {
+                output.append(number, snprintf(number, sizeof(number), "%ld", (long)state.timing_.tv_nsec));
+            }
+            else if (info.kind_ == CSVColumn::FIELD)
+            {
+                const std::vector<double>& values = state.Field(info.field_);
+                if (info.element_ < values.size())
+                {
+                    // 17 significant digits round-trip every double exactly
+                    output.append(number, snprintf(number, sizeof(number), "%.17g", values[info.element_]));
+                }
+            }
+            else if (info.kind_ == CSVColumn::EXTRA)
+            {
+                std::map<std::string, KeyValue>::const_iterator extra = state.extras_.find(info.name_);
+                if (extra != state.extras_.end())
+                {
+                    AppendCSVCell(output, extra->second.GetValueString(), delimiter);
+                }
+            }
+        }
+        output.push_back('\n');
+    }
+}
+
+bool Parser::ExportCSV(const TrajectoryView& view, std::string filename, const CSVOptions& options)
+{
+    const Trajectory& header = view.Header();
+    std::vector<std::string> labels = ElementLabels(header);
+    // Only emit the fields and extras that actually appear somewhere in the trajectory
+    bool present[State::NUM_FIELDS] = {false, false, false, false, false, false};
+    std::map<std::string, std::string> extra_types;
+    for (size_t idx = 0; idx < view.size(); idx++)
+    {
+        const State& state = view[idx];
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            present[field] = present[field] || (state.Field((State::FIELDS)field).size() > 0);
+        }
+        std::map<std::string, KeyValue>::const_iterator itr;
+        for (itr = state.extras_.begin(); itr != state.extras_.end(); ++itr)
+        {
+            extra_types.insert(std::pair<std::string, std::string>(itr->first, itr->second.GetTypeString()));
+        }
+    }
+    std::vector<CSVColumn> columns(3);
+    columns[0].kind_ = CSVColumn::SEQUENCE;
+    columns[1].kind_ = CSVColumn::SECS;
+    columns[2].kind_ = CSVColumn::NSECS;
+    std::string output("sequence");
+    output.push_back(options.delimiter_);
+    output.append("secs");
+    output.push_back(options.delimiter_);
+    output.append("nsecs");
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        if (!present[field])
+        {
+            continue;
+        }
+        for (size_t element = 0; element < labels.size(); element++)
+        {
+            CSVColumn info;
+            info.kind_ = CSVColumn::FIELD;
+            info.field_ = (State::FIELDS)field;
+            info.element_ = element;
+            columns.push_back(info);
+            output.push_back(options.delimiter_);
+            AppendCSVCell(output, std::string(State::FieldName((State::FIELDS)field)) + "." + labels[element], options.delimiter_);
+        }
+    }
+    std::map<std::string, std::string>::iterator extra;
+    for (extra = extra_types.begin(); extra != extra_types.end(); ++extra)
+    {
+        CSVColumn info;
+        info.kind_ = CSVColumn::EXTRA;
+        info.name_ = extra->first;
+        info.type_ = extra->second;
+        columns.push_back(info);
+        output.push_back(options.delimiter_);
+        AppendCSVCell(output, "extra." + extra->first + ":" + extra->second, options.delimiter_);
+    }
+    output.push_back('\n');
+    // Format chunks of rows in parallel, then write them out in order
+    size_t threads = ResolveThreads(options.threads_);
+    size_t num_chunks = std::max((size_t)1, std::min(threads * 4, view.size() / CSV_MIN_CHUNK_STATES));
+    std::vector<std::string> chunks(num_chunks);
+    char delimiter = options.delimiter_;
+    ParallelFor(num_chunks, threads, [&](size_t chunk)
+    {
+        size_t start = (view.size() * chunk) / num_chunks;
+        size_t end = (view.size() * (chunk + 1)) / num_chunks;
+        WriteCSVRows(chunks[chunk], view, start, end, columns, delimiter);
+    });
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+    {
+        throw std::runtime_error("Unable to write CSV file: " + filename);
+    }
+    bool written = (fwrite(output.data(), 1, output.size(), file) == output.size());
+    for (size_t chunk = 0; chunk < num_chunks && written; chunk++)
+    {
+        written = (fwrite(chunks[chunk].data(), 1, chunks[chunk].size(), file) == chunks[chunk].size());
+    }
+    if (fclose(file) != 0 || !written)
+    {
+        throw std::runtime_error("Unable to write CSV file: " + filename);
+    }
+    return true;
+}
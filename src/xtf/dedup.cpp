@@ -0,0 +1,495 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "xtf/xtf.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/stream.hpp"
+#include "xtf/diff.hpp"
+#include "xtf/dedup.hpp"
+
+using namespace XTF;
+
+static const char DEDUP_MAGIC[] = "XTFDDP01";
+static const uint32_t DEDUP_VERSION = 1;
+// The sketch holds the first present field of this many evenly spaced states
+static const size_t DEDUP_SKETCH_STATES = 8;
+
+static inline double Canonical(double value)
+{
+    if (value == 0.0)
+    {
+        return 0.0;
+    }
+    else if (value != value)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    return value;
+}
+
+static void EncodeHeader(const Trajectory& header, std::string& buffer)
+{
+    AppendUInt32(buffer, (uint32_t)header.data_type_);
+    AppendUInt32(buffer, (uint32_t)header.timing_);
+    AppendUInt32(buffer, (uint32_t)header.traj_type_);
+    AppendString(buffer, header.robot_);
+    if (header.data_type_ == Trajectory::JOINT)
+    {
+        AppendStrings(buffer, header.joint_names_);
+    }
+    else
+    {
+        AppendString(buffer, header.root_frame_);
+        AppendString(buffer, header.target_frame_);
+    }
+}
+
+static uint64_t FinishDigest(StreamingHash hash, size_t length)
+{
+    std::string trailer;
+    AppendUInt64(trailer, length);
+    hash.Update(trailer);
+    return hash.Digest();
+}
+
+ContentHasher::ContentHasher(const Trajectory& header) : length_(0)
+{
+    std::string encoded;
+    EncodeHeader(header, encoded);
+    content_.Update(encoded);
+    shape_.Update(encoded);
+}
+
+void ContentHasher::push_back(const State& state)
+{
+    scratch_.clear();
+    AppendInt64(scratch_, state.sequence_);
+    AppendInt64(scratch_, state.timing_.tv_sec);
+    AppendInt64(scratch_, state.timing_.tv_nsec);
+    unsigned char sizes[4 * State::NUM_FIELDS];
+    for (int field = 0; field < State::NUM_FIELDS; field++)
+    {
+        const std::vector<double>& values = state.Field((State::FIELDS)field);
+        uint32_t count = (uint32_t)values.size();
+        for (size_t i = 0; i < 4; i++)
+        {
+            sizes[(4 * field) + i] = (unsigned char)((count >> (8 * i)) & 0xff);
+        }
+        AppendUInt32(scratch_, count);
+        for (size_t idx = 0; idx < values.size(); idx++)
+        {
+            AppendDouble(scratch_, Canonical(values[idx]));
+        }
+    }
+    AppendUInt32(scratch_, (uint32_t)state.extras_.size());
+    for (std::map<std::string, KeyValue>::const_iterator itr = state.extras_.begin(); itr != state.extras_.end(); ++itr)
+    {
+        AppendString(scratch_, itr->first);
+        AppendString(scratch_, itr->second.GetTypeString());
+        AppendString(scratch_, itr->second.GetValueString());
+    }
+    content_.Update(scratch_);
+    shape_.Update(sizes, sizeof(sizes));
+    length_++;
+}
+
+size_t ContentHasher::size() const
+{
+    return length_;
+}
+
+uint64_t ContentHasher::Digest() const
+{
+    return FinishDigest(content_, length_);
+}
+
+uint64_t ContentHasher::ShapeDigest() const
+{
+    return FinishDigest(shape_, length_);
+}
+
+uint64_t XTF::ContentHash(const TrajectoryView& view)
+{
+    ContentHasher hasher(view.Header());
+    for (size_t idx = 0; idx < view.size(); idx++)
+    {
+        hasher.push_back(view[idx]);
+    }
+    return hasher.Digest();
+}
+
+uint64_t XTF::ContentHashFile(std::string filename)
+{
+    StateReader reader(filename);
+    ContentHasher hasher(reader.Header());
+    while (reader.HasNext())
+    {
+        hasher.push_back(reader.Next());
+    }
+    return hasher.Digest();
+}
+
+static bool SameHeader(const Trajectory& first, const Trajectory& second)
+{
+    if (first.data_type_ != second.data_type_ || first.timing_ != second.timing_ || first.traj_type_ != second.traj_type_ || first.robot_ != second.robot_)
+    {
+        return false;
+    }
+    else if (first.data_type_ == Trajectory::JOINT)
+    {
+        return first.joint_names_ == second.joint_names_;
+    }
+    return first.root_frame_ == second.root_frame_ && first.target_frame_ == second.target_frame_;
+}
+
+static inline bool Within(double first, double second, double tolerance)
+{
+    if (first != first || second != second)
+    {
+        return first != first && second != second;
+    }
+    // Equal infinities differ by NaN, so they are matched here
+    return first == second || fabs(first - second) <= tolerance;
+}
+
+bool XTF::NearDuplicates(const TrajectoryView& first, const TrajectoryView& second, double tolerance)
+{
+    if (first.size() != second.size() || !SameHeader(first.Header(), second.Header()))
+    {
+        return false;
+    }
+    for (size_t idx = 0; idx < first.size(); idx++)
+    {
+        const State& first_state = first[idx];
+        const State& second_state = second[idx];
+        double timing_difference = (double)(first_state.timing_.tv_sec - second_state.timing_.tv_sec) + ((double)(first_state.timing_.tv_nsec - second_state.timing_.tv_nsec) * 0.000000001);
+        if (fabs(timing_difference) > tolerance)
+        {
+            return false;
+        }
+        for (int field = 0; field < State::NUM_FIELDS; field++)
+        {
+            const std::vector<double>& first_values = first_state.Field((State::FIELDS)field);
+            const std::vector<double>& second_values = second_state.Field((State::FIELDS)field);
+            if (first_values.size() != second_values.size())
+            {
+                return false;
+            }
+            for (size_t value = 0; value < first_values.size(); value++)
+            {
+                if (!Within(first_values[value], second_values[value], tolerance))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+DedupStore::DedupStore(std::string directory, double tolerance)
+{
+    if (tolerance < 0.0)
+    {
+        throw std::invalid_argument("Dedup tolerance must not be negative");
+    }
+    directory_ = directory;
+    index_path_ = directory + "/.xtf_dedup.idx";
+    tolerance_ = tolerance;
+    if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("Unable to create dedup store directory: " + directory_);
+    }
+    LoadIndex();
+}
+
+void DedupStore::CreateIndex()
+{
+    // Write-then-rename, so the index either has its whole header or does not exist
+    std::string buffer(DEDUP_MAGIC, 8);
+    AppendUInt32(buffer, DEDUP_VERSION);
+    std::string temp_path = index_path_ + ".tmp";
+    FILE* output = fopen(temp_path.c_str(), "wb");
+    if (output == NULL)
+    {
+        throw std::runtime_error("Unable to write dedup store index: " + index_path_);
+    }
+    size_t written = fwrite(buffer.data(), 1, buffer.size(), output);
+    if (fclose(output) != 0 || written != buffer.size() || rename(temp_path.c_str(), index_path_.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("Unable to write dedup store index: " + index_path_);
+    }
+}
+
+void DedupStore::LoadIndex()
+{
+    FILE* input = fopen(index_path_.c_str(), "rb");
+    if (input == NULL)
+    {
+        CreateIndex();
+        return;
+    }
+    std::string contents;
+    char buffer[1 << 16];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+        contents.append(buffer, read);
+    }
+    fclose(input);
+    // An index left empty or part-written by an older version that crashed while creating it holds no records
+    std::string header(DEDUP_MAGIC, 8);
+    AppendUInt32(header, DEDUP_VERSION);
+    if (contents.size() < header.size() && header.compare(0, contents.size(), contents) == 0)
+    {
+        CreateIndex();
+        return;
+    }
+    ByteReader reader(contents.data(), contents.size());
+    try
+    {
+        if (memcmp(reader.ReadBytes(8), DEDUP_MAGIC, 8) != 0 || reader.ReadUInt32() != DEDUP_VERSION)
+        {
+            throw std::invalid_argument("Not a dedup store index: " + index_path_);
+        }
+    }
+    catch (std::invalid_argument& e)
+    {
+        throw std::invalid_argument("Not a dedup store index: " + index_path_);
+    }
+    size_t valid = reader.Offset();
+    try
+    {
+        while (reader.Remaining() > 0)
+        {
+            Entry entry;
+            entry.hash_ = reader.ReadUInt64();
+            entry.shape_ = reader.ReadUInt64();
+            size_t count = reader.ReadUInt32();
+            if (count > (reader.Remaining() / sizeof(double)))
+            {
+                throw std::invalid_argument("Truncated dedup store index record");
+            }
+            entry.sketch_.resize(count);
+            reader.ReadDoubles(entry.sketch_.data(), entry.sketch_.size());
+            AddEntry(entry);
+            valid = reader.Offset();
+        }
+    }
+    catch (std::invalid_argument& e)
+    {
+        // The last append was cut short; drop it so new records follow the last complete one
+        if (truncate(index_path_.c_str(), (off_t)valid) != 0)
+        {
+            throw std::runtime_error("Unable to repair dedup store index: " + index_path_);
+        }
+    }
+}
+
+void DedupStore::AppendIndex(const Entry& entry)
+{
+    std::string buffer;
+    AppendUInt64(buffer, entry.hash_);
+    AppendUInt64(buffer, entry.shape_);
+    AppendUInt32(buffer, (uint32_t)entry.sketch_.size());
+    AppendDoubles(buffer, entry.sketch_.data(), entry.sketch_.size());
+    FILE* output = fopen(index_path_.c_str(), "ab");
+    if (output == NULL)
+    {
+        throw std::runtime_error("Unable to write dedup store index: " + index_path_);
+    }
+    size_t written = fwrite(buffer.data(), 1, buffer.size(), output);
+    if (fclose(output) != 0 || written != buffer.size())
+    {
+        throw std::runtime_error("Unable to write dedup store index: " + index_path_);
+    }
+}
+
+void DedupStore::AddEntry(const Entry& entry)
+{
+    if (by_hash_.count(entry.hash_) > 0)
+    {
+        return;
+    }
+    by_hash_[entry.hash_] = entries_.size();
+    by_shape_.insert(std::make_pair(entry.shape_, entries_.size()));
+    entries_.push_back(entry);
+}
+
+std::vector<double> DedupStore::Sketch(const TrajectoryView& view)
+{
+    std::vector<double> sketch;
+    size_t samples = std::min(view.size(), DEDUP_SKETCH_STATES);
+    for (size_t sample = 0; sample < samples; sample++)
+    {
+        size_t idx = (samples > 1) ? ((sample * (view.size() - 1)) / (samples - 1)) : 0;
+        const State& state = view[idx];
+        for (int field = 0; field < State::NUM_FIELDS; field++)
+        {
+            const std::vector<double>& values = state.Field((State::FIELDS)field);
+            if (values.size() > 0)
+            {
+                sketch.insert(sketch.end(), values.begin(), values.end());
+                break;
+            }
+        }
+    }
+    return sketch;
+}
+
+bool DedupStore::SketchesWithin(const std::vector<double>& first, const std::vector<double>& second, double tolerance)
+{
+    if (first.size() != second.size())
+    {
+        return false;
+    }
+    for (size_t idx = 0; idx < first.size(); idx++)
+    {
+        if (!Within(first[idx], second[idx], tolerance))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+DedupResult DedupStore::Insert(const TrajectoryView& view, bool compact)
+{
+    /* Stored files hold what the exporter writes, which rounds values to fewer digits than a
+     * double has. Hashing, sketching and comparing the trajectory as it reads back from that export
+     * makes the hash match the stored file's and an exact comparison with it meaningful.
+     */
+    Parser parser;
+    std::string exported;
+    parser.ExportTrajToBuffer(view, exported, compact);
+    Trajectory canonical = parser.ParseTrajFromBuffer(exported.data(), exported.size());
+    TrajectoryView canonical_view(canonical);
+    ContentHasher hasher(canonical_view.Header());
+    for (size_t idx = 0; idx < canonical_view.size(); idx++)
+    {
+        hasher.push_back(canonical_view[idx]);
+    }
+    DedupResult result;
+    result.hash_ = hasher.Digest();
+    std::vector<double> sketch = Sketch(canonical_view);
+    if (Contains(result.hash_))
+    {
+        result.status_ = DedupResult::DUPLICATE;
+        result.path_ = Path(result.hash_);
+        if (!SameContent(canonical_view, entries_[by_hash_[result.hash_]], hasher.ShapeDigest(), sketch))
+        {
+            throw std::runtime_error("Content hash collides with a different stored trajectory: " + result.path_);
+        }
+        return result;
+    }
+    if (tolerance_ > 0.0)
+    {
+        std::vector<uint64_t> near = FindNearDuplicates(canonical_view, hasher.ShapeDigest(), sketch, tolerance_);
+        if (near.size() > 0)
+        {
+            result.status_ = DedupResult::NEAR_DUPLICATE;
+            result.path_ = Path(near[0]);
+            return result;
+        }
+    }
+    result.path_ = Path(result.hash_);
+    // Write-then-rename, so a stored file is always complete
+    std::string temp_path = result.path_ + ".tmp";
+    FILE* output = fopen(temp_path.c_str(), "wb");
+    if (output == NULL)
+    {
+        throw std::runtime_error("Unable to write XTF file: " + result.path_);
+    }
+    size_t written = fwrite(exported.data(), 1, exported.size(), output);
+    if (fclose(output) != 0 || written != exported.size() || rename(temp_path.c_str(), result.path_.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("Unable to write XTF file: " + result.path_);
+    }
+    Entry entry;
+    entry.hash_ = result.hash_;
+    entry.shape_ = hasher.ShapeDigest();
+    entry.sketch_ = sketch;
+    AppendIndex(entry);
+    AddEntry(entry);
+    return result;
+}
+
+DedupResult DedupStore::InsertFile(std::string filename, bool compact)
+{
+    Parser parser;
+    Trajectory trajectory = parser.ParseTraj(filename);
+    return Insert(TrajectoryView(trajectory), compact);
+}
+
+bool DedupStore::SameContent(const TrajectoryView& view, const Entry& entry, uint64_t shape, const std::vector<double>& sketch) const
+{
+    // The stored shape and sketch rule out most collisions without reading the file
+    if (entry.shape_ != shape || !SketchesWithin(sketch, entry.sketch_, 0.0))
+    {
+        return false;
+    }
+    Parser parser;
+    Trajectory stored = parser.ParseTraj(Path(entry.hash_));
+    DiffOptions options;
+    options.alignment_ = DiffOptions::BY_INDEX;
+    DiffReport report = Diff(view, TrajectoryView(stored), options);
+    return report.Equivalent() && report.sequence_mismatches_ == 0 && report.first_length_ == report.second_length_;
+}
+
+std::vector<uint64_t> DedupStore::FindNearDuplicates(const TrajectoryView& view, double tolerance) const
+{
+    ContentHasher hasher(view.Header());
+    for (size_t idx = 0; idx < view.size(); idx++)
+    {
+        hasher.push_back(view[idx]);
+    }
+    return FindNearDuplicates(view, hasher.ShapeDigest(), Sketch(view), tolerance);
+}
+
+std::vector<uint64_t> DedupStore::FindNearDuplicates(const TrajectoryView& view, uint64_t shape, const std::vector<double>& sketch, double tolerance) const
+{
+    std::vector<uint64_t> found;
+    std::pair<std::multimap<uint64_t, size_t>::const_iterator, std::multimap<uint64_t, size_t>::const_iterator> candidates = by_shape_.equal_range(shape);
+    Parser parser;
+    for (std::multimap<uint64_t, size_t>::const_iterator itr = candidates.first; itr != candidates.second; ++itr)
+    {
+        const Entry& entry = entries_[itr->second];
+        if (!SketchesWithin(sketch, entry.sketch_, tolerance))
+        {
+            continue;
+        }
+        Trajectory stored = parser.ParseTraj(Path(entry.hash_));
+        if (NearDuplicates(view, TrajectoryView(stored), tolerance))
+        {
+            found.push_back(entry.hash_);
+        }
+    }
+    return found;
+}
+
+bool DedupStore::Contains(uint64_t hash) const
+{
+    return by_hash_.count(hash) > 0;
+}
+
+std::string DedupStore::Path(uint64_t hash) const
+{
+    return directory_ + "/" + HashToHex(hash) + ".xtf";
+}
+
+size_t DedupStore::size() const
+{
+    return entries_.size();
+}
@@ -0,0 +1,590 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <arc_utilities/pretty_print.hpp>
+#include "xtf/xtf.hpp"
+#include "xtf/stream.hpp"
+#include "xtf/diff.hpp"
+
+using namespace XTF;
+
+static inline bool Agrees(double first, double second, double absolute, double relative)
+{
+    bool first_nan = (first != first);
+    bool second_nan = (second != second);
+    if (first_nan || second_nan)
+    {
+        return first_nan && second_nan;
+    }
+    else if (first == second)
+    {
+        return true;
+    }
+    else if (std::isinf(first) || std::isinf(second))
+    {
+        // An infinite operand would make the relative limit infinite too
+        return false;
+    }
+    double limit = absolute;
+    if (relative > 0.0)
+    {
+        limit += relative * std::max(fabs(first), fabs(second));
+    }
+    return fabs(first - second) <= limit;
+}
+
+/* Adds |first[i] - second[i]| into joint_max[i] and joint_sum_squares[i] and returns how many pairs
+ * disagree. Pairs involving NaN (and equal infinities) add nothing to the maxima and sums.
+ */
+static size_t AccumulateDeviations(const double* first, const double* second, size_t count, double absolute, double relative, double* joint_max, double* joint_sum_squares)
+{
+    size_t exceeded = 0;
+    size_t idx = 0;
+#if defined(__SSE2__)
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d infinity = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    const __m128d packed_absolute = _mm_set1_pd(absolute);
+    const __m128d packed_relative = _mm_set1_pd(relative);
+    for (; (idx + 2) <= count; idx += 2)
+    {
+        __m128d packed_first = _mm_loadu_pd(first + idx);
+        __m128d packed_second = _mm_loadu_pd(second + idx);
+        __m128d first_nan = _mm_cmpunord_pd(packed_first, packed_first);
+        __m128d second_nan = _mm_cmpunord_pd(packed_second, packed_second);
+        __m128d either_nan = _mm_or_pd(first_nan, second_nan);
+        __m128d skip = _mm_or_pd(either_nan, _mm_cmpeq_pd(packed_first, packed_second));
+        __m128d difference = _mm_andnot_pd(skip, _mm_andnot_pd(sign, _mm_sub_pd(packed_first, packed_second)));
+        __m128d limit = packed_absolute;
+        if (relative > 0.0)
+        {
+            __m128d scale = _mm_max_pd(_mm_andnot_pd(sign, packed_first), _mm_andnot_pd(sign, packed_second));
+            limit = _mm_add_pd(limit, _mm_mul_pd(packed_relative, scale));
+        }
+        __m128d one_nan = _mm_andnot_pd(_mm_and_pd(first_nan, second_nan), either_nan);
+        __m128d either_infinite = _mm_or_pd(_mm_cmpeq_pd(_mm_andnot_pd(sign, packed_first), infinity), _mm_cmpeq_pd(_mm_andnot_pd(sign, packed_second), infinity));
+        __m128d unequal_infinite = _mm_andnot_pd(skip, either_infinite);
+        int outside = _mm_movemask_pd(_mm_or_pd(_mm_or_pd(_mm_cmpgt_pd(difference, limit), one_nan), unequal_infinite));
+        exceeded += (size_t)((outside & 1) + (outside >> 1));
+        _mm_storeu_pd(joint_max + idx, _mm_max_pd(_mm_loadu_pd(joint_max + idx), difference));
+        _mm_storeu_pd(joint_sum_squares + idx, _mm_add_pd(_mm_loadu_pd(joint_sum_squares + idx), _mm_mul_pd(difference, difference)));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        if (!Agrees(first[idx], second[idx], absolute, relative))
+        {
+            exceeded++;
+        }
+        if (first[idx] != first[idx] || second[idx] != second[idx] || first[idx] == second[idx])
+        {
+            continue;
+        }
+        double difference = fabs(first[idx] - second[idx]);
+        joint_max[idx] = std::max(joint_max[idx], difference);
+        joint_sum_squares[idx] += difference * difference;
+    }
+    return exceeded;
+}
+
+static inline double TimingDifference(const State& first, const State& second)
+{
+    return (double)(first.timing_.tv_sec - second.timing_.tv_sec) + ((double)(first.timing_.tv_nsec - second.timing_.tv_nsec) * 0.000000001);
+}
+
+static void CompareHeaders(const Trajectory& first, const Trajectory& second, const DiffOptions& options, std::vector<std::string>& differences)
+{
+    const char* data_types[] = {"JOINT", "POSE"};
+    const char* timings[] = {"TIMED", "UNTIMED"};
+    const char* traj_types[] = {"GENERATED", "RECORDED"};
+    if (first.data_type_ != second.data_type_)
+    {
+        differences.push_back(std::string("data type: ") + data_types[first.data_type_] + " != " + data_types[second.data_type_]);
+    }
+    if (first.timing_ != second.timing_)
+    {
+        differences.push_back(std::string("timing: ") + timings[first.timing_] + " != " + timings[second.timing_]);
+    }
+    if (first.traj_type_ != second.traj_type_)
+    {
+        differences.push_back(std::string("trajectory type: ") + traj_types[first.traj_type_] + " != " + traj_types[second.traj_type_]);
+    }
+    if (first.robot_ != second.robot_)
+    {
+        differences.push_back("robot: '" + first.robot_ + "' != '" + second.robot_ + "'");
+    }
+    if (first.joint_names_ != second.joint_names_)
+    {
+        differences.push_back("joint names: " + PrettyPrint::PrettyPrint(first.joint_names_) + " != " + PrettyPrint::PrettyPrint(second.joint_names_));
+    }
+    if (first.root_frame_ != second.root_frame_)
+    {
+        differences.push_back("root frame: '" + first.root_frame_ + "' != '" + second.root_frame_ + "'");
+    }
+    if (first.target_frame_ != second.target_frame_)
+    {
+        differences.push_back("target frame: '" + first.target_frame_ + "' != '" + second.target_frame_ + "'");
+    }
+    if (options.compare_provenance_)
+    {
+        if (first.uid_ != second.uid_)
+        {
+            differences.push_back("uid: '" + first.uid_ + "' != '" + second.uid_ + "'");
+        }
+        if (first.generator_ != second.generator_)
+        {
+            differences.push_back("generator: '" + first.generator_ + "' != '" + second.generator_ + "'");
+        }
+        if (first.tags_ != second.tags_)
+        {
+            differences.push_back("tags: " + PrettyPrint::PrettyPrint(first.tags_) + " != " + PrettyPrint::PrettyPrint(second.tags_));
+        }
+    }
+}
+
+class DiffAccumulator
+{
+protected:
+
+    const DiffOptions& options_;
+    DiffReport& report_;
+    std::vector<std::string> joint_names_;
+    std::vector<double> sum_squares_[State::NUM_FIELDS];
+    std::vector<size_t> counts_[State::NUM_FIELDS];
+    double timing_sum_squares_;
+
+    void Diverge(size_t first, size_t second, const std::string& reason)
+    {
+        if (!report_.diverged_)
+        {
+            report_.diverged_ = true;
+            report_.divergence_first_ = first;
+            report_.divergence_second_ = second;
+            report_.divergence_reason_ = reason;
+        }
+    }
+
+    std::string JointName(size_t joint) const
+    {
+        std::ostringstream name;
+        name << "value " << joint;
+        if (joint < joint_names_.size())
+        {
+            name << " (" << joint_names_[joint] << ")";
+        }
+        return name.str();
+    }
+
+    bool ExtrasAgree(const KeyValue& first, const KeyValue& second) const
+    {
+        std::string type = first.GetTypeString();
+        if (type != second.GetTypeString())
+        {
+            return false;
+        }
+        else if (type == "double")
+        {
+            return Agrees(first.DoubleValue(), second.DoubleValue(), options_.absolute_tolerance_, options_.relative_tolerance_);
+        }
+        else if (type == "doublelist")
+        {
+            std::vector<double> first_values = first.DoubleListValue();
+            std::vector<double> second_values = second.DoubleListValue();
+            if (first_values.size() != second_values.size())
+            {
+                return false;
+            }
+            for (size_t idx = 0; idx < first_values.size(); idx++)
+            {
+                if (!Agrees(first_values[idx], second_values[idx], options_.absolute_tolerance_, options_.relative_tolerance_))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return first.GetValueString() == second.GetValueString();
+    }
+
+    void ExtrasMismatch(size_t first, size_t second, const std::string& description)
+    {
+        report_.extras_mismatch_count_++;
+        if (report_.extras_mismatches_.size() < options_.max_reported_)
+        {
+            report_.extras_mismatches_.push_back(description);
+        }
+        Diverge(first, second, description);
+    }
+
+    void CompareExtras(const State& first, size_t first_index, const State& second, size_t second_index)
+    {
+        std::map<std::string, KeyValue>::const_iterator first_itr = first.extras_.begin();
+        std::map<std::string, KeyValue>::const_iterator second_itr = second.extras_.begin();
+        while (first_itr != first.extras_.end() || second_itr != second.extras_.end())
+        {
+            std::ostringstream description;
+            description << "state " << first_index << "/" << second_index << ": extra '";
+            if (second_itr == second.extras_.end() || (first_itr != first.extras_.end() && first_itr->first < second_itr->first))
+            {
+                description << first_itr->first << "' missing from second";
+                ExtrasMismatch(first_index, second_index, description.str());
+                ++first_itr;
+            }
+            else if (first_itr == first.extras_.end() || second_itr->first < first_itr->first)
+            {
+                description << second_itr->first << "' missing from first";
+                ExtrasMismatch(first_index, second_index, description.str());
+                ++second_itr;
+            }
+            else
+            {
+                if (!ExtrasAgree(first_itr->second, second_itr->second))
+                {
+                    description << first_itr->first << "' differs: " << first_itr->second.GetValueString() << " != " << second_itr->second.GetValueString();
+                    ExtrasMismatch(first_index, second_index, description.str());
+                }
+                ++first_itr;
+                ++second_itr;
+            }
+        }
+    }
+
+public:
+
+    DiffAccumulator(const Trajectory& first, const Trajectory& second, const DiffOptions& options, DiffReport& report) : options_(options), report_(report), timing_sum_squares_(0.0)
+    {
+        CompareHeaders(first, second, options_, report_.header_differences_);
+        if (first.data_type_ == Trajectory::JOINT)
+        {
+            joint_names_ = first.joint_names_;
+        }
+    }
+
+    void Compare(const State& first, size_t first_index, const State& second, size_t second_index)
+    {
+        report_.matched_++;
+        if (first.sequence_ != second.sequence_)
+        {
+            report_.sequence_mismatches_++;
+        }
+        double timing_difference = fabs(TimingDifference(first, second));
+        report_.timing_max_ = std::max(report_.timing_max_, timing_difference);
+        timing_sum_squares_ += timing_difference * timing_difference;
+        if (options_.compare_timing_ && timing_difference > options_.time_tolerance_)
+        {
+            report_.timing_exceeded_++;
+            std::ostringstream reason;
+            reason << "timing differs by " << timing_difference << "s";
+            Diverge(first_index, second_index, reason.str());
+        }
+        for (int field = 0; field < State::NUM_FIELDS; field++)
+        {
+            const std::vector<double>& first_values = first.Field((State::FIELDS)field);
+            const std::vector<double>& second_values = second.Field((State::FIELDS)field);
+            FieldDeviation& deviation = report_.fields_[field];
+            if (first_values.size() != second_values.size())
+            {
+                deviation.size_mismatches_++;
+                std::ostringstream reason;
+                reason << State::FieldName((State::FIELDS)field) << " has " << first_values.size() << " values in first and " << second_values.size() << " in second";
+                Diverge(first_index, second_index, reason.str());
+                continue;
+            }
+            else if (first_values.size() == 0)
+            {
+                continue;
+            }
+            size_t count = first_values.size();
+            if (deviation.joint_max_.size() < count)
+            {
+                deviation.joint_max_.resize(count, 0.0);
+                sum_squares_[field].resize(count, 0.0);
+                counts_[field].resize(count, 0);
+            }
+            size_t exceeded = AccumulateDeviations(first_values.data(), second_values.data(), count, options_.absolute_tolerance_, options_.relative_tolerance_, deviation.joint_max_.data(), sum_squares_[field].data());
+            for (size_t joint = 0; joint < count; joint++)
+            {
+                counts_[field][joint]++;
+            }
+            deviation.compared_++;
+            deviation.exceeded_ += exceeded;
+            if (exceeded > 0 && !report_.diverged_)
+            {
+                for (size_t joint = 0; joint < count; joint++)
+                {
+                    if (!Agrees(first_values[joint], second_values[joint], options_.absolute_tolerance_, options_.relative_tolerance_))
+                    {
+                        std::ostringstream reason;
+                        reason << State::FieldName((State::FIELDS)field) << " " << JointName(joint) << ": " << first_values[joint] << " != " << second_values[joint];
+                        Diverge(first_index, second_index, reason.str());
+                        break;
+                    }
+                }
+            }
+        }
+        if (options_.compare_extras_)
+        {
+            CompareExtras(first, first_index, second, second_index);
+        }
+    }
+
+    void MissingFromSecond(size_t first_index, size_t second_index)
+    {
+        report_.missing_from_second_++;
+        std::ostringstream reason;
+        reason << "state " << first_index << " of first has no partner in second";
+        Diverge(first_index, second_index, reason.str());
+    }
+
+    void MissingFromFirst(size_t first_index, size_t second_index)
+    {
+        report_.missing_from_first_++;
+        std::ostringstream reason;
+        reason << "state " << second_index << " of second has no partner in first";
+        Diverge(first_index, second_index, reason.str());
+    }
+
+    void Finish(size_t first_length, size_t second_length)
+    {
+        report_.first_length_ = first_length;
+        report_.second_length_ = second_length;
+        if (report_.matched_ > 0)
+        {
+            report_.timing_rms_ = sqrt(timing_sum_squares_ / (double)report_.matched_);
+        }
+        for (int field = 0; field < State::NUM_FIELDS; field++)
+        {
+            FieldDeviation& deviation = report_.fields_[field];
+            deviation.joint_rms_.resize(deviation.joint_max_.size(), 0.0);
+            double total_squares = 0.0;
+            size_t total_count = 0;
+            for (size_t joint = 0; joint < deviation.joint_max_.size(); joint++)
+            {
+                deviation.max_ = std::max(deviation.max_, deviation.joint_max_[joint]);
+                deviation.joint_rms_[joint] = sqrt(sum_squares_[field][joint] / (double)counts_[field][joint]);
+                total_squares += sum_squares_[field][joint];
+                total_count += counts_[field][joint];
+            }
+            if (total_count > 0)
+            {
+                deviation.rms_ = sqrt(total_squares / (double)total_count);
+            }
+        }
+    }
+
+};
+
+class ViewSource
+{
+protected:
+
+    const TrajectoryView& view_;
+    size_t position_;
+
+public:
+
+    ViewSource(const TrajectoryView& view) : view_(view), position_(0) {}
+
+    inline bool HasNext() const
+    {
+        return position_ < view_.size();
+    }
+
+    inline const State& Peek() const
+    {
+        return view_[position_];
+    }
+
+    inline void Pop()
+    {
+        position_++;
+    }
+
+    inline size_t Position() const
+    {
+        return position_;
+    }
+
+};
+
+class ReaderSource
+{
+protected:
+
+    StateReader& reader_;
+    State current_;
+    bool has_current_;
+    size_t position_;
+
+    void Load()
+    {
+        has_current_ = reader_.HasNext();
+        if (has_current_)
+        {
+            current_ = reader_.Next();
+        }
+    }
+
+public:
+
+    ReaderSource(StateReader& reader) : reader_(reader), has_current_(false), position_(0)
+    {
+        Load();
+    }
+
+    inline bool HasNext() const
+    {
+        return has_current_;
+    }
+
+    inline const State& Peek() const
+    {
+        return current_;
+    }
+
+    inline void Pop()
+    {
+        position_++;
+        Load();
+    }
+
+    inline size_t Position() const
+    {
+        return position_;
+    }
+
+};
+
+template<typename Source>
+static void Align(Source& first, Source& second, const DiffOptions& options, DiffAccumulator& accumulator)
+{
+    while (first.HasNext() && second.HasNext())
+    {
+        const State& first_state = first.Peek();
+        const State& second_state = second.Peek();
+        int order = 0;
+        if (options.alignment_ == DiffOptions::BY_SEQUENCE)
+        {
+            order = (first_state.sequence_ < second_state.sequence_) ? -1 : ((first_state.sequence_ > second_state.sequence_) ? 1 : 0);
+        }
+        else if (options.alignment_ == DiffOptions::BY_TIME)
+        {
+            double difference = TimingDifference(first_state, second_state);
+            order = (difference < -options.time_tolerance_) ? -1 : ((difference > options.time_tolerance_) ? 1 : 0);
+        }
+        if (order == 0)
+        {
+            accumulator.Compare(first_state, first.Position(), second_state, second.Position());
+            first.Pop();
+            second.Pop();
+        }
+        else if (order < 0)
+        {
+            accumulator.MissingFromSecond(first.Position(), second.Position());
+            first.Pop();
+        }
+        else
+        {
+            accumulator.MissingFromFirst(first.Position(), second.Position());
+            second.Pop();
+        }
+    }
+    while (first.HasNext())
+    {
+        accumulator.MissingFromSecond(first.Position(), second.Position());
+        first.Pop();
+    }
+    while (second.HasNext())
+    {
+        accumulator.MissingFromFirst(first.Position(), second.Position());
+        second.Pop();
+    }
+    accumulator.Finish(first.Position(), second.Position());
+}
+
+bool DiffReport::Equivalent() const
+{
+    return header_differences_.size() == 0 && !diverged_;
+}
+
+std::string DiffReport::Summary() const
+{
+    std::ostringstream summary;
+    summary << (Equivalent() ? "equivalent" : "different") << ": " << first_length_ << " and " << second_length_ << " states, " << matched_ << " paired";
+    if (missing_from_second_ > 0 || missing_from_first_ > 0)
+    {
+        summary << ", " << missing_from_second_ << " missing from second, " << missing_from_first_ << " missing from first";
+    }
+    summary << "\n";
+    for (size_t idx = 0; idx < header_differences_.size(); idx++)
+    {
+        summary << "header " << header_differences_[idx] << "\n";
+    }
+    for (int field = 0; field < State::NUM_FIELDS; field++)
+    {
+        const FieldDeviation& deviation = fields_[field];
+        if (deviation.compared_ == 0 && deviation.size_mismatches_ == 0)
+        {
+            continue;
+        }
+        size_t worst = std::max_element(deviation.joint_max_.begin(), deviation.joint_max_.end()) - deviation.joint_max_.begin();
+        summary << State::FieldName((State::FIELDS)field) << ": max " << deviation.max_;
+        if (deviation.joint_max_.size() > 0)
+        {
+            summary << " (value " << worst << ")";
+        }
+        summary << ", rms " << deviation.rms_ << ", " << deviation.exceeded_ << " outside tolerance";
+        if (deviation.size_mismatches_ > 0)
+        {
+            summary << ", " << deviation.size_mismatches_ << " size mismatches";
+        }
+        summary << "\n";
+    }
+    summary << "timing: max " << timing_max_ << "s, rms " << timing_rms_ << "s, " << timing_exceeded_ << " outside tolerance\n";
+    if (extras_mismatch_count_ > 0)
+    {
+        summary << "extras: " << extras_mismatch_count_ << " mismatches\n";
+    }
+    if (diverged_)
+    {
+        summary << "first divergence at state " << divergence_first_ << " of first, " << divergence_second_ << " of second: " << divergence_reason_ << "\n";
+    }
+    return summary.str();
+}
+
+DiffReport XTF::Diff(const TrajectoryView& first, const TrajectoryView& second, const DiffOptions& options)
+{
+    DiffReport report;
+    DiffAccumulator accumulator(first.Header(), second.Header(), options, report);
+    ViewSource first_source(first);
+    ViewSource second_source(second);
+    Align(first_source, second_source, options, accumulator);
+    return report;
+}
+
+DiffReport XTF::Diff(const Trajectory& first, const Trajectory& second, const DiffOptions& options)
+{
+    return Diff(TrajectoryView(first), TrajectoryView(second), options);
+}
+
+DiffReport XTF::DiffFiles(std::string first, std::string second, const DiffOptions& options)
+{
+    StateReader first_reader(first);
+    StateReader second_reader(second);
+    DiffReport report;
+    DiffAccumulator accumulator(first_reader.Header(), second_reader.Header(), options, report);
+    ReaderSource first_source(first_reader);
+    ReaderSource second_source(second_reader);
+    Align(first_source, second_source, options, accumulator);
+    return report;
+}
@@ -0,0 +1,408 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include "xtf/xtf.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/endpoints.hpp"
+
+using namespace XTF;
+
+static const char ENDPOINT_INDEX_MAGIC[] = "XTFEPI01";
+static const uint32_t ENDPOINT_INDEX_VERSION = 1;
+static const size_t ENDPOINT_LEAF_SIZE = 16;
+
+class EndpointIndex::Search
+{
+public:
+
+    size_t k_;
+    bool radius_;
+    double limit_;
+    // Max-heap of (squared distance, index) in k-nearest mode; every match in radius mode
+    std::vector< std::pair<double, size_t> > found_;
+
+    Search(size_t k, bool radius, double limit) : k_(k), radius_(radius), limit_(limit) {}
+
+    inline void Offer(double squared_distance, size_t index)
+    {
+        if (radius_)
+        {
+            if (squared_distance <= limit_)
+            {
+                found_.push_back(std::make_pair(squared_distance, index));
+            }
+            return;
+        }
+        std::pair<double, size_t> candidate(squared_distance, index);
+        if (found_.size() < k_)
+        {
+            found_.push_back(candidate);
+            std::push_heap(found_.begin(), found_.end());
+        }
+        else if (candidate < found_.front())
+        {
+            std::pop_heap(found_.begin(), found_.end());
+            found_.back() = candidate;
+            std::push_heap(found_.begin(), found_.end());
+        }
+        if (found_.size() == k_)
+        {
+            limit_ = found_.front().first;
+        }
+    }
+
+};
+
+EndpointIndex::EndpointIndex(const std::vector<std::string>& joint_names, const std::vector<double>& weights)
+{
+    if (joint_names.size() == 0)
+    {
+        throw std::invalid_argument("Endpoint index needs at least one joint");
+    }
+    joint_names_ = joint_names;
+    weights_ = (weights.size() > 0) ? weights : std::vector<double>(joint_names.size(), 1.0);
+    if (weights_.size() != joint_names_.size())
+    {
+        throw std::invalid_argument("Endpoint index needs one weight per joint");
+    }
+    for (size_t idx = 0; idx < weights_.size(); idx++)
+    {
+        if (!(weights_[idx] >= 0.0) || std::isinf(weights_[idx]))
+        {
+            throw std::invalid_argument("Endpoint index weights must be finite and non-negative");
+        }
+    }
+}
+
+std::vector<double> EndpointIndex::Key(const std::vector<double>& start, const std::vector<double>& goal) const
+{
+    size_t joints = joint_names_.size();
+    if (start.size() != joints || goal.size() != joints)
+    {
+        throw std::invalid_argument("Start and goal must have one value per joint of the endpoint index");
+    }
+    std::vector<double> key(2 * joints);
+    for (size_t joint = 0; joint < joints; joint++)
+    {
+        double scale = sqrt(weights_[joint]);
+        key[joint] = start[joint] * scale;
+        key[joints + joint] = goal[joint] * scale;
+    }
+    for (size_t idx = 0; idx < key.size(); idx++)
+    {
+        if (!std::isfinite(key[idx]))
+        {
+            throw std::invalid_argument("Start and goal values must be finite");
+        }
+    }
+    return key;
+}
+
+void EndpointIndex::Append(const EndpointEntry& entry)
+{
+    std::vector<double> key = Key(entry.start_, entry.goal_);
+    coordinates_.insert(coordinates_.end(), key.begin(), key.end());
+    entries_.push_back(entry);
+}
+
+size_t EndpointIndex::BuildNode(Tree& tree, size_t begin, size_t end)
+{
+    size_t node = tree.nodes_.size();
+    tree.nodes_.push_back(Node());
+    tree.nodes_[node].begin_ = begin;
+    tree.nodes_[node].end_ = end;
+    tree.nodes_[node].left_ = 0;
+    tree.nodes_[node].right_ = 0;
+    tree.nodes_[node].dimension_ = 0;
+    tree.nodes_[node].split_ = 0.0;
+    if ((end - begin) <= ENDPOINT_LEAF_SIZE)
+    {
+        return node;
+    }
+    // Split on the dimension with the widest spread, at the median
+    size_t dimensions = 2 * joint_names_.size();
+    size_t dimension = 0;
+    double widest = -1.0;
+    for (size_t current = 0; current < dimensions; current++)
+    {
+        double low = std::numeric_limits<double>::infinity();
+        double high = -std::numeric_limits<double>::infinity();
+        for (size_t idx = begin; idx < end; idx++)
+        {
+            double value = coordinates_[(tree.entries_[idx] * dimensions) + current];
+            low = std::min(low, value);
+            high = std::max(high, value);
+        }
+        if ((high - low) > widest)
+        {
+            widest = high - low;
+            dimension = current;
+        }
+    }
+    size_t middle = begin + ((end - begin) / 2);
+    const std::vector<double>& coordinates = coordinates_;
+    std::nth_element(tree.entries_.begin() + begin, tree.entries_.begin() + middle, tree.entries_.begin() + end, [&](size_t first, size_t second)
+    {
+        return coordinates[(first * dimensions) + dimension] < coordinates[(second * dimensions) + dimension];
+    });
+    double split = coordinates_[(tree.entries_[middle] * dimensions) + dimension];
+    size_t left = BuildNode(tree, begin, middle);
+    size_t right = BuildNode(tree, middle, end);
+    tree.nodes_[node].dimension_ = dimension;
+    tree.nodes_[node].split_ = split;
+    tree.nodes_[node].left_ = left;
+    tree.nodes_[node].right_ = right;
+    return node;
+}
+
+void EndpointIndex::Build(Tree& tree)
+{
+    tree.nodes_.clear();
+    if (tree.entries_.size() > 0)
+    {
+        BuildNode(tree, 0, tree.entries_.size());
+    }
+}
+
+void EndpointIndex::Insert(size_t first)
+{
+    if (first == entries_.size())
+    {
+        return;
+    }
+    Tree added;
+    for (size_t idx = first; idx < entries_.size(); idx++)
+    {
+        added.entries_.push_back(idx);
+    }
+    trees_.push_back(added);
+    // Keep tree sizes geometrically decreasing, so there are O(log n) of them
+    while (trees_.size() >= 2 && trees_[trees_.size() - 2].entries_.size() <= (2 * trees_.back().entries_.size()))
+    {
+        Tree& merged = trees_[trees_.size() - 2];
+        merged.entries_.insert(merged.entries_.end(), trees_.back().entries_.begin(), trees_.back().entries_.end());
+        trees_.pop_back();
+    }
+    Build(trees_.back());
+}
+
+size_t EndpointIndex::Add(const EndpointEntry& entry)
+{
+    return Add(std::vector<EndpointEntry>(1, entry));
+}
+
+size_t EndpointIndex::Add(const TrajectoryView& view, const std::string& path)
+{
+    const Trajectory& header = view.Header();
+    if (header.data_type_ != Trajectory::JOINT || header.joint_names_ != joint_names_)
+    {
+        throw std::invalid_argument("Trajectory does not have the same joints as the endpoint index");
+    }
+    if (view.size() == 0)
+    {
+        throw std::invalid_argument("Cannot index the endpoints of an empty trajectory");
+    }
+    return Add(EndpointEntry(header.uid_, path, view[0].position_desired_, view[view.size() - 1].position_desired_));
+}
+
+size_t EndpointIndex::Add(const std::vector<EndpointEntry>& entries)
+{
+    size_t first = entries_.size();
+    try
+    {
+        for (size_t idx = 0; idx < entries.size(); idx++)
+        {
+            Append(entries[idx]);
+        }
+    }
+    catch (...)
+    {
+        // Leave the index as it was if any entry is rejected
+        entries_.resize(first);
+        coordinates_.resize(first * 2 * joint_names_.size());
+        throw;
+    }
+    Insert(first);
+    return first;
+}
+
+const EndpointEntry& EndpointIndex::at(size_t index) const
+{
+    if (index < entries_.size())
+    {
+        return entries_[index];
+    }
+    else
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << index << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+}
+
+size_t EndpointIndex::size() const
+{
+    return entries_.size();
+}
+
+const std::vector<std::string>& EndpointIndex::JointNames() const
+{
+    return joint_names_;
+}
+
+const std::vector<double>& EndpointIndex::Weights() const
+{
+    return weights_;
+}
+
+void EndpointIndex::SearchTree(const Tree& tree, size_t node, const double* query, Search& search) const
+{
+    const Node& current = tree.nodes_[node];
+    size_t dimensions = 2 * joint_names_.size();
+    if (current.left_ == 0)
+    {
+        for (size_t idx = current.begin_; idx < current.end_; idx++)
+        {
+            size_t entry = tree.entries_[idx];
+            const double* coordinates = &coordinates_[entry * dimensions];
+            double squared_distance = 0.0;
+            for (size_t dimension = 0; dimension < dimensions; dimension++)
+            {
+                double difference = query[dimension] - coordinates[dimension];
+                squared_distance += difference * difference;
+            }
+            search.Offer(squared_distance, entry);
+        }
+        return;
+    }
+    // Visit the side holding the query first; the other side is at least the plane distance away
+    double difference = query[current.dimension_] - current.split_;
+    size_t near = (difference < 0.0) ? current.left_ : current.right_;
+    size_t far = (difference < 0.0) ? current.right_ : current.left_;
+    SearchTree(tree, near, query, search);
+    if ((difference * difference) <= search.limit_)
+    {
+        SearchTree(tree, far, query, search);
+    }
+}
+
+std::vector<EndpointMatch> EndpointIndex::Run(const std::vector<double>& start, const std::vector<double>& goal, size_t k, double radius) const
+{
+    std::vector<double> query = Key(start, goal);
+    bool within_radius = (k == 0);
+    Search search(k, within_radius, within_radius ? (radius * radius) : std::numeric_limits<double>::infinity());
+    for (size_t idx = 0; idx < trees_.size(); idx++)
+    {
+        if (trees_[idx].nodes_.size() > 0)
+        {
+            SearchTree(trees_[idx], 0, query.data(), search);
+        }
+    }
+    std::sort(search.found_.begin(), search.found_.end());
+    std::vector<EndpointMatch> matches;
+    matches.reserve(search.found_.size());
+    for (size_t idx = 0; idx < search.found_.size(); idx++)
+    {
+        matches.push_back(EndpointMatch(search.found_[idx].second, sqrt(search.found_[idx].first)));
+    }
+    return matches;
+}
+
+std::vector<EndpointMatch> EndpointIndex::Nearest(const std::vector<double>& start, const std::vector<double>& goal, size_t k) const
+{
+    if (k == 0)
+    {
+        Key(start, goal);
+        return std::vector<EndpointMatch>();
+    }
+    return Run(start, goal, k, 0.0);
+}
+
+std::vector<EndpointMatch> EndpointIndex::WithinRadius(const std::vector<double>& start, const std::vector<double>& goal, double radius) const
+{
+    if (!(radius >= 0.0))
+    {
+        throw std::invalid_argument("Radius must be non-negative");
+    }
+    return Run(start, goal, 0, radius);
+}
+
+void EndpointIndex::Save(std::string filename) const
+{
+    std::string buffer(ENDPOINT_INDEX_MAGIC, 8);
+    AppendUInt32(buffer, ENDPOINT_INDEX_VERSION);
+    AppendStrings(buffer, joint_names_);
+    AppendDoubles(buffer, weights_.data(), weights_.size());
+    AppendUInt64(buffer, entries_.size());
+    for (size_t idx = 0; idx < entries_.size(); idx++)
+    {
+        const EndpointEntry& entry = entries_[idx];
+        AppendString(buffer, entry.uid_);
+        AppendString(buffer, entry.path_);
+        AppendDoubles(buffer, entry.start_.data(), entry.start_.size());
+        AppendDoubles(buffer, entry.goal_.data(), entry.goal_.size());
+    }
+    // Write-then-rename, so a concurrent reader never sees a partially written index
+    std::string temp_path = filename + ".tmp";
+    FILE* output = fopen(temp_path.c_str(), "wb");
+    if (output == NULL)
+    {
+        throw std::runtime_error("Unable to write endpoint index: " + filename);
+    }
+    size_t written = fwrite(buffer.data(), 1, buffer.size(), output);
+    bool closed = (fclose(output) == 0);
+    if (written != buffer.size() || !closed || rename(temp_path.c_str(), filename.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("Unable to write endpoint index: " + filename);
+    }
+}
+
+EndpointIndex EndpointIndex::Load(std::string filename)
+{
+    FILE* input = fopen(filename.c_str(), "rb");
+    if (input == NULL)
+    {
+        throw std::runtime_error("Unable to read endpoint index: " + filename);
+    }
+    std::string contents;
+    char buffer[1 << 16];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+        contents.append(buffer, read);
+    }
+    fclose(input);
+    ByteReader reader(contents.data(), contents.size());
+    if (contents.size() < 12 || memcmp(reader.ReadBytes(8), ENDPOINT_INDEX_MAGIC, 8) != 0 || reader.ReadUInt32() != ENDPOINT_INDEX_VERSION)
+    {
+        throw std::invalid_argument("File is not an endpoint index: " + filename);
+    }
+    std::vector<std::string> joint_names = reader.ReadStrings();
+    std::vector<double> weights(joint_names.size());
+    reader.ReadDoubles(weights.data(), weights.size());
+    EndpointIndex index(joint_names, weights);
+    uint64_t count = reader.ReadUInt64();
+    std::vector<EndpointEntry> entries;
+    for (uint64_t idx = 0; idx < count; idx++)
+    {
+        EndpointEntry entry;
+        entry.uid_ = reader.ReadString();
+        entry.path_ = reader.ReadString();
+        entry.start_.resize(joint_names.size());
+        entry.goal_.resize(joint_names.size());
+        reader.ReadDoubles(entry.start_.data(), entry.start_.size());
+        reader.ReadDoubles(entry.goal_.data(), entry.goal_.size());
+        entries.push_back(entry);
+    }
+    index.Add(entries);
+    return index;
+}
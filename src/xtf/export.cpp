@@ -0,0 +1,188 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <libxml/parser.h>
+#include <libxml++/libxml++.h>
+#include <arc_utilities/pretty_print.hpp>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+
+using namespace XTF;
+
+// States are formatted in chunks of about this many, a few chunks per worker at a time
+static const size_t EXPORT_CHUNK_STATES = 512;
+static const size_t EXPORT_CHUNKS_PER_WORKER = 4;
+
+std::string Parser::EncodeStateElements(const TrajectoryView& view, bool compact, const std::string& indent)
+{
+    std::string encoded = EncodeStates(view, compact);
+    size_t open = encoded.find("<states");
+    size_t start = (open == std::string::npos) ? std::string::npos : encoded.find('>', open);
+    size_t close = encoded.rfind("</states>");
+    if (start == std::string::npos || encoded[start - 1] == '/')
+    {
+        // No states, so <states length="0"/>
+        return std::string();
+    }
+    if (close == std::string::npos || close <= start)
+    {
+        throw std::invalid_argument("Unable to encode XTF states");
+    }
+    std::string elements = encoded.substr(start + 1, close - start - 1);
+    elements.erase(elements.find_last_not_of(" \t\r\n") + 1);
+    if (indent.size() == 0)
+    {
+        return elements;
+    }
+    // The states were encoded with <states> as the root, so every line moves in by indent
+    std::string indented;
+    indented.reserve(elements.size() + (elements.size() / 8));
+    for (size_t idx = 0; idx < elements.size(); idx++)
+    {
+        indented.push_back(elements[idx]);
+        if (elements[idx] == '\n')
+        {
+            indented.append(indent);
+        }
+    }
+    return indented;
+}
+
+void Parser::EncodeStatesEnvelope(const Trajectory& header, bool compact, std::string& prefix, std::string& suffix, std::string& indent)
+{
+    std::string document;
+    ExportTrajToBuffer(TrajectoryView(header, 0, 0), document, compact);
+    std::string empty("<states length=\"0\"/>");
+    size_t open = document.rfind(empty);
+    if (open == std::string::npos)
+    {
+        throw std::invalid_argument("Unable to export the trajectory header");
+    }
+    size_t line_start = open;
+    while (line_start > 0 && (document[line_start - 1] == ' ' || document[line_start - 1] == '\t'))
+    {
+        line_start--;
+    }
+    indent = compact ? std::string() : document.substr(line_start, open - line_start);
+    prefix = document.substr(0, open) + "<states length=\"";
+    suffix = (compact ? std::string() : ("\n" + indent)) + "</states>" + document.substr(open + empty.size());
+}
+
+static void WriteBuffers(int fd, const std::vector<std::string>& buffers, size_t count, const std::string& filename)
+{
+    std::vector<struct iovec> pending;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        if (buffers[idx].size() > 0)
+        {
+            struct iovec vector;
+            vector.iov_base = (void*)buffers[idx].data();
+            vector.iov_len = buffers[idx].size();
+            pending.push_back(vector);
+        }
+    }
+    size_t first = 0;
+    while (first < pending.size())
+    {
+        int batch = (int)std::min(pending.size() - first, (size_t)IOV_MAX);
+        ssize_t result = writev(fd, &pending[first], batch);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result < 0)
+        {
+            throw std::runtime_error("Unable to write XTF file: " + filename);
+        }
+        // Skip what was written, which may end part way through a buffer
+        size_t written = (size_t)result;
+        while (first < pending.size() && written >= pending[first].iov_len)
+        {
+            written -= pending[first].iov_len;
+            first++;
+        }
+        if (first < pending.size())
+        {
+            pending[first].iov_base = (char*)pending[first].iov_base + written;
+            pending[first].iov_len -= written;
+        }
+    }
+}
+
+bool Parser::ExportViewsParallel(const Trajectory& header, const std::vector<TrajectoryView>& parts, std::string filename, bool compact, size_t threads)
+{
+    // Chunk boundaries never straddle parts
+    std::vector<TrajectoryView> chunks;
+    size_t length = 0;
+    for (size_t part = 0; part < parts.size(); part++)
+    {
+        for (size_t start = 0; start < parts[part].size(); start += EXPORT_CHUNK_STATES)
+        {
+            chunks.push_back(parts[part].Slice(start, std::min(EXPORT_CHUNK_STATES, parts[part].size() - start)));
+        }
+        length += parts[part].size();
+    }
+    if (length == 0)
+    {
+        return ExportViews(header, parts, filename, compact);
+    }
+    std::string prefix;
+    std::string suffix;
+    std::string indent;
+    EncodeStatesEnvelope(header, compact, prefix, suffix, indent);
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Unable to write XTF file: " + filename);
+    }
+    try
+    {
+        xmlInitParser();
+        size_t workers = ResolveThreads(threads);
+        size_t window = std::max(workers * EXPORT_CHUNKS_PER_WORKER, (size_t)1);
+        // The head and tail go out with the first and last windows
+        std::vector<std::string> buffers(window + 2);
+        buffers[0] = prefix + PrettyPrint::PrettyPrint(length) + "\">";
+        for (size_t first = 0; first < chunks.size(); first += window)
+        {
+            size_t count = std::min(window, chunks.size() - first);
+            ParallelFor(count, workers, [&](size_t idx)
+            {
+                buffers[idx + 1] = EncodeStateElements(chunks[first + idx], compact, indent);
+            });
+            bool last = (first + count) == chunks.size();
+            buffers[count + 1] = last ? suffix : std::string();
+            WriteBuffers(fd, buffers, count + 2, filename);
+            buffers[0].clear();
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    if (close(fd) != 0)
+    {
+        throw std::runtime_error("Unable to write XTF file: " + filename);
+    }
+    return true;
+}
+
+bool Parser::ExportTrajParallel(const TrajectoryView& view, std::string filename, bool compact, size_t threads)
+{
+    return ExportViewsParallel(view.Header(), std::vector<TrajectoryView>(1, view), filename, compact, threads);
+}
+
+bool Parser::ExportTrajParallel(const ConcatenatedView& view, std::string filename, bool compact, size_t threads)
+{
+    return ExportViewsParallel(view.Header(), view.Parts(), filename, compact, threads);
+}
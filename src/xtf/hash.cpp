@@ -0,0 +1,184 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+#include <string>
+#include <algorithm>
+#include "xtf/hash.hpp"
+
+using namespace XTF;
+
+static const uint64_t PRIME64_1 = 11400714785074694791ULL;
+static const uint64_t PRIME64_2 = 14029467366897019727ULL;
+static const uint64_t PRIME64_3 = 1609587929392839161ULL;
+static const uint64_t PRIME64_4 = 9650029242287828579ULL;
+static const uint64_t PRIME64_5 = 2870177450012600261ULL;
+
+static inline uint64_t RotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t Read64(const unsigned char* bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; i++)
+    {
+        value |= ((uint64_t)bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+static inline uint64_t Read32(const unsigned char* bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < 4; i++)
+    {
+        value |= ((uint64_t)bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+static inline uint64_t Round(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * PRIME64_2;
+    accumulator = RotateLeft(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+static inline uint64_t MergeRound(uint64_t accumulator, uint64_t value)
+{
+    accumulator ^= Round(0, value);
+    return (accumulator * PRIME64_1) + PRIME64_4;
+}
+
+static inline uint64_t MergeLanes(const uint64_t* lanes)
+{
+    uint64_t hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+    hash = MergeRound(hash, lanes[0]);
+    hash = MergeRound(hash, lanes[1]);
+    hash = MergeRound(hash, lanes[2]);
+    hash = MergeRound(hash, lanes[3]);
+    return hash;
+}
+
+static inline void InitLanes(uint64_t* lanes, uint64_t seed)
+{
+    lanes[0] = seed + PRIME64_1 + PRIME64_2;
+    lanes[1] = seed + PRIME64_2;
+    lanes[2] = seed;
+    lanes[3] = seed - PRIME64_1;
+}
+
+// Consumes whole 32-byte stripes and returns where the remainder starts
+static inline const unsigned char* ConsumeStripes(uint64_t* lanes, const unsigned char* cursor, const unsigned char* end)
+{
+    uint64_t v1 = lanes[0];
+    uint64_t v2 = lanes[1];
+    uint64_t v3 = lanes[2];
+    uint64_t v4 = lanes[3];
+    while ((end - cursor) >= 32)
+    {
+        v1 = Round(v1, Read64(cursor));
+        v2 = Round(v2, Read64(cursor + 8));
+        v3 = Round(v3, Read64(cursor + 16));
+        v4 = Round(v4, Read64(cursor + 24));
+        cursor += 32;
+    }
+    lanes[0] = v1;
+    lanes[1] = v2;
+    lanes[2] = v3;
+    lanes[3] = v4;
+    return cursor;
+}
+
+// Mixes in the final (under 32) bytes and avalanches
+static inline uint64_t Finish(uint64_t hash, const unsigned char* cursor, const unsigned char* end)
+{
+    while ((cursor + 8) <= end)
+    {
+        hash ^= Round(0, Read64(cursor));
+        hash = (RotateLeft(hash, 27) * PRIME64_1) + PRIME64_4;
+        cursor += 8;
+    }
+    if ((cursor + 4) <= end)
+    {
+        hash ^= Read32(cursor) * PRIME64_1;
+        hash = (RotateLeft(hash, 23) * PRIME64_2) + PRIME64_3;
+        cursor += 4;
+    }
+    while (cursor < end)
+    {
+        hash ^= (*cursor) * PRIME64_5;
+        hash = RotateLeft(hash, 11) * PRIME64_1;
+        cursor++;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t XTF::HashBytes(const void* data, size_t length, uint64_t seed)
+{
+    const unsigned char* cursor = (const unsigned char*)data;
+    const unsigned char* end = cursor + length;
+    uint64_t hash = 0;
+    if (length >= 32)
+    {
+        uint64_t lanes[4];
+        InitLanes(lanes, seed);
+        cursor = ConsumeStripes(lanes, cursor, end);
+        hash = MergeLanes(lanes);
+    }
+    else
+    {
+        hash = seed + PRIME64_5;
+    }
+    hash += (uint64_t)length;
+    return Finish(hash, cursor, end);
+}
+
+StreamingHash::StreamingHash(uint64_t seed) : seed_(seed), buffered_(0), length_(0)
+{
+    InitLanes(lanes_, seed);
+}
+
+void StreamingHash::Update(const void* data, size_t length)
+{
+    const unsigned char* cursor = (const unsigned char*)data;
+    const unsigned char* end = cursor + length;
+    length_ += length;
+    if (buffered_ > 0)
+    {
+        size_t fill = std::min(length, sizeof(buffer_) - buffered_);
+        memcpy(buffer_ + buffered_, cursor, fill);
+        buffered_ += fill;
+        cursor += fill;
+        if (buffered_ < sizeof(buffer_))
+        {
+            return;
+        }
+        ConsumeStripes(lanes_, buffer_, buffer_ + sizeof(buffer_));
+        buffered_ = 0;
+    }
+    cursor = ConsumeStripes(lanes_, cursor, end);
+    memcpy(buffer_, cursor, end - cursor);
+    buffered_ = end - cursor;
+}
+
+uint64_t StreamingHash::Digest() const
+{
+    uint64_t hash = (length_ >= 32) ? MergeLanes(lanes_) : (seed_ + PRIME64_5);
+    hash += length_;
+    return Finish(hash, buffer_, buffer_ + buffered_);
+}
+
+std::string XTF::HashToHex(uint64_t hash)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+    return std::string(buffer, 16);
+}
@@ -0,0 +1,716 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <libxml/parser.h>
+#include <libxml++/libxml++.h>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/library.hpp"
+
+using namespace XTF;
+
+static const char LIBRARY_MAGIC[] = "XTFLIB01";
+static const uint32_t LIBRARY_VERSION = 1;
+// The last state's start tag is looked for in this many bytes at the end of the file
+static const long LIBRARY_TAIL_BYTES = 64 * 1024;
+
+static bool IsBlank(const std::string& value)
+{
+    return value.find_first_not_of(" \t\r\n") == std::string::npos;
+}
+
+static bool FindAttribute(const std::string& tag, const std::string& name, std::string& value)
+{
+    size_t pos = tag.find(name + "=");
+    while (pos != std::string::npos)
+    {
+        size_t quote = pos + name.size() + 1;
+        if (pos > 0 && isspace((unsigned char)tag[pos - 1]) && quote < tag.size() && (tag[quote] == '"' || tag[quote] == '\''))
+        {
+            size_t close = tag.find(tag[quote], quote + 1);
+            if (close == std::string::npos)
+            {
+                return false;
+            }
+            value = tag.substr(quote + 1, close - quote - 1);
+            return true;
+        }
+        pos = tag.find(name + "=", pos + 1);
+    }
+    return false;
+}
+
+static bool ReadLastStateTiming(const std::string& filename, timespec& timing)
+{
+    FILE* input = fopen(filename.c_str(), "rb");
+    if (input == NULL)
+    {
+        return false;
+    }
+    std::string tail;
+    if (fseek(input, 0, SEEK_END) == 0)
+    {
+        long size = ftell(input);
+        long offset = std::max(0L, size - LIBRARY_TAIL_BYTES);
+        if (size > 0 && fseek(input, offset, SEEK_SET) == 0)
+        {
+            tail.resize((size_t)(size - offset));
+            tail.resize(fread(&tail[0], 1, tail.size(), input));
+        }
+    }
+    fclose(input);
+    // Markup cannot appear inside attribute values or text, so the last "<state" start tag belongs to the last state
+    size_t pos = tail.rfind("<state");
+    while (pos != std::string::npos && !(pos + 6 < tail.size() && isspace((unsigned char)tail[pos + 6])))
+    {
+        pos = (pos == 0) ? std::string::npos : tail.rfind("<state", pos - 1);
+    }
+    if (pos == std::string::npos)
+    {
+        return false;
+    }
+    size_t tag_end = tail.find('>', pos);
+    if (tag_end == std::string::npos)
+    {
+        return false;
+    }
+    std::string tag = tail.substr(pos, tag_end - pos);
+    std::string secs;
+    std::string nsecs;
+    if (!FindAttribute(tag, "secs", secs) || !FindAttribute(tag, "nsecs", nsecs))
+    {
+        return false;
+    }
+    timing.tv_sec = atol(secs.c_str());
+    timing.tv_nsec = atol(nsecs.c_str());
+    return true;
+}
+
+static timespec ReadStateTiming(const xmlpp::TextReader& reader)
+{
+    timespec timing;
+    timing.tv_sec = atol(std::string(reader.get_attribute("secs")).c_str());
+    timing.tv_nsec = atol(std::string(reader.get_attribute("nsecs")).c_str());
+    return timing;
+}
+
+Trajectory Parser::ParseTrajHeader(std::string filename, size_t& length, timespec& start_time, timespec& end_time)
+{
+    Trajectory header;
+    bool found_uid = false;
+    bool found_info = false;
+    bool found_type = false;
+    bool found_states = false;
+    bool found_state = false;
+    std::string length_str;
+    length = 0;
+    start_time.tv_sec = 0;
+    start_time.tv_nsec = 0;
+    end_time = start_time;
+    try
+    {
+        // Stream through the document and stop at the first state, so nothing else is built in memory
+        xmlpp::TextReader reader(filename);
+        while (!found_state && reader.read())
+        {
+            if (reader.get_node_type() != xmlpp::TextReader::Element)
+            {
+                continue;
+            }
+            std::string name = reader.get_name();
+            if (name == "trajectory")
+            {
+                std::string uid = reader.get_attribute("uid");
+                found_uid = !IsBlank(uid);
+                if (found_uid)
+                {
+                    header.uid_ = CleanString(uid);
+                }
+            }
+            else if (name == "info")
+            {
+                std::string robot = reader.get_attribute("robot");
+                std::string generator = reader.get_attribute("generator");
+                found_info = !IsBlank(robot) && !IsBlank(generator);
+                if (found_info)
+                {
+                    header.robot_ = CleanString(robot);
+                    header.generator_ = CleanString(generator);
+                }
+            }
+            else if (name == "type")
+            {
+                std::string timing = reader.get_attribute("timing");
+                std::string traj_type = reader.get_attribute("traj_type");
+                std::string data_type = reader.get_attribute("data_type");
+                if (IsBlank(timing) || IsBlank(traj_type) || IsBlank(data_type))
+                {
+                    throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+                }
+                timing = CleanString(timing);
+                traj_type = CleanString(traj_type);
+                data_type = CleanString(data_type);
+                if (timing == "timed" || timing == "untimed")
+                {
+                    header.timing_ = (timing == "timed") ? Trajectory::TIMED : Trajectory::UNTIMED;
+                }
+                else
+                {
+                    throw std::invalid_argument("Invalid timing type");
+                }
+                if (traj_type == "generated" || traj_type == "recorded")
+                {
+                    header.traj_type_ = (traj_type == "generated") ? Trajectory::GENERATED : Trajectory::RECORDED;
+                }
+                else
+                {
+                    throw std::invalid_argument("Invalid trajectory type");
+                }
+                if (data_type == "joint" || data_type == "pose")
+                {
+                    header.data_type_ = (data_type == "joint") ? Trajectory::JOINT : Trajectory::POSE;
+                }
+                else
+                {
+                    throw std::invalid_argument("Invalid trajectory data type");
+                }
+                found_type = true;
+            }
+            else if (name == "joint_names" || name == "tags" || name == "root_frame" || name == "target_frame")
+            {
+                std::string text = reader.read_string();
+                if (IsBlank(text))
+                {
+                    continue;
+                }
+                if (name == "joint_names")
+                {
+                    header.joint_names_ = ReadStrings(text);
+                }
+                else if (name == "tags")
+                {
+                    header.tags_ = ReadStrings(text);
+                }
+                else if (name == "root_frame")
+                {
+                    header.root_frame_ = CleanString(text);
+                }
+                else
+                {
+                    header.target_frame_ = CleanString(text);
+                }
+            }
+            else if (name == "states")
+            {
+                found_states = true;
+                length_str = reader.get_attribute("length");
+            }
+            else if (name == "state" && found_states)
+            {
+                start_time = ReadStateTiming(reader);
+                found_state = true;
+            }
+        }
+        if (!found_uid || !found_info || !found_type || !found_states)
+        {
+            throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+        }
+        if ((header.data_type_ == Trajectory::JOINT && header.joint_names_.size() == 0) || (header.data_type_ == Trajectory::POSE && (header.root_frame_.size() == 0 || header.target_frame_.size() == 0)))
+        {
+            throw std::invalid_argument("Type fields do not match type attribute");
+        }
+        if (!found_state)
+        {
+            return header;
+        }
+        char* length_end = NULL;
+        long declared_length = strtol(length_str.c_str(), &length_end, 10);
+        bool length_valid = !IsBlank(length_str) && IsBlank(std::string(length_end)) && declared_length > 0;
+        if (length_valid && ReadLastStateTiming(filename, end_time))
+        {
+            length = (size_t)declared_length;
+            return header;
+        }
+        // Without a usable length or tail, skim every state's start tag (skipping its contents)
+        length = 1;
+        end_time = start_time;
+        bool more = reader.next();
+        while (more)
+        {
+            if (reader.get_node_type() == xmlpp::TextReader::Element && std::string(reader.get_name()) == "state")
+            {
+                length++;
+                end_time = ReadStateTiming(reader);
+                more = reader.next();
+            }
+            else
+            {
+                more = reader.read();
+            }
+        }
+        return header;
+    }
+    catch (xmlpp::exception& e)
+    {
+        std::string error_str("Unable to read XTF file (file may not exist): " + filename);
+        throw std::invalid_argument(error_str.c_str());
+    }
+}
+
+static std::string LowerCase(std::string value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+static std::vector< std::pair<std::string, bool> > TokenizeQuery(const std::string& query)
+{
+    // Each token is paired with whether it was quoted, so quoted values are never read as keywords
+    std::vector< std::pair<std::string, bool> > tokens;
+    size_t pos = 0;
+    while (pos < query.size())
+    {
+        char current = query[pos];
+        if (isspace((unsigned char)current))
+        {
+            pos++;
+        }
+        else if (current == '"' || current == '\'')
+        {
+            size_t close = query.find(current, pos + 1);
+            if (close == std::string::npos)
+            {
+                throw std::invalid_argument("Library query has an unterminated quote");
+            }
+            tokens.push_back(std::make_pair(query.substr(pos + 1, close - pos - 1), true));
+            pos = close + 1;
+        }
+        else if (strchr("=!<>", current) != NULL)
+        {
+            size_t op_length = ((pos + 1) < query.size() && query[pos + 1] == '=' && current != '=') ? 2 : 1;
+            tokens.push_back(std::make_pair(query.substr(pos, op_length), false));
+            pos += op_length;
+        }
+        else
+        {
+            size_t end = pos;
+            while (end < query.size() && !isspace((unsigned char)query[end]) && strchr("=!<>'\"", query[end]) == NULL)
+            {
+                end++;
+            }
+            tokens.push_back(std::make_pair(query.substr(pos, end - pos), false));
+            pos = end;
+        }
+    }
+    return tokens;
+}
+
+static bool IsStringField(const std::string& field)
+{
+    return (field == "uid" || field == "robot" || field == "generator" || field == "traj_type" || field == "timing" || field == "data_type" || field == "root_frame" || field == "target_frame" || field == "path");
+}
+
+static bool IsListField(const std::string& field)
+{
+    return (field == "tags" || field == "joint_names");
+}
+
+static bool IsNumericField(const std::string& field)
+{
+    return (field == "length" || field == "duration");
+}
+
+LibraryQuery::LibraryQuery(const std::string& query)
+{
+    std::vector< std::pair<std::string, bool> > tokens = TokenizeQuery(query);
+    size_t pos = 0;
+    while (pos < tokens.size())
+    {
+        if ((pos + 3) > tokens.size())
+        {
+            throw std::invalid_argument("Library query clause is incomplete: " + query);
+        }
+        Clause clause;
+        clause.field_ = LowerCase(tokens[pos].first);
+        clause.op_ = LowerCase(tokens[pos + 1].first);
+        clause.value_ = tokens[pos + 2].first;
+        clause.number_ = 0.0;
+        bool equality = (clause.op_ == "=" || clause.op_ == "!=");
+        bool ordering = (clause.op_ == "<" || clause.op_ == "<=" || clause.op_ == ">" || clause.op_ == ">=");
+        if (IsStringField(clause.field_) && equality)
+        {
+            // Done
+        }
+        else if (IsListField(clause.field_) && clause.op_ == "contains")
+        {
+            // Done
+        }
+        else if (IsNumericField(clause.field_) && (equality || ordering))
+        {
+            std::string number = clause.value_;
+            if (clause.field_ == "duration" && number.size() > 1 && number[number.size() - 1] == 's')
+            {
+                number.erase(number.size() - 1);
+            }
+            char* number_end = NULL;
+            clause.number_ = strtod(number.c_str(), &number_end);
+            if (number.size() == 0 || *number_end != '\0')
+            {
+                throw std::invalid_argument("Library query value is not a number: " + clause.value_);
+            }
+        }
+        else
+        {
+            throw std::invalid_argument("Library query clause is invalid: " + clause.field_ + " " + clause.op_ + " " + clause.value_);
+        }
+        clauses_.push_back(clause);
+        pos += 3;
+        if (pos < tokens.size())
+        {
+            if (tokens[pos].second || LowerCase(tokens[pos].first) != "and")
+            {
+                throw std::invalid_argument("Library query clauses must be joined by AND: " + query);
+            }
+            pos++;
+            if (pos == tokens.size())
+            {
+                throw std::invalid_argument("Library query clause is incomplete: " + query);
+            }
+        }
+    }
+}
+
+static std::string StringField(const TrajectoryHeader& entry, const std::string& field)
+{
+    const Trajectory& header = entry.header_;
+    if (field == "uid")
+    {
+        return header.uid_;
+    }
+    else if (field == "robot")
+    {
+        return header.robot_;
+    }
+    else if (field == "generator")
+    {
+        return header.generator_;
+    }
+    else if (field == "traj_type")
+    {
+        return (header.traj_type_ == Trajectory::GENERATED) ? "generated" : "recorded";
+    }
+    else if (field == "timing")
+    {
+        return (header.timing_ == Trajectory::TIMED) ? "timed" : "untimed";
+    }
+    else if (field == "data_type")
+    {
+        return (header.data_type_ == Trajectory::JOINT) ? "joint" : "pose";
+    }
+    else if (field == "root_frame")
+    {
+        return header.root_frame_;
+    }
+    else if (field == "target_frame")
+    {
+        return header.target_frame_;
+    }
+    else
+    {
+        return entry.path_;
+    }
+}
+
+bool LibraryQuery::Matches(const TrajectoryHeader& entry) const
+{
+    for (size_t idx = 0; idx < clauses_.size(); idx++)
+    {
+        const Clause& clause = clauses_[idx];
+        bool matched = false;
+        if (IsStringField(clause.field_))
+        {
+            matched = ((StringField(entry, clause.field_) == clause.value_) == (clause.op_ == "="));
+        }
+        else if (IsListField(clause.field_))
+        {
+            const std::vector<std::string>& values = (clause.field_ == "tags") ? entry.header_.tags_ : entry.header_.joint_names_;
+            matched = (std::find(values.begin(), values.end(), clause.value_) != values.end());
+        }
+        else
+        {
+            double value = (clause.field_ == "length") ? (double)entry.length_ : entry.Duration();
+            if (clause.op_ == "=")
+            {
+                matched = (value == clause.number_);
+            }
+            else if (clause.op_ == "!=")
+            {
+                matched = (value != clause.number_);
+            }
+            else if (clause.op_ == "<")
+            {
+                matched = (value < clause.number_);
+            }
+            else if (clause.op_ == "<=")
+            {
+                matched = (value <= clause.number_);
+            }
+            else if (clause.op_ == ">")
+            {
+                matched = (value > clause.number_);
+            }
+            else
+            {
+                matched = (value >= clause.number_);
+            }
+        }
+        if (!matched)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void FindTrajectoryFiles(const std::string& directory, std::vector<TrajectoryHeader>& found)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (dir == NULL)
+    {
+        return;
+    }
+    struct dirent* dirent_ptr = NULL;
+    while ((dirent_ptr = readdir(dir)) != NULL)
+    {
+        std::string name(dirent_ptr->d_name);
+        if (name == "." || name == "..")
+        {
+            continue;
+        }
+        std::string path = directory + "/" + name;
+        struct stat info;
+        if (lstat(path.c_str(), &info) != 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode))
+        {
+            FindTrajectoryFiles(path, found);
+            continue;
+        }
+        // Symlinked files are followed, but symlinked directories are not, so link cycles cannot recurse
+        if (S_ISLNK(info.st_mode) && (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)))
+        {
+            continue;
+        }
+        if (S_ISREG(info.st_mode) && name.size() > 4 && name.compare(name.size() - 4, 4, ".xtf") == 0)
+        {
+            TrajectoryHeader entry;
+            entry.path_ = path;
+            entry.file_size_ = (uint64_t)info.st_size;
+            entry.mtime_ = info.st_mtim;
+            found.push_back(entry);
+        }
+    }
+    closedir(dir);
+}
+
+static bool CompareEntryPaths(const TrajectoryHeader& first, const TrajectoryHeader& second)
+{
+    return first.path_ < second.path_;
+}
+
+TrajectoryLibrary::TrajectoryLibrary(std::string root, std::string index_path)
+{
+    root_ = root;
+    index_path_ = (index_path.size() > 0) ? index_path : (root + "/.xtf_library.idx");
+    LoadIndex();
+}
+
+void TrajectoryLibrary::LoadIndex()
+{
+    entries_.clear();
+    FILE* input = fopen(index_path_.c_str(), "rb");
+    if (input == NULL)
+    {
+        return;
+    }
+    std::string contents;
+    char buffer[1 << 16];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    {
+        contents.append(buffer, read);
+    }
+    fclose(input);
+    try
+    {
+        ByteReader reader(contents.data(), contents.size());
+        if (memcmp(reader.ReadBytes(8), LIBRARY_MAGIC, 8) != 0 || reader.ReadUInt32() != LIBRARY_VERSION)
+        {
+            return;
+        }
+        uint64_t count = reader.ReadUInt64();
+        Parser parser;
+        std::vector<TrajectoryHeader> loaded;
+        for (uint64_t idx = 0; idx < count; idx++)
+        {
+            TrajectoryHeader entry;
+            entry.path_ = reader.ReadString();
+            entry.file_size_ = reader.ReadUInt64();
+            entry.mtime_.tv_sec = (time_t)reader.ReadInt64();
+            entry.mtime_.tv_nsec = (long)reader.ReadInt64();
+            entry.length_ = (size_t)reader.ReadUInt64();
+            entry.start_time_.tv_sec = (time_t)reader.ReadInt64();
+            entry.start_time_.tv_nsec = (long)reader.ReadInt64();
+            entry.end_time_.tv_sec = (time_t)reader.ReadInt64();
+            entry.end_time_.tv_nsec = (long)reader.ReadInt64();
+            std::string encoded_header = reader.ReadString();
+            entry.header_ = parser.DecodeBinary(encoded_header.data(), encoded_header.size());
+            loaded.push_back(entry);
+        }
+        entries_.swap(loaded);
+    }
+    catch (std::invalid_argument& e)
+    {
+        // A corrupt index is rebuilt by the next Update()
+        entries_.clear();
+    }
+}
+
+void TrajectoryLibrary::SaveIndex()
+{
+    Parser parser;
+    std::string buffer(LIBRARY_MAGIC, 8);
+    AppendUInt32(buffer, LIBRARY_VERSION);
+    AppendUInt64(buffer, entries_.size());
+    for (size_t idx = 0; idx < entries_.size(); idx++)
+    {
+        const TrajectoryHeader& entry = entries_[idx];
+        AppendString(buffer, entry.path_);
+        AppendUInt64(buffer, entry.file_size_);
+        AppendInt64(buffer, entry.mtime_.tv_sec);
+        AppendInt64(buffer, entry.mtime_.tv_nsec);
+        AppendUInt64(buffer, entry.length_);
+        AppendInt64(buffer, entry.start_time_.tv_sec);
+        AppendInt64(buffer, entry.start_time_.tv_nsec);
+        AppendInt64(buffer, entry.end_time_.tv_sec);
+        AppendInt64(buffer, entry.end_time_.tv_nsec);
+        AppendString(buffer, parser.EncodeBinary(TrajectoryView(entry.header_)));
+    }
+    // Write-then-rename, so a concurrent reader never sees a partially written index
+    std::string temp_path = index_path_ + ".tmp";
+    FILE* output = fopen(temp_path.c_str(), "wb");
+    if (output == NULL)
+    {
+        throw std::runtime_error("Unable to write trajectory library index: " + index_path_);
+    }
+    size_t written = fwrite(buffer.data(), 1, buffer.size(), output);
+    bool closed = (fclose(output) == 0);
+    if (written != buffer.size() || !closed || rename(temp_path.c_str(), index_path_.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        throw std::runtime_error("Unable to write trajectory library index: " + index_path_);
+    }
+}
+
+size_t TrajectoryLibrary::Update(size_t threads)
+{
+    std::vector<TrajectoryHeader> found;
+    FindTrajectoryFiles(root_, found);
+    std::map<std::string, const TrajectoryHeader*> indexed;
+    for (size_t idx = 0; idx < entries_.size(); idx++)
+    {
+        indexed[entries_[idx].path_] = &entries_[idx];
+    }
+    std::vector<size_t> changed;
+    for (size_t idx = 0; idx < found.size(); idx++)
+    {
+        std::map<std::string, const TrajectoryHeader*>::const_iterator existing = indexed.find(found[idx].path_);
+        if (existing != indexed.end() && existing->second->file_size_ == found[idx].file_size_ && CompareTimespecs(existing->second->mtime_, found[idx].mtime_) == 0)
+        {
+            found[idx] = *(existing->second);
+        }
+        else
+        {
+            changed.push_back(idx);
+        }
+    }
+    xmlInitParser();
+    std::vector<char> readable(found.size(), 1);
+    ParallelFor(changed.size(), threads, [&](size_t task)
+    {
+        TrajectoryHeader& entry = found[changed[task]];
+        try
+        {
+            Parser parser;
+            entry.header_ = parser.ParseTrajHeader(entry.path_, entry.length_, entry.start_time_, entry.end_time_);
+        }
+        catch (std::exception& e)
+        {
+            // Unreadable files are left out of the index and retried on the next update
+            readable[changed[task]] = 0;
+        }
+    });
+    std::vector<TrajectoryHeader> updated;
+    updated.reserve(found.size());
+    for (size_t idx = 0; idx < found.size(); idx++)
+    {
+        if (readable[idx])
+        {
+            updated.push_back(found[idx]);
+        }
+    }
+    std::sort(updated.begin(), updated.end(), CompareEntryPaths);
+    entries_.swap(updated);
+    SaveIndex();
+    return changed.size();
+}
+
+const std::vector<TrajectoryHeader>& TrajectoryLibrary::Entries() const
+{
+    return entries_;
+}
+
+std::vector<TrajectoryHeader> TrajectoryLibrary::Query(const std::string& query) const
+{
+    LibraryQuery compiled(query);
+    std::vector<TrajectoryHeader> matches;
+    for (size_t idx = 0; idx < entries_.size(); idx++)
+    {
+        if (compiled.Matches(entries_[idx]))
+        {
+            matches.push_back(entries_[idx]);
+        }
+    }
+    return matches;
+}
+
+std::vector<Trajectory> TrajectoryLibrary::LoadMatching(const std::string& query, size_t threads) const
+{
+    std::vector<TrajectoryHeader> matches = Query(query);
+    std::vector<Trajectory> loaded(matches.size());
+    xmlInitParser();
+    ParallelFor(matches.size(), threads, [&](size_t task)
+    {
+        Parser parser;
+        loaded[task] = parser.ParseTraj(matches[task].path_);
+    });
+    return loaded;
+}
+
+size_t TrajectoryLibrary::size() const
+{
+    return entries_.size();
+}
@@ -0,0 +1,223 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include "xtf/xtf.hpp"
+
+using namespace XTF;
+
+// An estimate of the allocator and tree bookkeeping around each map node and shared block
+static const size_t MAP_NODE_OVERHEAD = 4 * sizeof(void*);
+static const size_t BLOCK_OVERHEAD = 4 * sizeof(void*);
+
+static std::atomic<size_t> live_trajectory_bytes(0);
+
+size_t XTF::LiveTrajectoryBytes()
+{
+    return live_trajectory_bytes.load();
+}
+
+static size_t StringHeapBytes(const std::string& value)
+{
+    // Short strings live inside the object where the library has a small-string buffer
+    static const size_t inline_capacity = std::string().capacity();
+    return (value.capacity() > inline_capacity) ? (value.capacity() + 1) : 0;
+}
+
+static size_t StringsHeapBytes(const std::vector<std::string>& values)
+{
+    size_t bytes = values.capacity() * sizeof(std::string);
+    for (size_t idx = 0; idx < values.size(); idx++)
+    {
+        bytes += StringHeapBytes(values[idx]);
+    }
+    return bytes;
+}
+
+static void CompactStrings(std::vector<std::string>& values)
+{
+    for (size_t idx = 0; idx < values.size(); idx++)
+    {
+        values[idx].shrink_to_fit();
+    }
+    values.shrink_to_fit();
+}
+
+static size_t FieldBytes(const State& state)
+{
+    size_t bytes = 0;
+    for (int field = 0; field < State::NUM_FIELDS; field++)
+    {
+        bytes += state.Field((State::FIELDS)field).capacity() * sizeof(double);
+    }
+    return bytes;
+}
+
+static size_t ExtrasBytes(const State& state)
+{
+    size_t bytes = 0;
+    for (std::map<std::string, KeyValue>::const_iterator itr = state.extras_.begin(); itr != state.extras_.end(); ++itr)
+    {
+        bytes += MAP_NODE_OVERHEAD + sizeof(std::string) + sizeof(KeyValue) + StringHeapBytes(itr->first) + itr->second.HeapBytes();
+    }
+    return bytes;
+}
+
+size_t KeyValue::HeapBytes() const
+{
+    // A payload shared by several copies is counted by each of them
+    if (type_ == KV_STRING)
+    {
+        return BLOCK_OVERHEAD + sizeof(std::string) + StringHeapBytes(Payload<std::string>());
+    }
+    else if (type_ == KV_BOOLEANLIST)
+    {
+        return BLOCK_OVERHEAD + sizeof(std::vector<bool>) + ((Payload<std::vector<bool>>().capacity() + 7) / 8);
+    }
+    else if (type_ == KV_INTEGERLIST)
+    {
+        return BLOCK_OVERHEAD + sizeof(std::vector<long>) + (Payload<std::vector<long>>().capacity() * sizeof(long));
+    }
+    else if (type_ == KV_DOUBLELIST)
+    {
+        return BLOCK_OVERHEAD + sizeof(std::vector<double>) + (Payload<std::vector<double>>().capacity() * sizeof(double));
+    }
+    else if (type_ == KV_STRINGLIST)
+    {
+        return BLOCK_OVERHEAD + sizeof(std::vector<std::string>) + StringsHeapBytes(Payload<std::vector<std::string>>());
+    }
+    return 0;
+}
+
+void KeyValue::Compact()
+{
+    // Payloads are immutable, so an unshared one is replaced by an exact-size copy
+    if (payload_.use_count() != 1)
+    {
+        return;
+    }
+    if (type_ == KV_STRING)
+    {
+        SetValue(std::string(Payload<std::string>()));
+    }
+    else if (type_ == KV_BOOLEANLIST)
+    {
+        SetValue(std::vector<bool>(Payload<std::vector<bool>>()));
+    }
+    else if (type_ == KV_INTEGERLIST)
+    {
+        SetValue(std::vector<long>(Payload<std::vector<long>>()));
+    }
+    else if (type_ == KV_DOUBLELIST)
+    {
+        SetValue(std::vector<double>(Payload<std::vector<double>>()));
+    }
+    else if (type_ == KV_STRINGLIST)
+    {
+        std::vector<std::string> values(Payload<std::vector<std::string>>());
+        CompactStrings(values);
+        SetValue(std::move(values));
+    }
+}
+
+StateStorage::Block::~Block()
+{
+    live_trajectory_bytes -= bytes_;
+}
+
+size_t StateStorage::StateBytes(const State& state)
+{
+    return FieldBytes(state) + ExtrasBytes(state);
+}
+
+void StateStorage::Account(Block& block, size_t bytes)
+{
+    live_trajectory_bytes += bytes;
+    live_trajectory_bytes -= block.bytes_;
+    block.bytes_ = bytes;
+}
+
+void StateStorage::Recount(Block& block)
+{
+    size_t bytes = block.states_.capacity() * sizeof(State);
+    for (size_t idx = 0; idx < block.states_.size(); idx++)
+    {
+        bytes += StateBytes(block.states_[idx]);
+    }
+    Account(block, bytes);
+}
+
+void StateStorage::AddMemoryUsage(MemoryBreakdown& usage) const
+{
+    usage.states_ += blocks_.capacity() * sizeof(std::shared_ptr<Block>);
+    for (size_t block = 0; block < blocks_.size(); block++)
+    {
+        const std::vector<State>& states = blocks_[block]->states_;
+        size_t state_bytes = BLOCK_OVERHEAD + sizeof(Block) + (states.capacity() * sizeof(State));
+        size_t field_bytes = 0;
+        size_t extras_bytes = 0;
+        for (size_t idx = 0; idx < states.size(); idx++)
+        {
+            field_bytes += FieldBytes(states[idx]);
+            extras_bytes += ExtrasBytes(states[idx]);
+        }
+        usage.states_ += state_bytes;
+        usage.fields_ += field_bytes;
+        usage.extras_ += extras_bytes;
+        if (blocks_[block].use_count() > 1)
+        {
+            usage.shared_ += state_bytes + field_bytes + extras_bytes;
+        }
+    }
+}
+
+void StateStorage::Compact()
+{
+    for (size_t block = 0; block < blocks_.size(); block++)
+    {
+        if (blocks_[block].use_count() > 1)
+        {
+            continue;
+        }
+        // Block vectors keep their BLOCK_STATES capacity, so the last block can still be appended to in place
+        std::vector<State>& states = blocks_[block]->states_;
+        for (size_t idx = 0; idx < states.size(); idx++)
+        {
+            State& state = states[idx];
+            for (int field = 0; field < State::NUM_FIELDS; field++)
+            {
+                state.Field((State::FIELDS)field).shrink_to_fit();
+            }
+            for (std::map<std::string, KeyValue>::iterator itr = state.extras_.begin(); itr != state.extras_.end(); ++itr)
+            {
+                itr->second.Compact();
+            }
+        }
+        Recount(*blocks_[block]);
+    }
+    blocks_.shrink_to_fit();
+}
+
+MemoryBreakdown Trajectory::MemoryUsage() const
+{
+    MemoryBreakdown usage;
+    trajectory_.AddMemoryUsage(usage);
+    usage.strings_ += StringHeapBytes(robot_) + StringHeapBytes(generator_) + StringHeapBytes(root_frame_) + StringHeapBytes(target_frame_) + StringHeapBytes(uid_);
+    usage.strings_ += StringsHeapBytes(joint_names_) + StringsHeapBytes(tags_);
+    return usage;
+}
+
+void Trajectory::Compact()
+{
+    robot_.shrink_to_fit();
+    generator_.shrink_to_fit();
+    root_frame_.shrink_to_fit();
+    target_frame_.shrink_to_fit();
+    uid_.shrink_to_fit();
+    CompactStrings(joint_names_);
+    CompactStrings(tags_);
+    trajectory_.Compact();
+}
@@ -0,0 +1,73 @@
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include "xtf/parallel.hpp"
+
+size_t XTF::ResolveThreads(size_t requested)
+{
+    if (requested > 0)
+    {
+        return requested;
+    }
+    size_t hardware = std::thread::hardware_concurrency();
+    return (hardware > 0) ? hardware : 1;
+}
+
+void XTF::ParallelFor(size_t num_tasks, size_t threads, const std::function<void(size_t)>& work)
+{
+    size_t workers = std::min(ResolveThreads(threads), num_tasks);
+    if (workers <= 1)
+    {
+        for (size_t task = 0; task < num_tasks; task++)
+        {
+            work(task);
+        }
+        return;
+    }
+    std::atomic<size_t> next_task(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
+    std::vector<std::thread> pool;
+    pool.reserve(workers);
+    for (size_t worker = 0; worker < workers; worker++)
+    {
+        pool.push_back(std::thread([&]()
+        {
+            while (!failed.load())
+            {
+                size_t task = next_task.fetch_add(1);
+                if (task >= num_tasks)
+                {
+                    return;
+                }
+                try
+                {
+                    work(task);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(failure_mutex);
+                    if (!failed.load())
+                    {
+                        failure = std::current_exception();
+                        failed.store(true);
+                    }
+                }
+            }
+        }));
+    }
+    for (size_t worker = 0; worker < pool.size(); worker++)
+    {
+        pool[worker].join();
+    }
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+}
@@ -0,0 +1,338 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+#include "xtf/player.hpp"
+
+using namespace XTF;
+
+static inline double Elapsed(const timespec& from, const timespec& to)
+{
+    return (double)(to.tv_sec - from.tv_sec) + ((double)(to.tv_nsec - from.tv_nsec) * 0.000000001);
+}
+
+static bool HasFieldEverywhere(const TrajectoryView& view, State::FIELDS field, size_t data_length)
+{
+    for (size_t idx = 0; idx < view.size(); idx++)
+    {
+        if (view[idx].Field(field).size() != data_length)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Interpolates unit quaternions [X,Y,Z,W] along the shorter arc, as InterpolatePoses does
+static inline void Slerp(const double* start, const double* end, double t, double* out)
+{
+    double cos_theta = 0.0;
+    for (size_t idx = 0; idx < 4; idx++)
+    {
+        cos_theta += start[idx] * end[idx];
+    }
+    double sign = (cos_theta < 0.0) ? -1.0 : 1.0;
+    cos_theta = std::min(std::fabs(cos_theta), 1.0);
+    double start_weight = 1.0 - t;
+    double end_weight = t;
+    if (cos_theta < 0.9995)
+    {
+        double theta = acos(cos_theta);
+        start_weight = sin((1.0 - t) * theta) / sin(theta);
+        end_weight = sin(t * theta) / sin(theta);
+    }
+    double norm = 0.0;
+    for (size_t idx = 0; idx < 4; idx++)
+    {
+        out[idx] = (start_weight * start[idx]) + (sign * end_weight * end[idx]);
+        norm += out[idx] * out[idx];
+    }
+    norm = sqrt(norm);
+    for (size_t idx = 0; idx < 4; idx++)
+    {
+        out[idx] /= norm;
+    }
+}
+
+PlaybackBuffer::PlaybackBuffer(const TrajectoryView& view, size_t data_length)
+{
+    if (view.size() == 0)
+    {
+        throw std::invalid_argument("Cannot play back an empty trajectory");
+    }
+    if (!HasFieldEverywhere(view, State::POSITION_DESIRED, data_length))
+    {
+        throw std::invalid_argument("Every state must have desired positions to be played back");
+    }
+    count_ = view.size();
+    data_length_ = data_length;
+    times_.resize(count_);
+    positions_.resize(count_ * data_length_);
+    bool has_velocities = HasFieldEverywhere(view, State::VELOCITY_DESIRED, data_length);
+    bool has_accelerations = HasFieldEverywhere(view, State::ACCELERATION_DESIRED, data_length);
+    if (has_velocities)
+    {
+        velocities_.resize(count_ * data_length_);
+    }
+    if (has_accelerations)
+    {
+        accelerations_.resize(count_ * data_length_);
+    }
+    for (size_t idx = 0; idx < count_; idx++)
+    {
+        const State& state = view[idx];
+        times_[idx] = Elapsed(view[0].timing_, state.timing_);
+        if (idx > 0 && !(times_[idx] > times_[idx - 1]))
+        {
+            throw std::invalid_argument("State times must be strictly increasing to be played back");
+        }
+        memcpy(&positions_[idx * data_length_], state.position_desired_.data(), data_length_ * sizeof(double));
+        if (has_velocities)
+        {
+            memcpy(&velocities_[idx * data_length_], state.velocity_desired_.data(), data_length_ * sizeof(double));
+        }
+        if (has_accelerations)
+        {
+            memcpy(&accelerations_[idx * data_length_], state.acceleration_desired_.data(), data_length_ * sizeof(double));
+        }
+    }
+    duration_ = times_[count_ - 1];
+}
+
+TrajectoryPlayer::TrajectoryPlayer(const Trajectory& header) : published_(NULL), in_use_(NULL), paused_(false), time_scale_(1.0), seek_target_(NAN)
+{
+    pose_ = (header.data_type_ == Trajectory::POSE);
+    data_length_ = pose_ ? 7 : header.joint_names_.size();
+    active_ = NULL;
+    segment_ = 0;
+    playback_time_ = 0.0;
+    last_step_.tv_sec = 0;
+    last_step_.tv_nsec = 0;
+    started_ = false;
+}
+
+TrajectoryPlayer::~TrajectoryPlayer()
+{
+    for (size_t idx = 0; idx < owned_.size(); idx++)
+    {
+        delete owned_[idx];
+    }
+}
+
+void TrajectoryPlayer::Load(const TrajectoryView& view)
+{
+    const Trajectory& header = view.Header();
+    size_t data_length = (header.data_type_ == Trajectory::POSE) ? 7 : header.joint_names_.size();
+    if (data_length != data_length_ || (header.data_type_ == Trajectory::POSE) != pose_)
+    {
+        throw std::invalid_argument("Trajectory does not match the player's data length");
+    }
+    if (header.timing_ != Trajectory::TIMED)
+    {
+        throw std::invalid_argument("Only TIMED trajectories can be played back");
+    }
+    PlaybackBuffer* buffer = new PlaybackBuffer(view, data_length_);
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    owned_.push_back(buffer);
+    published_.store(buffer);
+    // Anything neither published nor announced by Step() can no longer be reached by it
+    PlaybackBuffer* in_use = in_use_.load();
+    std::vector<PlaybackBuffer*> kept;
+    for (size_t idx = 0; idx < owned_.size(); idx++)
+    {
+        if (owned_[idx] == buffer || owned_[idx] == in_use)
+        {
+            kept.push_back(owned_[idx]);
+        }
+        else
+        {
+            delete owned_[idx];
+        }
+    }
+    owned_.swap(kept);
+}
+
+void TrajectoryPlayer::Pause()
+{
+    paused_.store(true);
+}
+
+void TrajectoryPlayer::Resume()
+{
+    paused_.store(false);
+}
+
+void TrajectoryPlayer::Seek(double seconds)
+{
+    seek_target_.store(seconds);
+}
+
+void TrajectoryPlayer::SetTimeScale(double time_scale)
+{
+    time_scale_.store(time_scale);
+}
+
+void TrajectoryPlayer::Adopt()
+{
+    // Announce the buffer before using it, then make sure it was not replaced (and possibly freed)
+    // in between; a buffer that is still published after the announcement is safe to use
+    PlaybackBuffer* published = published_.load();
+    while (true)
+    {
+        in_use_.store(published);
+        PlaybackBuffer* check = published_.load();
+        if (check == published)
+        {
+            break;
+        }
+        published = check;
+    }
+    active_ = published;
+    segment_ = 0;
+    playback_time_ = 0.0;
+}
+
+void TrajectoryPlayer::FindSegment(bool search)
+{
+    const std::vector<double>& times = active_->times_;
+    size_t last_segment = (active_->count_ > 1) ? (active_->count_ - 2) : 0;
+    if (search)
+    {
+        size_t end = std::upper_bound(times.begin(), times.end(), playback_time_) - times.begin();
+        segment_ = std::min((end > 0) ? (end - 1) : 0, last_segment);
+        return;
+    }
+    while (segment_ < last_segment && times[segment_ + 1] <= playback_time_)
+    {
+        segment_++;
+    }
+    while (segment_ > 0 && times[segment_] > playback_time_)
+    {
+        segment_--;
+    }
+}
+
+void TrajectoryPlayer::Interpolate(double* position, double* velocity, double* acceleration, double time_scale) const
+{
+    const PlaybackBuffer& buffer = *active_;
+    size_t length = buffer.data_length_;
+    if (buffer.count_ == 1 || playback_time_ >= buffer.duration_)
+    {
+        const double* last = &buffer.positions_[(buffer.count_ - 1) * length];
+        for (size_t idx = 0; idx < length; idx++)
+        {
+            if (position != NULL)
+            {
+                position[idx] = last[idx];
+            }
+            if (velocity != NULL)
+            {
+                velocity[idx] = 0.0;
+            }
+            if (acceleration != NULL)
+            {
+                acceleration[idx] = 0.0;
+            }
+        }
+        return;
+    }
+    size_t start = segment_;
+    double step = buffer.times_[start + 1] - buffer.times_[start];
+    double u = std::min(std::max((playback_time_ - buffer.times_[start]) / step, 0.0), 1.0);
+    const double* p0 = &buffer.positions_[start * length];
+    const double* p1 = p0 + length;
+    bool hermite = (buffer.velocities_.size() > 0);
+    const double* v0 = hermite ? &buffer.velocities_[start * length] : NULL;
+    const double* v1 = hermite ? (v0 + length) : NULL;
+    const double* a0 = (buffer.accelerations_.size() > 0) ? &buffer.accelerations_[start * length] : NULL;
+    const double* a1 = (a0 != NULL) ? (a0 + length) : NULL;
+    double u2 = u * u;
+    double u3 = u2 * u;
+    double h00 = (2.0 * u3) - (3.0 * u2) + 1.0;
+    double h10 = u3 - (2.0 * u2) + u;
+    double h01 = (-2.0 * u3) + (3.0 * u2);
+    double h11 = u3 - u2;
+    for (size_t idx = 0; idx < length; idx++)
+    {
+        if (position != NULL)
+        {
+            if (hermite)
+            {
+                position[idx] = (h00 * p0[idx]) + (h10 * step * v0[idx]) + (h01 * p1[idx]) + (h11 * step * v1[idx]);
+            }
+            else
+            {
+                position[idx] = p0[idx] + (u * (p1[idx] - p0[idx]));
+            }
+        }
+        if (velocity != NULL)
+        {
+            double value = hermite ? (v0[idx] + (u * (v1[idx] - v0[idx]))) : ((p1[idx] - p0[idx]) / step);
+            velocity[idx] = value * time_scale;
+        }
+        if (acceleration != NULL)
+        {
+            double value = (a0 != NULL) ? (a0[idx] + (u * (a1[idx] - a0[idx]))) : 0.0;
+            acceleration[idx] = value * time_scale * time_scale;
+        }
+    }
+    if (pose_ && position != NULL)
+    {
+        Slerp(p0 + 3, p1 + 3, u, position + 3);
+    }
+}
+
+TrajectoryPlayer::STATUS TrajectoryPlayer::Step(const timespec& now, double* position, double* velocity, double* acceleration)
+{
+    bool search = false;
+    if (published_.load(std::memory_order_acquire) != active_)
+    {
+        Adopt();
+        search = true;
+    }
+    // A newly adopted trajectory starts at its first state on this step
+    double elapsed = (started_ && !search) ? Elapsed(last_step_, now) : 0.0;
+    last_step_ = now;
+    started_ = true;
+    if (active_ == NULL)
+    {
+        return IDLE;
+    }
+    bool paused = paused_.load(std::memory_order_relaxed);
+    double time_scale = time_scale_.load(std::memory_order_relaxed);
+    double seek = seek_target_.exchange(NAN);
+    if (seek == seek)
+    {
+        playback_time_ = seek;
+        search = true;
+    }
+    else if (!paused)
+    {
+        playback_time_ += elapsed * time_scale;
+    }
+    playback_time_ = std::min(std::max(playback_time_, 0.0), active_->duration_);
+    FindSegment(search);
+    Interpolate(position, velocity, acceleration, paused ? 0.0 : time_scale);
+    if (paused)
+    {
+        return PAUSED;
+    }
+    return (playback_time_ >= active_->duration_) ? FINISHED : PLAYING;
+}
+
+double TrajectoryPlayer::PlaybackTime() const
+{
+    return playback_time_;
+}
+
+size_t TrajectoryPlayer::data_length() const
+{
+    return data_length_;
+}
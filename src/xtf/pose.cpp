@@ -0,0 +1,497 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "xtf/xtf.hpp"
+#include "xtf/pose.hpp"
+
+using namespace XTF;
+
+/* The kernels are written once over a value type, and run two poses at a time with SSE2 where
+ * available before finishing the remainder with plain doubles.
+ */
+
+#if defined(__SSE2__)
+class Packed2
+{
+public:
+
+    __m128d value_;
+
+    Packed2() {}
+
+    Packed2(__m128d value) : value_(value) {}
+
+};
+
+static inline Packed2 operator+(const Packed2& first, const Packed2& second) { return _mm_add_pd(first.value_, second.value_); }
+
+static inline Packed2 operator-(const Packed2& first, const Packed2& second) { return _mm_sub_pd(first.value_, second.value_); }
+
+static inline Packed2 operator*(const Packed2& first, const Packed2& second) { return _mm_mul_pd(first.value_, second.value_); }
+
+static inline Packed2 operator/(const Packed2& first, const Packed2& second) { return _mm_div_pd(first.value_, second.value_); }
+
+static inline Packed2 operator-(const Packed2& value) { return _mm_sub_pd(_mm_setzero_pd(), value.value_); }
+
+static inline Packed2 Sqrt(const Packed2& value) { return _mm_sqrt_pd(value.value_); }
+
+static inline void Load(const double* values, size_t stride, Packed2& loaded)
+{
+    loaded = (stride == 0) ? _mm_set1_pd(values[0]) : _mm_loadu_pd(values);
+}
+
+static inline void Store(double* values, const Packed2& stored)
+{
+    _mm_storeu_pd(values, stored.value_);
+}
+#endif
+
+static inline double Sqrt(double value) { return sqrt(value); }
+
+static inline void Load(const double* values, size_t, double& loaded)
+{
+    loaded = values[0];
+}
+
+static inline void Store(double* values, const double& stored)
+{
+    values[0] = stored;
+}
+
+template <typename V>
+static inline void ComposeKernel(const V* first, const V* second, V* out)
+{
+    // Rotates second's translation by first's quaternion: u = 2 * (q x v), v' = v + w * u + q x u
+    V ux = (first[PoseStream::QY] * second[PoseStream::Z]) - (first[PoseStream::QZ] * second[PoseStream::Y]);
+    V uy = (first[PoseStream::QZ] * second[PoseStream::X]) - (first[PoseStream::QX] * second[PoseStream::Z]);
+    V uz = (first[PoseStream::QX] * second[PoseStream::Y]) - (first[PoseStream::QY] * second[PoseStream::X]);
+    ux = ux + ux;
+    uy = uy + uy;
+    uz = uz + uz;
+    out[PoseStream::X] = first[PoseStream::X] + second[PoseStream::X] + (first[PoseStream::QW] * ux) + ((first[PoseStream::QY] * uz) - (first[PoseStream::QZ] * uy));
+    out[PoseStream::Y] = first[PoseStream::Y] + second[PoseStream::Y] + (first[PoseStream::QW] * uy) + ((first[PoseStream::QZ] * ux) - (first[PoseStream::QX] * uz));
+    out[PoseStream::Z] = first[PoseStream::Z] + second[PoseStream::Z] + (first[PoseStream::QW] * uz) + ((first[PoseStream::QX] * uy) - (first[PoseStream::QY] * ux));
+    V qx = (first[PoseStream::QW] * second[PoseStream::QX]) + (first[PoseStream::QX] * second[PoseStream::QW]) + (first[PoseStream::QY] * second[PoseStream::QZ]) - (first[PoseStream::QZ] * second[PoseStream::QY]);
+    V qy = (first[PoseStream::QW] * second[PoseStream::QY]) - (first[PoseStream::QX] * second[PoseStream::QZ]) + (first[PoseStream::QY] * second[PoseStream::QW]) + (first[PoseStream::QZ] * second[PoseStream::QX]);
+    V qz = (first[PoseStream::QW] * second[PoseStream::QZ]) + (first[PoseStream::QX] * second[PoseStream::QY]) - (first[PoseStream::QY] * second[PoseStream::QX]) + (first[PoseStream::QZ] * second[PoseStream::QW]);
+    V qw = (first[PoseStream::QW] * second[PoseStream::QW]) - (first[PoseStream::QX] * second[PoseStream::QX]) - (first[PoseStream::QY] * second[PoseStream::QY]) - (first[PoseStream::QZ] * second[PoseStream::QZ]);
+    out[PoseStream::QX] = qx;
+    out[PoseStream::QY] = qy;
+    out[PoseStream::QZ] = qz;
+    out[PoseStream::QW] = qw;
+}
+
+template <typename V>
+static inline void InvertKernel(const V* pose, V* out)
+{
+    // The inverse rotation is the conjugate c, and the inverse translation is c applied to -v
+    V cx = -pose[PoseStream::QX];
+    V cy = -pose[PoseStream::QY];
+    V cz = -pose[PoseStream::QZ];
+    V vx = -pose[PoseStream::X];
+    V vy = -pose[PoseStream::Y];
+    V vz = -pose[PoseStream::Z];
+    V ux = (cy * vz) - (cz * vy);
+    V uy = (cz * vx) - (cx * vz);
+    V uz = (cx * vy) - (cy * vx);
+    ux = ux + ux;
+    uy = uy + uy;
+    uz = uz + uz;
+    out[PoseStream::X] = vx + (pose[PoseStream::QW] * ux) + ((cy * uz) - (cz * uy));
+    out[PoseStream::Y] = vy + (pose[PoseStream::QW] * uy) + ((cz * ux) - (cx * uz));
+    out[PoseStream::Z] = vz + (pose[PoseStream::QW] * uz) + ((cx * uy) - (cy * ux));
+    out[PoseStream::QX] = cx;
+    out[PoseStream::QY] = cy;
+    out[PoseStream::QZ] = cz;
+    out[PoseStream::QW] = pose[PoseStream::QW];
+}
+
+template <typename V>
+static inline void NormalizeKernel(const V* pose, V* out)
+{
+    V norm = Sqrt((pose[PoseStream::QX] * pose[PoseStream::QX]) + (pose[PoseStream::QY] * pose[PoseStream::QY]) + (pose[PoseStream::QZ] * pose[PoseStream::QZ]) + (pose[PoseStream::QW] * pose[PoseStream::QW]));
+    out[PoseStream::X] = pose[PoseStream::X];
+    out[PoseStream::Y] = pose[PoseStream::Y];
+    out[PoseStream::Z] = pose[PoseStream::Z];
+    out[PoseStream::QX] = pose[PoseStream::QX] / norm;
+    out[PoseStream::QY] = pose[PoseStream::QY] / norm;
+    out[PoseStream::QZ] = pose[PoseStream::QZ] / norm;
+    out[PoseStream::QW] = pose[PoseStream::QW] / norm;
+}
+
+// Component arrays of one operand, with a stride of 0 to broadcast a single pose to every index
+class PoseArrays
+{
+public:
+
+    const double* components_[PoseStream::NUM_COMPONENTS];
+    size_t stride_;
+
+    PoseArrays(const PoseStream& poses, size_t offset) : stride_(1)
+    {
+        for (size_t component = 0; component < PoseStream::NUM_COMPONENTS; component++)
+        {
+            components_[component] = poses.components_[component].data() + offset;
+        }
+    }
+
+    PoseArrays(const std::vector<double>& pose) : stride_(0)
+    {
+        for (size_t component = 0; component < PoseStream::NUM_COMPONENTS; component++)
+        {
+            components_[component] = &pose[component];
+        }
+    }
+
+    template <typename V>
+    inline void Load(size_t idx, V* values) const
+    {
+        for (size_t component = 0; component < PoseStream::NUM_COMPONENTS; component++)
+        {
+            ::Load(components_[component] + (idx * stride_), stride_, values[component]);
+        }
+    }
+
+};
+
+template <typename V>
+static inline void StorePose(PoseStream& out, size_t idx, const V* values)
+{
+    for (size_t component = 0; component < PoseStream::NUM_COMPONENTS; component++)
+    {
+        ::Store(out.components_[component].data() + idx, values[component]);
+    }
+}
+
+// Both operands are loaded before anything is stored, so out may alias either of them
+static void ComposeArrays(const PoseArrays& first, const PoseArrays& second, PoseStream& out, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    for (; (idx + 2) <= count; idx += 2)
+    {
+        Packed2 first_values[PoseStream::NUM_COMPONENTS];
+        Packed2 second_values[PoseStream::NUM_COMPONENTS];
+        Packed2 out_values[PoseStream::NUM_COMPONENTS];
+        first.Load(idx, first_values);
+        second.Load(idx, second_values);
+        ComposeKernel(first_values, second_values, out_values);
+        StorePose(out, idx, out_values);
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        double first_values[PoseStream::NUM_COMPONENTS];
+        double second_values[PoseStream::NUM_COMPONENTS];
+        double out_values[PoseStream::NUM_COMPONENTS];
+        first.Load(idx, first_values);
+        second.Load(idx, second_values);
+        ComposeKernel(first_values, second_values, out_values);
+        StorePose(out, idx, out_values);
+    }
+}
+
+static void InvertArrays(const PoseArrays& poses, PoseStream& out, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    for (; (idx + 2) <= count; idx += 2)
+    {
+        Packed2 values[PoseStream::NUM_COMPONENTS];
+        Packed2 out_values[PoseStream::NUM_COMPONENTS];
+        poses.Load(idx, values);
+        InvertKernel(values, out_values);
+        StorePose(out, idx, out_values);
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        double values[PoseStream::NUM_COMPONENTS];
+        double out_values[PoseStream::NUM_COMPONENTS];
+        poses.Load(idx, values);
+        InvertKernel(values, out_values);
+        StorePose(out, idx, out_values);
+    }
+}
+
+static void VerifyTransform(const std::vector<double>& transform)
+{
+    if (transform.size() != PoseStream::NUM_COMPONENTS)
+    {
+        throw std::invalid_argument("Pose data is not 7 doubles [X,Y,Z,X,Y,Z,W]");
+    }
+}
+
+static double Elapsed(const timespec& from, const timespec& to)
+{
+    return (double)(to.tv_sec - from.tv_sec) + ((double)(to.tv_nsec - from.tv_nsec) * 0.000000001);
+}
+
+PoseStream::PoseStream(const TrajectoryView& view, State::FIELDS field)
+{
+    if (view.Header().data_type_ != Trajectory::POSE)
+    {
+        throw std::invalid_argument("PoseStream needs a POSE trajectory");
+    }
+    base_time_.tv_sec = 0;
+    base_time_.tv_nsec = 0;
+    if (view.size() > 0)
+    {
+        base_time_ = view[0].timing_;
+    }
+    resize(view.size());
+    for (size_t idx = 0; idx < view.size(); idx++)
+    {
+        const std::vector<double>& pose = view[idx].Field(field);
+        if (pose.size() != NUM_COMPONENTS)
+        {
+            throw std::invalid_argument("State does not have the requested field");
+        }
+        times_[idx] = Elapsed(base_time_, view[idx].timing_);
+        for (size_t component = 0; component < NUM_COMPONENTS; component++)
+        {
+            components_[component][idx] = pose[component];
+        }
+    }
+}
+
+size_t PoseStream::size() const
+{
+    return times_.size();
+}
+
+void PoseStream::resize(size_t count)
+{
+    times_.resize(count, 0.0);
+    for (size_t component = 0; component < NUM_COMPONENTS; component++)
+    {
+        components_[component].resize(count, (component == QW) ? 1.0 : 0.0);
+    }
+}
+
+std::vector<double> PoseStream::at(size_t idx) const
+{
+    if (idx >= size())
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    std::vector<double> pose(NUM_COMPONENTS);
+    for (size_t component = 0; component < NUM_COMPONENTS; component++)
+    {
+        pose[component] = components_[component][idx];
+    }
+    return pose;
+}
+
+void PoseStream::Set(size_t idx, const std::vector<double>& pose)
+{
+    if (idx >= size())
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    VerifyTransform(pose);
+    for (size_t component = 0; component < NUM_COMPONENTS; component++)
+    {
+        components_[component][idx] = pose[component];
+    }
+}
+
+timespec PoseStream::Timing(size_t idx) const
+{
+    if (idx >= size())
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    double whole = floor(times_[idx]);
+    long long nsecs = (long long)base_time_.tv_nsec + llround((times_[idx] - whole) * 1000000000.0);
+    timespec timing;
+    timing.tv_sec = base_time_.tv_sec + (time_t)whole + (time_t)(nsecs / 1000000000);
+    timing.tv_nsec = (long)(nsecs % 1000000000);
+    return timing;
+}
+
+Trajectory PoseStream::ToTrajectory(const Trajectory& header, State::FIELDS field) const
+{
+    Trajectory trajectory = header.CloneHeader();
+    trajectory.data_type_ = Trajectory::POSE;
+    trajectory.reserve(size());
+    for (size_t idx = 0; idx < size(); idx++)
+    {
+        std::vector<double> fields[State::NUM_FIELDS];
+        fields[field] = at(idx);
+        trajectory.push_back(State(std::move(fields[0]), std::move(fields[1]), std::move(fields[2]), std::move(fields[3]), std::move(fields[4]), std::move(fields[5]), (int)idx, Timing(idx)));
+    }
+    return trajectory;
+}
+
+void PoseStream::Store(Trajectory& trajectory, State::FIELDS field) const
+{
+    if (trajectory.data_type_ != Trajectory::POSE || trajectory.size() != size())
+    {
+        throw std::invalid_argument("Trajectory does not match the pose stream");
+    }
+    for (size_t idx = 0; idx < size(); idx++)
+    {
+        std::vector<double>& pose = trajectory.trajectory_[idx].Field(field);
+        pose.resize(NUM_COMPONENTS);
+        for (size_t component = 0; component < NUM_COMPONENTS; component++)
+        {
+            pose[component] = components_[component][idx];
+        }
+    }
+}
+
+void XTF::NormalizeQuaternions(PoseStream& poses)
+{
+    PoseArrays arrays(poses, 0);
+    size_t idx = 0;
+#if defined(__SSE2__)
+    for (; (idx + 2) <= poses.size(); idx += 2)
+    {
+        Packed2 values[PoseStream::NUM_COMPONENTS];
+        arrays.Load(idx, values);
+        NormalizeKernel(values, values);
+        StorePose(poses, idx, values);
+    }
+#endif
+    for (; idx < poses.size(); idx++)
+    {
+        double values[PoseStream::NUM_COMPONENTS];
+        arrays.Load(idx, values);
+        NormalizeKernel(values, values);
+        StorePose(poses, idx, values);
+    }
+}
+
+void XTF::ComposePoses(const PoseStream& first, const PoseStream& second, PoseStream& out)
+{
+    if (first.size() != second.size())
+    {
+        throw std::invalid_argument("Pose streams have different lengths");
+    }
+    PoseArrays first_arrays(first, 0);
+    PoseArrays second_arrays(second, 0);
+    if (&out != &first)
+    {
+        out.base_time_ = first.base_time_;
+        out.times_ = first.times_;
+    }
+    out.resize(first.size());
+    ComposeArrays(first_arrays, second_arrays, out, first.size());
+}
+
+void XTF::InvertPoses(const PoseStream& poses, PoseStream& out)
+{
+    PoseArrays arrays(poses, 0);
+    if (&out != &poses)
+    {
+        out.base_time_ = poses.base_time_;
+        out.times_ = poses.times_;
+    }
+    out.resize(poses.size());
+    InvertArrays(arrays, out, poses.size());
+}
+
+PoseStream XTF::RelativePoses(const PoseStream& poses)
+{
+    PoseStream relative;
+    relative.base_time_ = poses.base_time_;
+    if (poses.size() < 2)
+    {
+        return relative;
+    }
+    size_t count = poses.size() - 1;
+    relative.resize(count);
+    relative.times_.assign(poses.times_.begin() + 1, poses.times_.end());
+    InvertArrays(PoseArrays(poses, 0), relative, count);
+    ComposeArrays(PoseArrays(relative, 0), PoseArrays(poses, 1), relative, count);
+    return relative;
+}
+
+void XTF::PreMultiplyPoses(PoseStream& poses, const std::vector<double>& transform)
+{
+    VerifyTransform(transform);
+    ComposeArrays(PoseArrays(transform), PoseArrays(poses, 0), poses, poses.size());
+}
+
+void XTF::PostMultiplyPoses(PoseStream& poses, const std::vector<double>& transform)
+{
+    VerifyTransform(transform);
+    ComposeArrays(PoseArrays(poses, 0), PoseArrays(transform), poses, poses.size());
+}
+
+PoseStream XTF::InterpolatePoses(const PoseStream& poses, const std::vector<timespec>& times)
+{
+    if (poses.size() == 0)
+    {
+        throw std::invalid_argument("Cannot interpolate an empty pose stream");
+    }
+    for (size_t idx = 1; idx < poses.size(); idx++)
+    {
+        if (poses.times_[idx] < poses.times_[idx - 1])
+        {
+            throw std::invalid_argument("Pose stream times are not in order");
+        }
+    }
+    PoseStream interpolated;
+    interpolated.base_time_ = poses.base_time_;
+    interpolated.resize(times.size());
+    for (size_t query = 0; query < times.size(); query++)
+    {
+        double time = Elapsed(poses.base_time_, times[query]);
+        interpolated.times_[query] = time;
+        size_t end = std::upper_bound(poses.times_.begin(), poses.times_.end(), time) - poses.times_.begin();
+        size_t start = (end > 0) ? (end - 1) : 0;
+        end = std::min(end, poses.size() - 1);
+        double t = (end > start) ? ((time - poses.times_[start]) / (poses.times_[end] - poses.times_[start])) : 0.0;
+        for (size_t component = PoseStream::X; component <= PoseStream::Z; component++)
+        {
+            const std::vector<double>& values = poses.components_[component];
+            interpolated.components_[component][query] = values[start] + (t * (values[end] - values[start]));
+        }
+        double cos_theta = 0.0;
+        for (size_t component = PoseStream::QX; component <= PoseStream::QW; component++)
+        {
+            cos_theta += poses.components_[component][start] * poses.components_[component][end];
+        }
+        // Interpolate along the shorter arc, falling back to a normalized lerp when nearly parallel
+        double sign = (cos_theta < 0.0) ? -1.0 : 1.0;
+        cos_theta = std::min(std::fabs(cos_theta), 1.0);
+        double start_weight = 1.0 - t;
+        double end_weight = t;
+        if (cos_theta < 0.9995)
+        {
+            double theta = acos(cos_theta);
+            start_weight = sin((1.0 - t) * theta) / sin(theta);
+            end_weight = sin(t * theta) / sin(theta);
+        }
+        double norm = 0.0;
+        for (size_t component = PoseStream::QX; component <= PoseStream::QW; component++)
+        {
+            double value = (start_weight * poses.components_[component][start]) + (sign * end_weight * poses.components_[component][end]);
+            interpolated.components_[component][query] = value;
+            norm += value * value;
+        }
+        norm = sqrt(norm);
+        for (size_t component = PoseStream::QX; component <= PoseStream::QW; component++)
+        {
+            interpolated.components_[component][query] /= norm;
+        }
+    }
+    return interpolated;
+}
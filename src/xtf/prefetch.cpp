@@ -0,0 +1,128 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <future>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libxml/parser.h>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+#include "xtf/prefetch.hpp"
+
+using namespace XTF;
+
+static void AdviseWillNeed(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+static Trajectory ReadAndParse(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::string error_str("Unable to read XTF file (file may not exist): " + filename);
+        throw std::invalid_argument(error_str.c_str());
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    struct stat info;
+    std::string contents;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        contents.reserve((size_t)info.st_size);
+    }
+    char buffer[1 << 16];
+    while (true)
+    {
+        ssize_t result = read(fd, buffer, sizeof(buffer));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result < 0)
+        {
+            close(fd);
+            std::string error_str("Unable to read XTF file: " + filename);
+            throw std::invalid_argument(error_str.c_str());
+        }
+        else if (result == 0)
+        {
+            break;
+        }
+        contents.append(buffer, (size_t)result);
+    }
+    close(fd);
+    Parser parser;
+    return parser.ParseTrajFromBuffer(contents.data(), contents.size());
+}
+
+std::future<Trajectory> Parser::ParseTrajAsync(std::string filename)
+{
+    // libxml2 must be initialized on the calling thread before it is used from worker threads
+    xmlInitParser();
+    return std::async(std::launch::async, ReadAndParse, filename);
+}
+
+TrajectoryPrefetcher::TrajectoryPrefetcher(const std::vector<std::string>& filenames, size_t depth)
+{
+    xmlInitParser();
+    filenames_ = filenames;
+    depth_ = ResolveThreads(depth);
+    next_request_ = 0;
+    next_advised_ = 0;
+    next_result_ = 0;
+    Fill();
+}
+
+void TrajectoryPrefetcher::Fill()
+{
+    while (in_flight_.size() < depth_ && next_request_ < filenames_.size())
+    {
+        in_flight_.push_back(std::async(std::launch::async, ReadAndParse, filenames_[next_request_]));
+        next_request_++;
+    }
+    // Let the kernel read the files after those being parsed, so their I/O is done by the time a parser frees up
+    if (next_advised_ < next_request_)
+    {
+        next_advised_ = next_request_;
+    }
+    while (next_advised_ < filenames_.size() && next_advised_ < (next_request_ + depth_))
+    {
+        AdviseWillNeed(filenames_[next_advised_]);
+        next_advised_++;
+    }
+}
+
+bool TrajectoryPrefetcher::HasNext() const
+{
+    return next_result_ < filenames_.size();
+}
+
+Trajectory TrajectoryPrefetcher::Next()
+{
+    if (!HasNext())
+    {
+        throw std::out_of_range("No trajectories remain to be prefetched");
+    }
+    std::future<Trajectory> result = std::move(in_flight_.front());
+    in_flight_.pop_front();
+    next_result_++;
+    // Start the next parse before blocking, so the pipeline stays full while this result is consumed
+    Fill();
+    return result.get();
+}
+
+size_t TrajectoryPrefetcher::size() const
+{
+    return filenames_.size();
+}
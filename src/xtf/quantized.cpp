@@ -0,0 +1,354 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <sstream>
+#include <cmath>
+#include <cfloat>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "xtf/xtf.hpp"
+#include "xtf/quantized.hpp"
+
+using namespace XTF;
+
+PrecisionOptions PrecisionOptions::Float32()
+{
+    PrecisionOptions precision;
+    precision.mode_ = FLOAT32;
+    return precision;
+}
+
+PrecisionOptions PrecisionOptions::Fixed32(const std::vector<double>& quantum)
+{
+    PrecisionOptions precision;
+    precision.mode_ = FIXED32;
+    precision.quantum_ = quantum;
+    return precision;
+}
+
+void PrecisionOptions::Verify(size_t data_length) const
+{
+    if (mode_ != FIXED32)
+    {
+        return;
+    }
+    if (quantum_.size() != 1 && quantum_.size() != data_length)
+    {
+        throw std::invalid_argument("Fixed-point precision needs one quantum, or one quantum per element");
+    }
+    for (size_t idx = 0; idx < quantum_.size(); idx++)
+    {
+        if (!std::isfinite(quantum_[idx]) || quantum_[idx] <= 0.0)
+        {
+            throw std::invalid_argument("Fixed-point quantum must be finite and positive");
+        }
+    }
+}
+
+double PrecisionOptions::Quantum(size_t element) const
+{
+    if (mode_ != FIXED32 || quantum_.size() == 0)
+    {
+        return 0.0;
+    }
+    return (quantum_.size() == 1) ? quantum_[0] : quantum_.at(element);
+}
+
+double PrecisionOptions::ErrorBound(size_t element, double magnitude) const
+{
+    if (mode_ == FLOAT32)
+    {
+        // Round-to-nearest is off by at most half an ulp, i.e. 2^-24 relative, or half the smallest subnormal
+        return std::max(std::fabs(magnitude) * ldexp(1.0, -24), ldexp(1.0, -150));
+    }
+    else if (mode_ == FIXED32)
+    {
+        return Quantum(element) * 0.5;
+    }
+    return 0.0;
+}
+
+void XTF::DoublesToFloats(const double* values, float* converted, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    for (; (idx + 4) <= count; idx += 4)
+    {
+        __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(values + idx));
+        __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(values + idx + 2));
+        _mm_storeu_ps(converted + idx, _mm_movelh_ps(low, high));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        converted[idx] = (float)values[idx];
+    }
+}
+
+void XTF::FloatsToDoubles(const float* values, double* converted, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    for (; (idx + 4) <= count; idx += 4)
+    {
+        __m128 packed = _mm_loadu_ps(values + idx);
+        _mm_storeu_pd(converted + idx, _mm_cvtps_pd(packed));
+        _mm_storeu_pd(converted + idx + 2, _mm_cvtps_pd(_mm_movehl_ps(packed, packed)));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        converted[idx] = (double)values[idx];
+    }
+}
+
+void XTF::DoublesToFixed(const double* values, int32_t* converted, const double* inverse_quantum, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    // cvtpd_epi32 rounds to nearest-even under the default rounding mode, matching lrint below
+    for (; (idx + 4) <= count; idx += 4)
+    {
+        __m128i low = _mm_cvtpd_epi32(_mm_mul_pd(_mm_loadu_pd(values + idx), _mm_loadu_pd(inverse_quantum + idx)));
+        __m128i high = _mm_cvtpd_epi32(_mm_mul_pd(_mm_loadu_pd(values + idx + 2), _mm_loadu_pd(inverse_quantum + idx + 2)));
+        _mm_storeu_si128((__m128i*)(converted + idx), _mm_unpacklo_epi64(low, high));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        converted[idx] = (int32_t)lrint(values[idx] * inverse_quantum[idx]);
+    }
+}
+
+void XTF::FixedToDoubles(const int32_t* values, double* converted, const double* quantum, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    for (; (idx + 4) <= count; idx += 4)
+    {
+        __m128i packed = _mm_loadu_si128((const __m128i*)(values + idx));
+        _mm_storeu_pd(converted + idx, _mm_mul_pd(_mm_cvtepi32_pd(packed), _mm_loadu_pd(quantum + idx)));
+        _mm_storeu_pd(converted + idx + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(packed, 8)), _mm_loadu_pd(quantum + idx + 2)));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        converted[idx] = (double)values[idx] * quantum[idx];
+    }
+}
+
+void XTF::VerifyRepresentable(const double* values, const double* inverse_quantum, size_t count, PrecisionOptions::MODES mode)
+{
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        if (mode == PrecisionOptions::FLOAT32 && std::isfinite(values[idx]) && std::fabs(values[idx]) > FLT_MAX)
+        {
+            throw std::invalid_argument("Value is too large to store as float32");
+        }
+        else if (mode == PrecisionOptions::FIXED32 && !(std::fabs(values[idx] * inverse_quantum[idx]) <= 2147483647.0))
+        {
+            std::ostringstream error_stream;
+            error_stream << "Value " << values[idx] << " cannot be stored as fixed-point with the given quantum";
+            throw std::invalid_argument(error_stream.str());
+        }
+    }
+}
+
+QuantizedTrajectory::QuantizedTrajectory(const TrajectoryView& view, const PrecisionOptions& precision)
+{
+    if (precision.mode_ == PrecisionOptions::DOUBLE)
+    {
+        throw std::invalid_argument("QuantizedTrajectory needs FLOAT32 or FIXED32 precision");
+    }
+    header_ = view.Header().CloneHeader();
+    precision_ = precision;
+    data_length_ = (header_.data_type_ == Trajectory::POSE) ? 7 : header_.joint_names_.size();
+    precision_.Verify(data_length_);
+    std::vector<double> inverse_quantum(data_length_, 1.0);
+    quantum_.assign(data_length_, 1.0);
+    for (size_t element = 0; element < data_length_ && precision_.mode_ == PrecisionOptions::FIXED32; element++)
+    {
+        quantum_[element] = precision_.Quantum(element);
+        inverse_quantum[element] = 1.0 / quantum_[element];
+    }
+    size_t count = view.size();
+    sequences_.resize(count);
+    timings_.resize(count);
+    field_masks_.assign(count, 0);
+    uint8_t present = 0;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        const State& state = view[idx];
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            size_t field_size = state.Field((State::FIELDS)field).size();
+            if (field_size > 0 && field_size != data_length_)
+            {
+                throw std::invalid_argument("Inconsistent joint names and joint data");
+            }
+            else if (field_size > 0)
+            {
+                field_masks_[idx] |= (uint8_t)(1 << field);
+            }
+        }
+        present |= field_masks_[idx];
+    }
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        if ((present >> field) & 1)
+        {
+            if (precision_.mode_ == PrecisionOptions::FLOAT32)
+            {
+                float_fields_[field].assign(count * data_length_, 0.0f);
+            }
+            else
+            {
+                fixed_fields_[field].assign(count * data_length_, 0);
+            }
+        }
+    }
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        const State& state = view[idx];
+        sequences_[idx] = state.sequence_;
+        timings_[idx] = state.timing_;
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            if (((field_masks_[idx] >> field) & 1) == 0)
+            {
+                continue;
+            }
+            const double* values = state.Field((State::FIELDS)field).data();
+            VerifyRepresentable(values, inverse_quantum.data(), data_length_, precision_.mode_);
+            if (precision_.mode_ == PrecisionOptions::FLOAT32)
+            {
+                DoublesToFloats(values, &float_fields_[field][idx * data_length_], data_length_);
+            }
+            else
+            {
+                DoublesToFixed(values, &fixed_fields_[field][idx * data_length_], inverse_quantum.data(), data_length_);
+            }
+        }
+        if (state.extras_.size() > 0)
+        {
+            extras_[idx] = state.extras_;
+        }
+    }
+}
+
+const Trajectory& QuantizedTrajectory::Header() const
+{
+    return header_;
+}
+
+const PrecisionOptions& QuantizedTrajectory::Precision() const
+{
+    return precision_;
+}
+
+size_t QuantizedTrajectory::size() const
+{
+    return sequences_.size();
+}
+
+bool QuantizedTrajectory::HasField(size_t idx, State::FIELDS field) const
+{
+    if (idx >= sequences_.size())
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    return ((field_masks_[idx] >> field) & 1) == 1;
+}
+
+void QuantizedTrajectory::DecodeField(size_t idx, State::FIELDS field, double* values) const
+{
+    if (!HasField(idx, field))
+    {
+        throw std::invalid_argument("State does not have the requested field");
+    }
+    if (precision_.mode_ == PrecisionOptions::FLOAT32)
+    {
+        FloatsToDoubles(&float_fields_[field][idx * data_length_], values, data_length_);
+    }
+    else
+    {
+        FixedToDoubles(&fixed_fields_[field][idx * data_length_], values, quantum_.data(), data_length_);
+    }
+}
+
+std::vector<double> QuantizedTrajectory::DecodeColumn(State::FIELDS field) const
+{
+    std::vector<double> column(sequences_.size() * data_length_, 0.0);
+    if (precision_.mode_ == PrecisionOptions::FLOAT32 && float_fields_[field].size() > 0)
+    {
+        FloatsToDoubles(float_fields_[field].data(), column.data(), column.size());
+    }
+    else if (precision_.mode_ == PrecisionOptions::FIXED32 && fixed_fields_[field].size() > 0)
+    {
+        for (size_t idx = 0; idx < sequences_.size(); idx++)
+        {
+            FixedToDoubles(&fixed_fields_[field][idx * data_length_], &column[idx * data_length_], quantum_.data(), data_length_);
+        }
+    }
+    return column;
+}
+
+State QuantizedTrajectory::at(size_t idx) const
+{
+    std::vector<double> fields[State::NUM_FIELDS];
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        if (HasField(idx, (State::FIELDS)field))
+        {
+            fields[field].resize(data_length_);
+            DecodeField(idx, (State::FIELDS)field, fields[field].data());
+        }
+    }
+    State state(std::move(fields[0]), std::move(fields[1]), std::move(fields[2]), std::move(fields[3]), std::move(fields[4]), std::move(fields[5]), sequences_[idx], timings_[idx]);
+    std::map<size_t, std::map<std::string, KeyValue> >::const_iterator extras = extras_.find(idx);
+    if (extras != extras_.end())
+    {
+        state.extras_ = extras->second;
+    }
+    return state;
+}
+
+Trajectory QuantizedTrajectory::Materialize() const
+{
+    Trajectory materialized = header_.CloneHeader();
+    materialized.reserve(size());
+    for (size_t idx = 0; idx < size(); idx++)
+    {
+        materialized.push_back(at(idx));
+    }
+    return materialized;
+}
+
+size_t QuantizedTrajectory::MemoryUsage() const
+{
+    size_t bytes = sizeof(QuantizedTrajectory);
+    bytes += sequences_.capacity() * sizeof(int);
+    bytes += timings_.capacity() * sizeof(timespec);
+    bytes += field_masks_.capacity() * sizeof(uint8_t);
+    bytes += quantum_.capacity() * sizeof(double);
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        bytes += float_fields_[field].capacity() * sizeof(float);
+        bytes += fixed_fields_[field].capacity() * sizeof(int32_t);
+    }
+    // Extras are counted by entry, without their heap-allocated contents
+    std::map<size_t, std::map<std::string, KeyValue> >::const_iterator itr;
+    for (itr = extras_.begin(); itr != extras_.end(); ++itr)
+    {
+        bytes += itr->second.size() * (sizeof(std::string) + sizeof(KeyValue));
+    }
+    return bytes;
+}
@@ -0,0 +1,505 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "xtf/xtf.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/segmented.hpp"
+
+using namespace XTF;
+
+static const char SEGMENT_FILE_MAGIC[] = "XTFSEG01";
+static const char SEGMENT_BLOCK_MAGIC[] = "XTFBLK01";
+static const char SEGMENT_INDEX_MAGIC[] = "XTFIDX01";
+static const char SEGMENT_END_MAGIC[] = "XTFEND01";
+static const uint32_t SEGMENT_VERSION = 1;
+// Magic + payload size + state count + sequence range + time range
+static const size_t SEGMENT_BLOCK_HEADER_SIZE = 8 + 8 + 8 + 16 + 32;
+// Offset + block metadata
+static const size_t SEGMENT_INDEX_ENTRY_SIZE = 8 + SEGMENT_BLOCK_HEADER_SIZE - 8;
+static const size_t SEGMENT_FOOTER_SIZE = 16;
+
+static void ReadFully(int fd, char* buffer, size_t length, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t result = pread(fd, buffer + done, length - done, (off_t)(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            throw std::invalid_argument("Segmented XTF file is truncated or unreadable");
+        }
+        done += (size_t)result;
+    }
+}
+
+static void WriteFully(int fd, const char* buffer, size_t length, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < length)
+    {
+        ssize_t result = pwrite(fd, buffer + done, length - done, (off_t)(offset + done));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (result <= 0)
+        {
+            throw std::runtime_error("Unable to write segmented XTF file");
+        }
+        done += (size_t)result;
+    }
+}
+
+static uint64_t FileSize(int fd)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        throw std::runtime_error("Unable to stat segmented XTF file");
+    }
+    return (uint64_t)info.st_size;
+}
+
+static void AppendBlockMetadata(std::string& buffer, const SegmentIndexEntry& entry)
+{
+    AppendUInt64(buffer, entry.size_);
+    AppendUInt64(buffer, entry.state_count_);
+    AppendInt64(buffer, entry.first_sequence_);
+    AppendInt64(buffer, entry.last_sequence_);
+    AppendInt64(buffer, entry.first_timing_.tv_sec);
+    AppendInt64(buffer, entry.first_timing_.tv_nsec);
+    AppendInt64(buffer, entry.last_timing_.tv_sec);
+    AppendInt64(buffer, entry.last_timing_.tv_nsec);
+}
+
+static SegmentIndexEntry ReadBlockMetadata(ByteReader& reader, uint64_t offset)
+{
+    SegmentIndexEntry entry;
+    entry.offset_ = offset;
+    entry.size_ = reader.ReadUInt64();
+    entry.state_count_ = reader.ReadUInt64();
+    entry.first_sequence_ = reader.ReadInt64();
+    entry.last_sequence_ = reader.ReadInt64();
+    entry.first_timing_.tv_sec = reader.ReadInt64();
+    entry.first_timing_.tv_nsec = reader.ReadInt64();
+    entry.last_timing_.tv_sec = reader.ReadInt64();
+    entry.last_timing_.tv_nsec = reader.ReadInt64();
+    return entry;
+}
+
+static Trajectory ReadFileHeader(int fd, Parser& parser, uint64_t& data_offset)
+{
+    char prefix[20];
+    ReadFully(fd, prefix, sizeof(prefix), 0);
+    if (memcmp(prefix, SEGMENT_FILE_MAGIC, 8) != 0)
+    {
+        throw std::invalid_argument("File is not a segmented XTF file");
+    }
+    ByteReader reader(prefix + 8, sizeof(prefix) - 8);
+    uint32_t version = reader.ReadUInt32();
+    if (version != SEGMENT_VERSION)
+    {
+        throw std::invalid_argument("Unsupported segmented XTF version");
+    }
+    uint64_t header_length = reader.ReadUInt64();
+    if (header_length > (FileSize(fd) - sizeof(prefix)))
+    {
+        throw std::invalid_argument("Segmented XTF header is truncated or otherwise corrupted");
+    }
+    std::string header(header_length, '\0');
+    ReadFully(fd, &header[0], header_length, sizeof(prefix));
+    data_offset = sizeof(prefix) + header_length;
+    return parser.DecodeHeader(header.data(), header.size());
+}
+
+static bool ReadIndex(int fd, uint64_t data_offset, std::vector<SegmentIndexEntry>& index, uint64_t& index_offset)
+{
+    uint64_t file_size = FileSize(fd);
+    if (file_size < data_offset + SEGMENT_FOOTER_SIZE)
+    {
+        return false;
+    }
+    char footer[SEGMENT_FOOTER_SIZE];
+    ReadFully(fd, footer, SEGMENT_FOOTER_SIZE, file_size - SEGMENT_FOOTER_SIZE);
+    if (memcmp(footer + 8, SEGMENT_END_MAGIC, 8) != 0)
+    {
+        return false;
+    }
+    ByteReader footer_reader(footer, 8);
+    index_offset = footer_reader.ReadUInt64();
+    if (index_offset < data_offset || index_offset > (file_size - SEGMENT_FOOTER_SIZE))
+    {
+        return false;
+    }
+    std::string raw(file_size - SEGMENT_FOOTER_SIZE - index_offset, '\0');
+    ReadFully(fd, &raw[0], raw.size(), index_offset);
+    if (raw.size() < 16 || memcmp(raw.data(), SEGMENT_INDEX_MAGIC, 8) != 0)
+    {
+        return false;
+    }
+    ByteReader reader(raw.data() + 8, raw.size() - 8);
+    uint64_t count = reader.ReadUInt64();
+    if ((reader.Remaining() % SEGMENT_INDEX_ENTRY_SIZE) != 0 || count != (reader.Remaining() / SEGMENT_INDEX_ENTRY_SIZE))
+    {
+        return false;
+    }
+    index.clear();
+    index.reserve(count);
+    for (uint64_t block = 0; block < count; block++)
+    {
+        uint64_t offset = reader.ReadUInt64();
+        index.push_back(ReadBlockMetadata(reader, offset));
+    }
+    return true;
+}
+
+static uint64_t ScanBlocks(int fd, uint64_t data_offset, std::vector<SegmentIndexEntry>& index)
+{
+    // Walk the block headers from the start - anything after the last complete block is discarded
+    uint64_t file_size = FileSize(fd);
+    uint64_t offset = data_offset;
+    index.clear();
+    char raw[SEGMENT_BLOCK_HEADER_SIZE];
+    while ((offset + SEGMENT_BLOCK_HEADER_SIZE) <= file_size)
+    {
+        ReadFully(fd, raw, SEGMENT_BLOCK_HEADER_SIZE, offset);
+        if (memcmp(raw, SEGMENT_BLOCK_MAGIC, 8) != 0)
+        {
+            break;
+        }
+        ByteReader reader(raw + 8, SEGMENT_BLOCK_HEADER_SIZE - 8);
+        SegmentIndexEntry entry = ReadBlockMetadata(reader, offset);
+        if (entry.size_ > (file_size - offset - SEGMENT_BLOCK_HEADER_SIZE))
+        {
+            break;
+        }
+        index.push_back(entry);
+        offset += SEGMENT_BLOCK_HEADER_SIZE + entry.size_;
+    }
+    return offset;
+}
+
+SegmentedWriter::SegmentedWriter(std::string filename, const Trajectory& header, size_t block_size, bool compact)
+{
+    if (block_size == 0)
+    {
+        throw std::invalid_argument("Block size must be at least 1");
+    }
+    filename_ = filename;
+    block_size_ = block_size;
+    compact_ = compact;
+    pending_ = header.CloneHeader();
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+    {
+        throw std::runtime_error("Unable to create segmented XTF file: " + filename);
+    }
+    try
+    {
+        std::string encoded_header = parser_.EncodeHeader(pending_);
+        std::string prefix(SEGMENT_FILE_MAGIC, 8);
+        AppendUInt32(prefix, SEGMENT_VERSION);
+        AppendUInt64(prefix, encoded_header.size());
+        prefix.append(encoded_header);
+        WriteFully(fd_, prefix.data(), prefix.size(), 0);
+        write_offset_ = prefix.size();
+    }
+    catch (...)
+    {
+        close(fd_);
+        fd_ = -1;
+        throw;
+    }
+}
+
+SegmentedWriter::SegmentedWriter(std::string filename, size_t block_size, bool compact)
+{
+    if (block_size == 0)
+    {
+        throw std::invalid_argument("Block size must be at least 1");
+    }
+    filename_ = filename;
+    block_size_ = block_size;
+    compact_ = compact;
+    fd_ = open(filename.c_str(), O_RDWR);
+    if (fd_ < 0)
+    {
+        throw std::runtime_error("Unable to open segmented XTF file: " + filename);
+    }
+    try
+    {
+        uint64_t data_offset = 0;
+        pending_ = ReadFileHeader(fd_, parser_, data_offset);
+        uint64_t index_offset = 0;
+        if (ReadIndex(fd_, data_offset, index_, index_offset))
+        {
+            write_offset_ = index_offset;
+        }
+        else
+        {
+            write_offset_ = ScanBlocks(fd_, data_offset, index_);
+        }
+        // Drop the old index now, so a crash before Close() leaves a file that ScanBlocks can recover
+        if (ftruncate(fd_, (off_t)write_offset_) != 0)
+        {
+            throw std::runtime_error("Unable to truncate segmented XTF file: " + filename);
+        }
+    }
+    catch (...)
+    {
+        close(fd_);
+        fd_ = -1;
+        throw;
+    }
+}
+
+SegmentedWriter::~SegmentedWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+        // Nothing sensible can be done from a destructor
+    }
+}
+
+void SegmentedWriter::push_back(const State& state)
+{
+    if (fd_ < 0)
+    {
+        throw std::invalid_argument("Segmented XTF writer is closed");
+    }
+    pending_.push_back(pool_.Acquire(state));
+    if (pending_.size() >= block_size_)
+    {
+        Rotate();
+    }
+}
+
+void SegmentedWriter::Append(const TrajectoryView& view)
+{
+    for (size_t idx = 0; idx < view.size(); idx++)
+    {
+        push_back(view[idx]);
+    }
+}
+
+void SegmentedWriter::Rotate()
+{
+    if (fd_ < 0 || pending_.size() == 0)
+    {
+        return;
+    }
+    const State& first = pending_.trajectory_.front();
+    const State& last = pending_.trajectory_.back();
+    std::string payload = parser_.EncodeStates(TrajectoryView(pending_), compact_);
+    SegmentIndexEntry entry;
+    entry.offset_ = write_offset_;
+    entry.size_ = payload.size();
+    entry.state_count_ = pending_.size();
+    entry.first_sequence_ = first.sequence_;
+    entry.last_sequence_ = last.sequence_;
+    entry.first_timing_ = first.timing_;
+    entry.last_timing_ = last.timing_;
+    std::string block(SEGMENT_BLOCK_MAGIC, 8);
+    block.reserve(SEGMENT_BLOCK_HEADER_SIZE + payload.size());
+    AppendBlockMetadata(block, entry);
+    block.append(payload);
+    WriteFully(fd_, block.data(), block.size(), write_offset_);
+    write_offset_ += block.size();
+    index_.push_back(entry);
+    pool_.Release(pending_.trajectory_);
+}
+
+void SegmentedWriter::Flush()
+{
+    Rotate();
+    if (fd_ >= 0 && fdatasync(fd_) != 0)
+    {
+        throw std::runtime_error("Unable to flush segmented XTF file: " + filename_);
+    }
+}
+
+void SegmentedWriter::WriteIndex()
+{
+    std::string index(SEGMENT_INDEX_MAGIC, 8);
+    AppendUInt64(index, index_.size());
+    for (size_t block = 0; block < index_.size(); block++)
+    {
+        AppendUInt64(index, index_[block].offset_);
+        AppendBlockMetadata(index, index_[block]);
+    }
+    AppendUInt64(index, write_offset_);
+    index.append(SEGMENT_END_MAGIC, 8);
+    WriteFully(fd_, index.data(), index.size(), write_offset_);
+}
+
+void SegmentedWriter::Close()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    Rotate();
+    WriteIndex();
+    int fd = fd_;
+    fd_ = -1;
+    bool synced = (fdatasync(fd) == 0);
+    bool closed = (close(fd) == 0);
+    if (!synced || !closed)
+    {
+        throw std::runtime_error("Unable to close segmented XTF file: " + filename_);
+    }
+}
+
+const std::vector<SegmentIndexEntry>& SegmentedWriter::Index() const
+{
+    return index_;
+}
+
+SegmentedReader::SegmentedReader(std::string filename)
+{
+    filename_ = filename;
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0)
+    {
+        throw std::invalid_argument("Unable to read segmented XTF file (file may not exist): " + filename);
+    }
+    try
+    {
+        uint64_t data_offset = 0;
+        header_ = ReadFileHeader(fd_, parser_, data_offset);
+        uint64_t index_offset = 0;
+        recovered_ = !ReadIndex(fd_, data_offset, index_, index_offset);
+        if (recovered_)
+        {
+            ScanBlocks(fd_, data_offset, index_);
+        }
+    }
+    catch (...)
+    {
+        close(fd_);
+        throw;
+    }
+}
+
+SegmentedReader::~SegmentedReader()
+{
+    close(fd_);
+}
+
+const Trajectory& SegmentedReader::Header() const
+{
+    return header_;
+}
+
+const std::vector<SegmentIndexEntry>& SegmentedReader::Index() const
+{
+    return index_;
+}
+
+bool SegmentedReader::Recovered() const
+{
+    return recovered_;
+}
+
+size_t SegmentedReader::size() const
+{
+    size_t total = 0;
+    for (size_t block = 0; block < index_.size(); block++)
+    {
+        total += index_[block].state_count_;
+    }
+    return total;
+}
+
+size_t SegmentedReader::FindBlock(const timespec& timing) const
+{
+    // Last block starting at or before timing, or the first block if timing precedes them all
+    size_t low = 0;
+    size_t high = index_.size();
+    while (low < high)
+    {
+        size_t mid = low + ((high - low) / 2);
+        if (CompareTimespecs(index_[mid].first_timing_, timing) <= 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return (low > 0) ? (low - 1) : 0;
+}
+
+std::vector<State> SegmentedReader::ReadBlock(size_t block)
+{
+    if (block >= index_.size())
+    {
+        throw std::out_of_range("Block index is out of range");
+    }
+    const SegmentIndexEntry& entry = index_[block];
+    uint64_t file_size = FileSize(fd_);
+    if (entry.offset_ > file_size || (file_size - entry.offset_) < SEGMENT_BLOCK_HEADER_SIZE || entry.size_ > (file_size - entry.offset_ - SEGMENT_BLOCK_HEADER_SIZE))
+    {
+        throw std::invalid_argument("Segmented XTF block is truncated or otherwise corrupted");
+    }
+    std::string payload(entry.size_, '\0');
+    ReadFully(fd_, &payload[0], payload.size(), entry.offset_ + SEGMENT_BLOCK_HEADER_SIZE);
+    return parser_.DecodeStates(payload.data(), payload.size());
+}
+
+Trajectory SegmentedReader::ReadTimeRange(const timespec& start, const timespec& end)
+{
+    // Half-open [start, end), matching TrajectoryView::SliceTime
+    Trajectory range = header_.CloneHeader();
+    for (size_t block = FindBlock(start); block < index_.size(); block++)
+    {
+        if (CompareTimespecs(index_[block].first_timing_, end) >= 0)
+        {
+            break;
+        }
+        if (CompareTimespecs(index_[block].last_timing_, start) < 0)
+        {
+            continue;
+        }
+        std::vector<State> states = ReadBlock(block);
+        for (size_t idx = 0; idx < states.size(); idx++)
+        {
+            if (CompareTimespecs(states[idx].timing_, start) >= 0 && CompareTimespecs(states[idx].timing_, end) < 0)
+            {
+                range.push_back(std::move(states[idx]));
+            }
+        }
+    }
+    return range;
+}
+
+Trajectory SegmentedReader::ReadAll()
+{
+    Trajectory all = header_.CloneHeader();
+    all.trajectory_.reserve(size());
+    for (size_t block = 0; block < index_.size(); block++)
+    {
+        std::vector<State> states = ReadBlock(block);
+        for (size_t idx = 0; idx < states.size(); idx++)
+        {
+            all.push_back(std::move(states[idx]));
+        }
+    }
+    return all;
+}
@@ -0,0 +1,397 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <new>
+#include "xtf/xtf.hpp"
+#include "xtf/shared_memory.hpp"
+
+using namespace XTF;
+
+static const char SHARED_MAGIC[] = "XTFSHM01";
+static const uint32_t SHARED_VERSION = 1;
+
+struct SharedSegmentHeader
+{
+    // SHARED_MAGIC as a word, stored last with release semantics to publish the rest of the header
+    std::atomic<uint64_t> magic_;
+    uint32_t version_;
+    uint32_t data_length_;
+    std::atomic<uint64_t> seqlock_;
+    std::atomic<uint64_t> state_count_;
+    uint64_t capacity_;
+    uint64_t header_offset_;
+    uint64_t header_length_;
+    uint64_t states_offset_;
+    uint64_t record_size_;
+};
+
+static uint64_t MagicWord()
+{
+    uint64_t word = 0;
+    memcpy(&word, SHARED_MAGIC, 8);
+    return word;
+}
+
+static size_t RecordSize(uint32_t data_length)
+{
+    return sizeof(SharedStateRecord) + (State::NUM_FIELDS * data_length * sizeof(double));
+}
+
+// Checks the offsets and sizes a reader relies on against the mapped size, without overflowing
+static bool LayoutFits(const SharedSegmentHeader* segment_header, size_t segment_size)
+{
+    if (segment_header->record_size_ != RecordSize(segment_header->data_length_))
+    {
+        return false;
+    }
+    if (segment_header->header_offset_ > segment_size || segment_header->header_length_ > (segment_size - segment_header->header_offset_))
+    {
+        return false;
+    }
+    if (segment_header->states_offset_ > segment_size)
+    {
+        return false;
+    }
+    return segment_header->capacity_ <= ((segment_size - segment_header->states_offset_) / segment_header->record_size_);
+}
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+    return ((value + alignment - 1) / alignment) * alignment;
+}
+
+static uint32_t HeaderDataLength(const Trajectory& header)
+{
+    if (header.data_type_ == Trajectory::POSE)
+    {
+        return 7;
+    }
+    return (uint32_t)header.joint_names_.size();
+}
+
+State SharedStateView::Copy() const
+{
+    std::vector<double> fields[State::NUM_FIELDS];
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        const double* values = Field((State::FIELDS)field);
+        if (values != NULL)
+        {
+            fields[field].assign(values, values + data_length_);
+        }
+    }
+    return State(fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], sequence(), timing());
+}
+
+SharedTrajectoryWriter::SharedTrajectoryWriter(std::string name, const Trajectory& header, size_t capacity)
+{
+    name_ = name;
+    header_ = header.CloneHeader();
+    Parser parser;
+    std::string encoded_header = parser.EncodeHeader(header_);
+    uint32_t data_length = HeaderDataLength(header_);
+    size_t header_offset = AlignUp(sizeof(SharedSegmentHeader), 64);
+    size_t states_offset = AlignUp(header_offset + encoded_header.size(), 64);
+    segment_size_ = states_offset + (capacity * RecordSize(data_length));
+    // A segment left by an earlier writer is unlinked rather than truncated, so readers still
+    // attached to it keep a valid mapping instead of faulting
+    fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd_ < 0 && errno == EEXIST && shm_unlink(name.c_str()) == 0)
+    {
+        fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd_ < 0)
+    {
+        throw std::runtime_error("Unable to create shared memory segment: " + name);
+    }
+    if (ftruncate(fd_, (off_t)segment_size_) != 0)
+    {
+        close(fd_);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Unable to size shared memory segment: " + name);
+    }
+    void* mapped = mmap(NULL, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(fd_);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Unable to map shared memory segment: " + name);
+    }
+    segment_ = (char*)mapped;
+    SharedSegmentHeader* segment_header = new (segment_) SharedSegmentHeader();
+    segment_header->version_ = SHARED_VERSION;
+    segment_header->data_length_ = data_length;
+    segment_header->seqlock_.store(0);
+    segment_header->state_count_.store(0);
+    segment_header->capacity_ = capacity;
+    segment_header->header_offset_ = header_offset;
+    segment_header->header_length_ = encoded_header.size();
+    segment_header->states_offset_ = states_offset;
+    segment_header->record_size_ = RecordSize(data_length);
+    memcpy(segment_ + header_offset, encoded_header.data(), encoded_header.size());
+    // The magic goes in last so that readers never attach to a half-initialized segment
+    segment_header->magic_.store(MagicWord(), std::memory_order_release);
+}
+
+SharedTrajectoryWriter::~SharedTrajectoryWriter()
+{
+    munmap(segment_, segment_size_);
+    close(fd_);
+}
+
+SharedStateRecord* SharedTrajectoryWriter::Record(size_t idx)
+{
+    SharedSegmentHeader* segment_header = (SharedSegmentHeader*)segment_;
+    return (SharedStateRecord*)(segment_ + segment_header->states_offset_ + (idx * segment_header->record_size_));
+}
+
+void SharedTrajectoryWriter::WriteRecord(size_t idx, const State& state)
+{
+    SharedSegmentHeader* segment_header = (SharedSegmentHeader*)segment_;
+    if (state.data_length_ != segment_header->data_length_)
+    {
+        throw std::invalid_argument("State does not match the published trajectory's data length");
+    }
+    SharedStateRecord* record = Record(idx);
+    record->sequence_ = state.sequence_;
+    record->secs_ = state.timing_.tv_sec;
+    record->nsecs_ = state.timing_.tv_nsec;
+    record->field_mask_ = 0;
+    double* values = reinterpret_cast<double*>(record + 1);
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        const std::vector<double>& source = state.Field((State::FIELDS)field);
+        if (source.size() > 0)
+        {
+            memcpy(values + (field * segment_header->data_length_), &source[0], source.size() * sizeof(double));
+            record->field_mask_ |= ((uint64_t)1 << field);
+        }
+    }
+}
+
+void SharedTrajectoryWriter::BeginWrite()
+{
+    SharedSegmentHeader* segment_header = (SharedSegmentHeader*)segment_;
+    segment_header->seqlock_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SharedTrajectoryWriter::EndWrite()
+{
+    SharedSegmentHeader* segment_header = (SharedSegmentHeader*)segment_;
+    segment_header->seqlock_.fetch_add(1, std::memory_order_release);
+}
+
+void SharedTrajectoryWriter::Publish(const TrajectoryView& view)
+{
+    SharedSegmentHeader* segment_header = (SharedSegmentHeader*)segment_;
+    if (view.size() > segment_header->capacity_)
+    {
+        throw std::invalid_argument("Trajectory does not fit in the shared memory segment");
+    }
+    BeginWrite();
+    try
+    {
+        for (size_t idx = 0; idx < view.size(); idx++)
+        {
+            WriteRecord(idx, view[idx]);
+        }
+        segment_header->state_count_.store(view.size(), std::memory_order_relaxed);
+    }
+    catch (...)
+    {
+        EndWrite();
+        throw;
+    }
+    EndWrite();
+}
+
+void SharedTrajectoryWriter::push_back(const State& state)
+{
+    SharedSegmentHeader* segment_header = (SharedSegmentHeader*)segment_;
+    uint64_t count = segment_header->state_count_.load(std::memory_order_relaxed);
+    if (count >= segment_header->capacity_)
+    {
+        throw std::invalid_argument("Shared memory segment is full");
+    }
+    // Readers only look at records below state_count_, so appends do not need the seqlock
+    WriteRecord(count, state);
+    segment_header->state_count_.store(count + 1, std::memory_order_release);
+}
+
+void SharedTrajectoryWriter::Update(size_t idx, const State& state)
+{
+    SharedSegmentHeader* segment_header = (SharedSegmentHeader*)segment_;
+    if (idx >= segment_header->state_count_.load(std::memory_order_relaxed))
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    BeginWrite();
+    try
+    {
+        WriteRecord(idx, state);
+    }
+    catch (...)
+    {
+        EndWrite();
+        throw;
+    }
+    EndWrite();
+}
+
+size_t SharedTrajectoryWriter::size() const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    return segment_header->state_count_.load(std::memory_order_relaxed);
+}
+
+size_t SharedTrajectoryWriter::Capacity() const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    return segment_header->capacity_;
+}
+
+void SharedTrajectoryWriter::Unlink()
+{
+    shm_unlink(name_.c_str());
+}
+
+SharedTrajectoryReader::SharedTrajectoryReader(std::string name)
+{
+    name_ = name;
+    fd_ = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd_ < 0)
+    {
+        throw std::invalid_argument("Unable to open shared memory segment (segment may not exist): " + name);
+    }
+    struct stat info;
+    if (fstat(fd_, &info) != 0 || (size_t)info.st_size < sizeof(SharedSegmentHeader))
+    {
+        close(fd_);
+        throw std::invalid_argument("Shared memory segment is not an XTF segment: " + name);
+    }
+    segment_size_ = (size_t)info.st_size;
+    void* mapped = mmap(NULL, segment_size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(fd_);
+        throw std::runtime_error("Unable to map shared memory segment: " + name);
+    }
+    segment_ = (const char*)mapped;
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    // Pairs with the writer's release store, so the fields below are complete once the magic is seen
+    if (segment_header->magic_.load(std::memory_order_acquire) != MagicWord() || segment_header->version_ != SHARED_VERSION || !LayoutFits(segment_header, segment_size_))
+    {
+        munmap((void*)segment_, segment_size_);
+        close(fd_);
+        throw std::invalid_argument("Shared memory segment is not an XTF segment: " + name);
+    }
+    // Only the header is decoded, so attaching does not depend on the number of states
+    Parser parser;
+    try
+    {
+        header_ = parser.DecodeHeader(segment_ + segment_header->header_offset_, segment_header->header_length_);
+        if (HeaderDataLength(header_) != segment_header->data_length_)
+        {
+            throw std::invalid_argument("Shared memory segment is not an XTF segment: " + name);
+        }
+    }
+    catch (...)
+    {
+        munmap((void*)segment_, segment_size_);
+        close(fd_);
+        throw;
+    }
+}
+
+SharedTrajectoryReader::~SharedTrajectoryReader()
+{
+    munmap((void*)segment_, segment_size_);
+    close(fd_);
+}
+
+const Trajectory& SharedTrajectoryReader::Header() const
+{
+    return header_;
+}
+
+uint64_t SharedTrajectoryReader::BeginRead() const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    uint64_t version = segment_header->seqlock_.load(std::memory_order_acquire);
+    while ((version & 1) == 1)
+    {
+        sched_yield();
+        version = segment_header->seqlock_.load(std::memory_order_acquire);
+    }
+    return version;
+}
+
+bool SharedTrajectoryReader::ValidateRead(uint64_t version) const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (segment_header->seqlock_.load(std::memory_order_relaxed) == version);
+}
+
+size_t SharedTrajectoryReader::size() const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    return segment_header->state_count_.load(std::memory_order_acquire);
+}
+
+size_t SharedTrajectoryReader::Capacity() const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    return segment_header->capacity_;
+}
+
+SharedStateView SharedTrajectoryReader::at(size_t idx) const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    if (idx >= size())
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    const SharedStateRecord* record = (const SharedStateRecord*)(segment_ + segment_header->states_offset_ + (idx * segment_header->record_size_));
+    return SharedStateView(record, segment_header->data_length_);
+}
+
+Trajectory SharedTrajectoryReader::Snapshot() const
+{
+    const SharedSegmentHeader* segment_header = (const SharedSegmentHeader*)segment_;
+    while (true)
+    {
+        uint64_t version = BeginRead();
+        Trajectory snapshot = header_.CloneHeader();
+        // Records are read directly rather than through at(), whose check against the live count
+        // would throw if a shorter trajectory were published meanwhile; ValidateRead() discards that
+        size_t count = std::min(size(), (size_t)segment_header->capacity_);
+        snapshot.trajectory_.reserve(count);
+        for (size_t idx = 0; idx < count; idx++)
+        {
+            const SharedStateRecord* record = (const SharedStateRecord*)(segment_ + segment_header->states_offset_ + (idx * segment_header->record_size_));
+            snapshot.trajectory_.push_back(SharedStateView(record, segment_header->data_length_).Copy());
+        }
+        if (ValidateRead(version))
+        {
+            return snapshot;
+        }
+    }
+}
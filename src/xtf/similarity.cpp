@@ -0,0 +1,437 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+#include "xtf/similarity.hpp"
+
+using namespace XTF;
+
+/* Resampled trajectories are stored joint-major (all samples of the first joint, then the second,
+ * ...), so the kernels below run along a row of the warping matrix two samples per SSE2
+ * instruction.
+ */
+
+static const double SIMILARITY_INFINITY = std::numeric_limits<double>::infinity();
+// Candidates are evaluated in lower bound order, this many per task
+static const size_t SIMILARITY_TASK_SIZE = 16;
+
+// accumulated[i] += (values[i] - reference)^2
+static void AccumulateSquaredDifferences(const double* values, double reference, double* accumulated, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    __m128d packed_reference = _mm_set1_pd(reference);
+    for (; (idx + 2) <= count; idx += 2)
+    {
+        __m128d difference = _mm_sub_pd(_mm_loadu_pd(values + idx), packed_reference);
+        _mm_storeu_pd(accumulated + idx, _mm_add_pd(_mm_loadu_pd(accumulated + idx), _mm_mul_pd(difference, difference)));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        double difference = values[idx] - reference;
+        accumulated[idx] += difference * difference;
+    }
+}
+
+// accumulated[i] += squared distance from values[i] to [lower[i], upper[i]]
+static void AccumulateEnvelopeExcess(const double* values, const double* lower, const double* upper, double* accumulated, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    __m128d zero = _mm_setzero_pd();
+    for (; (idx + 2) <= count; idx += 2)
+    {
+        __m128d packed = _mm_loadu_pd(values + idx);
+        __m128d below = _mm_max_pd(_mm_sub_pd(_mm_loadu_pd(lower + idx), packed), zero);
+        __m128d above = _mm_max_pd(_mm_sub_pd(packed, _mm_loadu_pd(upper + idx)), zero);
+        __m128d excess = _mm_add_pd(below, above);
+        _mm_storeu_pd(accumulated + idx, _mm_add_pd(_mm_loadu_pd(accumulated + idx), _mm_mul_pd(excess, excess)));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        double excess = std::max(lower[idx] - values[idx], 0.0) + std::max(values[idx] - upper[idx], 0.0);
+        accumulated[idx] += excess * excess;
+    }
+}
+
+static void SqrtInPlace(double* values, size_t count)
+{
+    size_t idx = 0;
+#if defined(__SSE2__)
+    for (; (idx + 2) <= count; idx += 2)
+    {
+        _mm_storeu_pd(values + idx, _mm_sqrt_pd(_mm_loadu_pd(values + idx)));
+    }
+#endif
+    for (; idx < count; idx++)
+    {
+        values[idx] = sqrt(values[idx]);
+    }
+}
+
+static size_t BandWindow(const SimilarityOptions& options)
+{
+    if (options.samples_ < 1)
+    {
+        throw std::invalid_argument("Similarity search needs at least one sample per trajectory");
+    }
+    if (!(options.band_ >= 0.0))
+    {
+        throw std::invalid_argument("Similarity band must be non-negative");
+    }
+    if (options.band_ >= 1.0)
+    {
+        return options.samples_;
+    }
+    return (size_t)ceil(options.band_ * (double)options.samples_);
+}
+
+static void ResampleField(const TrajectoryView& view, State::FIELDS field, size_t data_length, size_t samples, double* out)
+{
+    size_t count = view.size();
+    if (count == 0)
+    {
+        throw std::invalid_argument("Cannot compare an empty trajectory");
+    }
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        if (view[idx].Field(field).size() != data_length)
+        {
+            std::ostringstream error_stream;
+            error_stream << "State " << idx << " does not have the compared field for every joint";
+            throw std::invalid_argument(error_stream.str());
+        }
+    }
+    // Uniform in time when the states are timed and ordered, uniform over states otherwise
+    bool timed = (view.Header().timing_ == Trajectory::TIMED && count > 1);
+    double duration = timed ? TimespecToSeconds(view[count - 1].timing_) - TimespecToSeconds(view[0].timing_) : 0.0;
+    for (size_t idx = 1; timed && idx < count; idx++)
+    {
+        timed = (CompareTimespecs(view[idx - 1].timing_, view[idx].timing_) <= 0);
+    }
+    timed = timed && (duration > 0.0);
+    double first_time = TimespecToSeconds(view[0].timing_);
+    size_t segment = 0;
+    for (size_t sample = 0; sample < samples; sample++)
+    {
+        double fraction = (samples > 1) ? ((double)sample / (double)(samples - 1)) : 0.0;
+        size_t start = 0;
+        double u = 0.0;
+        if (count == 1)
+        {
+            start = 0;
+        }
+        else if (timed)
+        {
+            double target = first_time + (fraction * duration);
+            while (segment + 2 < count && TimespecToSeconds(view[segment + 1].timing_) <= target)
+            {
+                segment++;
+            }
+            double segment_start = TimespecToSeconds(view[segment].timing_);
+            double segment_length = TimespecToSeconds(view[segment + 1].timing_) - segment_start;
+            start = segment;
+            u = (segment_length > 0.0) ? std::min(std::max((target - segment_start) / segment_length, 0.0), 1.0) : 0.0;
+        }
+        else
+        {
+            double position = fraction * (double)(count - 1);
+            start = std::min((size_t)position, count - 2);
+            u = position - (double)start;
+        }
+        const std::vector<double>& from = view[start].Field(field);
+        const std::vector<double>& to = view[std::min(start + 1, count - 1)].Field(field);
+        for (size_t joint = 0; joint < data_length; joint++)
+        {
+            out[(joint * samples) + sample] = from[joint] + (u * (to[joint] - from[joint]));
+        }
+    }
+}
+
+static double SampleDistance(const double* first, const double* second, size_t data_length, size_t samples, size_t idx)
+{
+    double total = 0.0;
+    for (size_t joint = 0; joint < data_length; joint++)
+    {
+        double difference = first[(joint * samples) + idx] - second[(joint * samples) + idx];
+        total += difference * difference;
+    }
+    return sqrt(total);
+}
+
+class WarpWorkspace
+{
+public:
+
+    std::vector<double> costs_;
+    std::vector<double> previous_;
+    std::vector<double> current_;
+    std::vector<double> upper_;
+    std::vector<double> lower_;
+
+    WarpWorkspace(size_t samples) : costs_(samples), previous_(samples + 1), current_(samples + 1) {}
+
+};
+
+/* Banded DTW (sums) or discrete Frechet (maximums) between two resampled trajectories. Row r
+ * holds the best path cost to (i, j) at r[j + 1], with r[0] as an infinite sentinel. Returns
+ * infinity once every cell of a row exceeds threshold, since no path can come back under it.
+ */
+static double Warp(const double* query, const double* candidate, size_t data_length, size_t samples, size_t window, bool frechet, double threshold, WarpWorkspace& workspace)
+{
+    double* costs = workspace.costs_.data();
+    double* previous = workspace.previous_.data();
+    double* current = workspace.current_.data();
+    std::fill(workspace.previous_.begin(), workspace.previous_.end(), SIMILARITY_INFINITY);
+    std::fill(workspace.current_.begin(), workspace.current_.end(), SIMILARITY_INFINITY);
+    previous[0] = 0.0;
+    for (size_t row = 0; row < samples; row++)
+    {
+        size_t low = (row > window) ? (row - window) : 0;
+        size_t high = std::min(samples - 1, row + window);
+        size_t width = high - low + 1;
+        std::fill(costs + low, costs + high + 1, 0.0);
+        for (size_t joint = 0; joint < data_length; joint++)
+        {
+            AccumulateSquaredDifferences(candidate + (joint * samples) + low, query[(joint * samples) + row], costs + low, width);
+        }
+        SqrtInPlace(costs + low, width);
+        current[low] = SIMILARITY_INFINITY;
+        double row_minimum = SIMILARITY_INFINITY;
+        for (size_t column = low; column <= high; column++)
+        {
+            double best = std::min(std::min(previous[column + 1], previous[column]), current[column]);
+            double value = frechet ? std::max(costs[column], best) : (costs[column] + best);
+            current[column + 1] = value;
+            row_minimum = std::min(row_minimum, value);
+        }
+        if (high + 2 <= samples)
+        {
+            current[high + 2] = SIMILARITY_INFINITY;
+        }
+        if (row_minimum > threshold)
+        {
+            return SIMILARITY_INFINITY;
+        }
+        std::swap(previous, current);
+    }
+    return previous[samples];
+}
+
+static void BuildEnvelope(const double* query, size_t data_length, size_t samples, size_t window, WarpWorkspace& workspace)
+{
+    workspace.upper_.resize(data_length * samples);
+    workspace.lower_.resize(data_length * samples);
+    for (size_t joint = 0; joint < data_length; joint++)
+    {
+        const double* values = query + (joint * samples);
+        for (size_t idx = 0; idx < samples; idx++)
+        {
+            size_t low = (idx > window) ? (idx - window) : 0;
+            size_t high = std::min(samples - 1, idx + window);
+            std::pair<const double*, const double*> extremes = std::minmax_element(values + low, values + high + 1);
+            workspace.lower_[(joint * samples) + idx] = *extremes.first;
+            workspace.upper_[(joint * samples) + idx] = *extremes.second;
+        }
+    }
+}
+
+// LB_Kim (first and last samples are on every path) and LB_Keogh (every candidate sample is matched within the query's envelope)
+static double LowerBound(const double* query, const double* candidate, size_t data_length, size_t samples, bool frechet, const WarpWorkspace& envelope, WarpWorkspace& workspace)
+{
+    double first = SampleDistance(query, candidate, data_length, samples, 0);
+    double last = SampleDistance(query, candidate, data_length, samples, samples - 1);
+    double kim = frechet ? std::max(first, last) : ((samples > 1) ? (first + last) : first);
+    double* excess = workspace.costs_.data();
+    std::fill(excess, excess + samples, 0.0);
+    for (size_t joint = 0; joint < data_length; joint++)
+    {
+        size_t offset = joint * samples;
+        AccumulateEnvelopeExcess(candidate + offset, envelope.lower_.data() + offset, envelope.upper_.data() + offset, excess, samples);
+    }
+    SqrtInPlace(excess, samples);
+    double keogh = 0.0;
+    for (size_t idx = 0; idx < samples; idx++)
+    {
+        keogh = frechet ? std::max(keogh, excess[idx]) : (keogh + excess[idx]);
+    }
+    return std::max(kim, keogh);
+}
+
+static size_t DataLength(const Trajectory& header)
+{
+    return (header.data_type_ == Trajectory::POSE) ? 7 : header.joint_names_.size();
+}
+
+double XTF::TrajectoryDistance(const TrajectoryView& first, const TrajectoryView& second, const SimilarityOptions& options)
+{
+    size_t data_length = DataLength(first.Header());
+    if (first.Header().data_type_ != second.Header().data_type_ || data_length != DataLength(second.Header()))
+    {
+        throw std::invalid_argument("Trajectories must have the same data type and length to be compared");
+    }
+    size_t window = BandWindow(options);
+    std::vector<double> first_samples(data_length * options.samples_);
+    std::vector<double> second_samples(data_length * options.samples_);
+    ResampleField(first, options.field_, data_length, options.samples_, first_samples.data());
+    ResampleField(second, options.field_, data_length, options.samples_, second_samples.data());
+    WarpWorkspace workspace(options.samples_);
+    return Warp(first_samples.data(), second_samples.data(), data_length, options.samples_, window, (options.metric_ == SimilarityOptions::FRECHET), SIMILARITY_INFINITY, workspace);
+}
+
+SimilarityIndex::SimilarityIndex(const Trajectory& header, const SimilarityOptions& options) : options_(options), size_(0)
+{
+    if (header.data_type_ != Trajectory::JOINT)
+    {
+        throw std::invalid_argument("Similarity search is only supported for JOINT trajectories");
+    }
+    joint_names_ = header.joint_names_;
+    window_ = BandWindow(options_);
+}
+
+void SimilarityIndex::Prepare(const TrajectoryView& view, double* out) const
+{
+    const Trajectory& header = view.Header();
+    if (header.data_type_ != Trajectory::JOINT || header.joint_names_ != joint_names_)
+    {
+        throw std::invalid_argument("Trajectory does not have the same joints as the similarity index");
+    }
+    ResampleField(view, options_.field_, joint_names_.size(), options_.samples_, out);
+}
+
+size_t SimilarityIndex::Add(const TrajectoryView& view)
+{
+    return Add(std::vector<TrajectoryView>(1, view));
+}
+
+size_t SimilarityIndex::Add(const std::vector<TrajectoryView>& views)
+{
+    size_t stride = joint_names_.size() * options_.samples_;
+    size_t first = size_;
+    std::vector<double> added(views.size() * stride);
+    ParallelFor(views.size(), options_.threads_, [&](size_t idx)
+    {
+        Prepare(views[idx], added.data() + (idx * stride));
+    });
+    series_.insert(series_.end(), added.begin(), added.end());
+    size_ += views.size();
+    return first;
+}
+
+size_t SimilarityIndex::size() const
+{
+    return size_;
+}
+
+double SimilarityIndex::Distance(const TrajectoryView& query, size_t index) const
+{
+    if (index >= size_)
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << index << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+    size_t data_length = joint_names_.size();
+    std::vector<double> samples(data_length * options_.samples_);
+    Prepare(query, samples.data());
+    WarpWorkspace workspace(options_.samples_);
+    const double* candidate = series_.data() + (index * data_length * options_.samples_);
+    return Warp(samples.data(), candidate, data_length, options_.samples_, window_, (options_.metric_ == SimilarityOptions::FRECHET), SIMILARITY_INFINITY, workspace);
+}
+
+std::vector<SimilarityMatch> SimilarityIndex::Query(const TrajectoryView& query, size_t k) const
+{
+    std::vector<SimilarityMatch> matches;
+    k = std::min(k, size_);
+    if (k == 0)
+    {
+        return matches;
+    }
+    size_t data_length = joint_names_.size();
+    size_t samples = options_.samples_;
+    size_t stride = data_length * samples;
+    bool frechet = (options_.metric_ == SimilarityOptions::FRECHET);
+    std::vector<double> query_samples(stride);
+    Prepare(query, query_samples.data());
+    WarpWorkspace envelope(samples);
+    BuildEnvelope(query_samples.data(), data_length, samples, window_, envelope);
+    // Bound every candidate, then evaluate the most promising first so the k-th best tightens quickly
+    size_t num_tasks = (size_ + SIMILARITY_TASK_SIZE - 1) / SIMILARITY_TASK_SIZE;
+    std::vector< std::pair<double, size_t> > bounds(size_);
+    ParallelFor(num_tasks, options_.threads_, [&](size_t task)
+    {
+        WarpWorkspace workspace(samples);
+        size_t end = std::min(size_, (task + 1) * SIMILARITY_TASK_SIZE);
+        for (size_t idx = task * SIMILARITY_TASK_SIZE; idx < end; idx++)
+        {
+            bounds[idx] = std::make_pair(LowerBound(query_samples.data(), series_.data() + (idx * stride), data_length, samples, frechet, envelope, workspace), idx);
+        }
+    });
+    std::sort(bounds.begin(), bounds.end());
+    // best holds the k smallest distances so far as a max-heap; threshold mirrors its top once full
+    std::vector<double> best;
+    std::mutex best_mutex;
+    std::atomic<double> threshold(SIMILARITY_INFINITY);
+    std::vector<double> distances(size_, SIMILARITY_INFINITY);
+    ParallelFor(num_tasks, options_.threads_, [&](size_t task)
+    {
+        WarpWorkspace workspace(samples);
+        size_t end = std::min(size_, (task + 1) * SIMILARITY_TASK_SIZE);
+        for (size_t rank = task * SIMILARITY_TASK_SIZE; rank < end; rank++)
+        {
+            double limit = threshold.load();
+            if (bounds[rank].first > limit)
+            {
+                // Bounds are sorted, so nothing later in this task can qualify either
+                return;
+            }
+            size_t idx = bounds[rank].second;
+            double distance = Warp(query_samples.data(), series_.data() + (idx * stride), data_length, samples, window_, frechet, limit, workspace);
+            distances[idx] = distance;
+            if (distance <= limit)
+            {
+                std::lock_guard<std::mutex> lock(best_mutex);
+                best.push_back(distance);
+                std::push_heap(best.begin(), best.end());
+                if (best.size() > k)
+                {
+                    std::pop_heap(best.begin(), best.end());
+                    best.pop_back();
+                }
+                if (best.size() == k)
+                {
+                    threshold.store(best.front());
+                }
+            }
+        }
+    });
+    // Candidates tied with the k-th best are never pruned, so ties resolve by index
+    for (size_t idx = 0; idx < size_; idx++)
+    {
+        if (distances[idx] <= threshold.load())
+        {
+            matches.push_back(SimilarityMatch(idx, distances[idx]));
+        }
+    }
+    std::sort(matches.begin(), matches.end(), [](const SimilarityMatch& first, const SimilarityMatch& second)
+    {
+        return (first.distance_ < second.distance_) || (first.distance_ == second.distance_ && first.index_ < second.index_);
+    });
+    matches.resize(std::min(matches.size(), k));
+    return matches;
+}
@@ -0,0 +1,393 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+#include "xtf/simplify.hpp"
+
+using namespace XTF;
+
+// Intervals at least this long have their farthest state searched in parallel chunks
+static const size_t SIMPLIFY_CHUNK = 16384;
+
+class DeviationMetric
+{
+protected:
+
+    static inline double Normalize(double deviation, double tolerance)
+    {
+        if (tolerance > 0.0)
+        {
+            return deviation / tolerance;
+        }
+        return (deviation > 0.0) ? INFINITY : 0.0;
+    }
+
+    static inline double Elapsed(const timespec& from, const timespec& to)
+    {
+        return (double)(to.tv_sec - from.tv_sec) + ((double)(to.tv_nsec - from.tv_nsec) * 0.000000001);
+    }
+
+    static double RotationDeviation(const double* start, const double* end, const double* point, double t)
+    {
+        double start_norm = sqrt(start[0] * start[0] + start[1] * start[1] + start[2] * start[2] + start[3] * start[3]);
+        double end_norm = sqrt(end[0] * end[0] + end[1] * end[1] + end[2] * end[2] + end[3] * end[3]);
+        double point_norm = sqrt(point[0] * point[0] + point[1] * point[1] + point[2] * point[2] + point[3] * point[3]);
+        if (start_norm == 0.0 || end_norm == 0.0 || point_norm == 0.0)
+        {
+            return INFINITY;
+        }
+        double cos_theta = 0.0;
+        for (size_t idx = 0; idx < 4; idx++)
+        {
+            cos_theta += (start[idx] / start_norm) * (end[idx] / end_norm);
+        }
+        // q and -q are the same rotation, so interpolate along the shorter arc
+        double sign = (cos_theta < 0.0) ? -1.0 : 1.0;
+        cos_theta = std::min(std::fabs(cos_theta), 1.0);
+        double start_weight = 1.0 - t;
+        double end_weight = t;
+        if (cos_theta < 0.9995)
+        {
+            double theta = acos(cos_theta);
+            start_weight = sin((1.0 - t) * theta) / sin(theta);
+            end_weight = sin(t * theta) / sin(theta);
+        }
+        double interpolated[4];
+        double interpolated_norm = 0.0;
+        for (size_t idx = 0; idx < 4; idx++)
+        {
+            interpolated[idx] = (start_weight * start[idx] / start_norm) + (sign * end_weight * end[idx] / end_norm);
+            interpolated_norm += interpolated[idx] * interpolated[idx];
+        }
+        interpolated_norm = sqrt(interpolated_norm);
+        double dot = 0.0;
+        for (size_t idx = 0; idx < 4; idx++)
+        {
+            dot += (interpolated[idx] / interpolated_norm) * (point[idx] / point_norm);
+        }
+        return 2.0 * acos(std::min(std::fabs(dot), 1.0));
+    }
+
+public:
+
+    State::FIELDS field_;
+    bool pose_;
+    bool synchronized_;
+    double tolerance_;
+    double rotation_tolerance_;
+
+    DeviationMetric(const Trajectory& header, double tolerance, const SimplifyOptions& options)
+    {
+        if (!(tolerance >= 0.0))
+        {
+            throw std::invalid_argument("Simplification tolerance must be non-negative");
+        }
+        field_ = options.field_;
+        pose_ = (header.data_type_ == Trajectory::POSE);
+        synchronized_ = options.synchronized_ && (header.timing_ == Trajectory::TIMED);
+        tolerance_ = tolerance;
+        rotation_tolerance_ = (options.rotation_tolerance_ < 0.0) ? tolerance : options.rotation_tolerance_;
+    }
+
+    // Deviation of point from the start-end line, scaled so that 1.0 is the tolerance
+    double operator()(const State& start, const State& end, const State& point) const
+    {
+        const std::vector<double>& start_values = start.Field(field_);
+        const std::vector<double>& end_values = end.Field(field_);
+        const std::vector<double>& point_values = point.Field(field_);
+        size_t linear = pose_ ? 3 : start_values.size();
+        double t = 0.0;
+        if (synchronized_)
+        {
+            double span = Elapsed(start.timing_, end.timing_);
+            t = (span > 0.0) ? (Elapsed(start.timing_, point.timing_) / span) : 0.0;
+        }
+        else
+        {
+            double projection = 0.0;
+            double length_squared = 0.0;
+            for (size_t idx = 0; idx < linear; idx++)
+            {
+                double direction = end_values[idx] - start_values[idx];
+                projection += (point_values[idx] - start_values[idx]) * direction;
+                length_squared += direction * direction;
+            }
+            t = (length_squared > 0.0) ? std::min(std::max(projection / length_squared, 0.0), 1.0) : 0.0;
+        }
+        double distance_squared = 0.0;
+        for (size_t idx = 0; idx < linear; idx++)
+        {
+            double interpolated = start_values[idx] + (t * (end_values[idx] - start_values[idx]));
+            distance_squared += (point_values[idx] - interpolated) * (point_values[idx] - interpolated);
+        }
+        double deviation = Normalize(sqrt(distance_squared), tolerance_);
+        if (pose_)
+        {
+            deviation = std::max(deviation, Normalize(RotationDeviation(&start_values[3], &end_values[3], &point_values[3], t), rotation_tolerance_));
+        }
+        return deviation;
+    }
+
+};
+
+class FarthestState
+{
+public:
+
+    size_t index_;
+    double deviation_;
+
+    FarthestState() : index_(0), deviation_(-1.0) {}
+
+    // Ties go to the lower index so that the result does not depend on how the search was split
+    inline void Merge(const FarthestState& other)
+    {
+        if (other.deviation_ > deviation_ || (other.deviation_ == deviation_ && other.index_ < index_))
+        {
+            *this = other;
+        }
+    }
+
+};
+
+static FarthestState FindFarthest(const TrajectoryView& view, const DeviationMetric& metric, size_t start, size_t end, size_t first, size_t last)
+{
+    FarthestState farthest;
+    for (size_t idx = first; idx < last; idx++)
+    {
+        double deviation = metric(view[start], view[end], view[idx]);
+        // NaN positions always count as out of tolerance
+        if (deviation != deviation)
+        {
+            deviation = INFINITY;
+        }
+        if (deviation > farthest.deviation_)
+        {
+            farthest.index_ = idx;
+            farthest.deviation_ = deviation;
+        }
+    }
+    return farthest;
+}
+
+std::vector<size_t> XTF::SimplifyIndices(const TrajectoryView& view, double tolerance, const SimplifyOptions& options)
+{
+    DeviationMetric metric(view.Header(), tolerance, options);
+    size_t count = view.size();
+    std::vector<uint8_t> keep(count, 0);
+    if (count == 0)
+    {
+        return std::vector<size_t>();
+    }
+    keep[0] = 1;
+    keep[count - 1] = 1;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        if (view[idx].Field(options.field_).size() == 0)
+        {
+            keep[idx] = 1;
+            keep[(idx > 0) ? (idx - 1) : idx] = 1;
+            keep[(idx + 1 < count) ? (idx + 1) : idx] = 1;
+        }
+        else if (options.preserve_extras_ && view[idx].extras_.size() > 0)
+        {
+            keep[idx] = 1;
+        }
+    }
+    std::vector< std::pair<size_t, size_t> > intervals;
+    size_t previous = 0;
+    for (size_t idx = 1; idx < count; idx++)
+    {
+        if (keep[idx])
+        {
+            if ((idx - previous) > 1)
+            {
+                intervals.push_back(std::pair<size_t, size_t>(previous, idx));
+            }
+            previous = idx;
+        }
+    }
+    // The recursion runs one level at a time, in parallel across intervals once there are enough
+    // of them, and across chunks of each interval before that
+    size_t threads = ResolveThreads(options.threads_);
+    while (intervals.size() > 0)
+    {
+        std::vector<FarthestState> farthest(intervals.size());
+        if (intervals.size() >= threads)
+        {
+            ParallelFor(intervals.size(), threads, [&](size_t interval)
+            {
+                farthest[interval] = FindFarthest(view, metric, intervals[interval].first, intervals[interval].second, intervals[interval].first + 1, intervals[interval].second);
+            });
+        }
+        else
+        {
+            for (size_t interval = 0; interval < intervals.size(); interval++)
+            {
+                size_t start = intervals[interval].first;
+                size_t end = intervals[interval].second;
+                size_t num_chunks = std::max((size_t)1, (end - start - 1) / SIMPLIFY_CHUNK);
+                std::vector<FarthestState> chunks(num_chunks);
+                ParallelFor(num_chunks, threads, [&](size_t chunk)
+                {
+                    size_t first = start + 1 + (chunk * (end - start - 1)) / num_chunks;
+                    size_t last = start + 1 + ((chunk + 1) * (end - start - 1)) / num_chunks;
+                    chunks[chunk] = FindFarthest(view, metric, start, end, first, last);
+                });
+                for (size_t chunk = 0; chunk < num_chunks; chunk++)
+                {
+                    farthest[interval].Merge(chunks[chunk]);
+                }
+            }
+        }
+        std::vector< std::pair<size_t, size_t> > next_intervals;
+        for (size_t interval = 0; interval < intervals.size(); interval++)
+        {
+            if (farthest[interval].deviation_ <= 1.0)
+            {
+                continue;
+            }
+            size_t split = farthest[interval].index_;
+            keep[split] = 1;
+            if ((split - intervals[interval].first) > 1)
+            {
+                next_intervals.push_back(std::pair<size_t, size_t>(intervals[interval].first, split));
+            }
+            if ((intervals[interval].second - split) > 1)
+            {
+                next_intervals.push_back(std::pair<size_t, size_t>(split, intervals[interval].second));
+            }
+        }
+        intervals.swap(next_intervals);
+    }
+    std::vector<size_t> indices;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        if (keep[idx])
+        {
+            indices.push_back(idx);
+        }
+    }
+    return indices;
+}
+
+Trajectory XTF::Simplify(const TrajectoryView& view, double tolerance, const SimplifyOptions& options)
+{
+    std::vector<size_t> indices = SimplifyIndices(view, tolerance, options);
+    Trajectory simplified = view.Header().CloneHeader();
+    simplified.reserve(indices.size());
+    for (size_t idx = 0; idx < indices.size(); idx++)
+    {
+        simplified.push_back(view[indices[idx]]);
+    }
+    return simplified;
+}
+
+StreamingSimplifier::StreamingSimplifier(const Trajectory& header, double tolerance, const SimplifyOptions& options)
+{
+    // Validates the tolerance up front rather than on the first state
+    DeviationMetric metric(header, tolerance, options);
+    header_ = header.CloneHeader();
+    tolerance_ = tolerance;
+    options_ = options;
+    has_anchor_ = false;
+    received_ = 0;
+    retained_ = 0;
+}
+
+void StreamingSimplifier::Retain(const State& state)
+{
+    anchor_ = state;
+    has_anchor_ = true;
+    window_.clear();
+    ready_.push_back(anchor_);
+    retained_++;
+}
+
+bool StreamingSimplifier::Fits(const State& end) const
+{
+    DeviationMetric metric(header_, tolerance_, options_);
+    for (size_t idx = 0; idx < window_.size(); idx++)
+    {
+        // Written as a negated comparison so that NaN deviations do not fit
+        if (!(metric(anchor_, end, window_[idx]) <= 1.0))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void StreamingSimplifier::push_back(const State& state)
+{
+    received_++;
+    bool breakpoint = (state.Field(options_.field_).size() == 0) || (options_.preserve_extras_ && state.extras_.size() > 0);
+    if (!has_anchor_ || anchor_.Field(options_.field_).size() == 0)
+    {
+        Retain(state);
+        return;
+    }
+    // Every held-back state is within tolerance of the line to the newest one, so the newest can
+    // always be retained to close the window
+    if (breakpoint || (options_.max_window_ > 0 && window_.size() >= options_.max_window_))
+    {
+        if (window_.size() > 0)
+        {
+            State last = window_.back();
+            Retain(last);
+        }
+        if (breakpoint)
+        {
+            Retain(state);
+            return;
+        }
+    }
+    if (window_.size() > 0 && !Fits(state))
+    {
+        State last = window_.back();
+        Retain(last);
+    }
+    window_.push_back(state);
+}
+
+void StreamingSimplifier::Finish()
+{
+    if (window_.size() > 0)
+    {
+        State last = window_.back();
+        Retain(last);
+    }
+}
+
+bool StreamingSimplifier::HasNext() const
+{
+    return (ready_.size() > 0);
+}
+
+State StreamingSimplifier::Next()
+{
+    if (ready_.size() == 0)
+    {
+        throw std::out_of_range("No simplified states are ready");
+    }
+    State state = ready_.front();
+    ready_.pop_front();
+    return state;
+}
+
+size_t StreamingSimplifier::Received() const
+{
+    return received_;
+}
+
+size_t StreamingSimplifier::Retained() const
+{
+    return retained_;
+}
@@ -0,0 +1,492 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <libxml/parser.h>
+#include <libxml++/libxml++.h>
+#include "xtf/xtf.hpp"
+#include "xtf/stream.hpp"
+
+using namespace XTF;
+
+static const size_t STREAM_LENGTH_DIGITS = 20;
+
+static inline int64_t ToNanoseconds(const timespec& timing)
+{
+    return ((int64_t)timing.tv_sec * 1000000000) + (int64_t)timing.tv_nsec;
+}
+
+static inline timespec FromNanoseconds(int64_t nanoseconds)
+{
+    timespec timing;
+    timing.tv_sec = (time_t)(nanoseconds / 1000000000);
+    timing.tv_nsec = (long)(nanoseconds % 1000000000);
+    if (timing.tv_nsec < 0)
+    {
+        timing.tv_sec -= 1;
+        timing.tv_nsec += 1000000000;
+    }
+    return timing;
+}
+
+StateReader::StateReader(std::string filename) : filename_(filename), length_(0), has_next_(false)
+{
+    timespec start_time;
+    timespec end_time;
+    header_ = parser_.ParseTrajHeader(filename, length_, start_time, end_time);
+    try
+    {
+        reader_.reset(new xmlpp::TextReader(filename));
+        Advance(false);
+    }
+    catch (xmlpp::exception& e)
+    {
+        throw std::invalid_argument("Unable to read XTF file (file may not exist): " + filename);
+    }
+}
+
+void StateReader::Advance(bool skip)
+{
+    // After a state, next() skips its subtree, and lands on whatever follows it
+    bool more = skip ? reader_->next() : reader_->read();
+    while (more)
+    {
+        if (reader_->get_node_type() == xmlpp::TextReader::Element && std::string(reader_->get_name()) == "state")
+        {
+            has_next_ = true;
+            return;
+        }
+        more = reader_->read();
+    }
+    has_next_ = false;
+}
+
+const Trajectory& StateReader::Header() const
+{
+    return header_;
+}
+
+size_t StateReader::Length() const
+{
+    return length_;
+}
+
+bool StateReader::HasNext() const
+{
+    return has_next_;
+}
+
+State StateReader::Next()
+{
+    if (!has_next_)
+    {
+        throw std::out_of_range("No more states in " + filename_);
+    }
+    try
+    {
+        // Only the current state's subtree is expanded into a DOM
+        xmlpp::Node* node = reader_->expand();
+        if (node == NULL)
+        {
+            throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+        }
+        State state = parser_.ReadState(node);
+        Advance(true);
+        return state;
+    }
+    catch (xmlpp::exception& e)
+    {
+        has_next_ = false;
+        throw std::invalid_argument("XTF file is malformed or otherwise corrupted: " + filename_);
+    }
+}
+
+StateWriter::StateWriter(std::string filename, const Trajectory& header, bool compact, size_t block_size) : filename_(filename), output_(NULL), block_size_(std::max(block_size, (size_t)1)), compact_(compact), length_offset_(0), written_(0)
+{
+    pending_ = header.CloneHeader();
+    std::string prefix;
+    parser_.EncodeStatesEnvelope(pending_, compact, prefix, suffix_, indent_);
+    length_offset_ = (long)prefix.size();
+    prefix += std::string(STREAM_LENGTH_DIGITS, '0') + "\">";
+    output_ = fopen(filename.c_str(), "wb");
+    if (output_ == NULL)
+    {
+        throw std::runtime_error("Unable to write XTF file: " + filename);
+    }
+    if (fwrite(prefix.data(), 1, prefix.size(), output_) != prefix.size())
+    {
+        fclose(output_);
+        output_ = NULL;
+        throw std::runtime_error("Unable to write XTF file: " + filename);
+    }
+    pending_.reserve(block_size_);
+}
+
+StateWriter::~StateWriter()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+        // Destructors must not throw; call Close() directly to see errors
+    }
+}
+
+void StateWriter::push_back(const State& state)
+{
+    if (output_ == NULL)
+    {
+        throw std::runtime_error("XTF file is already closed: " + filename_);
+    }
+    pending_.push_back(state);
+    if (pending_.size() >= block_size_)
+    {
+        WriteBlock();
+    }
+}
+
+void StateWriter::WriteBlock()
+{
+    if (pending_.size() == 0)
+    {
+        return;
+    }
+    std::string elements = parser_.EncodeStateElements(TrajectoryView(pending_), compact_, indent_);
+    if (fwrite(elements.data(), 1, elements.size(), output_) != elements.size())
+    {
+        throw std::runtime_error("Unable to write XTF file: " + filename_);
+    }
+    written_ += pending_.size();
+    pending_.trajectory_.clear();
+}
+
+void StateWriter::Flush()
+{
+    if (output_ == NULL)
+    {
+        return;
+    }
+    WriteBlock();
+    if (fflush(output_) != 0)
+    {
+        throw std::runtime_error("Unable to write XTF file: " + filename_);
+    }
+}
+
+void StateWriter::Close()
+{
+    if (output_ == NULL)
+    {
+        return;
+    }
+    try
+    {
+        WriteBlock();
+    }
+    catch (...)
+    {
+        fclose(output_);
+        output_ = NULL;
+        throw;
+    }
+    std::string length = std::to_string(written_);
+    length.insert(0, STREAM_LENGTH_DIGITS - std::min(length.size(), STREAM_LENGTH_DIGITS), '0');
+    bool written = (fwrite(suffix_.data(), 1, suffix_.size(), output_) == suffix_.size());
+    written = written && (fseek(output_, length_offset_, SEEK_SET) == 0) && (fwrite(length.data(), 1, length.size(), output_) == length.size());
+    bool closed = (fclose(output_) == 0);
+    output_ = NULL;
+    if (!written || !closed)
+    {
+        throw std::runtime_error("Unable to write XTF file: " + filename_);
+    }
+}
+
+size_t StateWriter::size() const
+{
+    return written_ + pending_.size();
+}
+
+StateMerger::StateMerger(const std::vector<std::string>& filenames, const MergeOptions& options) : options_(options), clock_(0), period_(0), sequence_(0), finished_(false)
+{
+    if (filenames.size() == 0)
+    {
+        throw std::invalid_argument("Nothing to merge");
+    }
+    try
+    {
+        for (size_t idx = 0; idx < filenames.size(); idx++)
+        {
+            sources_.push_back(new StateReader(filenames[idx]));
+        }
+        BuildHeader();
+        current_.resize(sources_.size());
+        next_.resize(sources_.size());
+        has_current_.resize(sources_.size(), false);
+        has_next_.resize(sources_.size(), false);
+        if (options_.mode_ == MergeOptions::ALIGNED)
+        {
+            StartAligned();
+        }
+        else
+        {
+            for (size_t idx = 0; idx < sources_.size(); idx++)
+            {
+                has_current_[idx] = sources_[idx]->HasNext();
+                if (has_current_[idx])
+                {
+                    current_[idx] = sources_[idx]->Next();
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        for (size_t idx = 0; idx < sources_.size(); idx++)
+        {
+            delete sources_[idx];
+        }
+        throw;
+    }
+}
+
+StateMerger::~StateMerger()
+{
+    for (size_t idx = 0; idx < sources_.size(); idx++)
+    {
+        delete sources_[idx];
+    }
+}
+
+void StateMerger::BuildHeader()
+{
+    std::string uid;
+    std::string robot = sources_[0]->Header().robot_;
+    std::vector<std::string> tags;
+    for (size_t idx = 0; idx < sources_.size(); idx++)
+    {
+        const Trajectory& header = sources_[idx]->Header();
+        if (header.timing_ != Trajectory::TIMED)
+        {
+            throw std::invalid_argument("Only TIMED trajectories can be merged by time");
+        }
+        uid += ((idx > 0) ? "+" : "") + header.uid_;
+        if (header.robot_ != sources_[0]->Header().robot_)
+        {
+            robot += "+" + header.robot_;
+        }
+        for (size_t tag = 0; tag < header.tags_.size(); tag++)
+        {
+            if (std::find(tags.begin(), tags.end(), header.tags_[tag]) == tags.end())
+            {
+                tags.push_back(header.tags_[tag]);
+            }
+        }
+    }
+    if (options_.uid_.size() > 0)
+    {
+        uid = options_.uid_;
+    }
+    const Trajectory& first = sources_[0]->Header();
+    if (options_.mode_ == MergeOptions::INTERLEAVED)
+    {
+        for (size_t idx = 1; idx < sources_.size(); idx++)
+        {
+            const Trajectory& header = sources_[idx]->Header();
+            if (header.data_type_ != first.data_type_ || header.joint_names_ != first.joint_names_ || header.root_frame_ != first.root_frame_ || header.target_frame_ != first.target_frame_)
+            {
+                throw std::invalid_argument("Interleaved sources must have the same data type and joint names or frames");
+            }
+        }
+        header_ = first.CloneHeader();
+        header_.uid_ = uid;
+        header_.robot_ = robot;
+        header_.tags_ = tags;
+        return;
+    }
+    if (!(options_.period_ > 0.0))
+    {
+        throw std::invalid_argument("Aligned merging needs a positive period");
+    }
+    period_ = std::max((int64_t)llround(options_.period_ * 1000000000.0), (int64_t)1);
+    if (options_.prefixes_.size() > 0 && options_.prefixes_.size() != sources_.size())
+    {
+        throw std::invalid_argument("Aligned merging needs one prefix per source");
+    }
+    std::vector<std::string> joint_names;
+    for (size_t idx = 0; idx < sources_.size(); idx++)
+    {
+        const Trajectory& header = sources_[idx]->Header();
+        if (header.data_type_ != Trajectory::JOINT)
+        {
+            throw std::invalid_argument("Only JOINT trajectories can be aligned onto a common clock");
+        }
+        std::string prefix = (options_.prefixes_.size() > 0) ? options_.prefixes_[idx] : header.uid_;
+        for (size_t joint = 0; joint < header.joint_names_.size(); joint++)
+        {
+            std::string name = options_.namespace_joints_ ? (prefix + "/" + header.joint_names_[joint]) : header.joint_names_[joint];
+            if (std::find(joint_names.begin(), joint_names.end(), name) != joint_names.end())
+            {
+                throw std::invalid_argument("Merged joint name " + name + " is not unique");
+            }
+            joint_names.push_back(name);
+        }
+    }
+    header_ = Trajectory(uid, first.traj_type_, Trajectory::TIMED, robot, first.generator_, joint_names, tags);
+}
+
+void StateMerger::StartAligned()
+{
+    for (size_t idx = 0; idx < sources_.size(); idx++)
+    {
+        if (!sources_[idx]->HasNext())
+        {
+            finished_ = true;
+            return;
+        }
+        current_[idx] = sources_[idx]->Next();
+        has_current_[idx] = true;
+        has_next_[idx] = sources_[idx]->HasNext();
+        if (has_next_[idx])
+        {
+            next_[idx] = sources_[idx]->Next();
+        }
+        clock_ = (idx == 0) ? ToNanoseconds(current_[idx].timing_) : std::max(clock_, ToNanoseconds(current_[idx].timing_));
+    }
+    AdvanceAligned();
+}
+
+bool StateMerger::AdvanceAligned()
+{
+    // Bring every source to the states either side of the clock, reading each state only once
+    for (size_t idx = 0; idx < sources_.size(); idx++)
+    {
+        while (has_next_[idx] && ToNanoseconds(next_[idx].timing_) <= clock_)
+        {
+            current_[idx] = std::move(next_[idx]);
+            has_next_[idx] = sources_[idx]->HasNext();
+            if (has_next_[idx])
+            {
+                next_[idx] = sources_[idx]->Next();
+            }
+        }
+        if (!has_next_[idx] && ToNanoseconds(current_[idx].timing_) != clock_)
+        {
+            finished_ = true;
+        }
+    }
+    return !finished_;
+}
+
+const Trajectory& StateMerger::Header() const
+{
+    return header_;
+}
+
+bool StateMerger::HasNext()
+{
+    if (options_.mode_ == MergeOptions::ALIGNED)
+    {
+        return !finished_;
+    }
+    return std::find(has_current_.begin(), has_current_.end(), true) != has_current_.end();
+}
+
+State StateMerger::Next()
+{
+    if (!HasNext())
+    {
+        throw std::out_of_range("No more states to merge");
+    }
+    if (options_.mode_ == MergeOptions::INTERLEAVED)
+    {
+        // A linear scan over the sources beats a heap for the handful of sources a recording has
+        size_t chosen = sources_.size();
+        for (size_t idx = 0; idx < sources_.size(); idx++)
+        {
+            if (has_current_[idx] && (chosen == sources_.size() || CompareTimespecs(current_[idx].timing_, current_[chosen].timing_) < 0))
+            {
+                chosen = idx;
+            }
+        }
+        State state = std::move(current_[chosen]);
+        has_current_[chosen] = sources_[chosen]->HasNext();
+        if (has_current_[chosen])
+        {
+            current_[chosen] = sources_[chosen]->Next();
+        }
+        if (options_.source_extra_.size() > 0)
+        {
+            state.extras_[options_.source_extra_] = KeyValue((long)chosen);
+        }
+        return state;
+    }
+    std::vector<double> fields[State::NUM_FIELDS];
+    bool present[State::NUM_FIELDS];
+    std::fill(present, present + State::NUM_FIELDS, true);
+    std::map<std::string, KeyValue> extras;
+    for (size_t idx = 0; idx < sources_.size(); idx++)
+    {
+        const State& before = current_[idx];
+        const State& after = has_next_[idx] ? next_[idx] : current_[idx];
+        size_t data_length = sources_[idx]->Header().joint_names_.size();
+        int64_t span = ToNanoseconds(after.timing_) - ToNanoseconds(before.timing_);
+        double u = (span > 0) ? ((double)(clock_ - ToNanoseconds(before.timing_)) / (double)span) : 0.0;
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            const std::vector<double>& from = before.Field((State::FIELDS)field);
+            const std::vector<double>& to = after.Field((State::FIELDS)field);
+            present[field] = present[field] && from.size() == data_length && to.size() == data_length;
+            if (!present[field])
+            {
+                continue;
+            }
+            for (size_t joint = 0; joint < data_length; joint++)
+            {
+                fields[field].push_back(from[joint] + (u * (to[joint] - from[joint])));
+            }
+        }
+        std::string prefix = (options_.prefixes_.size() > 0) ? options_.prefixes_[idx] : sources_[idx]->Header().uid_;
+        std::map<std::string, KeyValue>::const_iterator itr;
+        for (itr = before.extras_.begin(); itr != before.extras_.end(); ++itr)
+        {
+            std::string name = options_.namespace_joints_ ? (prefix + "/" + itr->first) : itr->first;
+            if (!extras.insert(std::make_pair(name, itr->second)).second)
+            {
+                throw std::invalid_argument("Merged extra name " + name + " is not unique");
+            }
+        }
+    }
+    for (size_t field = 0; field < State::NUM_FIELDS; field++)
+    {
+        if (!present[field])
+        {
+            fields[field].clear();
+        }
+    }
+    State state(fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], sequence_, FromNanoseconds(clock_));
+    state.extras_.swap(extras);
+    sequence_++;
+    clock_ += period_;
+    AdvanceAligned();
+    return state;
+}
+
+size_t XTF::MergeFiles(const std::vector<std::string>& filenames, std::string output, const MergeOptions& options, bool compact)
+{
+    StateMerger merger(filenames, options);
+    StateWriter writer(output, merger.Header(), compact);
+    while (merger.HasNext())
+    {
+        writer.push_back(merger.Next());
+    }
+    writer.Close();
+    return writer.size();
+}
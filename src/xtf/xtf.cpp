@@ -6,8 +6,11 @@
 #include "string.h"
 #include <iostream>
 #include <algorithm>
+#include <utility>
 #include <stdexcept>
 #include <typeinfo>
+#include <cmath>
+#include <limits.h>
 #include <libxml++/libxml++.h>
 #include <arc_utilities/pretty_print.hpp>
 #include "xtf/xtf.hpp"
@@ -16,134 +19,100 @@ using namespace XTF;
 
 KeyValue::KeyValue(bool value)
 {
-    Zero();
-    type_ = KV_BOOLEAN;
-    bool_val_ = value;
+    SetValue(value);
 }
 
 KeyValue::KeyValue(long value)
 {
-    Zero();
-    type_ = KV_INTEGER;
-    int_val_ = value;
+    SetValue(value);
 }
 
 KeyValue::KeyValue(double value)
 {
-    Zero();
-    type_ = KV_DOUBLE;
-    flt_val_ = value;
+    SetValue(value);
 }
 
 KeyValue::KeyValue(std::string value)
 {
-    Zero();
-    type_ = KV_STRING;
-    str_val_ = value;
+    SetValue(std::move(value));
 }
 
 KeyValue::KeyValue(std::vector<bool> value)
 {
-    Zero();
-    type_ = KV_BOOLEANLIST;
-    bool_list_ = value;
+    SetValue(std::move(value));
 }
 
 KeyValue::KeyValue(std::vector<long> value)
 {
-    Zero();
-    type_ = KV_INTEGERLIST;
-    int_list_ = value;
+    SetValue(std::move(value));
 }
 
 KeyValue::KeyValue(std::vector<double> value)
 {
-    Zero();
-    type_ = KV_DOUBLELIST;
-    flt_list_ = value;
+    SetValue(std::move(value));
 }
 
 KeyValue::KeyValue(std::vector<std::string> value)
 {
-    Zero();
-    type_ = KV_STRINGLIST;
-    str_list_ = value;
+    SetValue(std::move(value));
 }
 
-void KeyValue::Zero()
+void KeyValue::SetScalar(TYPES type)
 {
-    bool_val_ = false;
-    flt_val_ = 0.0;
+    type_ = type;
     int_val_ = 0;
-    str_val_.clear();
-    bool_list_.clear();
-    flt_list_.clear();
-    int_list_.clear();
-    str_list_.clear();
+    payload_.reset();
 }
 
-KeyValue::TYPES KeyValue::Type()
+KeyValue::TYPES KeyValue::Type() const
 {
     return type_;
 }
 
 void KeyValue::SetValue(bool value)
 {
-    Zero();
-    type_ = KV_BOOLEAN;
+    SetScalar(KV_BOOLEAN);
     bool_val_ = value;
 }
 
 void KeyValue::SetValue(long value)
 {
-    Zero();
-    type_ = KV_INTEGER;
+    SetScalar(KV_INTEGER);
     int_val_ = value;
 }
 
 void KeyValue::SetValue(double value)
 {
-    Zero();
-    type_ = KV_DOUBLE;
+    SetScalar(KV_DOUBLE);
     flt_val_ = value;
 }
 
 void KeyValue::SetValue(std::string value)
 {
-    Zero();
-    type_ = KV_STRING;
-    str_val_ = value;
+    SetPayload(KV_STRING, std::move(value));
 }
 
 void KeyValue::SetValue(std::vector<bool> value)
 {
-    Zero();
-    type_ = KV_BOOLEANLIST;
-    bool_list_ = value;
+    SetPayload(KV_BOOLEANLIST, std::move(value));
 }
 
 void KeyValue::SetValue(std::vector<long> value)
 {
-    Zero();
-    type_ = KV_INTEGERLIST;
-    int_list_ = value;
+    SetPayload(KV_INTEGERLIST, std::move(value));
 }
 
 void KeyValue::SetValue(std::vector<double> value)
 {
-    Zero();
-    type_ = KV_DOUBLELIST;
-    flt_list_ = value;
+    SetPayload(KV_DOUBLELIST, std::move(value));
 }
 
 void KeyValue::SetValue(std::vector<std::string> value)
 {
-    Zero();
-    type_ = KV_STRINGLIST;
-    str_list_ = value;
+    SetPayload(KV_STRINGLIST, std::move(value));
 }
 
-bool KeyValue::BoolValue()
+bool KeyValue::BoolValue() const
 {
     if (type_ == KV_BOOLEAN)
     {
@@ -155,7 +124,7 @@ bool KeyValue::BoolValue()
     }
 }
 
-long KeyValue::IntegerValue()
+long KeyValue::IntegerValue() const
 {
     if (type_ == KV_INTEGER)
     {
@@ -167,7 +136,7 @@ long KeyValue::IntegerValue()
     }
 }
 
-double KeyValue::DoubleValue()
+double KeyValue::DoubleValue() const
 {
     if (type_ == KV_DOUBLE)
     {
@@ -179,11 +148,11 @@ double KeyValue::DoubleValue()
     }
 }
 
-std::string KeyValue::StringValue()
+std::string KeyValue::StringValue() const
 {
     if (type_ == KV_STRING)
     {
-        return str_val_;
+        return Payload<std::string>();
     }
     else
     {
@@ -191,11 +160,11 @@ std::string KeyValue::StringValue()
     }
 }
 
-std::vector<bool> KeyValue::BoolListValue()
+std::vector<bool> KeyValue::BoolListValue() const
 {
     if (type_ == KV_BOOLEANLIST)
     {
-        return bool_list_;
+        return Payload<std::vector<bool>>();
     }
     else
     {
@@ -203,11 +172,11 @@ std::vector<bool> KeyValue::BoolListValue()
     }
 }
 
-std::vector<long> KeyValue::IntegerListValue()
+std::vector<long> KeyValue::IntegerListValue() const
 {
     if (type_ == KV_INTEGERLIST)
     {
-        return int_list_;
+        return Payload<std::vector<long>>();
     }
     else
     {
@@ -215,11 +184,11 @@ std::vector<long> KeyValue::IntegerListValue()
     }
 }
 
-std::vector<double> KeyValue::DoubleListValue()
+std::vector<double> KeyValue::DoubleListValue() const
 {
     if (type_ == KV_DOUBLELIST)
     {
-        return flt_list_;
+        return Payload<std::vector<double>>();
     }
     else
     {
@@ -227,11 +196,11 @@ std::vector<double> KeyValue::DoubleListValue()
     }
 }
 
-std::vector<std::string> KeyValue::StringListValue()
+std::vector<std::string> KeyValue::StringListValue() const
 {
     if (type_ == KV_STRINGLIST)
     {
-        return str_list_;
+        return Payload<std::vector<std::string>>();
     }
     else
     {
@@ -239,7 +208,7 @@ std::vector<std::string> KeyValue::StringListValue()
     }
 }
 
-std::string KeyValue::GetValueString()
+std::string KeyValue::GetValueString() const
 {
     std::ostringstream strm;
     if (type_ == KV_BOOLEAN)
@@ -256,28 +225,28 @@ std::string KeyValue::GetValueString()
     }
     else if (type_ == KV_STRING)
     {
-        strm << str_val_;
+        strm << Payload<std::string>();
     }
     else if (type_ == KV_BOOLEANLIST)
     {
-        strm << PrettyPrint::PrettyPrint(bool_list_);
+        strm << PrettyPrint::PrettyPrint(Payload<std::vector<bool>>());
     }
     else if (type_ == KV_INTEGERLIST)
     {
-        strm << PrettyPrint::PrettyPrint(int_list_);
+        strm << PrettyPrint::PrettyPrint(Payload<std::vector<long>>());
     }
     else if (type_ == KV_DOUBLELIST)
     {
-        strm << PrettyPrint::PrettyPrint(flt_list_);
+        strm << PrettyPrint::PrettyPrint(Payload<std::vector<double>>());
     }
     else if (type_ == KV_STRINGLIST)
     {
-        strm << PrettyPrint::PrettyPrint(str_list_);
+        strm << PrettyPrint::PrettyPrint(Payload<std::vector<std::string>>());
     }
     return strm.str();
 }
 
-std::string KeyValue::GetTypeString()
+std::string KeyValue::GetTypeString() const
 {
     if (type_ == KV_BOOLEAN)
     {
@@ -324,7 +293,7 @@ std::ostream& operator<<(std::ostream& strm, KeyValue& keyvalue)
 }
 
 
-void State::VerifySize(std::vector<double> element)
+void State::VerifySize(const std::vector<double>& element)
 {
     if (data_length_ == 0 && element.size() != 0)
     {
@@ -343,17 +312,17 @@ State::State(std::vector<double> desiredP, std::vector<double> desiredV, std::ve
 {
     data_length_ = 0;
     VerifySize(desiredP);
-    position_desired_ = desiredP;
+    position_desired_ = std::move(desiredP);
     VerifySize(desiredV);
-    velocity_desired_ = desiredV;
+    velocity_desired_ = std::move(desiredV);
     VerifySize(desiredA);
-    acceleration_desired_ = desiredA;
+    acceleration_desired_ = std::move(desiredA);
     VerifySize(actualP);
-    position_actual_ = actualP;
+    position_actual_ = std::move(actualP);
     VerifySize(actualV);
-    velocity_actual_ = actualV;
+    velocity_actual_ = std::move(actualV);
     VerifySize(actualA);
-    acceleration_actual_ = actualA;
+    acceleration_actual_ = std::move(actualA);
     sequence_ = sequence;
     timing_ = timing;
 }
@@ -371,6 +340,75 @@ std::vector<std::string> State::ListExtras()
     return keys;
 }
 
+std::vector<double>& State::Field(FIELDS field)
+{
+    return const_cast<std::vector<double>&>(static_cast<const State*>(this)->Field(field));
+}
+
+const std::vector<double>& State::Field(FIELDS field) const
+{
+    if (field == POSITION_DESIRED)
+    {
+        return position_desired_;
+    }
+    else if (field == VELOCITY_DESIRED)
+    {
+        return velocity_desired_;
+    }
+    else if (field == ACCELERATION_DESIRED)
+    {
+        return acceleration_desired_;
+    }
+    else if (field == POSITION_ACTUAL)
+    {
+        return position_actual_;
+    }
+    else if (field == VELOCITY_ACTUAL)
+    {
+        return velocity_actual_;
+    }
+    else if (field == ACCELERATION_ACTUAL)
+    {
+        return acceleration_actual_;
+    }
+    else
+    {
+        throw std::invalid_argument("Invalid State field ID");
+    }
+}
+
+const char* State::FieldName(FIELDS field)
+{
+    if (field == POSITION_DESIRED)
+    {
+        return "position_desired";
+    }
+    else if (field == VELOCITY_DESIRED)
+    {
+        return "velocity_desired";
+    }
+    else if (field == ACCELERATION_DESIRED)
+    {
+        return "acceleration_desired";
+    }
+    else if (field == POSITION_ACTUAL)
+    {
+        return "position_actual";
+    }
+    else if (field == VELOCITY_ACTUAL)
+    {
+        return "velocity_actual";
+    }
+    else if (field == ACCELERATION_ACTUAL)
+    {
+        return "acceleration_actual";
+    }
+    else
+    {
+        throw std::invalid_argument("Invalid State field ID");
+    }
+}
+
 std::ostream& operator<<(std::ostream& strm, State& state)
 {
     strm << "State #" << state.sequence_ << " at:\nsecs: " << state.timing_.tv_sec << "\nnsecs: " << state.timing_.tv_nsec << "\ndesired:\nposition:";
@@ -412,6 +450,218 @@ std::ostream& operator<<(std::ostream& strm, State& state)
     return strm;
 }
 
+const size_t StateStorage::BLOCK_STATES;
+
+StateStorage::StateStorage(std::vector<State>&& states) : size_(0)
+{
+    blocks_.reserve((states.size() + BLOCK_STATES - 1) / BLOCK_STATES);
+    for (size_t idx = 0; idx < states.size(); idx++)
+    {
+        push_back(std::move(states[idx]));
+    }
+    states.clear();
+}
+
+StateStorage::Block& StateStorage::MutableBlock(size_t block)
+{
+    std::shared_ptr<Block>& owned = blocks_[block];
+    if (owned.use_count() > 1)
+    {
+        std::shared_ptr<Block> copied = std::make_shared<Block>();
+        copied->states_.reserve(BLOCK_STATES);
+        copied->states_ = owned->states_;
+        Recount(*copied);
+        owned = copied;
+    }
+    return *owned;
+}
+
+void StateStorage::push_back(const State& state)
+{
+    if ((size_ % BLOCK_STATES) == 0)
+    {
+        blocks_.push_back(std::make_shared<Block>());
+        blocks_.back()->states_.reserve(BLOCK_STATES);
+        Recount(*blocks_.back());
+    }
+    // A block shared before the copy stays alive, and vector::push_back copes with state referring into its own storage
+    Block& block = MutableBlock(blocks_.size() - 1);
+    size_t capacity = block.states_.capacity();
+    block.states_.push_back(state);
+    Account(block, block.bytes_ + StateBytes(block.states_.back()) + ((block.states_.capacity() - capacity) * sizeof(State)));
+    size_++;
+}
+
+void StateStorage::push_back(State&& state)
+{
+    if ((size_ % BLOCK_STATES) == 0)
+    {
+        blocks_.push_back(std::make_shared<Block>());
+        blocks_.back()->states_.reserve(BLOCK_STATES);
+        Recount(*blocks_.back());
+    }
+    Block& block = MutableBlock(blocks_.size() - 1);
+    size_t capacity = block.states_.capacity();
+    block.states_.push_back(std::move(state));
+    Account(block, block.bytes_ + StateBytes(block.states_.back()) + ((block.states_.capacity() - capacity) * sizeof(State)));
+    size_++;
+}
+
+void StateStorage::pop_back()
+{
+    if (size_ == 0)
+    {
+        throw std::out_of_range("pop_back() on an empty trajectory");
+    }
+    size_--;
+    if ((size_ % BLOCK_STATES) == 0)
+    {
+        // Drops this storage's reference; another owner of a shared block keeps its states
+        blocks_.pop_back();
+        return;
+    }
+    Block& block = MutableBlock(blocks_.size() - 1);
+    size_t bytes = StateBytes(block.states_.back());
+    block.states_.pop_back();
+    Account(block, block.bytes_ - bytes);
+}
+
+void StateStorage::RecountFrom(size_t idx)
+{
+    for (size_t block = idx / BLOCK_STATES; block < blocks_.size(); block++)
+    {
+        Recount(MutableBlock(block));
+    }
+}
+
+StateStorage::iterator StateStorage::insert(const_iterator position, const State& state)
+{
+    return insert(position, State(state));
+}
+
+StateStorage::iterator StateStorage::insert(const_iterator position, State&& state)
+{
+    size_t idx = position.index();
+    if (idx > size_)
+    {
+        throw std::out_of_range("Insert position is out of range");
+    }
+    push_back(std::move(state));
+    std::rotate(begin() + idx, end() - 1, end());
+    RecountFrom(idx);
+    return begin() + idx;
+}
+
+StateStorage::iterator StateStorage::erase(const_iterator position)
+{
+    return erase(position, position + 1);
+}
+
+StateStorage::iterator StateStorage::erase(const_iterator first, const_iterator last)
+{
+    size_t start = first.index();
+    size_t end_idx = last.index();
+    if (start > end_idx || end_idx > size_)
+    {
+        throw std::out_of_range("Erase range is out of range");
+    }
+    if (start == end_idx)
+    {
+        return begin() + start;
+    }
+    std::move(begin() + end_idx, end(), begin() + start);
+    for (size_t removed = end_idx - start; removed > 0; removed--)
+    {
+        pop_back();
+    }
+    RecountFrom(start);
+    return begin() + start;
+}
+
+void StateStorage::reserve(size_t capacity)
+{
+    blocks_.reserve((capacity + BLOCK_STATES - 1) / BLOCK_STATES);
+}
+
+void StateStorage::clear()
+{
+    blocks_.clear();
+    size_ = 0;
+}
+
+size_t StateStorage::SharedBlocks() const
+{
+    size_t shared = 0;
+    for (size_t idx = 0; idx < blocks_.size(); idx++)
+    {
+        if (blocks_[idx].use_count() > 1)
+        {
+            shared++;
+        }
+    }
+    return shared;
+}
+
+void StateStorage::Drain(std::vector<State>& recycled)
+{
+    for (size_t block = 0; block < blocks_.size(); block++)
+    {
+        if (blocks_[block].use_count() == 1)
+        {
+            std::vector<State>& states = blocks_[block]->states_;
+            for (size_t idx = 0; idx < states.size(); idx++)
+            {
+                recycled.push_back(std::move(states[idx]));
+            }
+        }
+    }
+    clear();
+}
+
+State StatePool::Acquire(const State& source)
+{
+    if (free_.size() == 0)
+    {
+        return source;
+    }
+    State recycled = std::move(free_.back());
+    free_.pop_back();
+    // Copy-assignment reuses the recycled vectors' capacity
+    recycled = source;
+    return recycled;
+}
+
+void StatePool::Release(State&& state)
+{
+    free_.push_back(std::move(state));
+}
+
+void StatePool::Release(std::vector<State>& states)
+{
+    free_.reserve(free_.size() + states.size());
+    for (size_t idx = 0; idx < states.size(); idx++)
+    {
+        free_.push_back(std::move(states[idx]));
+    }
+    states.clear();
+}
+
+void StatePool::Release(StateStorage& states)
+{
+    free_.reserve(free_.size() + states.size());
+    states.Drain(free_);
+}
+
+size_t StatePool::size() const
+{
+    return free_.size();
+}
+
+void StatePool::clear()
+{
+    free_.clear();
+}
+
 Trajectory::Trajectory(std::string uid, TRAJTYPES traj_type, TIMINGS timing, std::string robot, std::string generator, std::string root_frame, std::string target_frame, std::vector<State> trajectory_data, std::vector<std::string> tags)
 {
     robot_ = robot;
@@ -423,7 +673,7 @@ Trajectory::Trajectory(std::string uid, TRAJTYPES traj_type, TIMINGS timing, std
     data_type_ = Trajectory::POSE;
     traj_type_ = traj_type;
     timing_ = timing;
-    trajectory_ = trajectory_data;
+    trajectory_ = std::move(trajectory_data);
     for (size_t index = 0; index < trajectory_.size(); index++)
     {
         if (trajectory_[index].data_length_ != 7)
@@ -443,7 +693,7 @@ Trajectory::Trajectory(std::string uid, TRAJTYPES traj_type, TIMINGS timing, std
     data_type_ = Trajectory::JOINT;
     traj_type_ = traj_type;
     timing_ = timing;
-    trajectory_ = trajectory_data;
+    trajectory_ = std::move(trajectory_data);
     for (size_t index = 0; index < trajectory_.size(); index++)
     {
         if (trajectory_[index].data_length_ != joint_names_.size())
@@ -478,12 +728,28 @@ Trajectory::Trajectory(std::string uid, TRAJTYPES traj_type, TIMINGS timing, std
     timing_ = timing;
 }
 
-size_t Trajectory::size()
+size_t Trajectory::size() const
 {
     return trajectory_.size();
 }
 
-void Trajectory::push_back(State& val)
+Trajectory Trajectory::CloneHeader() const
+{
+    Trajectory header;
+    header.robot_ = robot_;
+    header.generator_ = generator_;
+    header.joint_names_ = joint_names_;
+    header.root_frame_ = root_frame_;
+    header.target_frame_ = target_frame_;
+    header.tags_ = tags_;
+    header.uid_ = uid_;
+    header.timing_ = timing_;
+    header.traj_type_ = traj_type_;
+    header.data_type_ = data_type_;
+    return header;
+}
+
+void Trajectory::VerifyState(const State& val) const
 {
     if (data_type_ == Trajectory::JOINT && (val.data_length_ != joint_names_.size()))
     {
@@ -493,13 +759,40 @@ void Trajectory::push_back(State& val)
     {
         throw std::invalid_argument("Pose data is not 7 doubles [X,Y,Z,X,Y,Z,W]");
     }
+}
+
+void Trajectory::push_back(const State& val)
+{
+    VerifyState(val);
+    trajectory_.push_back(val);
+}
+
+void Trajectory::push_back(State&& val)
+{
+    VerifyState(val);
+    trajectory_.push_back(std::move(val));
+}
+
+void Trajectory::reserve(size_t capacity)
+{
+    trajectory_.reserve(capacity);
+}
+
+State& Trajectory::at(size_t idx)
+{
+    if (idx < trajectory_.size())
+    {
+        return trajectory_[idx];
+    }
     else
     {
-        trajectory_.push_back(val);
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
     }
 }
 
-State& Trajectory::at(size_t idx)
+const State& Trajectory::at(size_t idx) const
 {
     if (idx < trajectory_.size())
     {
@@ -527,360 +820,765 @@ State& Trajectory::operator[](size_t idx)
     }
 }
 
-std::ostream& operator<<(std::ostream& strm, Trajectory& traj)
+const State& Trajectory::operator[](size_t idx) const
 {
-    if (traj.traj_type_ == traj.GENERATED)
+    if (idx < trajectory_.size())
     {
-        strm << "Generated ";
+        return trajectory_[idx];
     }
-    else if (traj.traj_type_ == traj.RECORDED)
+    else
     {
-        strm << "Recorded ";
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
     }
-    if (traj.data_type_ == traj.JOINT)
+}
+
+TrajectoryView::TrajectoryView(const Trajectory& trajectory)
+{
+    trajectory_ = &trajectory;
+    start_ = 0;
+    length_ = trajectory.trajectory_.size();
+    stride_ = 1;
+}
+
+TrajectoryView::TrajectoryView(const Trajectory& trajectory, size_t start, size_t length, size_t stride)
+{
+    if (stride == 0)
     {
-        strm << "Joint ";
+        throw std::invalid_argument("View stride must be at least 1");
     }
-    else if (traj.data_type_ == traj.POSE)
+    if (length > 0 && (start + ((length - 1) * stride)) >= trajectory.trajectory_.size())
     {
-        strm << "Pose ";
+        throw std::out_of_range("View extends past the end of the trajectory");
     }
-    strm << "Trajectory:\nUID: " << traj.uid_;
-    if (traj.data_type_ == traj.JOINT)
+    trajectory_ = &trajectory;
+    start_ = start;
+    length_ = length;
+    stride_ = stride;
+}
+
+const Trajectory& TrajectoryView::Header() const
+{
+    if (trajectory_ == NULL)
     {
-        strm << "\nJoint names:";
-        for (unsigned int i = 0; i < traj.joint_names_.size(); i++)
+        throw std::invalid_argument("View is not attached to a trajectory");
+    }
+    return *trajectory_;
+}
+
+const State& TrajectoryView::at(size_t idx) const
+{
+    if (idx < length_)
+    {
+        return trajectory_->trajectory_[start_ + (idx * stride_)];
+    }
+    else
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+}
+
+TrajectoryView TrajectoryView::Slice(size_t start, size_t length, size_t stride) const
+{
+    if (stride == 0)
+    {
+        throw std::invalid_argument("View stride must be at least 1");
+    }
+    if (length > 0 && (start + ((length - 1) * stride)) >= length_)
+    {
+        throw std::out_of_range("Slice extends past the end of the view");
+    }
+    TrajectoryView slice(*this);
+    slice.start_ = start_ + (start * stride_);
+    slice.length_ = length;
+    slice.stride_ = stride_ * stride;
+    return slice;
+}
+
+size_t TrajectoryView::LowerBound(const timespec& timing) const
+{
+    // States are assumed to be in time order, so a binary search finds the first state at or after timing
+    size_t low = 0;
+    size_t high = length_;
+    while (low < high)
+    {
+        size_t mid = low + ((high - low) / 2);
+        if (CompareTimespecs((*this)[mid].timing_, timing) < 0)
         {
-            strm << " " << traj.joint_names_[i];
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
         }
     }
-    else if (traj.data_type_ == traj.POSE)
+    return low;
+}
+
+TrajectoryView TrajectoryView::SliceTime(const timespec& start, const timespec& end) const
+{
+    // Half-open [start, end) so that consecutive time windows never share a state
+    size_t first = LowerBound(start);
+    size_t last = LowerBound(end);
+    if (last < first)
     {
-        strm << "\nRoot frame: " << traj.root_frame_;
-        strm << "\nTarget frame: " << traj.target_frame_;
+        last = first;
     }
-    strm << "\nRobot: " << traj.robot_ << "\nGenerator: " << traj.generator_;
-    if (traj.timing_ == traj.TIMED)
+    return Slice(first, last - first);
+}
+
+std::vector<TrajectoryView> TrajectoryView::Split(size_t segment_length) const
+{
+    if (segment_length == 0)
     {
-        strm << "\nTiming: timed";
+        throw std::invalid_argument("Segment length must be at least 1");
     }
-    else if (traj.timing_ == traj.UNTIMED)
+    std::vector<TrajectoryView> segments;
+    segments.reserve((length_ + segment_length - 1) / segment_length);
+    for (size_t start = 0; start < length_; start += segment_length)
     {
-        strm << "\nTiming: untimed";
+        segments.push_back(Slice(start, std::min(segment_length, length_ - start)));
     }
-    strm << "\nTags:";
-    for (unsigned int i = 0; i < traj.tags_.size(); i++)
+    return segments;
+}
+
+Trajectory TrajectoryView::Materialize() const
+{
+    Trajectory materialized = Header().CloneHeader();
+    materialized.trajectory_.reserve(length_);
+    for (size_t idx = 0; idx < length_; idx++)
     {
-        strm << " " << traj.tags_[i];
+        materialized.trajectory_.push_back((*this)[idx]);
     }
-    strm << "\nTrajectory data:";
-    for (unsigned int i = 0; i < traj.trajectory_.size(); i++)
+    return materialized;
+}
+
+ConcatenatedView::ConcatenatedView(const std::vector<TrajectoryView>& parts)
+{
+    for (size_t idx = 0; idx < parts.size(); idx++)
     {
-        strm << "\n---\n" << traj.trajectory_[i];
+        push_back(parts[idx]);
     }
-    return strm;
 }
 
-Trajectory Parser::ParseTraj(std::string filename)
+void ConcatenatedView::push_back(const TrajectoryView& part)
 {
-    try
+    if (parts_.size() > 0)
     {
-        xmlpp::DomParser parser;
-        parser.set_substitute_entities();
-        parser.parse_file(filename);
-        if (parser)
+        const Trajectory& first = parts_.front().Header();
+        const Trajectory& next = part.Header();
+        if (first.data_type_ != next.data_type_ || first.joint_names_ != next.joint_names_)
         {
-            const xmlpp::Node* root = parser.get_document()->get_root_node();
-            /* Read the header data */
-            // Get the header nodes
-            xmlpp::Node::NodeList info = root->get_children("info");
-            xmlpp::Node* infoEL = info.front();
-            xmlpp::Node::NodeList type = infoEL->get_children("type");
-            xmlpp::Node* typeEL = type.front();
-            xmlpp::Node::NodeList tgs = infoEL->get_children("tags");
-            xmlpp::Node* tagsEL = tgs.front();
-            xmlpp::Node::NodeList rf = typeEL->get_children("root_frame");
-            xmlpp::Node* rfEL = rf.front();
-            xmlpp::Node::NodeList tf = typeEL->get_children("target_frame");
-            xmlpp::Node* tfEL = tf.front();
-            xmlpp::Node::NodeList jn = typeEL->get_children("joint_names");
-            xmlpp::Node* jnEL = jn.front();
-            // Get the trajectory uid
-            const xmlpp::Element* rootEL = dynamic_cast<const xmlpp::Element*>(root);
-            xmlpp::Attribute* uidAttrib = rootEL->get_attribute("uid");
-            std::string uid;
-            if (uidAttrib)
-            {
-                uid = CleanString(uidAttrib->get_value());
-            }
-            else
-            {
-                throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
-            }
-            // Get the info attributes
-            xmlpp::Element* infoAttribs = dynamic_cast<xmlpp::Element*>(infoEL);
-            xmlpp::Attribute* robotAttrib = infoAttribs->get_attribute("robot");
-            xmlpp::Attribute* generatorAttrib = infoAttribs->get_attribute("generator");
-            std::string robot;
-            std::string generator;
-            if (robotAttrib && generatorAttrib)
-            {
-                robot = CleanString(robotAttrib->get_value());
-                generator = CleanString(generatorAttrib->get_value());
-            }
-            else
+            throw std::invalid_argument("Concatenated trajectories must have the same data type and joint names");
+        }
+        else if (first.data_type_ == Trajectory::POSE && (first.root_frame_ != next.root_frame_ || first.target_frame_ != next.target_frame_))
+        {
+            throw std::invalid_argument("Concatenated POSE trajectories must have the same root and target frames");
+        }
+    }
+    size_t offset = (parts_.size() > 0) ? (offsets_.back() + parts_.back().size()) : 0;
+    parts_.push_back(part);
+    offsets_.push_back(offset);
+}
+
+const std::vector<TrajectoryView>& ConcatenatedView::Parts() const
+{
+    return parts_;
+}
+
+const Trajectory& ConcatenatedView::Header() const
+{
+    if (parts_.size() == 0)
+    {
+        throw std::invalid_argument("Concatenated view is empty");
+    }
+    return parts_.front().Header();
+}
+
+size_t ConcatenatedView::size() const
+{
+    if (parts_.size() == 0)
+    {
+        return 0;
+    }
+    return offsets_.back() + parts_.back().size();
+}
+
+const State& ConcatenatedView::at(size_t idx) const
+{
+    if (idx < size())
+    {
+        return (*this)[idx];
+    }
+    else
+    {
+        std::ostringstream error_stream;
+        error_stream << "Index " << idx << " is out of range";
+        throw std::out_of_range(error_stream.str());
+    }
+}
+
+const State& ConcatenatedView::operator[](size_t idx) const
+{
+    // Find the last part starting at or before idx
+    std::vector<size_t>::const_iterator part = std::upper_bound(offsets_.begin(), offsets_.end(), idx) - 1;
+    size_t part_idx = part - offsets_.begin();
+    return parts_[part_idx][idx - *part];
+}
+
+Trajectory ConcatenatedView::Materialize() const
+{
+    Trajectory materialized = Header().CloneHeader();
+    materialized.trajectory_.reserve(size());
+    for (size_t part = 0; part < parts_.size(); part++)
+    {
+        for (size_t idx = 0; idx < parts_[part].size(); idx++)
+        {
+            materialized.trajectory_.push_back(parts_[part][idx]);
+        }
+    }
+    return materialized;
+}
+
+std::ostream& operator<<(std::ostream& strm, Trajectory& traj)
+{
+    if (traj.traj_type_ == traj.GENERATED)
+    {
+        strm << "Generated ";
+    }
+    else if (traj.traj_type_ == traj.RECORDED)
+    {
+        strm << "Recorded ";
+    }
+    if (traj.data_type_ == traj.JOINT)
+    {
+        strm << "Joint ";
+    }
+    else if (traj.data_type_ == traj.POSE)
+    {
+        strm << "Pose ";
+    }
+    strm << "Trajectory:\nUID: " << traj.uid_;
+    if (traj.data_type_ == traj.JOINT)
+    {
+        strm << "\nJoint names:";
+        for (unsigned int i = 0; i < traj.joint_names_.size(); i++)
+        {
+            strm << " " << traj.joint_names_[i];
+        }
+    }
+    else if (traj.data_type_ == traj.POSE)
+    {
+        strm << "\nRoot frame: " << traj.root_frame_;
+        strm << "\nTarget frame: " << traj.target_frame_;
+    }
+    strm << "\nRobot: " << traj.robot_ << "\nGenerator: " << traj.generator_;
+    if (traj.timing_ == traj.TIMED)
+    {
+        strm << "\nTiming: timed";
+    }
+    else if (traj.timing_ == traj.UNTIMED)
+    {
+        strm << "\nTiming: untimed";
+    }
+    strm << "\nTags:";
+    for (unsigned int i = 0; i < traj.tags_.size(); i++)
+    {
+        strm << " " << traj.tags_[i];
+    }
+    strm << "\nTrajectory data:";
+    for (unsigned int i = 0; i < traj.trajectory_.size(); i++)
+    {
+        strm << "\n---\n" << traj.trajectory_[i];
+    }
+    return strm;
+}
+
+ValidationOptions ValidationOptions::All()
+{
+    ValidationOptions options;
+    options.check_timing_ = true;
+    options.check_sequence_ = true;
+    options.check_finite_ = true;
+    options.check_quaternions_ = true;
+    options.check_length_ = true;
+    return options;
+}
+
+bool ValidationOptions::Enabled() const
+{
+    return (check_timing_ || check_sequence_ || check_finite_ || check_quaternions_ || check_length_);
+}
+
+std::string ValidationDiagnostic::GetRuleString() const
+{
+    if (rule_ == NON_MONOTONIC_TIMING)
+    {
+        return std::string("non_monotonic_timing");
+    }
+    else if (rule_ == NON_CONTIGUOUS_SEQUENCE)
+    {
+        return std::string("non_contiguous_sequence");
+    }
+    else if (rule_ == NON_FINITE_VALUE)
+    {
+        return std::string("non_finite_value");
+    }
+    else if (rule_ == NON_UNIT_QUATERNION)
+    {
+        return std::string("non_unit_quaternion");
+    }
+    else if (rule_ == LENGTH_MISMATCH)
+    {
+        return std::string("length_mismatch");
+    }
+    else
+    {
+        throw std::invalid_argument("Invalid ValidationDiagnostic rule ID");
+    }
+}
+
+std::ostream& operator<<(std::ostream& strm, const ValidationDiagnostic& diagnostic)
+{
+    strm << "State #" << diagnostic.state_index_ << " " << diagnostic.GetRuleString();
+    if (diagnostic.field_.size() > 0)
+    {
+        strm << " in " << diagnostic.field_ << "[" << diagnostic.element_ << "]";
+    }
+    strm << " value: " << diagnostic.value_;
+    return strm;
+}
+
+Trajectory Parser::ParseTraj(std::string filename)
+{
+    ValidationOptions options;
+    std::vector<ValidationDiagnostic> diagnostics;
+    return ParseTraj(filename, options, diagnostics);
+}
+
+Trajectory Parser::ParseTraj(std::string filename, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics)
+{
+    try
+    {
+        xmlpp::DomParser parser;
+        parser.set_substitute_entities();
+        parser.parse_file(filename);
+        return ParseDocument(parser, filename, options, diagnostics);
+    }
+    catch (xmlpp::internal_error e)
+    {
+        std::string error_str("Unable to read XTF file (file may not exist): " + filename);
+        throw std::invalid_argument(error_str.c_str());
+    }
+}
+
+Trajectory Parser::ParseTrajFromBuffer(const char* buffer, size_t length)
+{
+    ValidationOptions options;
+    std::vector<ValidationDiagnostic> diagnostics;
+    return ParseTrajFromBuffer(buffer, length, options, diagnostics);
+}
+
+Trajectory Parser::ParseTrajFromBuffer(const char* buffer, size_t length, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics)
+{
+    if (length > (size_t)INT_MAX)
+    {
+        throw std::invalid_argument("XTF documents in memory are limited to 2 GiB");
+    }
+    try
+    {
+        // libxml2 copies the buffer into its own input buffer before parsing
+        xmlpp::DomParser parser;
+        parser.set_substitute_entities();
+        parser.parse_memory_raw((const unsigned char*)buffer, length);
+        return ParseDocument(parser, "<buffer>", options, diagnostics);
+    }
+    catch (xmlpp::exception& e)
+    {
+        throw std::invalid_argument("Unable to read XTF buffer - buffer is malformed or otherwise corrupted");
+    }
+}
+
+Trajectory Parser::ParseTrajFromStream(std::istream& stream)
+{
+    ValidationOptions options;
+    std::vector<ValidationDiagnostic> diagnostics;
+    return ParseTrajFromStream(stream, options, diagnostics);
+}
+
+Trajectory Parser::ParseTrajFromStream(std::istream& stream, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics)
+{
+    try
+    {
+        xmlpp::DomParser parser;
+        parser.set_substitute_entities();
+        parser.parse_stream(stream);
+        return ParseDocument(parser, "<stream>", options, diagnostics);
+    }
+    catch (xmlpp::exception& e)
+    {
+        throw std::invalid_argument("Unable to read XTF stream - stream is malformed or otherwise corrupted");
+    }
+}
+
+Trajectory Parser::ParseDocument(xmlpp::DomParser& parser, const std::string& filename, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics)
+{
+    if (parser)
+    {
+        const xmlpp::Node* root = parser.get_document()->get_root_node();
+        /* Read the header data */
+        // Get the header nodes
+        xmlpp::Node::NodeList info = root->get_children("info");
+        xmlpp::Node* infoEL = info.front();
+        xmlpp::Node::NodeList type = infoEL->get_children("type");
+        xmlpp::Node* typeEL = type.front();
+        xmlpp::Node::NodeList tgs = infoEL->get_children("tags");
+        xmlpp::Node* tagsEL = tgs.front();
+        xmlpp::Node::NodeList rf = typeEL->get_children("root_frame");
+        xmlpp::Node* rfEL = rf.front();
+        xmlpp::Node::NodeList tf = typeEL->get_children("target_frame");
+        xmlpp::Node* tfEL = tf.front();
+        xmlpp::Node::NodeList jn = typeEL->get_children("joint_names");
+        xmlpp::Node* jnEL = jn.front();
+        // Get the trajectory uid
+        const xmlpp::Element* rootEL = dynamic_cast<const xmlpp::Element*>(root);
+        xmlpp::Attribute* uidAttrib = rootEL->get_attribute("uid");
+        std::string uid;
+        if (uidAttrib)
+        {
+            uid = CleanString(uidAttrib->get_value());
+        }
+        else
+        {
+            throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+        }
+        // Get the info attributes
+        xmlpp::Element* infoAttribs = dynamic_cast<xmlpp::Element*>(infoEL);
+        xmlpp::Attribute* robotAttrib = infoAttribs->get_attribute("robot");
+        xmlpp::Attribute* generatorAttrib = infoAttribs->get_attribute("generator");
+        std::string robot;
+        std::string generator;
+        if (robotAttrib && generatorAttrib)
+        {
+            robot = CleanString(robotAttrib->get_value());
+            generator = CleanString(generatorAttrib->get_value());
+        }
+        else
+        {
+            throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+        }
+        // Get the type attributes
+        xmlpp::Element* typeAttribs = dynamic_cast<xmlpp::Element*>(typeEL);
+        xmlpp::Attribute* timingAttrib = typeAttribs->get_attribute("timing");
+        xmlpp::Attribute* trajtypeAttrib = typeAttribs->get_attribute("traj_type");
+        xmlpp::Attribute* datatypeAttrib = typeAttribs->get_attribute("data_type");
+        Trajectory::TIMINGS timing;
+        Trajectory::TRAJTYPES traj_type;
+        Trajectory::DATATYPES data_type;
+        if (timingAttrib && trajtypeAttrib && datatypeAttrib)
+        {
+            std::string timingstr = CleanString(timingAttrib->get_value());
+            std::string trajtypestr = CleanString(trajtypeAttrib->get_value());
+            std::string datatypestr = CleanString(datatypeAttrib->get_value());
+            if (timingstr.compare("timed") == 0)
             {
-                throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+                timing = Trajectory::TIMED;
             }
-            // Get the type attributes
-            xmlpp::Element* typeAttribs = dynamic_cast<xmlpp::Element*>(typeEL);
-            xmlpp::Attribute* timingAttrib = typeAttribs->get_attribute("timing");
-            xmlpp::Attribute* trajtypeAttrib = typeAttribs->get_attribute("traj_type");
-            xmlpp::Attribute* datatypeAttrib = typeAttribs->get_attribute("data_type");
-            Trajectory::TIMINGS timing;
-            Trajectory::TRAJTYPES traj_type;
-            Trajectory::DATATYPES data_type;
-            if (timingAttrib && trajtypeAttrib && datatypeAttrib)
+            else if (timingstr.compare("untimed") == 0)
             {
-                std::string timingstr = CleanString(timingAttrib->get_value());
-                std::string trajtypestr = CleanString(trajtypeAttrib->get_value());
-                std::string datatypestr = CleanString(datatypeAttrib->get_value());
-                if (timingstr.compare("timed") == 0)
-                {
-                    timing = Trajectory::TIMED;
-                }
-                else if (timingstr.compare("untimed") == 0)
-                {
-                    timing = Trajectory::UNTIMED;
-                }
-                else
-                {
-                    throw std::invalid_argument("Invalid timing type");
-                }
-                if (trajtypestr.compare("generated") == 0)
-                {
-                    traj_type = Trajectory::GENERATED;
-                }
-                else if (trajtypestr.compare("recorded") == 0)
-                {
-                    traj_type = Trajectory::RECORDED;
-                }
-                else
-                {
-                    throw std::invalid_argument("Invalid trajectory type");
-                }
-                if (datatypestr.compare("joint") == 0)
-                {
-                    data_type = Trajectory::JOINT;
-                }
-                else if (datatypestr.compare("pose") == 0)
-                {
-                    data_type = Trajectory::POSE;
-                }
-                else
-                {
-                    throw std::invalid_argument("Invalid trajectory data type");
-                }
+                timing = Trajectory::UNTIMED;
             }
             else
             {
-                throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+                throw std::invalid_argument("Invalid timing type");
             }
-            // Get the type data
-            std::string root_frame;
-            std::string target_frame;
-            std::vector<std::string> joint_names;
-            if (data_type == Trajectory::JOINT)
+            if (trajtypestr.compare("generated") == 0)
             {
-                xmlpp::ContentNode* jointnamesText = dynamic_cast<xmlpp::ContentNode*>(jnEL->get_children().front());
-                if (jointnamesText && !jointnamesText->is_white_space())
-                {
-                    joint_names = ReadStrings(jointnamesText->get_content());
-                }
-                else
-                {
-                    throw std::invalid_argument("Type fields do not match type attribute");
-                }
+                traj_type = Trajectory::GENERATED;
             }
-            else if (data_type == Trajectory::POSE)
+            else if (trajtypestr.compare("recorded") == 0)
             {
-                xmlpp::ContentNode* rootframeText = dynamic_cast<xmlpp::ContentNode*>(rfEL->get_children().front());
-                xmlpp::ContentNode* targetframeText = dynamic_cast<xmlpp::ContentNode*>(tfEL->get_children().front());
-                if (rootframeText && targetframeText && !rootframeText->is_white_space() && !targetframeText->is_white_space())
-                {
-                    root_frame = CleanString(rootframeText->get_content());
-                    target_frame = CleanString(targetframeText->get_content());
-                }
-                else
-                {
-                    throw std::invalid_argument("Type fields do not match type attribute");
-                }
+                traj_type = Trajectory::RECORDED;
             }
             else
             {
-                throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+                throw std::invalid_argument("Invalid trajectory type");
             }
-            // Get the tags
-            std::vector<std::string> tags;
-            // First, we need to check that current file actually has tags
-            xmlpp::Node* tagN = tagsEL->get_children().front();
-            if (tagN != NULL && (tagsEL->get_children().size() > 0))
+            if (datatypestr.compare("joint") == 0)
             {
-                xmlpp::ContentNode* tagsText = dynamic_cast<xmlpp::ContentNode*>(tagN);
-                if (tagsText != NULL && !tagsText->is_white_space())
-                {
-                    tags = ReadStrings(tagsText->get_content());
-                }
-                else
-                {
-                    //throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
-                }
+                data_type = Trajectory::JOINT;
             }
-            ////////////////////////////////////////////////////////////////////////////////
-            /* Read the trajectory data */
-            // Get the state nodes
-            xmlpp::Node::NodeList states = root->get_children("states");
-            xmlpp::Node* statesEL = states.front();
-            xmlpp::Node::NodeList statelist = statesEL->get_children("state");
-            // Run through the state nodes
-            std::vector<State> trajectory_data;
-            for (xmlpp::Node::NodeList::iterator iter = statelist.begin(); iter != statelist.end(); ++iter)
+            else if (datatypestr.compare("pose") == 0)
             {
-                // Get the desired data
-                xmlpp::Node::NodeList desired = ((xmlpp::Node*)*iter)->get_children("desired");
-                xmlpp::Node* desiredEL = desired.front();
-                std::vector< std::vector<double> > desiredData = ReadStateFields(desiredEL);
-                // Get the actual data
-                xmlpp::Node::NodeList actual = ((xmlpp::Node*)*iter)->get_children("actual");
-                xmlpp::Node* actualEL = actual.front();
-                std::vector< std::vector<double> > actualData = ReadStateFields(actualEL);
-                // Get the extras
-                std::map<std::string, KeyValue> extras;
-                xmlpp::Node::NodeList extralist = ((xmlpp::Node*)*iter)->get_children("extra");
-                for (xmlpp::Node::NodeList::iterator xiter = extralist.begin(); xiter != extralist.end(); ++xiter)
-                {
-                    xmlpp::Element* extraElement = dynamic_cast<xmlpp::Element*>(*xiter);
-                    xmlpp::Attribute* nameAttrib = extraElement->get_attribute("name");
-                    xmlpp::Attribute* typeAttrib = extraElement->get_attribute("type");
-                    xmlpp::Attribute* valueAttrib = extraElement->get_attribute("value");
-                    if (nameAttrib && typeAttrib && valueAttrib)
-                    {
-                        std::string real_type(typeAttrib->get_value());
-                        if (real_type.compare("BOOLEAN") == 0 || real_type.compare("boolean") == 0)
-                        {
-                            bool value = false;
-                            std::string value_string(valueAttrib->get_value());
-                            if (value_string.compare("TRUE") == 0 || value_string.compare("true") == 0 || value_string.compare("1") == 0)
-                            {
-                                value = true;
-                            }
-                            KeyValue extra(value);
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else if (real_type.compare("INTEGER") == 0 || real_type.compare("integer") == 0)
-                        {
-                            KeyValue extra(atol(valueAttrib->get_value().c_str()));
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else if (real_type.compare("DOUBLE") == 0 || real_type.compare("double") == 0)
-                        {
-                            KeyValue extra(atof(valueAttrib->get_value().c_str()));
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else if (real_type.compare("STRING") == 0 || real_type.compare("string") == 0)
-                        {
-                            KeyValue extra(std::string(valueAttrib->get_value()));
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else if (real_type.compare("BOOLEANLIST") == 0 || real_type.compare("booleanlist") == 0)
-                        {
-                            std::vector<bool> bools = ReadBools(std::string(valueAttrib->get_value()));
-                            KeyValue extra(bools);
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else if (real_type.compare("INTEGERLIST") == 0 || real_type.compare("integerlist") == 0)
-                        {
-                            std::vector<long> longs = ReadLongs(std::string(valueAttrib->get_value()));
-                            KeyValue extra(longs);
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else if (real_type.compare("DOUBLELIST") == 0 || real_type.compare("doublelist") == 0)
-                        {
-                            std::vector<double> doubles = ReadDoubles(std::string(valueAttrib->get_value()));
-                            KeyValue extra(doubles);
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else if (real_type.compare("STRINGLIST") == 0 || real_type.compare("stringlist") == 0)
-                        {
-                            std::vector<std::string> strings = ReadStrings(std::string(valueAttrib->get_value()));
-                            KeyValue extra(strings);
-                            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), extra));
-                        }
-                        else
-                        {
-                            throw std::invalid_argument("XTF file is malformed or otherwise corrupted - a state contains invalid extra type");
-                        }
-                    }
-                    else
-                    {
-                        throw std::invalid_argument("XTF file is malformed or otherwise corrupted - a state contains invalid extras");
-                    }
-                }
-                // Get the state header data
-                xmlpp::Element* nodeElement = dynamic_cast<xmlpp::Element*>(*iter);
-                xmlpp::Attribute* sequenceAttrib = nodeElement->get_attribute("sequence");
-                xmlpp::Attribute* secsAttrib = nodeElement->get_attribute("secs");
-                xmlpp::Attribute* nsecsAttrib = nodeElement->get_attribute("nsecs");
-                if (sequenceAttrib && secsAttrib && nsecsAttrib)
-                {
-                    int sequence = atoi(sequenceAttrib->get_value().c_str());
-                    unsigned long secs = atoi(secsAttrib->get_value().c_str());
-                    unsigned long nsecs = atoi(nsecsAttrib->get_value().c_str());
-                    timespec timing;
-                    timing.tv_sec = secs;
-                    timing.tv_nsec = nsecs;
-                    State new_state(desiredData[0], desiredData[1], desiredData[2], actualData[0], actualData[1], actualData[2], sequence, timing);
-                    new_state.extras_ = extras;
-                    trajectory_data.push_back(new_state);
-                }
-                else
-                {
-                    throw std::invalid_argument("XTF file is malformed or otherwise corrupted - one of the states is invalid");
-                }
+                data_type = Trajectory::POSE;
+            }
+            else
+            {
+                throw std::invalid_argument("Invalid trajectory data type");
+            }
+        }
+        else
+        {
+            throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+        }
+        // Get the type data
+        std::string root_frame;
+        std::string target_frame;
+        std::vector<std::string> joint_names;
+        if (data_type == Trajectory::JOINT)
+        {
+            xmlpp::ContentNode* jointnamesText = dynamic_cast<xmlpp::ContentNode*>(jnEL->get_children().front());
+            if (jointnamesText && !jointnamesText->is_white_space())
+            {
+                joint_names = ReadStrings(jointnamesText->get_content());
+            }
+            else
+            {
+                throw std::invalid_argument("Type fields do not match type attribute");
+            }
+        }
+        else if (data_type == Trajectory::POSE)
+        {
+            xmlpp::ContentNode* rootframeText = dynamic_cast<xmlpp::ContentNode*>(rfEL->get_children().front());
+            xmlpp::ContentNode* targetframeText = dynamic_cast<xmlpp::ContentNode*>(tfEL->get_children().front());
+            if (rootframeText && targetframeText && !rootframeText->is_white_space() && !targetframeText->is_white_space())
+            {
+                root_frame = CleanString(rootframeText->get_content());
+                target_frame = CleanString(targetframeText->get_content());
             }
-            // Assemble the trajectory
-            if (data_type == Trajectory::JOINT)
+            else
             {
-                Trajectory new_traj(uid, traj_type, timing, robot, generator, joint_names, trajectory_data, tags);
-                return new_traj;
+                throw std::invalid_argument("Type fields do not match type attribute");
             }
-            else if (data_type == Trajectory::POSE)
+        }
+        else
+        {
+            throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+        }
+        // Get the tags
+        std::vector<std::string> tags;
+        // First, we need to check that current file actually has tags
+        xmlpp::Node* tagN = tagsEL->get_children().front();
+        if (tagN != NULL && (tagsEL->get_children().size() > 0))
+        {
+            xmlpp::ContentNode* tagsText = dynamic_cast<xmlpp::ContentNode*>(tagN);
+            if (tagsText != NULL && !tagsText->is_white_space())
             {
-                Trajectory new_traj(uid, traj_type, timing, robot, generator, root_frame, target_frame, trajectory_data, tags);
-                return new_traj;
+                tags = ReadStrings(tagsText->get_content());
             }
             else
             {
-                std::string error_str("Unable to read XTF file: " + filename);
-                throw std::invalid_argument(error_str.c_str());
+                //throw std::invalid_argument("XTF file is malformed or otherwise corrupted");
+            }
+        }
+        ////////////////////////////////////////////////////////////////////////////////
+        /* Read the trajectory data */
+        // Get the state nodes
+        xmlpp::Node::NodeList states = root->get_children("states");
+        xmlpp::Node* statesEL = states.front();
+        xmlpp::Node::NodeList statelist = statesEL->get_children("state");
+        // Run through the state nodes
+        std::vector<State> trajectory_data;
+        trajectory_data.reserve(statelist.size());
+        for (xmlpp::Node::NodeList::iterator iter = statelist.begin(); iter != statelist.end(); ++iter)
+        {
+            State new_state = ReadState(*iter);
+            // Validation runs here so that it shares the single pass over the states
+            if (options.Enabled())
+            {
+                const State* previous = (trajectory_data.size() > 0) ? &trajectory_data.back() : NULL;
+                ValidateState(new_state, trajectory_data.size(), previous, timing, data_type, options, diagnostics);
+            }
+            trajectory_data.push_back(std::move(new_state));
+        }
+        // Check the declared length against the states we actually read
+        if (options.check_length_)
+        {
+            xmlpp::Attribute* lengthAttrib = dynamic_cast<xmlpp::Element*>(statesEL)->get_attribute("length");
+            if (lengthAttrib)
+            {
+                long declared_length = atol(lengthAttrib->get_value().c_str());
+                if (declared_length < 0 || (size_t)declared_length != trajectory_data.size())
+                {
+                    diagnostics.push_back(ValidationDiagnostic(trajectory_data.size(), ValidationDiagnostic::LENGTH_MISMATCH, (double)declared_length, "length"));
+                }
             }
         }
+        // Assemble the trajectory
+        if (data_type == Trajectory::JOINT)
+        {
+            Trajectory new_traj(uid, traj_type, timing, robot, generator, joint_names, std::move(trajectory_data), tags);
+            return new_traj;
+        }
+        else if (data_type == Trajectory::POSE)
+        {
+            Trajectory new_traj(uid, traj_type, timing, robot, generator, root_frame, target_frame, std::move(trajectory_data), tags);
+            return new_traj;
+        }
         else
         {
             std::string error_str("Unable to read XTF file: " + filename);
             throw std::invalid_argument(error_str.c_str());
         }
     }
-    catch (xmlpp::internal_error e)
+    else
     {
-        std::string error_str("Unable to read XTF file (file may not exist): " + filename);
+        std::string error_str("Unable to read XTF file: " + filename);
         throw std::invalid_argument(error_str.c_str());
     }
 }
 
+State Parser::ReadState(xmlpp::Node* state_node)
+{
+    // Get the desired data
+    xmlpp::Node::NodeList desired = state_node->get_children("desired");
+    xmlpp::Node* desiredEL = desired.front();
+    std::vector< std::vector<double> > desiredData = ReadStateFields(desiredEL);
+    // Get the actual data
+    xmlpp::Node::NodeList actual = state_node->get_children("actual");
+    xmlpp::Node* actualEL = actual.front();
+    std::vector< std::vector<double> > actualData = ReadStateFields(actualEL);
+    // Get the extras
+    std::map<std::string, KeyValue> extras;
+    xmlpp::Node::NodeList extralist = state_node->get_children("extra");
+    for (xmlpp::Node::NodeList::iterator xiter = extralist.begin(); xiter != extralist.end(); ++xiter)
+    {
+        xmlpp::Element* extraElement = dynamic_cast<xmlpp::Element*>(*xiter);
+        xmlpp::Attribute* nameAttrib = extraElement->get_attribute("name");
+        xmlpp::Attribute* typeAttrib = extraElement->get_attribute("type");
+        xmlpp::Attribute* valueAttrib = extraElement->get_attribute("value");
+        if (nameAttrib && typeAttrib && valueAttrib)
+        {
+            KeyValue extra = ReadKeyValue(typeAttrib->get_value(), valueAttrib->get_value());
+            extras.insert(std::pair<std::string, KeyValue>(std::string(nameAttrib->get_value()), std::move(extra)));
+        }
+        else
+        {
+            throw std::invalid_argument("XTF file is malformed or otherwise corrupted - a state contains invalid extras");
+        }
+    }
+    // Get the state header data
+    xmlpp::Element* nodeElement = dynamic_cast<xmlpp::Element*>(state_node);
+    xmlpp::Attribute* sequenceAttrib = nodeElement->get_attribute("sequence");
+    xmlpp::Attribute* secsAttrib = nodeElement->get_attribute("secs");
+    xmlpp::Attribute* nsecsAttrib = nodeElement->get_attribute("nsecs");
+    if (sequenceAttrib && secsAttrib && nsecsAttrib)
+    {
+        int sequence = atoi(sequenceAttrib->get_value().c_str());
+        unsigned long secs = atoi(secsAttrib->get_value().c_str());
+        unsigned long nsecs = atoi(nsecsAttrib->get_value().c_str());
+        timespec state_timing;
+        state_timing.tv_sec = secs;
+        state_timing.tv_nsec = nsecs;
+        // Moving the parsed fields in avoids deep-copying every vector of every state
+        State new_state(std::move(desiredData[0]), std::move(desiredData[1]), std::move(desiredData[2]), std::move(actualData[0]), std::move(actualData[1]), std::move(actualData[2]), sequence, state_timing);
+        new_state.extras_.swap(extras);
+        return new_state;
+    }
+    else
+    {
+        throw std::invalid_argument("XTF file is malformed or otherwise corrupted - one of the states is invalid");
+    }
+}
+
 bool Parser::ExportTraj(Trajectory trajectory, std::string filename, bool compact)
+{
+    return ExportViews(trajectory, std::vector<TrajectoryView>(1, TrajectoryView(trajectory)), filename, compact);
+}
+
+bool Parser::ExportTraj(const TrajectoryView& view, std::string filename, bool compact)
+{
+    return ExportViews(view.Header(), std::vector<TrajectoryView>(1, view), filename, compact);
+}
+
+bool Parser::ExportTraj(const ConcatenatedView& view, std::string filename, bool compact)
+{
+    return ExportViews(view.Header(), view.Parts(), filename, compact);
+}
+
+void Parser::WriteState(xmlpp::Element* states, const State& current)
+{
+    xmlpp::Element* state = states->add_child("state");
+    state->set_attribute("sequence", PrettyPrint::PrettyPrint(current.sequence_));
+    state->set_attribute("secs", PrettyPrint::PrettyPrint(current.timing_.tv_sec));
+    state->set_attribute("nsecs", PrettyPrint::PrettyPrint(current.timing_.tv_nsec));
+    // --- Make state fields
+    xmlpp::Element* desired = state->add_child("desired");
+    xmlpp::Element* actual = state->add_child("actual");
+    // ---- Fill in the state fields
+    xmlpp::Element* dp = desired->add_child("position");
+    dp->set_child_text(PrettyPrint::PrettyPrint(current.position_desired_));
+    xmlpp::Element* dv = desired->add_child("velocity");
+    dv->set_child_text(PrettyPrint::PrettyPrint(current.velocity_desired_));
+    xmlpp::Element* da = desired->add_child("acceleration");
+    da->set_child_text(PrettyPrint::PrettyPrint(current.acceleration_desired_));
+    xmlpp::Element* ap = actual->add_child("position");
+    ap->set_child_text(PrettyPrint::PrettyPrint(current.position_actual_));
+    xmlpp::Element* av = actual->add_child("velocity");
+    av->set_child_text(PrettyPrint::PrettyPrint(current.velocity_actual_));
+    xmlpp::Element* aa = actual->add_child("acceleration");
+    aa->set_child_text(PrettyPrint::PrettyPrint(current.acceleration_actual_));
+    std::map<std::string, KeyValue>::const_iterator itr;
+    for(itr = current.extras_.begin(); itr != current.extras_.end(); ++itr)
+    {
+        xmlpp::Element* extra = state->add_child("extra");
+        extra->set_attribute("name", itr->first);
+        extra->set_attribute("type", itr->second.GetTypeString());
+        extra->set_attribute("value", itr->second.GetValueString());
+    }
+}
+
+bool Parser::ExportViews(const Trajectory& trajectory, const std::vector<TrajectoryView>& parts, std::string filename, bool compact)
+{
+    xmlpp::Document trajXTF;
+    BuildDocument(trajXTF, trajectory, parts);
+    // Write the xml document to file
+    if (compact)
+    {
+        trajXTF.write_to_file(filename, "utf-8");
+    }
+    else
+    {
+        trajXTF.write_to_file_formatted(filename, "utf-8");
+    }
+    return true;
+}
+
+bool Parser::ExportTrajToBuffer(const TrajectoryView& view, std::string& buffer, bool compact)
+{
+    xmlpp::Document trajXTF;
+    BuildDocument(trajXTF, view.Header(), std::vector<TrajectoryView>(1, view));
+    if (compact)
+    {
+        buffer = trajXTF.write_to_string("utf-8");
+    }
+    else
+    {
+        buffer = trajXTF.write_to_string_formatted("utf-8");
+    }
+    return true;
+}
+
+bool Parser::ExportTrajToStream(const TrajectoryView& view, std::ostream& stream, bool compact)
 {
     xmlpp::Document trajXTF;
+    BuildDocument(trajXTF, view.Header(), std::vector<TrajectoryView>(1, view));
+    if (compact)
+    {
+        trajXTF.write_to_stream(stream, "utf-8");
+    }
+    else
+    {
+        trajXTF.write_to_stream_formatted(stream, "utf-8");
+    }
+    return stream.good();
+}
+
+void Parser::BuildDocument(xmlpp::Document& trajXTF, const Trajectory& trajectory, const std::vector<TrajectoryView>& parts)
+{
     // Make root
     xmlpp::Element* root = trajXTF.create_root_node("trajectory");
     root->set_attribute("uid", trajectory.uid_);
@@ -938,50 +1636,190 @@ bool Parser::ExportTraj(Trajectory trajectory, std::string filename, bool compac
     tags->set_child_text(PrettyPrint::PrettyPrint(trajectory.tags_));
     // - Make state block
     xmlpp::Element* states = root->add_child("states");
-    states->set_attribute("length", PrettyPrint::PrettyPrint(trajectory.trajectory_.size()));
+    size_t length = 0;
+    for (size_t part = 0; part < parts.size(); part++)
+    {
+        length += parts[part].size();
+    }
+    states->set_attribute("length", PrettyPrint::PrettyPrint(length));
     // -- Make states
-    for (unsigned int i = 0; i < trajectory.trajectory_.size(); i++)
-    {
-        State current = trajectory.trajectory_[i];
-        xmlpp::Element* state = states->add_child("state");
-        state->set_attribute("sequence", PrettyPrint::PrettyPrint(current.sequence_));
-        state->set_attribute("secs", PrettyPrint::PrettyPrint(current.timing_.tv_sec));
-        state->set_attribute("nsecs", PrettyPrint::PrettyPrint(current.timing_.tv_nsec));
-        // --- Make state fields
-        xmlpp::Element* desired = state->add_child("desired");
-        xmlpp::Element* actual = state->add_child("actual");
-        // ---- Fill in the state fields
-        xmlpp::Element* dp = desired->add_child("position");
-        dp->set_child_text(PrettyPrint::PrettyPrint(current.position_desired_));
-        xmlpp::Element* dv = desired->add_child("velocity");
-        dv->set_child_text(PrettyPrint::PrettyPrint(current.velocity_desired_));
-        xmlpp::Element* da = desired->add_child("acceleration");
-        da->set_child_text(PrettyPrint::PrettyPrint(current.acceleration_desired_));
-        xmlpp::Element* ap = actual->add_child("position");
-        ap->set_child_text(PrettyPrint::PrettyPrint(current.position_actual_));
-        xmlpp::Element* av = actual->add_child("velocity");
-        av->set_child_text(PrettyPrint::PrettyPrint(current.velocity_actual_));
-        xmlpp::Element* aa = actual->add_child("acceleration");
-        aa->set_child_text(PrettyPrint::PrettyPrint(current.acceleration_actual_));
-        std::map<std::string, KeyValue>::iterator itr;
-        for(itr = current.extras_.begin(); itr != current.extras_.end(); ++itr)
+    for (size_t part = 0; part < parts.size(); part++)
+    {
+        for (size_t i = 0; i < parts[part].size(); i++)
         {
-            xmlpp::Element* extra = state->add_child("extra");
-            extra->set_attribute("name", itr->first);
-            extra->set_attribute("type", itr->second.GetTypeString());
-            extra->set_attribute("value", itr->second.GetValueString());
+            WriteState(states, parts[part][i]);
         }
     }
-    // Write the xml document to file
+}
+
+std::string Parser::EncodeHeader(const Trajectory& trajectory)
+{
+    xmlpp::Document headerXTF;
+    BuildDocument(headerXTF, trajectory, std::vector<TrajectoryView>());
+    return headerXTF.write_to_string("utf-8");
+}
+
+Trajectory Parser::DecodeHeader(const char* buffer, size_t length)
+{
+    if (length > (size_t)INT_MAX)
+    {
+        throw std::invalid_argument("XTF documents in memory are limited to 2 GiB");
+    }
+    try
+    {
+        xmlpp::DomParser parser;
+        parser.set_substitute_entities();
+        parser.parse_memory_raw((const unsigned char*)buffer, length);
+        ValidationOptions options;
+        std::vector<ValidationDiagnostic> diagnostics;
+        return ParseDocument(parser, "<header>", options, diagnostics);
+    }
+    catch (xmlpp::exception& e)
+    {
+        throw std::invalid_argument("Unable to read XTF header - header is malformed or otherwise corrupted");
+    }
+}
+
+std::string Parser::EncodeStates(const TrajectoryView& view, bool compact)
+{
+    xmlpp::Document statesXTF;
+    xmlpp::Element* states = statesXTF.create_root_node("states");
+    states->set_attribute("length", PrettyPrint::PrettyPrint(view.size()));
+    for (size_t i = 0; i < view.size(); i++)
+    {
+        WriteState(states, view[i]);
+    }
     if (compact)
     {
-        trajXTF.write_to_file(filename, "utf-8");
+        return statesXTF.write_to_string("utf-8");
     }
     else
     {
-        trajXTF.write_to_file_formatted(filename, "utf-8");
+        return statesXTF.write_to_string_formatted("utf-8");
+    }
+}
+
+std::vector<State> Parser::DecodeStates(const char* buffer, size_t length)
+{
+    if (length > (size_t)INT_MAX)
+    {
+        throw std::invalid_argument("XTF documents in memory are limited to 2 GiB");
+    }
+    try
+    {
+        xmlpp::DomParser parser;
+        parser.set_substitute_entities();
+        parser.parse_memory_raw((const unsigned char*)buffer, length);
+        if (!parser)
+        {
+            throw std::invalid_argument("Unable to read XTF states - block is malformed or otherwise corrupted");
+        }
+        const xmlpp::Node* root = parser.get_document()->get_root_node();
+        xmlpp::Node::NodeList statelist = root->get_children("state");
+        std::vector<State> states;
+        states.reserve(statelist.size());
+        for (xmlpp::Node::NodeList::iterator iter = statelist.begin(); iter != statelist.end(); ++iter)
+        {
+            states.push_back(ReadState(*iter));
+        }
+        return states;
+    }
+    catch (xmlpp::exception& e)
+    {
+        throw std::invalid_argument("Unable to read XTF states - block is malformed or otherwise corrupted");
+    }
+}
+
+void Parser::ValidateState(const State& state, size_t index, const State* previous, Trajectory::TIMINGS timing, Trajectory::DATATYPES data_type, const ValidationOptions& options, std::vector<ValidationDiagnostic>& diagnostics)
+{
+    if (previous != NULL)
+    {
+        if (options.check_timing_ && timing == Trajectory::TIMED && CompareTimespecs(previous->timing_, state.timing_) >= 0)
+        {
+            double delta = TimespecToSeconds(state.timing_) - TimespecToSeconds(previous->timing_);
+            diagnostics.push_back(ValidationDiagnostic(index, ValidationDiagnostic::NON_MONOTONIC_TIMING, delta));
+        }
+        if (options.check_sequence_ && state.sequence_ != (previous->sequence_ + 1))
+        {
+            diagnostics.push_back(ValidationDiagnostic(index, ValidationDiagnostic::NON_CONTIGUOUS_SEQUENCE, (double)state.sequence_));
+        }
+    }
+    if (options.check_finite_)
+    {
+        for (size_t field = 0; field < State::NUM_FIELDS; field++)
+        {
+            const std::vector<double>& values = state.Field((State::FIELDS)field);
+            for (size_t element = 0; element < values.size(); element++)
+            {
+                if (!std::isfinite(values[element]))
+                {
+                    diagnostics.push_back(ValidationDiagnostic(index, ValidationDiagnostic::NON_FINITE_VALUE, values[element], State::FieldName((State::FIELDS)field), element));
+                }
+            }
+        }
+    }
+    if (options.check_quaternions_ && data_type == Trajectory::POSE)
+    {
+        // Only the position fields hold [X,Y,Z,X,Y,Z,W] poses
+        State::FIELDS pose_fields[2] = {State::POSITION_DESIRED, State::POSITION_ACTUAL};
+        for (size_t i = 0; i < 2; i++)
+        {
+            const std::vector<double>& pose = state.Field(pose_fields[i]);
+            if (pose.size() == 7)
+            {
+                double norm = sqrt((pose[3] * pose[3]) + (pose[4] * pose[4]) + (pose[5] * pose[5]) + (pose[6] * pose[6]));
+                if (!(fabs(norm - 1.0) <= options.quaternion_tolerance_))
+                {
+                    diagnostics.push_back(ValidationDiagnostic(index, ValidationDiagnostic::NON_UNIT_QUATERNION, norm, State::FieldName(pose_fields[i]), 3));
+                }
+            }
+        }
+    }
+}
+
+KeyValue Parser::ReadKeyValue(const std::string& real_type, const std::string& value_string)
+{
+    if (real_type.compare("BOOLEAN") == 0 || real_type.compare("boolean") == 0)
+    {
+        bool value = false;
+        if (value_string.compare("TRUE") == 0 || value_string.compare("true") == 0 || value_string.compare("1") == 0)
+        {
+            value = true;
+        }
+        return KeyValue(value);
+    }
+    else if (real_type.compare("INTEGER") == 0 || real_type.compare("integer") == 0)
+    {
+        return KeyValue(atol(value_string.c_str()));
+    }
+    else if (real_type.compare("DOUBLE") == 0 || real_type.compare("double") == 0)
+    {
+        return KeyValue(atof(value_string.c_str()));
+    }
+    else if (real_type.compare("STRING") == 0 || real_type.compare("string") == 0)
+    {
+        return KeyValue(value_string);
+    }
+    else if (real_type.compare("BOOLEANLIST") == 0 || real_type.compare("booleanlist") == 0)
+    {
+        return KeyValue(ReadBools(value_string));
+    }
+    else if (real_type.compare("INTEGERLIST") == 0 || real_type.compare("integerlist") == 0)
+    {
+        return KeyValue(ReadLongs(value_string));
+    }
+    else if (real_type.compare("DOUBLELIST") == 0 || real_type.compare("doublelist") == 0)
+    {
+        return KeyValue(ReadDoubles(value_string));
+    }
+    else if (real_type.compare("STRINGLIST") == 0 || real_type.compare("stringlist") == 0)
+    {
+        return KeyValue(ReadStrings(value_string));
+    }
+    else
+    {
+        throw std::invalid_argument("XTF file is malformed or otherwise corrupted - a state contains invalid extra type");
     }
-    return true;
 }
 
 std::vector<bool> Parser::ReadBools(std::string strtovec)
@@ -1012,14 +1850,27 @@ std::vector<long> Parser::ReadLongs(std::string strtovec)
     return longs;
 }
 
-std::vector<double> Parser::ReadDoubles(std::string strtovec)
+std::vector<double> Parser::ReadDoubles(const std::string& strtovec)
 {
-    std::vector<std::string> elements = Parser::ReadStrings(strtovec);
+    // This runs for every field of every state, so values are converted in place rather than
+    // going through ReadStrings, which allocates several strings per element
     std::vector<double> doubles;
-    for (unsigned int i = 0; i < elements.size(); i++)
+    doubles.reserve(std::count(strtovec.begin(), strtovec.end(), ',') + 1);
+    const char* cursor = strtovec.c_str();
+    while (true)
     {
-        double temp = atof(elements[i].c_str());
-        doubles.push_back(temp);
+        const char* comma = strchr(cursor, ',');
+        if (comma == NULL)
+        {
+            // Like ReadStrings, a trailing blank element is dropped
+            if (cursor[strspn(cursor, " \t\r\n")] != '\0')
+            {
+                doubles.push_back(atof(cursor));
+            }
+            break;
+        }
+        doubles.push_back(atof(cursor));
+        cursor = comma + 1;
     }
     return doubles;
 }
@@ -1083,8 +1934,9 @@ std::vector< std::vector<double> > Parser::ReadStateFields(xmlpp::Node* field_pa
     }
     // Pack everything together for return
     std::vector< std::vector<double> > data;
-    data.push_back(position_data);
-    data.push_back(velocity_data);
-    data.push_back(acceleration_data);
+    data.reserve(3);
+    data.push_back(std::move(position_data));
+    data.push_back(std::move(velocity_data));
+    data.push_back(std::move(acceleration_data));
     return data;
 }
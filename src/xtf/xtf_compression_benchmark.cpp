@@ -0,0 +1,152 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <random>
+#include <iostream>
+#include <stdexcept>
+#include <time.h>
+#include "xtf/xtf.hpp"
+#include "xtf/compression.hpp"
+
+/* Measures the compression ratio and decode throughput of CompressedTrajectory on a synthetic
+ * 1 kHz JOINT trajectory with positions, velocities and accelerations. The ratio compares the
+ * compressed size with the raw doubles and timing (8 bytes per value, 16 per timestamp plus 8 per
+ * sequence number); throughput is raw bytes produced per second by a single-threaded Materialize().
+ * --quantum rounds every value to a multiple of the given step, as an encoder or fixed-point
+ * controller would, and --noise adds full-precision Gaussian noise.
+ */
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "Options:\n"
+              << "  -j <joints>        number of joints (default: 7)\n"
+              << "  -n <states>        number of states (default: 100000)\n"
+              << "  -r <repeats>       decode repetitions to time (default: 10)\n"
+              << "  --hold <states>    hold each sample for this many states (default: 1)\n"
+              << "  --quantum <step>   round values to multiples of step (default: 0, off)\n"
+              << "  --noise <stddev>   add Gaussian noise to every value (default: 0)\n";
+}
+
+static XTF::Trajectory MakeTrajectory(size_t joints, size_t states, size_t hold, double quantum, double noise)
+{
+    std::vector<std::string> joint_names;
+    for (size_t joint = 0; joint < joints; joint++)
+    {
+        joint_names.push_back("joint_" + std::to_string(joint));
+    }
+    XTF::Trajectory trajectory("benchmark", XTF::Trajectory::RECORDED, XTF::Trajectory::TIMED, "robot", "xtf_compression_benchmark", joint_names, std::vector<std::string>());
+    trajectory.reserve(states);
+    std::mt19937_64 generator(42);
+    std::normal_distribution<double> distribution(0.0, (noise > 0.0) ? noise : 1.0);
+    std::vector<double> empty;
+    for (size_t idx = 0; idx < states; idx++)
+    {
+        double time = (double)(idx - (idx % hold)) * 0.001;
+        std::vector<double> values[3];
+        for (size_t joint = 0; joint < joints; joint++)
+        {
+            double angle = time + (double)joint;
+            double exact[3] = {sin(angle), cos(angle), -sin(angle)};
+            for (int field = 0; field < 3; field++)
+            {
+                double value = exact[field];
+                if (noise > 0.0)
+                {
+                    value += distribution(generator);
+                }
+                if (quantum > 0.0)
+                {
+                    value = round(value / quantum) * quantum;
+                }
+                values[field].push_back(value);
+            }
+        }
+        timespec timing;
+        timing.tv_sec = (time_t)(idx / 1000);
+        timing.tv_nsec = (long)((idx % 1000) * 1000000);
+        trajectory.push_back(XTF::State(values[0], values[1], values[2], empty, empty, empty, (int)idx, timing));
+    }
+    return trajectory;
+}
+
+static inline double NowSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + ((double)now.tv_nsec * 1e-9);
+}
+
+int main(int argc, char** argv)
+{
+    size_t joints = 7;
+    size_t states = 100000;
+    size_t repeats = 10;
+    size_t hold = 1;
+    double quantum = 0.0;
+    double noise = 0.0;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string option(argv[arg]);
+        bool has_value = (arg + 1) < argc;
+        if (option.compare("-j") == 0 && has_value)
+        {
+            joints = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("-n") == 0 && has_value)
+        {
+            states = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("-r") == 0 && has_value)
+        {
+            repeats = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("--hold") == 0 && has_value)
+        {
+            hold = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("--quantum") == 0 && has_value)
+        {
+            quantum = atof(argv[++arg]);
+        }
+        else if (option.compare("--noise") == 0 && has_value)
+        {
+            noise = atof(argv[++arg]);
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (joints == 0 || states == 0 || repeats == 0 || hold == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    XTF::Trajectory trajectory = MakeTrajectory(joints, states, hold, quantum, noise);
+    double raw_bytes = (double)states * ((double)(3 * joints * sizeof(double)) + 24.0);
+    XTF::TrajectoryView view(trajectory);
+    double encode_start = NowSeconds();
+    XTF::CompressedTrajectory compressed(view);
+    double encode_seconds = NowSeconds() - encode_start;
+    double compressed_bytes = (double)compressed.CompressedBytes();
+    double decode_seconds = 0.0;
+    size_t checksum = 0;
+    for (size_t repeat = 0; repeat < repeats; repeat++)
+    {
+        double decode_start = NowSeconds();
+        XTF::Trajectory decoded = compressed.Materialize(1);
+        decode_seconds += NowSeconds() - decode_start;
+        checksum += decoded.size();
+    }
+    std::cout << "states: " << states << ", joints: " << joints << ", hold: " << hold << ", quantum: " << quantum << ", noise: " << noise << "\n"
+              << "raw " << (size_t)raw_bytes << " bytes, compressed " << (size_t)compressed_bytes << " bytes, ratio " << (raw_bytes / compressed_bytes) << "x\n"
+              << "encode " << ((raw_bytes / encode_seconds) * 1e-9) << " GB/s, decode " << ((raw_bytes * (double)repeats / decode_seconds) * 1e-9) << " GB/s (single thread)\n"
+              << "(checksum " << checksum << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <atomic>
+#include <libxml/parser.h>
+#include "xtf/xtf.hpp"
+#include "xtf/parallel.hpp"
+
+/* Converts between XTF and CSV files, picking the direction from each input's extension.
+ * Files are converted in parallel; CSV import/export within a file is also parallel when
+ * only a single file is given.
+ */
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options] <input.xtf|input.csv>...\n"
+              << "Options:\n"
+              << "  -j <threads>       number of worker threads (default: all cores)\n"
+              << "  -o <directory>     write outputs into this directory (default: next to each input)\n"
+              << "  -d <delimiter>     CSV delimiter (default: ,)\n"
+              << "  --compact          write compact XTF instead of formatted XTF\n"
+              << "  --robot <name>     robot name for trajectories imported from CSV\n"
+              << "  --generator <name> generator name for trajectories imported from CSV\n"
+              << "  --generated        mark trajectories imported from CSV as generated (default: recorded)\n"
+              << "  --untimed          mark trajectories imported from CSV as untimed (default: timed)\n"
+              << "  --pose <root> <target>  import CSV as pose data with the given frames\n";
+}
+
+static bool HasExtension(const std::string& filename, const std::string& extension)
+{
+    return (filename.size() >= extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0);
+}
+
+static std::string OutputName(const std::string& input, const std::string& output_dir, const std::string& extension)
+{
+    std::string stem = input.substr(0, input.rfind('.'));
+    if (output_dir.size() > 0)
+    {
+        size_t slash = stem.rfind('/');
+        std::string base = (slash == std::string::npos) ? stem : stem.substr(slash + 1);
+        return output_dir + "/" + base + extension;
+    }
+    return stem + extension;
+}
+
+static std::string BaseName(const std::string& input)
+{
+    std::string stem = input.substr(0, input.rfind('.'));
+    size_t slash = stem.rfind('/');
+    return (slash == std::string::npos) ? stem : stem.substr(slash + 1);
+}
+
+int main(int argc, char** argv)
+{
+    size_t threads = 0;
+    std::string output_dir;
+    bool compact = false;
+    XTF::CSVOptions csv_options;
+    XTF::Trajectory csv_header;
+    csv_header.robot_ = "unknown";
+    csv_header.generator_ = "xtf_convert";
+    csv_header.traj_type_ = XTF::Trajectory::RECORDED;
+    csv_header.timing_ = XTF::Trajectory::TIMED;
+    csv_header.data_type_ = XTF::Trajectory::JOINT;
+    std::vector<std::string> inputs;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string option(argv[arg]);
+        bool has_value = (arg + 1) < argc;
+        if (option.compare("-j") == 0 && has_value)
+        {
+            threads = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("-o") == 0 && has_value)
+        {
+            output_dir = argv[++arg];
+        }
+        else if (option.compare("-d") == 0 && has_value)
+        {
+            csv_options.delimiter_ = argv[++arg][0];
+        }
+        else if (option.compare("--compact") == 0)
+        {
+            compact = true;
+        }
+        else if (option.compare("--robot") == 0 && has_value)
+        {
+            csv_header.robot_ = argv[++arg];
+        }
+        else if (option.compare("--generator") == 0 && has_value)
+        {
+            csv_header.generator_ = argv[++arg];
+        }
+        else if (option.compare("--generated") == 0)
+        {
+            csv_header.traj_type_ = XTF::Trajectory::GENERATED;
+        }
+        else if (option.compare("--untimed") == 0)
+        {
+            csv_header.timing_ = XTF::Trajectory::UNTIMED;
+        }
+        else if (option.compare("--pose") == 0 && (arg + 2) < argc)
+        {
+            csv_header.data_type_ = XTF::Trajectory::POSE;
+            csv_header.root_frame_ = argv[++arg];
+            csv_header.target_frame_ = argv[++arg];
+        }
+        else if (option.size() > 0 && option[0] == '-')
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            inputs.push_back(option);
+        }
+    }
+    if (inputs.size() == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    // libxml2 must be initialized once before parsers are used from multiple threads
+    xmlInitParser();
+    // Parallelize across files when there are several, otherwise within the one file
+    size_t file_threads = (inputs.size() > 1) ? threads : 1;
+    csv_options.threads_ = (inputs.size() > 1) ? 1 : threads;
+    std::atomic<size_t> failures(0);
+    XTF::ParallelFor(inputs.size(), file_threads, [&](size_t idx)
+    {
+        const std::string& input = inputs[idx];
+        try
+        {
+            XTF::Parser parser;
+            if (HasExtension(input, ".csv"))
+            {
+                XTF::Trajectory header = csv_header;
+                header.uid_ = BaseName(input);
+                XTF::Trajectory trajectory = parser.ImportCSV(input, header, csv_options);
+                parser.ExportTraj(XTF::TrajectoryView(trajectory), OutputName(input, output_dir, ".xtf"), compact);
+            }
+            else if (HasExtension(input, ".xtf") || HasExtension(input, ".xml"))
+            {
+                XTF::Trajectory trajectory = parser.ParseTraj(input);
+                parser.ExportCSV(XTF::TrajectoryView(trajectory), OutputName(input, output_dir, ".csv"), csv_options);
+            }
+            else
+            {
+                throw std::invalid_argument("unrecognized file extension");
+            }
+        }
+        catch (std::exception& e)
+        {
+            failures++;
+            std::cerr << "Failed to convert " << input << ": " << e.what() << std::endl;
+        }
+    });
+    return (failures.load() == 0) ? 0 : 1;
+}
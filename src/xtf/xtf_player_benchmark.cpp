@@ -0,0 +1,174 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <time.h>
+#include "xtf/xtf.hpp"
+#include "xtf/player.hpp"
+
+/* Measures the latency of TrajectoryPlayer::Step() on a synthetic 1 kHz trajectory.
+ * Playback runs on a simulated clock so that steps are timed back to back; with --swap a second
+ * thread keeps loading new trajectories to exercise the lock-free handover.
+ */
+
+static void PrintUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "Options:\n"
+              << "  -j <joints>        number of joints (default: 7)\n"
+              << "  -n <states>        states per trajectory (default: 10000)\n"
+              << "  -s <steps>         number of steps to time (default: 1000000)\n"
+              << "  --swap             load new trajectories from another thread while stepping\n";
+}
+
+static XTF::Trajectory MakeTrajectory(size_t joints, size_t states, double phase)
+{
+    std::vector<std::string> joint_names;
+    for (size_t joint = 0; joint < joints; joint++)
+    {
+        joint_names.push_back("joint_" + std::to_string(joint));
+    }
+    XTF::Trajectory trajectory("benchmark", XTF::Trajectory::GENERATED, XTF::Trajectory::TIMED, "robot", "xtf_player_benchmark", joint_names, std::vector<std::string>());
+    trajectory.reserve(states);
+    std::vector<double> empty;
+    for (size_t idx = 0; idx < states; idx++)
+    {
+        double time = (double)idx * 0.001;
+        std::vector<double> position(joints);
+        std::vector<double> velocity(joints);
+        std::vector<double> acceleration(joints);
+        for (size_t joint = 0; joint < joints; joint++)
+        {
+            double angle = time + phase + (double)joint;
+            position[joint] = sin(angle);
+            velocity[joint] = cos(angle);
+            acceleration[joint] = -sin(angle);
+        }
+        timespec timing;
+        timing.tv_sec = (time_t)(idx / 1000);
+        timing.tv_nsec = (long)((idx % 1000) * 1000000);
+        trajectory.push_back(XTF::State(position, velocity, acceleration, empty, empty, empty, (int)idx, timing));
+    }
+    return trajectory;
+}
+
+static inline uint64_t NowNanoseconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ull) + (uint64_t)now.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    size_t joints = 7;
+    size_t states = 10000;
+    size_t steps = 1000000;
+    bool swap = false;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string option(argv[arg]);
+        bool has_value = (arg + 1) < argc;
+        if (option.compare("-j") == 0 && has_value)
+        {
+            joints = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("-n") == 0 && has_value)
+        {
+            states = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("-s") == 0 && has_value)
+        {
+            steps = (size_t)atoi(argv[++arg]);
+        }
+        else if (option.compare("--swap") == 0)
+        {
+            swap = true;
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (joints == 0 || states < 2 || steps == 0)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    XTF::Trajectory trajectory = MakeTrajectory(joints, states, 0.0);
+    XTF::TrajectoryPlayer player(trajectory);
+    player.Load(XTF::TrajectoryView(trajectory));
+    std::vector<XTF::Trajectory> alternates;
+    alternates.push_back(MakeTrajectory(joints, states, 1.0));
+    alternates.push_back(MakeTrajectory(joints, states, 2.0));
+    std::atomic<bool> done(false);
+    std::atomic<size_t> swaps(0);
+    std::thread swapper;
+    if (swap)
+    {
+        swapper = std::thread([&]()
+        {
+            while (!done.load())
+            {
+                player.Load(XTF::TrajectoryView(alternates[swaps.load() % alternates.size()]));
+                swaps++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+    std::vector<double> position(joints);
+    std::vector<double> velocity(joints);
+    std::vector<double> acceleration(joints);
+    std::vector<uint32_t> latencies(steps);
+    timespec now;
+    now.tv_sec = 0;
+    now.tv_nsec = 0;
+    double checksum = 0.0;
+    for (size_t step = 0; step < steps; step++)
+    {
+        now.tv_nsec += 1000000;
+        if (now.tv_nsec >= 1000000000)
+        {
+            now.tv_sec++;
+            now.tv_nsec -= 1000000000;
+        }
+        uint64_t start = NowNanoseconds();
+        XTF::TrajectoryPlayer::STATUS status = player.Step(now, position.data(), velocity.data(), acceleration.data());
+        uint64_t end = NowNanoseconds();
+        latencies[step] = (uint32_t)std::min(end - start, (uint64_t)0xffffffff);
+        checksum += position[0];
+        if (status == XTF::TrajectoryPlayer::FINISHED)
+        {
+            player.Seek(0.0);
+        }
+    }
+    done.store(true);
+    if (swapper.joinable())
+    {
+        swapper.join();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "steps: " << steps << ", joints: " << joints << ", states: " << states;
+    if (swap)
+    {
+        std::cout << ", trajectory swaps: " << swaps.load();
+    }
+    std::cout << "\n"
+              << "Step() latency (ns): min " << latencies.front()
+              << ", median " << latencies[steps / 2]
+              << ", p99 " << latencies[(steps * 99) / 100]
+              << ", p99.9 " << latencies[(steps * 999) / 1000]
+              << ", max " << latencies.back() << "\n"
+              << "(checksum " << checksum << ")" << std::endl;
+    return 0;
+}
@@ -0,0 +1,552 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <gtest/gtest.h>
+#include "xtf/xtf.hpp"
+#include "xtf/diff.hpp"
+#include "xtf/compression.hpp"
+#include "xtf/archive.hpp"
+#include "xtf/serialization.hpp"
+#include "xtf/hash.hpp"
+#include "xtf/dedup.hpp"
+
+/* Encode -> decode round trips for the binary, Gorilla (compressed), archive and append journal
+ * formats. Each decoded trajectory must match the original exactly, extras included. Also covers
+ * content hashing, the dedup store and trajectory diffs.
+ */
+
+static timespec MakeTiming(size_t idx)
+{
+    timespec timing;
+    timing.tv_sec = (time_t)(idx / 100);
+    timing.tv_nsec = (long)((idx % 100) * 10000000);
+    return timing;
+}
+
+static XTF::Trajectory MakeTrajectory(const std::string& uid, size_t states)
+{
+    std::vector<std::string> joint_names;
+    joint_names.push_back("shoulder");
+    joint_names.push_back("elbow");
+    joint_names.push_back("wrist");
+    std::vector<std::string> tags;
+    tags.push_back("test");
+    XTF::Trajectory trajectory(uid, XTF::Trajectory::RECORDED, XTF::Trajectory::TIMED, "robot", "test_codecs", joint_names, tags);
+    for (size_t idx = 0; idx < states; idx++)
+    {
+        std::vector<double> position;
+        std::vector<double> velocity;
+        for (size_t joint = 0; joint < joint_names.size(); joint++)
+        {
+            double angle = ((double)idx * 0.01) + (double)joint;
+            position.push_back(sin(angle));
+            // Held values, repeated values and signed zeros exercise the short XOR cases
+            velocity.push_back((idx % 7 == 0) ? -0.0 : floor(cos(angle) * 8.0) / 8.0);
+        }
+        std::vector<double> actual = (idx % 3 == 0) ? position : std::vector<double>();
+        XTF::State state(position, velocity, std::vector<double>(), actual, std::vector<double>(), std::vector<double>(), (int)idx, MakeTiming(idx));
+        if (idx % 5 == 0)
+        {
+            state.extras_["label"] = XTF::KeyValue(std::string("sample ") + std::to_string(idx));
+            state.extras_["gripper"] = XTF::KeyValue(std::vector<double>(2, (double)idx));
+            state.extras_["contact"] = XTF::KeyValue(idx % 10 == 0);
+            state.extras_["count"] = XTF::KeyValue((long)idx);
+        }
+        trajectory.push_back(state);
+    }
+    return trajectory;
+}
+
+static void ExpectSame(const XTF::Trajectory& expected, const XTF::Trajectory& actual)
+{
+    XTF::DiffOptions options;
+    options.compare_provenance_ = true;
+    XTF::DiffReport report = XTF::Diff(expected, actual, options);
+    EXPECT_TRUE(report.Equivalent()) << report.Summary();
+    ASSERT_EQ(expected.size(), actual.size());
+}
+
+// A copy of trajectory without the states at the given indices
+static XTF::Trajectory Without(const XTF::Trajectory& trajectory, size_t first_skipped, size_t second_skipped)
+{
+    XTF::Trajectory copy = trajectory.CloneHeader();
+    for (size_t idx = 0; idx < trajectory.size(); idx++)
+    {
+        if (idx != first_skipped && idx != second_skipped)
+        {
+            copy.push_back(trajectory[idx]);
+        }
+    }
+    return copy;
+}
+
+static std::string TempPath(const std::string& name)
+{
+    char directory[] = "/tmp/xtf_test_XXXXXX";
+    if (mkdtemp(directory) == NULL)
+    {
+        throw std::runtime_error("Unable to create a temporary directory");
+    }
+    return std::string(directory) + "/" + name;
+}
+
+TEST(BinaryCodec, RoundTrip)
+{
+    XTF::Trajectory original = MakeTrajectory("binary", 250);
+    XTF::Parser parser;
+    std::string encoded = parser.EncodeBinary(XTF::TrajectoryView(original));
+    XTF::Trajectory decoded = parser.DecodeBinary(encoded.data(), encoded.size());
+    ExpectSame(original, decoded);
+}
+
+TEST(BinaryCodec, RejectsTruncatedInput)
+{
+    XTF::Trajectory original = MakeTrajectory("binary", 20);
+    XTF::Parser parser;
+    std::string encoded = parser.EncodeBinary(XTF::TrajectoryView(original));
+    EXPECT_THROW(parser.DecodeBinary(encoded.data(), encoded.size() / 2), std::invalid_argument);
+}
+
+TEST(BinaryCodec, RejectsOversizedCounts)
+{
+    // A list count far larger than the data that follows must be rejected before allocating
+    std::string buffer("\xff\xff\xff\xff", 4);
+    XTF::ByteReader strings(buffer.data(), buffer.size());
+    EXPECT_THROW(strings.ReadStrings(), std::invalid_argument);
+    std::string extra;
+    XTF::AppendString(extra, "doublelist");
+    extra.append(buffer);
+    extra.append(8, '\0');
+    XTF::ByteReader doubles(extra.data(), extra.size());
+    EXPECT_THROW(XTF::ReadKeyValue(doubles), std::invalid_argument);
+}
+
+TEST(GorillaCodec, DoublesRoundTrip)
+{
+    std::vector<double> values;
+    for (size_t idx = 0; idx < 1000; idx++)
+    {
+        values.push_back((idx % 4 == 0) ? 1.5 : sin((double)idx));
+    }
+    values.push_back(-0.0);
+    values.push_back(std::numeric_limits<double>::infinity());
+    values.push_back(std::numeric_limits<double>::quiet_NaN());
+    values.push_back(std::numeric_limits<double>::denorm_min());
+    std::string buffer;
+    XTF::CompressDoubles(buffer, values.data(), values.size());
+    std::vector<double> decoded(values.size());
+    EXPECT_EQ(buffer.size(), XTF::DecompressDoubles(buffer.data(), buffer.size(), decoded.data(), decoded.size()));
+    // Compared bit for bit, so signed zeros and NaNs count
+    EXPECT_EQ(0, memcmp(values.data(), decoded.data(), values.size() * sizeof(double)));
+}
+
+TEST(GorillaCodec, Int64sRoundTrip)
+{
+    std::vector<int64_t> values;
+    for (int64_t idx = 0; idx < 1000; idx++)
+    {
+        values.push_back(idx * 10000000);
+    }
+    values.push_back(std::numeric_limits<int64_t>::min());
+    values.push_back(std::numeric_limits<int64_t>::max());
+    values.push_back(0);
+    std::string buffer;
+    XTF::CompressInt64s(buffer, values.data(), values.size());
+    std::vector<int64_t> decoded(values.size());
+    EXPECT_EQ(buffer.size(), XTF::DecompressInt64s(buffer.data(), buffer.size(), decoded.data(), decoded.size()));
+    EXPECT_EQ(values, decoded);
+}
+
+TEST(GorillaCodec, TrajectoryRoundTrip)
+{
+    XTF::Trajectory original = MakeTrajectory("compressed", 1000);
+    XTF::CompressedTrajectory compressed(XTF::TrajectoryView(original), 64);
+    ExpectSame(original, compressed.Materialize());
+    std::string serialized = compressed.Serialize();
+    XTF::CompressedTrajectory deserialized = XTF::CompressedTrajectory::Deserialize(serialized.data(), serialized.size());
+    ExpectSame(original, deserialized.Materialize(2));
+    ExpectSame(XTF::TrajectoryView(original).Slice(100, 200).Materialize(), deserialized.ReadRange(100, 200));
+}
+
+TEST(GorillaCodec, TimeRangeIsHalfOpen)
+{
+    XTF::Trajectory original = MakeTrajectory("compressed", 1000);
+    XTF::CompressedTrajectory compressed(XTF::TrajectoryView(original), 64);
+    timespec start = MakeTiming(128);
+    timespec end = MakeTiming(320);
+    ExpectSame(XTF::TrajectoryView(original).SliceTime(start, end).Materialize(), compressed.ReadTimeRange(start, end));
+}
+
+TEST(GorillaCodec, RejectsCorruptCounts)
+{
+    XTF::Trajectory original = MakeTrajectory("compressed", 100);
+    std::string serialized = XTF::CompressedTrajectory(XTF::TrajectoryView(original), 128).Serialize();
+    std::string truncated = serialized.substr(0, serialized.size() - 10);
+    EXPECT_THROW(XTF::CompressedTrajectory::Deserialize(truncated.data(), truncated.size()), std::invalid_argument);
+    // Magic, version and header size, the header, the block size and block count, then the block's start and count
+    uint32_t header_size = 0;
+    memcpy(&header_size, serialized.data() + 12, sizeof(header_size));
+    size_t count_offset = 16 + header_size + 16 + 8;
+    uint64_t huge_count = (uint64_t)1 << 40;
+    memcpy(&serialized[count_offset], &huge_count, sizeof(huge_count));
+    EXPECT_THROW(XTF::CompressedTrajectory::Deserialize(serialized.data(), serialized.size()), std::invalid_argument);
+}
+
+TEST(ArchiveFormat, RoundTrip)
+{
+    std::string filename = TempPath("test.xtfa");
+    std::vector<XTF::Trajectory> originals;
+    originals.push_back(MakeTrajectory("first", 100));
+    originals.push_back(MakeTrajectory("second", 300));
+    originals.push_back(MakeTrajectory("third", 50));
+    {
+        XTF::ArchiveWriter writer(filename);
+        writer.Add(XTF::TrajectoryView(originals[0]), XTF::ArchiveEntry::BINARY);
+        writer.Add(XTF::TrajectoryView(originals[1]), XTF::ArchiveEntry::COMPRESSED);
+        writer.Close();
+    }
+    {
+        XTF::ArchiveWriter writer(filename, true);
+        writer.Add(XTF::TrajectoryView(originals[2]), XTF::ArchiveEntry::BINARY);
+        writer.Close();
+    }
+    XTF::ArchiveReader reader(filename);
+    EXPECT_FALSE(reader.Recovered());
+    ASSERT_EQ(originals.size(), reader.size());
+    std::vector<XTF::Trajectory> loaded = reader.LoadAll();
+    for (size_t idx = 0; idx < originals.size(); idx++)
+    {
+        ExpectSame(originals[idx], loaded[idx]);
+    }
+    ExpectSame(originals[1], reader.Load("second"));
+    unlink(filename.c_str());
+}
+
+TEST(AppendJournal, AppendRoundTrip)
+{
+    std::string filename = TempPath("test.xtf");
+    XTF::Trajectory original = MakeTrajectory("appended", 60);
+    XTF::Parser parser;
+    ASSERT_TRUE(parser.ExportTraj(XTF::TrajectoryView(original).Slice(0, 40).Materialize(), filename));
+    std::vector<XTF::State> tail;
+    for (size_t idx = 40; idx < original.size(); idx++)
+    {
+        tail.push_back(original[idx]);
+    }
+    ASSERT_TRUE(parser.AppendStates(filename, tail));
+    // A completed append leaves no journal behind
+    EXPECT_FALSE(parser.RecoverAppend(filename));
+    ExpectSame(original, parser.ParseTraj(filename));
+    unlink(filename.c_str());
+}
+
+TEST(ContentHash, MatchesReferenceValues)
+{
+    // Published XXH64 values with seed 0
+    EXPECT_EQ(0xef46db3751d8e999ULL, XTF::HashString(""));
+    EXPECT_EQ(0xd24ec4f1a98c6e5bULL, XTF::HashString("a"));
+    EXPECT_EQ(0x44bc2cf5ad770999ULL, XTF::HashString("abc"));
+    EXPECT_EQ("44bc2cf5ad770999", XTF::HashToHex(XTF::HashString("abc")));
+    // Streamed in uneven pieces across the 32-byte stripes
+    std::string data;
+    for (size_t idx = 0; idx < 1000; idx++)
+    {
+        data.push_back((char)(idx * 31));
+    }
+    XTF::StreamingHash streaming(7);
+    for (size_t offset = 0, piece = 1; offset < data.size(); offset += piece, piece = (piece * 3) % 41 + 1)
+    {
+        streaming.Update(data.data() + offset, std::min(piece, data.size() - offset));
+    }
+    EXPECT_EQ(XTF::HashBytes(data.data(), data.size(), 7), streaming.Digest());
+}
+
+TEST(ContentHash, CoversContentOnly)
+{
+    XTF::Trajectory original = MakeTrajectory("hashed", 100);
+    uint64_t hash = XTF::ContentHash(XTF::TrajectoryView(original));
+    // Provenance is left out, and -0.0 hashes as 0.0
+    XTF::Trajectory renamed = original;
+    renamed.uid_ = "renamed";
+    renamed.generator_ = "another_tool";
+    renamed.tags_.push_back("copy");
+    ASSERT_TRUE(std::signbit(original[14].velocity_desired_[0]));
+    renamed[14].velocity_desired_[0] = 0.0;
+    EXPECT_EQ(hash, XTF::ContentHash(XTF::TrajectoryView(renamed)));
+    // The binary codec is lossless, so a decoded copy hashes the same
+    XTF::Parser parser;
+    std::string encoded = parser.EncodeBinary(XTF::TrajectoryView(original));
+    XTF::Trajectory decoded = parser.DecodeBinary(encoded.data(), encoded.size());
+    EXPECT_EQ(hash, XTF::ContentHash(XTF::TrajectoryView(decoded)));
+    // Values, extras, timing and length are content
+    XTF::Trajectory changed = original;
+    changed[50].position_desired_[1] += 1e-12;
+    EXPECT_NE(hash, XTF::ContentHash(XTF::TrajectoryView(changed)));
+    changed = original;
+    changed[50].extras_["label"] = XTF::KeyValue(std::string("changed"));
+    EXPECT_NE(hash, XTF::ContentHash(XTF::TrajectoryView(changed)));
+    changed = original;
+    changed[50].timing_.tv_nsec += 1;
+    EXPECT_NE(hash, XTF::ContentHash(XTF::TrajectoryView(changed)));
+    EXPECT_NE(hash, XTF::ContentHash(XTF::TrajectoryView(original).Slice(0, 99)));
+}
+
+TEST(ContentHash, NearDuplicates)
+{
+    XTF::Trajectory original = MakeTrajectory("near", 100);
+    XTF::Trajectory perturbed = original;
+    for (size_t idx = 0; idx < perturbed.size(); idx++)
+    {
+        perturbed[idx].position_desired_[0] += 1e-9;
+    }
+    XTF::TrajectoryView original_view(original);
+    XTF::TrajectoryView perturbed_view(perturbed);
+    EXPECT_TRUE(XTF::NearDuplicates(original_view, perturbed_view, 1e-6));
+    EXPECT_FALSE(XTF::NearDuplicates(original_view, perturbed_view, 1e-12));
+    EXPECT_FALSE(XTF::NearDuplicates(original_view, original_view.Slice(0, 99), 1e-6));
+    // Extras and sequence numbers are ignored, a different shape is not
+    perturbed[20].extras_.clear();
+    perturbed[20].sequence_ = 1000;
+    EXPECT_TRUE(XTF::NearDuplicates(original_view, perturbed_view, 1e-6));
+    perturbed[20].velocity_desired_.pop_back();
+    EXPECT_FALSE(XTF::NearDuplicates(original_view, perturbed_view, 1.0));
+}
+
+// The dedup store writes and reads XTF files, so these need the XML parser
+
+TEST(DedupStore, ReinsertIsDuplicate)
+{
+    std::string directory = TempPath("store");
+    // Full-precision values, which the stored XTF file rounds
+    XTF::Trajectory original = MakeTrajectory("stored", 200);
+    XTF::DedupStore store(directory);
+    XTF::DedupResult first = store.Insert(XTF::TrajectoryView(original));
+    EXPECT_EQ(XTF::DedupResult::INSERTED, first.status_);
+    EXPECT_EQ(first.hash_, XTF::ContentHashFile(first.path_));
+    XTF::DedupResult second = store.Insert(XTF::TrajectoryView(original));
+    EXPECT_EQ(XTF::DedupResult::DUPLICATE, second.status_);
+    EXPECT_EQ(first.hash_, second.hash_);
+    // Inserting the stored file itself also finds it
+    XTF::DedupResult stored = store.InsertFile(first.path_);
+    EXPECT_EQ(XTF::DedupResult::DUPLICATE, stored.status_);
+    EXPECT_EQ(first.hash_, stored.hash_);
+    EXPECT_EQ(1u, store.size());
+    // Reopening reads the index back
+    XTF::DedupStore reopened(directory);
+    EXPECT_TRUE(reopened.Contains(first.hash_));
+    EXPECT_EQ(XTF::DedupResult::DUPLICATE, reopened.Insert(XTF::TrajectoryView(original)).status_);
+}
+
+TEST(DedupStore, NearDuplicates)
+{
+    std::string directory = TempPath("store");
+    XTF::Trajectory original = MakeTrajectory("stored", 200);
+    XTF::Trajectory perturbed = original;
+    XTF::Trajectory distinct = original;
+    for (size_t idx = 0; idx < original.size(); idx++)
+    {
+        perturbed[idx].position_desired_[0] += 0.001;
+        distinct[idx].position_desired_[0] += 0.5;
+    }
+    XTF::DedupStore store(directory, 0.01);
+    XTF::DedupResult first = store.Insert(XTF::TrajectoryView(original));
+    ASSERT_EQ(XTF::DedupResult::INSERTED, first.status_);
+    XTF::DedupResult near = store.Insert(XTF::TrajectoryView(perturbed));
+    EXPECT_EQ(XTF::DedupResult::NEAR_DUPLICATE, near.status_);
+    EXPECT_EQ(first.path_, near.path_);
+    EXPECT_EQ(XTF::DedupResult::INSERTED, store.Insert(XTF::TrajectoryView(distinct)).status_);
+    EXPECT_EQ(2u, store.size());
+    // Without a tolerance only exact content is skipped
+    XTF::DedupStore exact(TempPath("exact"));
+    exact.Insert(XTF::TrajectoryView(original));
+    EXPECT_EQ(XTF::DedupResult::INSERTED, exact.Insert(XTF::TrajectoryView(perturbed)).status_);
+}
+
+/* Diffs two one-state trajectories whose three desired positions are all first and all second,
+ * and returns the number of values found to disagree (0 or 3). Three values cover both the paired
+ * SSE2 comparison and the scalar tail.
+ */
+static size_t Disagreements(double first, double second, double absolute, double relative)
+{
+    const size_t count = 3;
+    XTF::Trajectory first_trajectory = MakeTrajectory("first", 0);
+    XTF::Trajectory second_trajectory = first_trajectory;
+    std::vector<double> empty;
+    first_trajectory.push_back(XTF::State(std::vector<double>(count, first), empty, empty, empty, empty, empty, 0, MakeTiming(0)));
+    second_trajectory.push_back(XTF::State(std::vector<double>(count, second), empty, empty, empty, empty, empty, 0, MakeTiming(0)));
+    XTF::DiffOptions options;
+    options.absolute_tolerance_ = absolute;
+    options.relative_tolerance_ = relative;
+    XTF::DiffReport report = XTF::Diff(first_trajectory, second_trajectory, options);
+    EXPECT_EQ(report.fields_[XTF::State::POSITION_DESIRED].exceeded_ == 0, report.Equivalent());
+    return report.fields_[XTF::State::POSITION_DESIRED].exceeded_;
+}
+
+TEST(Diff, ToleranceEdgeCases)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double inf = std::numeric_limits<double>::infinity();
+    // NaN only agrees with NaN, however loose the tolerance
+    EXPECT_EQ(0u, Disagreements(nan, nan, 0.0, 0.0));
+    EXPECT_EQ(3u, Disagreements(nan, 1.0, 1e300, 1.0));
+    EXPECT_EQ(3u, Disagreements(1.0, nan, 1e300, 1.0));
+    // An infinity only agrees with the same infinity
+    EXPECT_EQ(0u, Disagreements(inf, inf, 0.0, 0.0));
+    EXPECT_EQ(0u, Disagreements(-inf, -inf, 0.0, 0.0));
+    EXPECT_EQ(3u, Disagreements(inf, -inf, 1e300, 1.0));
+    EXPECT_EQ(3u, Disagreements(inf, 1e308, 1e300, 1.0));
+    EXPECT_EQ(3u, Disagreements(-1e308, -inf, 0.0, 1.0));
+    // Signed zeros are equal
+    EXPECT_EQ(0u, Disagreements(0.0, -0.0, 0.0, 0.0));
+    // Absolute tolerance, with the limit itself inclusive
+    EXPECT_EQ(0u, Disagreements(1.0, 1.5, 0.5, 0.0));
+    EXPECT_EQ(3u, Disagreements(1.0, 1.5, 0.25, 0.0));
+    // Relative tolerance scales with the larger magnitude
+    EXPECT_EQ(0u, Disagreements(1000.0, 1000.5, 0.0, 1e-3));
+    EXPECT_EQ(3u, Disagreements(0.001, 0.0015, 0.0, 1e-3));
+    EXPECT_EQ(0u, Disagreements(-1000.0, -1000.5, 0.0, 1e-3));
+    // The two add up
+    EXPECT_EQ(0u, Disagreements(1.0, 1.3, 0.2, 0.1));
+    EXPECT_EQ(3u, Disagreements(1.0, 1.3, 0.1, 0.1));
+}
+
+TEST(Diff, AlignsBySequence)
+{
+    XTF::Trajectory original = MakeTrajectory("sequence", 40);
+    XTF::Trajectory gapped = Without(original, 5, 12);
+    XTF::DiffOptions options;
+    options.alignment_ = XTF::DiffOptions::BY_SEQUENCE;
+    XTF::DiffReport report = XTF::Diff(original, gapped, options);
+    EXPECT_FALSE(report.Equivalent());
+    EXPECT_EQ(38u, report.matched_);
+    EXPECT_EQ(2u, report.missing_from_second_);
+    EXPECT_EQ(0u, report.missing_from_first_);
+    EXPECT_EQ(0u, report.sequence_mismatches_);
+    EXPECT_EQ(0u, report.fields_[XTF::State::POSITION_DESIRED].exceeded_);
+    EXPECT_TRUE(report.diverged_);
+    EXPECT_EQ(5u, report.divergence_first_);
+    EXPECT_EQ(5u, report.divergence_second_);
+    // Swapped, the same states are missing from the other side
+    XTF::DiffReport swapped = XTF::Diff(gapped, original, options);
+    EXPECT_EQ(38u, swapped.matched_);
+    EXPECT_EQ(0u, swapped.missing_from_second_);
+    EXPECT_EQ(2u, swapped.missing_from_first_);
+    // By index the same gap misaligns every later state instead
+    options.alignment_ = XTF::DiffOptions::BY_INDEX;
+    XTF::DiffReport by_index = XTF::Diff(original, gapped, options);
+    EXPECT_EQ(38u, by_index.matched_);
+    EXPECT_EQ(2u, by_index.missing_from_second_);
+    EXPECT_GT(by_index.sequence_mismatches_, 0u);
+    EXPECT_GT(by_index.fields_[XTF::State::POSITION_DESIRED].exceeded_, 0u);
+}
+
+TEST(Diff, AlignsByTime)
+{
+    XTF::Trajectory original = MakeTrajectory("time", 40);
+    // Renumbered and delayed by 0.1 ms, with two states dropped
+    XTF::Trajectory shifted = Without(original, 0, 20);
+    for (size_t idx = 0; idx < shifted.size(); idx++)
+    {
+        shifted[idx].sequence_ = (int)idx;
+        shifted[idx].timing_.tv_nsec += 100000;
+    }
+    XTF::DiffOptions options;
+    options.alignment_ = XTF::DiffOptions::BY_TIME;
+    options.time_tolerance_ = 0.001;
+    XTF::DiffReport report = XTF::Diff(original, shifted, options);
+    EXPECT_EQ(38u, report.matched_);
+    EXPECT_EQ(2u, report.missing_from_second_);
+    EXPECT_EQ(0u, report.missing_from_first_);
+    EXPECT_EQ(0u, report.timing_exceeded_);
+    EXPECT_NEAR(0.0001, report.timing_max_, 1e-9);
+    EXPECT_EQ(0u, report.fields_[XTF::State::POSITION_DESIRED].exceeded_);
+    EXPECT_EQ(0u, report.extras_mismatch_count_);
+    EXPECT_EQ(0u, report.divergence_first_);
+    // A tolerance below the delay pairs nothing
+    options.time_tolerance_ = 0.00005;
+    XTF::DiffReport strict = XTF::Diff(original, shifted, options);
+    EXPECT_EQ(0u, strict.matched_);
+    EXPECT_EQ(40u, strict.missing_from_second_);
+    EXPECT_EQ(38u, strict.missing_from_first_);
+}
+
+TEST(Diff, ExtrasMismatches)
+{
+    XTF::Trajectory original = MakeTrajectory("extras", 40);
+    XTF::Trajectory changed = original;
+    changed[10].extras_["label"] = XTF::KeyValue(std::string("relabelled"));
+    changed[15].extras_.erase("count");
+    changed[20].extras_["added"] = XTF::KeyValue(1.0);
+    changed[25].extras_["gripper"] = XTF::KeyValue(std::vector<double>(2, 25.0 + 1e-9));
+    changed[30].extras_["contact"] = XTF::KeyValue(std::string("true"));
+    XTF::DiffOptions options;
+    options.max_reported_ = 2;
+    XTF::DiffReport report = XTF::Diff(original, changed, options);
+    EXPECT_FALSE(report.Equivalent());
+    // The double list differs by more than the (zero) tolerance, the string value has another type
+    EXPECT_EQ(5u, report.extras_mismatch_count_);
+    EXPECT_EQ(2u, report.extras_mismatches_.size());
+    EXPECT_EQ(10u, report.divergence_first_);
+    // Double extras use the value tolerance
+    options.absolute_tolerance_ = 1e-6;
+    EXPECT_EQ(4u, XTF::Diff(original, changed, options).extras_mismatch_count_);
+    options.compare_extras_ = false;
+    XTF::DiffReport ignored = XTF::Diff(original, changed, options);
+    EXPECT_TRUE(ignored.Equivalent()) << ignored.Summary();
+    EXPECT_EQ(0u, ignored.extras_mismatch_count_);
+}
+
+// Reads XTF files, so needs the XML parser
+TEST(Diff, FilesAgreeWithInMemory)
+{
+    XTF::Parser parser;
+    std::string first_path = TempPath("first.xtf");
+    std::string second_path = TempPath("second.xtf");
+    XTF::Trajectory original = MakeTrajectory("files", 300);
+    XTF::Trajectory changed = Without(original, 7, 150);
+    changed[40].position_actual_.clear();
+    changed[60].extras_["label"] = XTF::KeyValue(std::string("relabelled"));
+    changed[80].velocity_desired_[2] += 0.5;
+    ASSERT_TRUE(parser.ExportTraj(original, first_path));
+    ASSERT_TRUE(parser.ExportTraj(changed, second_path, true));
+    // Compared with what the files hold, since export rounds the values
+    XTF::Trajectory first = parser.ParseTraj(first_path);
+    XTF::Trajectory second = parser.ParseTraj(second_path);
+    for (int alignment = XTF::DiffOptions::BY_INDEX; alignment <= XTF::DiffOptions::BY_TIME; alignment++)
+    {
+        XTF::DiffOptions options;
+        options.alignment_ = (XTF::DiffOptions::ALIGNMENTS)alignment;
+        options.absolute_tolerance_ = 1e-9;
+        XTF::DiffReport expected = XTF::Diff(first, second, options);
+        XTF::DiffReport actual = XTF::DiffFiles(first_path, second_path, options);
+        EXPECT_EQ(expected.Summary(), actual.Summary());
+        EXPECT_EQ(expected.matched_, actual.matched_);
+        EXPECT_EQ(expected.missing_from_second_, actual.missing_from_second_);
+        EXPECT_EQ(expected.missing_from_first_, actual.missing_from_first_);
+        EXPECT_EQ(expected.extras_mismatch_count_, actual.extras_mismatch_count_);
+        EXPECT_EQ(expected.divergence_first_, actual.divergence_first_);
+        EXPECT_EQ(expected.divergence_second_, actual.divergence_second_);
+        for (int field = 0; field < XTF::State::NUM_FIELDS; field++)
+        {
+            EXPECT_EQ(expected.fields_[field].exceeded_, actual.fields_[field].exceeded_);
+            EXPECT_EQ(expected.fields_[field].size_mismatches_, actual.fields_[field].size_mismatches_);
+            EXPECT_EQ(expected.fields_[field].max_, actual.fields_[field].max_);
+        }
+    }
+    XTF::DiffReport same = XTF::DiffFiles(first_path, first_path);
+    EXPECT_TRUE(same.Equivalent()) << same.Summary();
+    unlink(first_path.c_str());
+    unlink(second_path.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}